@@ -0,0 +1,357 @@
+#include "storage_mgr.h"
+#include "buffer_mgr.h"
+#include "buffer_mgr_checkpoint.h"
+#include "dberror.h"
+#include "bench_helper.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Workload benchmark of the buffer manager.
+ * Threads pin pages chosen by a workload generator, write to a share of them, and unpin them.
+ * Throughput, hit ratio, pin/unpin latency percentiles and I/O counts are reported as one CSV row per run.
+ *
+ * usage: bench_buffer_mgr [name=value ...]   without arguments the standard suite runs
+ *   workload=uniform|zipf|scan|loop|mixed  pages=16384  frames=1024  strategy=fifo|lru  threads=1  ops=200000
+ *   writes=0.1 (share of pins that write)  zipf=0.99 (skew)  loop=1280 (pages of the loop, default 1.25 * frames)
+ *   hot=512 (hot set of mixed, default frames / 2)  scanshare=0.1 (share of mixed pins that scan)
+ *   flush=none|pool|checkpoint (a thread writes the dirty pages back every flushms=20 milliseconds while the workers
+ *   run, with forceFlushPool or with runCheckpoint at ckrate=0 pages per second, 0 for no limit) */
+
+#define BENCH_FILE "bench_buffer_mgr.bin"
+
+typedef enum Workload {
+	WL_UNIFORM = 0,
+	WL_ZIPF = 1,
+	WL_SCAN = 2, // sequential, every thread starts at its own offset
+	WL_LOOP = 3, // cyclic over a working set a bit larger than the pool, the worst case of LRU
+	WL_MIXED = 4 // hot set read uniformly, mixed with a sequential scan of the other pages
+} Workload;
+
+static const char *workloadNames[] = { "uniform", "zipf", "scan", "loop", "mixed" };
+
+typedef enum FlushMode {
+	FL_NONE = 0,
+	FL_POOL = 1,
+	FL_CHECKPOINT = 2
+} FlushMode;
+
+static const char *flushNames[] = { "none", "pool", "checkpoint" };
+
+typedef struct BenchConfig {
+	Workload workload;
+	int pages;
+	int frames;
+	ReplacementStrategy strategy;
+	int threads;
+	int ops;
+	double writeRatio;
+	double zipfTheta;
+	int loopPages;
+	int hotPages;
+	double scanShare;
+	FlushMode flush;
+	int flushMillis;
+	int checkpointRate;
+} BenchConfig;
+
+typedef struct BenchThread {
+	const BenchConfig *config;
+	BM_BufferPool *bm;
+	const double *zipfCdf;
+	int index;
+	unsigned long long rng;
+	BM_Histogram latency; // in cycles
+} BenchThread;
+
+typedef struct BenchFlusher {
+	const BenchConfig *config;
+	BM_BufferPool *bm;
+	volatile int stop;
+	int numFlushes;
+	long long maxStallNanos; // longest forceFlushPool or checkpoint step, pins wait for it
+} BenchFlusher;
+
+static void runBench (const BenchConfig *config);
+static void *benchWorker (void *arg);
+static void *benchFlusher (void *arg);
+static int nextPage (BenchThread *thread, long long op);
+static unsigned long long nextRandom (BenchThread *thread);
+static double *buildZipfCdf (int pages, double theta);
+static bool parseOption (BenchConfig *config, const char *option);
+
+int
+main (int argc, char **argv)
+{
+	BenchConfig config = { WL_UNIFORM, 16384, 1024, RS_LRU, 1, 200000, 0.1, 0.99, 0, 0, 0.1, FL_NONE, 20, 0 };
+	SM_FileHandle fh;
+
+	for (int i = 1; i < argc; i++){
+		if (!parseOption(&config, argv[i])){
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	initStorageManager();
+	BENCH_CHECK(createPageFile(BENCH_FILE));
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	BENCH_CHECK(ensureCapacity(config.pages, &fh));
+	BENCH_CHECK(closePageFile(&fh));
+
+	printf("workload,strategy,frames,pages,threads,ops,write_ratio,ops_per_sec,hit_ratio,p50_ns,p99_ns,p999_ns,max_ns,reads,writes,flush,flushes,max_stall_us\n");
+	if (argc > 1){
+		runBench(&config);
+	} else { // standard suite
+		const int threadCounts[] = { 1, 4 };
+		for (int w = WL_UNIFORM; w <= WL_MIXED; w++){
+			for (int s = RS_FIFO; s <= RS_LRU; s++){
+				for (int t = 0; t < 2; t++){
+					config.workload = (Workload) w;
+					config.strategy = (ReplacementStrategy) s;
+					config.threads = threadCounts[t];
+					runBench(&config);
+				}
+			}
+		}
+	}
+
+	BENCH_CHECK(destroyPageFile(BENCH_FILE));
+	return 0;
+}
+
+void
+runBench (const BenchConfig *config)
+{
+	BM_BufferPool bm;
+	BM_Stats stats;
+	BM_Histogram latency;
+	BenchThread *threads = (BenchThread *) calloc(config->threads, sizeof(BenchThread));
+	pthread_t *ids = (pthread_t *) malloc(sizeof(pthread_t) * config->threads);
+	double *zipfCdf = (config->workload == WL_ZIPF) ? buildZipfCdf(config->pages, config->zipfTheta) : NULL;
+	BenchFlusher flusher = { config, &bm, 0, 0, 0 };
+	pthread_t flusherId;
+
+	BENCH_CHECK(initBufferPool(&bm, BENCH_FILE, config->frames, config->strategy, NULL));
+	for (int i = 0; i < config->threads; i++){
+		threads[i].config = config;
+		threads[i].bm = &bm;
+		threads[i].zipfCdf = zipfCdf;
+		threads[i].index = i;
+		threads[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+	}
+
+	unsigned long long startNanos = benchNanos();
+	unsigned long long startCycles = benchCycles();
+	for (int i = 0; i < config->threads; i++)
+		pthread_create(&ids[i], NULL, benchWorker, &threads[i]);
+	if (config->flush != FL_NONE)
+		pthread_create(&flusherId, NULL, benchFlusher, &flusher);
+	for (int i = 0; i < config->threads; i++)
+		pthread_join(ids[i], NULL);
+	if (config->flush != FL_NONE){
+		flusher.stop = 1;
+		pthread_join(flusherId, NULL);
+	}
+	unsigned long long nanos = benchNanos() - startNanos;
+	double nanosPerCycle = (double) nanos / (double) (benchCycles() - startCycles);
+
+	// per-thread histograms are merged once the threads are done
+	memset(&latency, 0, sizeof(latency));
+	for (int i = 0; i < config->threads; i++){
+		for (int b = 0; b < BM_HISTOGRAM_BUCKETS; b++)
+			latency.counts[b] += threads[i].latency.counts[b];
+		latency.totalCount += threads[i].latency.totalCount;
+		if (threads[i].latency.maxNanos > latency.maxNanos)
+			latency.maxNanos = threads[i].latency.maxNanos;
+	}
+	BENCH_CHECK(getPoolStats(&bm, &stats));
+	BENCH_CHECK(shutdownBufferPool(&bm));
+
+	long long totalOps = (long long) config->ops / config->threads * config->threads;
+	printf("%s,%s,%i,%i,%i,%lld,%.2f,%.0f,%.4f,%.0f,%.0f,%.0f,%.0f,%lld,%lld,%s,%i,%.0f\n", workloadNames[config->workload],
+			(config->strategy == RS_LRU) ? "LRU" : "FIFO", config->frames, config->pages, config->threads, totalOps,
+			config->writeRatio, totalOps / (nanos / 1e9), (double) stats.numHits / stats.numPins,
+			getHistogramPercentile(&latency, 50) * nanosPerCycle, getHistogramPercentile(&latency, 99) * nanosPerCycle,
+			getHistogramPercentile(&latency, 99.9) * nanosPerCycle, latency.maxNanos * nanosPerCycle,
+			stats.numReadIO, stats.numWriteIO, flushNames[config->flush], flusher.numFlushes,
+			flusher.maxStallNanos / 1e3);
+
+	free(zipfCdf);
+	free(threads);
+	free(ids);
+}
+
+void *
+benchWorker (void *arg)
+{
+	BenchThread *thread = (BenchThread *) arg;
+	const BenchConfig *config = thread->config;
+	BM_PageHandle h;
+	long long ops = config->ops / config->threads;
+	unsigned long long writeThreshold = (unsigned long long) (config->writeRatio * 1000000);
+
+	for (long long op = 0; op < ops; op++){
+		int pageNum = nextPage(thread, op);
+		bool write = (nextRandom(thread) % 1000000) < writeThreshold;
+		unsigned long long start = benchCycles();
+		BENCH_CHECK(pinPage(thread->bm, &h, pageNum));
+		if (write){
+			h.data[op % PAGE_SIZE] ++;
+			BENCH_CHECK(markDirty(thread->bm, &h));
+		}
+		BENCH_CHECK(unpinPage(thread->bm, &h));
+		histogramRecord(&(thread->latency), (long long) (benchCycles() - start)); // cycles, converted when reported
+	}
+	return NULL;
+}
+
+// Writes the dirty pages back periodically, like a background writer would
+void *
+benchFlusher (void *arg)
+{
+	BenchFlusher *flusher = (BenchFlusher *) arg;
+	const BenchConfig *config = flusher->config;
+	BM_CheckpointConfig checkpoint = { config->checkpointRate, 0, 0 };
+	BM_CheckpointInfo info;
+	struct timespec interval = { config->flushMillis / 1000, (config->flushMillis % 1000) * 1000000L };
+
+	while (!flusher->stop){
+		nanosleep(&interval, NULL);
+		long long stall;
+		if (config->flush == FL_POOL){
+			unsigned long long start = benchNanos();
+			BENCH_CHECK(forceFlushPool(flusher->bm));
+			stall = (long long) (benchNanos() - start);
+		} else {
+			BENCH_CHECK(runCheckpoint(flusher->bm, &checkpoint, &info));
+			stall = info.maxStepNanos;
+		}
+		if (stall > flusher->maxStallNanos)
+			flusher->maxStallNanos = stall;
+		flusher->numFlushes++;
+	}
+	return NULL;
+}
+
+int
+nextPage (BenchThread *thread, long long op)
+{
+	const BenchConfig *config = thread->config;
+	int offset = (int) ((long long) config->pages * thread->index / config->threads);
+
+	switch (config->workload){
+	case WL_ZIPF: {
+		double u = (double) (nextRandom(thread) >> 11) / (double) (1ULL << 53);
+		int low = 0, high = config->pages - 1;
+		while (low < high){ // first page whose cumulative probability reaches u
+			int middle = (low + high) / 2;
+			if (thread->zipfCdf[middle] < u)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		return low;
+	}
+	case WL_SCAN:
+		return (int) ((offset + op) % config->pages);
+	case WL_LOOP: {
+		int loopPages = (config->loopPages > 0) ? config->loopPages : config->frames + config->frames / 4;
+		return (int) ((offset + op) % loopPages);
+	}
+	case WL_MIXED: {
+		int hotPages = (config->hotPages > 0) ? config->hotPages : config->frames / 2;
+		if ((nextRandom(thread) % 1000000) >= (unsigned long long) (config->scanShare * 1000000))
+			return (int) (nextRandom(thread) % hotPages);
+		return hotPages + (int) ((offset + op) % (config->pages - hotPages));
+	}
+	default:
+		return (int) (nextRandom(thread) % config->pages);
+	}
+}
+
+// xorshift64*, one state per thread
+unsigned long long
+nextRandom (BenchThread *thread)
+{
+	thread->rng ^= thread->rng >> 12;
+	thread->rng ^= thread->rng << 25;
+	thread->rng ^= thread->rng >> 27;
+	return thread->rng * 0x2545F4914F6CDD1DULL;
+}
+
+// Page i is drawn with probability proportional to 1 / (i + 1)^theta
+double *
+buildZipfCdf (int pages, double theta)
+{
+	double *cdf = (double *) malloc(sizeof(double) * pages);
+	double sum = 0;
+
+	for (int i = 0; i < pages; i++){
+		sum += 1.0 / pow(i + 1, theta);
+		cdf[i] = sum;
+	}
+	for (int i = 0; i < pages; i++)
+		cdf[i] /= sum;
+	return cdf;
+}
+
+bool
+parseOption (BenchConfig *config, const char *option)
+{
+	const char *value = strchr(option, '=');
+
+	if (value == NULL)
+		return FALSE;
+	value++;
+	if (strncmp(option, "workload=", 9) == 0){
+		for (int w = WL_UNIFORM; w <= WL_MIXED; w++){
+			if (strcmp(value, workloadNames[w]) == 0){
+				config->workload = (Workload) w;
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+	if (strncmp(option, "strategy=", 9) == 0){
+		config->strategy = (strcmp(value, "fifo") == 0) ? RS_FIFO : RS_LRU;
+		return strcmp(value, "fifo") == 0 || strcmp(value, "lru") == 0;
+	}
+	if (strncmp(option, "flush=", 6) == 0){
+		for (int f = FL_NONE; f <= FL_CHECKPOINT; f++){
+			if (strcmp(value, flushNames[f]) == 0){
+				config->flush = (FlushMode) f;
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+	if (strncmp(option, "pages=", 6) == 0)
+		config->pages = atoi(value);
+	else if (strncmp(option, "frames=", 7) == 0)
+		config->frames = atoi(value);
+	else if (strncmp(option, "threads=", 8) == 0)
+		config->threads = atoi(value);
+	else if (strncmp(option, "ops=", 4) == 0)
+		config->ops = atoi(value);
+	else if (strncmp(option, "writes=", 7) == 0)
+		config->writeRatio = atof(value);
+	else if (strncmp(option, "zipf=", 5) == 0)
+		config->zipfTheta = atof(value);
+	else if (strncmp(option, "loop=", 5) == 0)
+		config->loopPages = atoi(value);
+	else if (strncmp(option, "hot=", 4) == 0)
+		config->hotPages = atoi(value);
+	else if (strncmp(option, "scanshare=", 10) == 0)
+		config->scanShare = atof(value);
+	else if (strncmp(option, "flushms=", 8) == 0)
+		config->flushMillis = atoi(value);
+	else if (strncmp(option, "ckrate=", 7) == 0)
+		config->checkpointRate = atoi(value);
+	else
+		return FALSE;
+	return TRUE;
+}
@@ -0,0 +1,45 @@
+#ifndef BENCH_HELPER_H
+#define BENCH_HELPER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Cycle counter used to report cycles per operation (falls back to nanoseconds)
+static inline unsigned long long
+benchCycles (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// Wall clock in nanoseconds
+static inline unsigned long long
+benchNanos (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// check the return code and exit if it's an error (benchmarks have no recovery path)
+#define BENCH_CHECK(code)						\
+		do {									\
+			int rc_internal = (code);						\
+			if (rc_internal != RC_OK)						\
+			{									\
+				printf("[%s-L%i] BENCH FAILED: Operation returned error %i\n", __FILE__, __LINE__, rc_internal); \
+				exit(1);							\
+			}									\
+		} while(0)
+
+#endif // BENCH_HELPER_H
@@ -0,0 +1,89 @@
+#include "log_mgr.h"
+#include "dberror.h"
+#include "bench_helper.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Commit throughput of the write-ahead log.
+ * Each thread commits in a loop: it appends a record of BENCH_RECORD_BYTES and flushes the log up to it, like a
+ * transaction that logs one change. With one thread every commit pays for an fdatasync; with more, commits that
+ * arrive while a sync is under way are grouped into the next one, so commits per sync grows with the threads.
+ * One CSV row per thread count.
+ *
+ * usage: bench_log_mgr [commits]   (default 2000 commits per run) */
+
+#define BENCH_FILE "bench_log_mgr.log"
+#define BENCH_RECORD_BYTES 100
+
+typedef struct BenchThread {
+	LM_Log *log;
+	int commits;
+	int id;
+} BenchThread;
+
+static void benchCommit (int numThreads, int commits);
+static void *benchWorker (void *arg);
+
+int
+main (int argc, char **argv)
+{
+	const int threadCounts[] = { 1, 2, 4, 8, 16 };
+	int commits = (argc > 1) ? atoi(argv[1]) : 2000;
+
+	printf("threads,commits,commits_per_sec,us_per_commit,syncs,commits_per_sync\n");
+	for (int t = 0; t < 5; t++){
+		benchCommit(threadCounts[t], commits);
+	}
+	return 0;
+}
+
+void
+benchCommit (int numThreads, int commits)
+{
+	LM_Log log;
+	LM_LogStats stats;
+	BenchThread *threads = (BenchThread *) calloc(numThreads, sizeof(BenchThread));
+	pthread_t *ids = (pthread_t *) malloc(sizeof(pthread_t) * numThreads);
+
+	unlink(BENCH_FILE);
+	BENCH_CHECK(openLog(BENCH_FILE, &log));
+	for (int i = 0; i < numThreads; i++){
+		threads[i].log = &log;
+		threads[i].commits = commits / numThreads;
+		threads[i].id = i;
+	}
+	unsigned long long start = benchNanos();
+	for (int i = 0; i < numThreads; i++)
+		pthread_create(&ids[i], NULL, benchWorker, &threads[i]);
+	for (int i = 0; i < numThreads; i++)
+		pthread_join(ids[i], NULL);
+	unsigned long long nanos = benchNanos() - start;
+	BENCH_CHECK(getLogStats(&log, &stats));
+	BENCH_CHECK(closeLog(&log));
+	unlink(BENCH_FILE);
+
+	int total = commits / numThreads * numThreads;
+	printf("%i,%i,%.0f,%.2f,%lld,%.2f\n", numThreads, total, total * 1e9 / nanos, nanos / 1e3 / total,
+			stats.numSyncs, (stats.numSyncs > 0) ? (double) total / stats.numSyncs : 0.0);
+	free(threads);
+	free(ids);
+}
+
+void *
+benchWorker (void *arg)
+{
+	BenchThread *thread = (BenchThread *) arg;
+	char record[BENCH_RECORD_BYTES];
+	LSN lsn;
+
+	memset(record, 'a' + thread->id % 26, sizeof(record));
+	for (int i = 0; i < thread->commits; i++){
+		BENCH_CHECK(appendLogRecord(thread->log, record, sizeof(record), &lsn));
+		BENCH_CHECK(flushLog(thread->log, lsn));
+	}
+	return NULL;
+}
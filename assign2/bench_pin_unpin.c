@@ -0,0 +1,103 @@
+#include "storage_mgr.h"
+#include "buffer_mgr.h"
+#include "dberror.h"
+#include "bench_helper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Microbenchmark of the pin/unpin cycle.
+ * Every scenario pins and directly unpins pages of a pre-filled page file and reports
+ * the average number of cycles (and nanoseconds) spent per pin/unpin pair. */
+
+#define BENCH_FILE "bench_pin_unpin.bin"
+#define BENCH_FILE_PAGES 4096
+
+static void benchHits (int numFrames, ReplacementStrategy strategy, int numOps);
+static void benchMisses (int numFrames, ReplacementStrategy strategy, int numOps);
+static void report (const char *scenario, int numFrames, ReplacementStrategy strategy, int numOps,
+		unsigned long long cycles, unsigned long long nanos);
+
+int
+main (int argc, char **argv)
+{
+	const int frameCounts[] = {8, 64, 256, 512, 2048, 4096};
+	const int numFrameCounts = sizeof(frameCounts) / sizeof(frameCounts[0]);
+	int numOps = (argc > 1) ? atoi(argv[1]) : 200000;
+	SM_FileHandle fh;
+
+	initStorageManager();
+	BENCH_CHECK(createPageFile(BENCH_FILE));
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	BENCH_CHECK(ensureCapacity(BENCH_FILE_PAGES, &fh));
+	BENCH_CHECK(closePageFile(&fh));
+
+	printf("scenario,frames,strategy,ops,cycles_per_op,ns_per_op\n");
+	for (int i = 0; i < numFrameCounts; i++){
+		benchHits(frameCounts[i], RS_FIFO, numOps);
+		benchHits(frameCounts[i], RS_LRU, numOps);
+		benchMisses(frameCounts[i], RS_FIFO, numOps / 10);
+		benchMisses(frameCounts[i], RS_LRU, numOps / 10);
+	}
+
+	BENCH_CHECK(destroyPageFile(BENCH_FILE));
+	return 0;
+}
+
+// Every request hits: all frames are loaded first, then pinned round-robin
+void
+benchHits (int numFrames, ReplacementStrategy strategy, int numOps)
+{
+	BM_BufferPool bm;
+	BM_PageHandle h;
+
+	BENCH_CHECK(initBufferPool(&bm, BENCH_FILE, numFrames, strategy, NULL));
+	for (int i = 0; i < numFrames; i++){
+		BENCH_CHECK(pinPage(&bm, &h, i));
+		BENCH_CHECK(unpinPage(&bm, &h));
+	}
+
+	unsigned long long startNanos = benchNanos();
+	unsigned long long startCycles = benchCycles();
+	for (int i = 0; i < numOps; i++){
+		pinPage(&bm, &h, i % numFrames);
+		unpinPage(&bm, &h);
+	}
+	unsigned long long cycles = benchCycles() - startCycles;
+	unsigned long long nanos = benchNanos() - startNanos;
+
+	BENCH_CHECK(shutdownBufferPool(&bm));
+	report("hit", numFrames, strategy, numOps, cycles, nanos);
+}
+
+// Every request misses: pages are pinned in a loop larger than the pool so each pin evicts a clean frame
+void
+benchMisses (int numFrames, ReplacementStrategy strategy, int numOps)
+{
+	BM_BufferPool bm;
+	BM_PageHandle h;
+	int loopLength = (numFrames * 2 < BENCH_FILE_PAGES) ? numFrames * 2 : BENCH_FILE_PAGES;
+
+	BENCH_CHECK(initBufferPool(&bm, BENCH_FILE, numFrames, strategy, NULL));
+
+	unsigned long long startNanos = benchNanos();
+	unsigned long long startCycles = benchCycles();
+	for (int i = 0; i < numOps; i++){
+		pinPage(&bm, &h, i % loopLength);
+		unpinPage(&bm, &h);
+	}
+	unsigned long long cycles = benchCycles() - startCycles;
+	unsigned long long nanos = benchNanos() - startNanos;
+
+	BENCH_CHECK(shutdownBufferPool(&bm));
+	report("miss", numFrames, strategy, numOps, cycles, nanos);
+}
+
+void
+report (const char *scenario, int numFrames, ReplacementStrategy strategy, int numOps,
+		unsigned long long cycles, unsigned long long nanos)
+{
+	printf("%s,%i,%s,%i,%.1f,%.1f\n", scenario, numFrames, (strategy == RS_LRU) ? "LRU" : "FIFO", numOps,
+			(double) cycles / numOps, (double) nanos / numOps);
+}
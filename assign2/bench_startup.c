@@ -0,0 +1,56 @@
+#include "storage_mgr.h"
+#include "buffer_mgr.h"
+#include "dberror.h"
+#include "bench_helper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Startup benchmark.
+ * Measures initBufferPool, the first pins of a freshly started pool and shutdownBufferPool
+ * for pools from 1K to 16M frames (4MB to 64GB of frames). */
+
+#define BENCH_FILE "bench_startup.bin"
+#define BENCH_PINS 1000
+
+int
+main (int argc, char **argv)
+{
+	int maxShift = (argc > 1) ? atoi(argv[1]) : 24;
+	SM_FileHandle fh;
+	BM_BufferPool bm;
+	BM_PageHandle h;
+
+	initStorageManager();
+	BENCH_CHECK(createPageFile(BENCH_FILE));
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	BENCH_CHECK(ensureCapacity(BENCH_PINS, &fh));
+	BENCH_CHECK(closePageFile(&fh));
+
+	printf("frames,pool_mb,init_us,first_pins_us_per_pin,shutdown_us\n");
+	for (int shift = 10; shift <= maxShift; shift += 2){
+		int numFrames = 1 << shift;
+
+		unsigned long long start = benchNanos();
+		BENCH_CHECK(initBufferPool(&bm, BENCH_FILE, numFrames, RS_FIFO, NULL));
+		unsigned long long initNanos = benchNanos() - start;
+
+		start = benchNanos();
+		for (int i = 0; i < BENCH_PINS; i++){
+			BENCH_CHECK(pinPage(&bm, &h, i));
+			BENCH_CHECK(unpinPage(&bm, &h));
+		}
+		unsigned long long pinNanos = benchNanos() - start;
+
+		start = benchNanos();
+		BENCH_CHECK(shutdownBufferPool(&bm));
+		unsigned long long shutdownNanos = benchNanos() - start;
+
+		printf("%i,%lld,%.1f,%.2f,%.1f\n", numFrames, (long long) numFrames * PAGE_SIZE / (1024 * 1024),
+				initNanos / 1000.0, pinNanos / 1000.0 / BENCH_PINS, shutdownNanos / 1000.0);
+	}
+
+	BENCH_CHECK(destroyPageFile(BENCH_FILE));
+	return 0;
+}
@@ -0,0 +1,303 @@
+#include "storage_mgr.h"
+#include "dberror.h"
+#include "bench_helper.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Throughput benchmark of the storage manager.
+ * Sequential and random readBlock/writeBlock, readNextBlock, and file extension with appendEmptyBlock and
+ * ensureCapacity are timed for several file sizes. The storage manager does synchronous I/O on one handle, so
+ * the queue depth is the number of threads, each with its own handle on the file. One CSV row per run.
+ * Reads and writes run plain (stdio), with page checksums (stdio_crc32c, every page of the file has one so every
+ * read verifies it) and on a compressed page file (stdio_lz4, pages of records that compress about 3:1).
+ * Random writes are also timed in each durability mode (sync_none, sync_write, sync_batched every 64 pages,
+ * sync_flush with one syncPageFile at the end), the runs other than sync_none end with everything on disk.
+ * Batches of SM_DWB_PAGES random pages are written with writeBlocks and synced, directly (batch_sync) or through the
+ * double-write buffer (batch_dwb).
+ *
+ * usage: bench_storage_mgr [ops]   (default 20000 operations per run) */
+
+#define BENCH_FILE "bench_storage_mgr.bin"
+
+typedef enum BenchBackend {
+	BACKEND_STDIO = 0,
+	BACKEND_STDIO_CRC32C = 1, // enablePageChecksums on the file
+	BACKEND_STDIO_LZ4 = 2 // createCompressedPageFile
+} BenchBackend;
+
+static const char *backendNames[] = { "stdio", "stdio_crc32c", "stdio_lz4" };
+static BenchBackend backend = BACKEND_STDIO;
+
+typedef enum BenchOp {
+	OP_SEQ_READ = 0,
+	OP_RAND_READ = 1,
+	OP_NEXT_READ = 2, // readNextBlock from the first page, wraps to readFirstBlock
+	OP_SEQ_WRITE = 3,
+	OP_RAND_WRITE = 4
+} BenchOp;
+
+static const char *opNames[] = { "seq_read", "rand_read", "next_read", "seq_write", "rand_write" };
+
+typedef struct BenchThread {
+	BenchOp op;
+	int filePages;
+	int ops;
+	int firstPage; // threads start at evenly spread pages
+	unsigned long long rng;
+} BenchThread;
+
+static void benchAccess (BenchOp op, int filePages, int depth, int ops);
+static void *benchWorker (void *arg);
+static void benchAppend (int ops);
+static void benchEnsureCapacity (int ops);
+static void benchDurability (SM_DurabilityMode mode, int filePages, int ops);
+static void benchDoubleWrite (int doubleWrite, int filePages, int ops);
+static void createBenchFile (int filePages);
+static void fillRecords (char *page, int pageNum);
+static void report (const char *op, int filePages, int depth, int ops, unsigned long long nanos);
+
+int
+main (int argc, char **argv)
+{
+	const int fileSizes[] = { 256, 4096, 32768 }; // 1MB, 16MB, 128MB
+	const int depths[] = { 1, 4 };
+	int ops = (argc > 1) ? atoi(argv[1]) : 20000;
+
+	initStorageManager();
+	printf("backend,op,file_pages,queue_depth,ops,ops_per_sec,mb_per_sec,us_per_op\n");
+	for (int b = BACKEND_STDIO; b <= BACKEND_STDIO_LZ4; b++){
+		backend = (BenchBackend) b;
+		for (int s = 0; s < 3; s++){
+			createBenchFile(fileSizes[s]);
+			for (int op = OP_SEQ_READ; op <= OP_RAND_WRITE; op++){
+				for (int d = 0; d < 2; d++){
+					benchAccess((BenchOp) op, fileSizes[s], depths[d], ops);
+				}
+			}
+			BENCH_CHECK(destroyPageFile(BENCH_FILE));
+		}
+	}
+	backend = BACKEND_STDIO;
+	benchAppend(ops / 4);
+	benchEnsureCapacity(ops / 4);
+	for (int mode = SM_DURABILITY_NONE; mode <= SM_DURABILITY_FLUSH; mode++){
+		benchDurability((SM_DurabilityMode) mode, 4096, ops / 10);
+	}
+	benchDoubleWrite(0, 4096, ops / 2);
+	benchDoubleWrite(1, 4096, ops / 2);
+	return 0;
+}
+
+void
+benchAccess (BenchOp op, int filePages, int depth, int ops)
+{
+	BenchThread *threads = (BenchThread *) calloc(depth, sizeof(BenchThread));
+	pthread_t *ids = (pthread_t *) malloc(sizeof(pthread_t) * depth);
+
+	for (int i = 0; i < depth; i++){
+		threads[i].op = op;
+		threads[i].filePages = filePages;
+		threads[i].ops = ops / depth;
+		threads[i].firstPage = (int) ((long long) filePages * i / depth);
+		threads[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+	}
+	unsigned long long start = benchNanos();
+	for (int i = 0; i < depth; i++)
+		pthread_create(&ids[i], NULL, benchWorker, &threads[i]);
+	for (int i = 0; i < depth; i++)
+		pthread_join(ids[i], NULL);
+	report(opNames[op], filePages, depth, ops / depth * depth, benchNanos() - start);
+	free(threads);
+	free(ids);
+}
+
+void *
+benchWorker (void *arg)
+{
+	BenchThread *thread = (BenchThread *) arg;
+	SM_FileHandle fh;
+	char *page = (char *) calloc(PAGE_SIZE, 1);
+	int pageNum = thread->firstPage;
+
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	BENCH_CHECK(readBlock(pageNum, &fh, page));
+	for (int i = 0; i < thread->ops; i++){
+		switch (thread->op){
+		case OP_SEQ_READ:
+			BENCH_CHECK(readBlock(pageNum, &fh, page));
+			pageNum = (pageNum + 1) % thread->filePages;
+			break;
+		case OP_NEXT_READ:
+			if (getBlockPos(&fh) + 1 < fh.totalNumPages)
+				BENCH_CHECK(readNextBlock(&fh, page));
+			else
+				BENCH_CHECK(readFirstBlock(&fh, page));
+			break;
+		case OP_SEQ_WRITE:
+			page[0] = (char) i;
+			BENCH_CHECK(writeBlock(pageNum, &fh, page));
+			pageNum = (pageNum + 1) % thread->filePages;
+			break;
+		default: // random read or write, xorshift64
+			thread->rng ^= thread->rng >> 12;
+			thread->rng ^= thread->rng << 25;
+			thread->rng ^= thread->rng >> 27;
+			pageNum = (int) ((thread->rng * 0x2545F4914F6CDD1DULL) % thread->filePages);
+			if (thread->op == OP_RAND_READ)
+				BENCH_CHECK(readBlock(pageNum, &fh, page));
+			else
+				BENCH_CHECK(writeBlock(pageNum, &fh, page));
+		}
+	}
+	BENCH_CHECK(closePageFile(&fh)); // the writes of stdio are flushed here, they are part of the run
+	free(page);
+	return NULL;
+}
+
+// One appendEmptyBlock per operation, from an empty file
+void
+benchAppend (int ops)
+{
+	SM_FileHandle fh;
+
+	BENCH_CHECK(createPageFile(BENCH_FILE));
+	unsigned long long start = benchNanos();
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	for (int i = 0; i < ops; i++)
+		BENCH_CHECK(appendEmptyBlock(&fh));
+	BENCH_CHECK(closePageFile(&fh));
+	report("append", ops, 1, ops, benchNanos() - start);
+	BENCH_CHECK(destroyPageFile(BENCH_FILE));
+}
+
+// One ensureCapacity growing the file by ops pages, reported per page
+void
+benchEnsureCapacity (int ops)
+{
+	SM_FileHandle fh;
+
+	BENCH_CHECK(createPageFile(BENCH_FILE));
+	unsigned long long start = benchNanos();
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	BENCH_CHECK(ensureCapacity(ops + 1, &fh));
+	BENCH_CHECK(closePageFile(&fh));
+	report("ensure_capacity", ops, 1, ops, benchNanos() - start);
+	BENCH_CHECK(destroyPageFile(BENCH_FILE));
+}
+
+// Random writes on one handle in a durability mode, the final sync is part of the run
+void
+benchDurability (SM_DurabilityMode mode, int filePages, int ops)
+{
+	static const char *modeNames[] = { "sync_none", "sync_write", "sync_batched", "sync_flush" };
+	SM_Durability durability = { mode, 64, 0 };
+	SM_FileHandle fh;
+	char *page = (char *) calloc(PAGE_SIZE, 1);
+	unsigned long long rng = 0x9E3779B97F4A7C15ULL;
+
+	createBenchFile(filePages);
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	BENCH_CHECK(setDurability(&fh, &durability));
+	unsigned long long start = benchNanos();
+	for (int i = 0; i < ops; i++){
+		rng ^= rng >> 12;
+		rng ^= rng << 25;
+		rng ^= rng >> 27;
+		page[0] = (char) i;
+		BENCH_CHECK(writeBlock((PageNumber) ((rng * 0x2545F4914F6CDD1DULL) % filePages), &fh, page));
+	}
+	if (mode != SM_DURABILITY_NONE)
+		BENCH_CHECK(syncPageFile(&fh));
+	BENCH_CHECK(closePageFile(&fh));
+	report(modeNames[mode], filePages, 1, ops, benchNanos() - start);
+	BENCH_CHECK(destroyPageFile(BENCH_FILE));
+	free(page);
+}
+
+// Random pages in batches of SM_DWB_PAGES, each batch on disk before the next
+void
+benchDoubleWrite (int doubleWrite, int filePages, int ops)
+{
+	SM_FileHandle fh;
+	PageNumber pageNums[SM_DWB_PAGES];
+	SM_PageHandle pages[SM_DWB_PAGES];
+	unsigned long long rng = 0x9E3779B97F4A7C15ULL;
+
+	for (int i = 0; i < SM_DWB_PAGES; i++){
+		pages[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+		fillRecords(pages[i], i);
+	}
+	createBenchFile(filePages);
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	if (doubleWrite)
+		BENCH_CHECK(enableDoubleWrite(&fh));
+	int batches = ops / SM_DWB_PAGES;
+	unsigned long long start = benchNanos();
+	for (int b = 0; b < batches; b++){
+		for (int i = 0; i < SM_DWB_PAGES; i++){
+			rng ^= rng >> 12;
+			rng ^= rng << 25;
+			rng ^= rng >> 27;
+			pageNums[i] = (PageNumber) ((rng * 0x2545F4914F6CDD1DULL) % filePages);
+		}
+		BENCH_CHECK(writeBlocks(&fh, SM_DWB_PAGES, pageNums, pages));
+		if (!doubleWrite)
+			BENCH_CHECK(syncPageFile(&fh));
+	}
+	BENCH_CHECK(closePageFile(&fh));
+	report(doubleWrite ? "batch_dwb" : "batch_sync", filePages, 1, batches * SM_DWB_PAGES, benchNanos() - start);
+	BENCH_CHECK(destroyPageFile(BENCH_FILE));
+	for (int i = 0; i < SM_DWB_PAGES; i++)
+		free(pages[i]);
+}
+
+void
+createBenchFile (int filePages)
+{
+	SM_FileHandle fh;
+
+	if (backend == BACKEND_STDIO_LZ4)
+		BENCH_CHECK(createCompressedPageFile(BENCH_FILE));
+	else
+		BENCH_CHECK(createPageFile(BENCH_FILE));
+	BENCH_CHECK(openPageFile(BENCH_FILE, &fh));
+	BENCH_CHECK(ensureCapacity(filePages, &fh));
+	if (backend != BACKEND_STDIO){
+		// Pages get a checksum or a slot when written, the handles of the threads open the sidecars with the file
+		char *page = (char *) calloc(PAGE_SIZE, 1);
+		if (backend == BACKEND_STDIO_CRC32C)
+			BENCH_CHECK(enablePageChecksums(&fh));
+		for (int i = 0; i < filePages; i++){
+			fillRecords(page, i);
+			BENCH_CHECK(writeBlock(i, &fh, page));
+		}
+		free(page);
+	}
+	BENCH_CHECK(closePageFile(&fh));
+}
+
+// Fixed size text records with a few varying fields, about 3:1 with the page codec
+void
+fillRecords (char *page, int pageNum)
+{
+	static const char *states[] = { "active", "closed", "pending", "blocked" };
+	unsigned int rng = 2654435761U * (pageNum + 1);
+
+	memset(page, 0, PAGE_SIZE);
+	for (int offset = 0; offset + 64 <= PAGE_SIZE; offset += 64){
+		rng = rng * 1103515245 + 12345;
+		snprintf(page + offset, 64, "%08i|customer-%05u|%s|%7.2f|", pageNum * 64 + offset / 64,
+				(rng >> 8) % 100000, states[(rng >> 4) & 3], (rng >> 12) % 100000 / 100.0);
+	}
+}
+
+void
+report (const char *op, int filePages, int depth, int ops, unsigned long long nanos)
+{
+	double seconds = nanos / 1e9;
+	printf("%s,%s,%i,%i,%i,%.0f,%.1f,%.2f\n", backendNames[backend], op, filePages, depth, ops, ops / seconds,
+			(double) ops * PAGE_SIZE / (1024 * 1024) / seconds, nanos / 1e3 / ops);
+}
@@ -1,42 +1,143 @@
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "buffer_mgr.h"
+#include "buffer_mgr_scan.h"
+#include "buffer_mgr_memory.h"
+#include "buffer_mgr_defrag.h"
+#include "buffer_mgr_budget.h"
+
+
+// local functions
+static RC forceFlushPoolLocked (BM_BufferPool *const bm);
+static RC pinPageLocked (BM_BufferPool *const bm, BM_PageHandle *const page, const int fileId, const PageNumber pageNum);
+static RC forceFlushFileLocked (BM_BufferPool *const bm, const int fileId);
+static RC dropFilePagesLocked (BM_BufferPool *const bm, const int fileId, bool writeDirty);
+static RC openPoolFile (BM_BufferPoolManagementInformation *mgmtData, char *const pageFileName, SM_FileHandle *fileHandle);
+static RC syncPoolFile (BM_BufferPoolManagementInformation *mgmtData, const int fileId);
+static RC flushFileFrames (BM_BufferPool *const bm, const int fileId);
+static void closePoolFiles (BM_BufferPoolManagementInformation *mgmtData);
+static long long nowNanos (void);
+static inline char *frameData (const BM_BufferPoolManagementInformation *mgmtData, const int frameIndex);
+
+// Pins made by this thread, picks the pins that are timed
+static __thread unsigned int pinSampleCounter;
+static RC growBufferPool (BM_BufferPool *const bm, const int newNumPages);
+static RC shrinkBufferPool (BM_BufferPool *const bm, const int newNumPages);
+static RC resizeFrameMetadata (BM_BufferPool *const bm, const int newNumPages);
 
 
 // Buffer Manager Interface Pool Handling
 
-RC initBufferPool(BM_BufferPool *const bm, char *const pageFileName, 
+RC initBufferPool(BM_BufferPool *const bm, char *const pageFileName,
 	const int numPages, ReplacementStrategy strategy,void *stratData)
-{   
+{
+    return initBufferPoolWithConfig(bm, pageFileName, numPages, strategy, stratData, NULL);
+}
+
+RC initBufferPoolWithConfig(BM_BufferPool *const bm, char *const pageFileName,
+	const int numPages, ReplacementStrategy strategy, void *stratData, const BM_PoolConfig *config)
+{
+    const BM_PoolConfig defaultConfig = BM_DEFAULT_POOL_CONFIG;
+    if (config == NULL){
+        config = &defaultConfig;
+    }
+    int pageShift = 0;
+    while ((PAGE_SIZE << pageShift) < config->pageSize && pageShift < SM_MAX_PAGE_SHIFT){
+        pageShift ++;
+    }
+    if (config->pageSize != 0 && config->pageSize != (PAGE_SIZE << pageShift)){
+        THROW(RC_INVALID_PAGE_SIZE,"The page size must be PAGE_SIZE times a power of two up to SM_MAX_PAGE_SIZE");
+    }
     BM_BufferPoolManagementInformation *bufferMgtData = (BM_BufferPoolManagementInformation *) malloc (sizeof(BM_BufferPoolManagementInformation));
     bm->pageFile = pageFileName;
     bm->numPages = numPages;
     bm->strategy = strategy;
     bm->mgmtData = bufferMgtData;
-    // Initializing management Information of the buffer
-    RC fileOpenRC = openPageFile(pageFileName,&(bufferMgtData->fileHandle));
-    if (fileOpenRC != RC_OK){
+    // Initializing management Information of the buffer, the page file (if any) becomes BM_DEFAULT_FILE
+    bufferMgtData->files = NULL;
+    bufferMgtData->numFiles = 0;
+    bufferMgtData->pageChecksums = config->pageChecksums;
+    bufferMgtData->durability = config->durability;
+    bufferMgtData->doubleWrite = config->doubleWrite;
+    bufferMgtData->changeTracking = config->changeTracking;
+    bufferMgtData->allocation.pageSize = config->pageSize; // 0 takes the size of the page file
+    if (pageFileName != NULL){
+        bufferMgtData->files = (BM_PoolFile *) malloc(sizeof(BM_PoolFile));
+        bufferMgtData->numFiles = 1;
+        RC fileOpenRC = openPoolFile(bufferMgtData, pageFileName, &(bufferMgtData->files[BM_DEFAULT_FILE].fileHandle));
+        if (fileOpenRC != RC_OK){
+            free(bufferMgtData->files);
+            free(bufferMgtData);
+            bm->mgmtData = NULL;
+            THROW(fileOpenRC,"Could not open the page file");
+        }
+        bufferMgtData->files[BM_DEFAULT_FILE].registered = TRUE;
+        bufferMgtData->files[BM_DEFAULT_FILE].numPages = bufferMgtData->files[BM_DEFAULT_FILE].fileHandle.totalNumPages;
+        bufferMgtData->files[BM_DEFAULT_FILE].freshPage = NO_PAGE;
+        bufferMgtData->files[BM_DEFAULT_FILE].defragmenting = FALSE;
+    }
+    if (bufferMgtData->allocation.pageSize == 0){
+        bufferMgtData->allocation.pageSize = PAGE_SIZE;
+    }
+    bufferMgtData->pageShift = 0;
+    while ((1 << bufferMgtData->pageShift) < bufferMgtData->allocation.pageSize){
+        bufferMgtData->pageShift ++;
+    }
+    memset(&(bufferMgtData->stats), 0, sizeof(BM_Stats));
+    bufferMgtData->trace = NULL;
+    bufferMgtData->log = NULL;
+    bufferMgtData->checkpoint = NULL;
+    bufferMgtData->budget = NULL;
+    bufferMgtData->defrag = NULL;
+    int reservedFrames = (config->maxNumPages > numPages) ? config->maxNumPages : BM_RESERVE_FACTOR * numPages;
+    bufferMgtData->framePool = allocFramePool(numPages, reservedFrames, bufferMgtData->allocation.pageSize, config, &(bufferMgtData->allocation));
+    if (bufferMgtData->framePool == NULL){
+        closePoolFiles(bufferMgtData);
+        free(bufferMgtData);
+        bm->mgmtData = NULL;
+        THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not map the frame pool");
+    }
+    // Allocating frame metadata, each array on its own cache lines. Frames are set up on first use
+    // (see initializeFrames) so neither the arrays nor the frame pool are touched here
+    bufferMgtData->framePageNums = (PageNumber *) allocCacheAligned(sizeof(PageNumber) * numPages);
+    bufferMgtData->frameFileIds = (int *) allocCacheAligned(sizeof(int) * numPages);
+    bufferMgtData->frameFixCounts = (int *) allocCacheAligned(sizeof(int) * numPages);
+    bufferMgtData->frameDirtyFlags = (bool *) allocCacheAligned(sizeof(bool) * numPages);
+    bufferMgtData->frameAccessCounts = (int *) allocCacheAligned(sizeof(int) * numPages);
+    bufferMgtData->frameLastAccess = (long long *) allocCacheAligned(sizeof(long long) * numPages);
+    bufferMgtData->frameLsns = (LSN *) allocCacheAligned(sizeof(LSN) * numPages);
+    bufferMgtData->accessClock = 0;
+    bufferMgtData->strategyBuffer = (int *) allocCacheAligned(sizeof(int) * numPages);
+    if (bufferMgtData->framePageNums == NULL || bufferMgtData->frameFileIds == NULL || bufferMgtData->frameFixCounts == NULL
+            || bufferMgtData->frameDirtyFlags == NULL || bufferMgtData->frameAccessCounts == NULL
+            || bufferMgtData->frameLastAccess == NULL || bufferMgtData->frameLsns == NULL || bufferMgtData->strategyBuffer == NULL){
+        free(bufferMgtData->framePageNums);
+        free(bufferMgtData->frameFileIds);
+        free(bufferMgtData->frameFixCounts);
+        free(bufferMgtData->frameDirtyFlags);
+        free(bufferMgtData->frameAccessCounts);
+        free(bufferMgtData->frameLastAccess);
+        free(bufferMgtData->frameLsns);
+        free(bufferMgtData->strategyBuffer);
+        freeFramePool(bufferMgtData->framePool, &(bufferMgtData->allocation));
+        closePoolFiles(bufferMgtData);
         free(bufferMgtData);
         bm->mgmtData = NULL;
-        THROW(fileOpenRC,"Could not open the page file");
-    }
-    bufferMgtData->numReadIO = 0;
-    bufferMgtData->numWriteIO = 0;
-    bufferMgtData->framePool = (char *) malloc (sizeof(char) * PAGE_SIZE * numPages);
-    // Initializing BM_FrameInfo
-    bufferMgtData->frameInfoPool = (BM_FrameInfo *) malloc (sizeof(BM_FrameInfo) * numPages);
-    for (int i = 0; i<numPages; i++){ 
-        BM_FrameInfo *frameInfo = &(bufferMgtData->frameInfoPool[i]);
-        frameInfo->pageNum = NO_PAGE;
-        frameInfo->isDirty = FALSE ;
-        frameInfo->fixCount = 0;
-    }
-    
-    
-    // Initializing strategyBuffer
-    bufferMgtData->strategyBuffer = (BM_FrameInfo **) malloc (sizeof(BM_FrameInfo *) * numPages);
-    for (int i = 0; i<numPages; i++){ 
-        bufferMgtData->strategyBuffer[i] = &(bufferMgtData->frameInfoPool[i]);
+        THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not allocate the frame metadata");
     }
+    bufferMgtData->numInitializedFrames = 0;
+    bufferMgtData->ghostPageNums = NULL;
+    bufferMgtData->ghostFileIds = NULL;
+    bufferMgtData->ghostCapacity = 0;
+    bufferMgtData->ghostNext = 0;
+    bufferMgtData->numGhostHits = 0;
+    // Small pools are scanned, larger ones get a page table
+    bufferMgtData->numUsedFrames = 0;
+    bufferMgtData->pageTable = NULL;
+    bufferMgtData->pageTableBits = 0;
+    rebuildPageTable(bm);
+    pthread_mutex_init(&(bufferMgtData->latch), NULL);
     return RC_OK;
 }
 
@@ -44,20 +145,47 @@ RC shutdownBufferPool(BM_BufferPool *const bm){
     if (bm->mgmtData == NULL){
         THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
     }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
     // First check if all page have fixCount = 0
-    for (int i = 0; i < bm->numPages; i++){
-        if (bm->mgmtData->frameInfoPool[i].fixCount != 0){
+    for (int i = 0; i < bm->mgmtData->numInitializedFrames; i++){
+        if (bm->mgmtData->frameFixCounts[i] != 0){
+            pthread_mutex_unlock(&(bm->mgmtData->latch));
             THROW(RC_BUFFER_WITH_PINNED_PAGES,"Cannot shutdown buffer pool as it contains pinned pages");
         }
     }
+    // A pool of a budget manager leaves it, else the manager keeps a pointer to a freed pool.
+    // The manager takes its latch before the one of the pool, so ours is released meanwhile
+    struct BM_BudgetManager *budget = bm->mgmtData->budget;
+    if (budget != NULL){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        unregisterBudgetPool(budget, bm);
+        pthread_mutex_lock(&(bm->mgmtData->latch));
+    }
     // We save pages that are dirty
-    forceFlushPool(bm);
+    forceFlushPoolLocked(bm);
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
     // Then we free all the memory that was allocated
-    free(bm->mgmtData->frameInfoPool);
-    free(bm->mgmtData->framePool);
+    pthread_mutex_destroy(&(bm->mgmtData->latch));
+    free(bm->mgmtData->framePageNums);
+    free(bm->mgmtData->frameFileIds);
+    free(bm->mgmtData->frameFixCounts);
+    free(bm->mgmtData->frameDirtyFlags);
+    free(bm->mgmtData->frameAccessCounts);
+    free(bm->mgmtData->frameLastAccess);
+    free(bm->mgmtData->frameLsns);
+    freeFramePool(bm->mgmtData->framePool, &(bm->mgmtData->allocation));
     free(bm->mgmtData->strategyBuffer);
-    closePageFile(&(bm->mgmtData->fileHandle));
+    free(bm->mgmtData->pageTable);
+    free(bm->mgmtData->ghostPageNums);
+    free(bm->mgmtData->ghostFileIds);
+    free(bm->mgmtData->checkpoint);
+    freeDefrag(bm->mgmtData->defrag);
+    if (bm->mgmtData->trace != NULL){
+        closeTrace(bm->mgmtData->trace);
+    }
+    closePoolFiles(bm->mgmtData);
     free(bm->mgmtData);
+    bm->mgmtData = NULL;
     return RC_OK;
 }
 
@@ -65,15 +193,463 @@ RC forceFlushPool(BM_BufferPool *const bm){
     if (bm->mgmtData == NULL){
         THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
     }
-    for (int i = 0; i < bm->numPages; i++){
-        BM_FrameInfo *frameInfo = &(bm->mgmtData->frameInfoPool[i]);
-        if (frameInfo->isDirty == TRUE && frameInfo->fixCount == 0){
-            forceFrame(bm, frameInfo, i);
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result = forceFlushPoolLocked(bm);
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC forceFlushPoolLocked(BM_BufferPool *const bm){
+    // File by file, so that pages are written in batches and each file is synced once
+    RC result = RC_OK;
+    for (int fileId = 0; fileId < bm->mgmtData->numFiles; fileId++){
+        if (bm->mgmtData->files[fileId].registered){
+            RC fileResult = forceFlushFileLocked(bm, fileId);
+            result = (result == RC_OK) ? fileResult : result;
+        }
+    }
+    return result;
+}
+
+RC resizeBufferPool(BM_BufferPool *const bm, const int newNumPages){
+    return resizePoolFrames(bm, newNumPages, FALSE);
+}
+
+RC resizePoolFrames(BM_BufferPool *const bm, const int newNumPages, const bool byBudget){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    if (newNumPages <= 0){
+        THROW(RC_BUFFERPOOL_INVALID_SIZE,"A buffer pool needs at least one frame");
+    }
+    if (newNumPages > bm->mgmtData->allocation.reservedFrames){
+        THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Cannot grow the buffer pool beyond its reserved frames");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    if (bm->mgmtData->budget != NULL && !byBudget){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        THROW(RC_BUFFERPOOL_INVALID_SIZE,"The pool is sized by its budget manager");
+    }
+    RC result = RC_OK;
+    if (newNumPages > bm->numPages){
+        result = growBufferPool(bm, newNumPages);
+    } else if (newNumPages < bm->numPages){
+        result = shrinkBufferPool(bm, newNumPages);
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+int getPoolNumPages(BM_BufferPool *const bm){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int numPages = bm->numPages;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return numPages;
+}
+
+RC setPoolBudget(BM_BufferPool *const bm, struct BM_BudgetManager *budget, const int maxFrames){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    if (budget != NULL && bm->numPages > maxFrames){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        THROW(RC_BUFFERPOOL_INVALID_SIZE,"The pool does not fit in the frame budget");
+    }
+    bm->mgmtData->budget = budget;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+// New frames are empty and join the end of the queue on first use, existing frames keep their content and position
+RC growBufferPool(BM_BufferPool *const bm, const int newNumPages){
+    RC result = resizeFrameMetadata(bm, newNumPages);
+    if (result != RC_OK){
+        return result;
+    }
+    bm->numPages = newNumPages;
+    rebuildPageTable(bm);
+    return RC_OK;
+}
+
+// The frames beyond newNumPages are released. Pages evicted to make room are the first unpinned ones of the queue,
+// exactly those the strategy would evict next, the other pages of released frames move to empty frames below newNumPages.
+RC shrinkBufferPool(BM_BufferPool *const bm, const int newNumPages){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    int oldNumPages = bm->numPages;
+    int queueLength = mgmtData->numInitializedFrames; // frames beyond it were never used
+    int pagesToMove = 0;
+    int emptyFrames = (newNumPages > queueLength) ? newNumPages - queueLength : 0;
+    // Pinned frames cannot move as callers hold pointers to their data
+    for (int i = newNumPages; i < queueLength; i++){
+        if (mgmtData->frameFixCounts[i] > 0){
+            THROW(RC_BUFFER_WITH_PINNED_PAGES,"Cannot release frames holding pinned pages");
+        }
+        if (mgmtData->framePageNums[i] != NO_PAGE){
+            pagesToMove ++;
+        }
+    }
+    for (int i = 0; i < newNumPages && i < queueLength; i++){
+        if (mgmtData->framePageNums[i] == NO_PAGE){
+            emptyFrames ++;
+        }
+    }
+    // Victims in queue order until the pages of released frames fit in the remaining empty frames, each eviction
+    // frees one frame. They are all chosen before anything changes, so a pool that cannot shrink is left as it was
+    int numVictims = 0;
+    int *victims = (int *) malloc(sizeof(int) * (queueLength + 1));
+    if (victims == NULL){
+        THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not allocate the victims of the shrink");
+    }
+    for (int pos = 0; pos < queueLength && pagesToMove - emptyFrames > numVictims; pos++){
+        int frameIndex = mgmtData->strategyBuffer[pos];
+        if (mgmtData->framePageNums[frameIndex] != NO_PAGE && mgmtData->frameFixCounts[frameIndex] == 0){
+            victims[numVictims++] = frameIndex;
+        }
+    }
+    if (pagesToMove - emptyFrames > numVictims){
+        free(victims);
+        THROW(RC_BUFFER_WITH_PINNED_PAGES,"Too many pinned pages to shrink the buffer pool");
+    }
+    // Dirty victims are written first, a failed write leaves every page in its frame (the written ones clean)
+    int numWritten = 0;
+    for (int i = 0; i < numVictims; i++){
+        if (mgmtData->frameDirtyFlags[victims[i]] == TRUE){
+            RC result = forceFrame(bm, victims[i]);
+            if (result != RC_OK){
+                free(victims);
+                return result;
+            }
+            numWritten ++;
         }
     }
+    mgmtData->stats.numDirtyEvictions += numWritten;
+    mgmtData->stats.numCleanEvictions += numVictims - numWritten;
+    for (int i = 0; i < numVictims; i++){
+        recordGhost(bm, victims[i]);
+        setFramePage(bm, victims[i], BM_DEFAULT_FILE, NO_PAGE);
+    }
+    free(victims);
+    // Move the remaining pages, the target frame takes the queue position of the released one
+    for (int i = newNumPages; i < queueLength; i++){
+        PageNumber pageNum = mgmtData->framePageNums[i];
+        int fileId = mgmtData->frameFileIds[i];
+        if (pageNum == NO_PAGE){
+            continue;
+        }
+        int target = scanFindLong(mgmtData->framePageNums, newNumPages, NO_PAGE);
+        memcpy(frameData(mgmtData, target), frameData(mgmtData, i), mgmtData->allocation.pageSize);
+        setFramePage(bm, i, BM_DEFAULT_FILE, NO_PAGE);
+        setFramePage(bm, target, fileId, pageNum);
+        mgmtData->frameDirtyFlags[target] = mgmtData->frameDirtyFlags[i];
+        mgmtData->frameAccessCounts[target] = mgmtData->frameAccessCounts[i];
+        mgmtData->frameLastAccess[target] = mgmtData->frameLastAccess[i];
+        mgmtData->frameLsns[target] = mgmtData->frameLsns[i];
+        mgmtData->frameDirtyFlags[i] = FALSE;
+        int releasedPosition = getPositionQueue(i, mgmtData->strategyBuffer, queueLength);
+        int targetPosition = getPositionQueue(target, mgmtData->strategyBuffer, queueLength);
+        mgmtData->strategyBuffer[releasedPosition] = target;
+        mgmtData->strategyBuffer[targetPosition] = i;
+    }
+    // Drop the released frames from the queue keeping the order of the others
+    int length = 0;
+    for (int pos = 0; pos < queueLength; pos++){
+        if (mgmtData->strategyBuffer[pos] < newNumPages){
+            mgmtData->strategyBuffer[length++] = mgmtData->strategyBuffer[pos];
+        }
+    }
+    releaseFrames(mgmtData->framePool, newNumPages, oldNumPages - newNumPages, mgmtData->allocation.pageSize);
+    mgmtData->numInitializedFrames = length;
+    resizeFrameMetadata(bm, newNumPages); // on failure the old arrays stay, they hold every frame that is left
+    bm->numPages = newNumPages;
+    rebuildPageTable(bm);
     return RC_OK;
 }
 
+// The old arrays are kept when an allocation fails
+RC resizeFrameMetadata(BM_BufferPool *const bm, const int newNumPages){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    int kept = mgmtData->numInitializedFrames; // never more than newNumPages, shrinking lowers it first
+    PageNumber *framePageNums = (PageNumber *) allocCacheAligned(sizeof(PageNumber) * newNumPages);
+    int *frameFileIds = (int *) allocCacheAligned(sizeof(int) * newNumPages);
+    int *frameFixCounts = (int *) allocCacheAligned(sizeof(int) * newNumPages);
+    bool *frameDirtyFlags = (bool *) allocCacheAligned(sizeof(bool) * newNumPages);
+    int *frameAccessCounts = (int *) allocCacheAligned(sizeof(int) * newNumPages);
+    long long *frameLastAccess = (long long *) allocCacheAligned(sizeof(long long) * newNumPages);
+    LSN *frameLsns = (LSN *) allocCacheAligned(sizeof(LSN) * newNumPages);
+    int *strategyBuffer = (int *) allocCacheAligned(sizeof(int) * newNumPages);
+    if (framePageNums == NULL || frameFileIds == NULL || frameFixCounts == NULL || frameDirtyFlags == NULL
+            || frameAccessCounts == NULL || frameLastAccess == NULL || frameLsns == NULL || strategyBuffer == NULL){
+        free(framePageNums);
+        free(frameFileIds);
+        free(frameFixCounts);
+        free(frameDirtyFlags);
+        free(frameAccessCounts);
+        free(frameLastAccess);
+        free(frameLsns);
+        free(strategyBuffer);
+        THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not allocate the frame metadata");
+    }
+    memcpy(framePageNums, mgmtData->framePageNums, sizeof(PageNumber) * kept);
+    memcpy(frameFileIds, mgmtData->frameFileIds, sizeof(int) * kept);
+    memcpy(frameFixCounts, mgmtData->frameFixCounts, sizeof(int) * kept);
+    memcpy(frameDirtyFlags, mgmtData->frameDirtyFlags, sizeof(bool) * kept);
+    memcpy(frameAccessCounts, mgmtData->frameAccessCounts, sizeof(int) * kept);
+    memcpy(frameLastAccess, mgmtData->frameLastAccess, sizeof(long long) * kept);
+    memcpy(frameLsns, mgmtData->frameLsns, sizeof(LSN) * kept);
+    memcpy(strategyBuffer, mgmtData->strategyBuffer, sizeof(int) * kept);
+    free(mgmtData->framePageNums);
+    free(mgmtData->frameFileIds);
+    free(mgmtData->frameFixCounts);
+    free(mgmtData->frameDirtyFlags);
+    free(mgmtData->frameAccessCounts);
+    free(mgmtData->frameLastAccess);
+    free(mgmtData->frameLsns);
+    free(mgmtData->strategyBuffer);
+    mgmtData->framePageNums = framePageNums;
+    mgmtData->frameFileIds = frameFileIds;
+    mgmtData->frameFixCounts = frameFixCounts;
+    mgmtData->frameDirtyFlags = frameDirtyFlags;
+    mgmtData->frameAccessCounts = frameAccessCounts;
+    mgmtData->frameLastAccess = frameLastAccess;
+    mgmtData->frameLsns = frameLsns;
+    mgmtData->strategyBuffer = strategyBuffer;
+    return RC_OK;
+}
+
+// Pages evicted recently are kept in a ring, a miss on one of them tells how useful more frames would be
+RC setGhostListSize(BM_BufferPool *const bm, const int numEntries){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    if (numEntries < 0){
+        THROW(RC_BUFFERPOOL_INVALID_SIZE,"A ghost list cannot have a negative size");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    free(mgmtData->ghostPageNums);
+    free(mgmtData->ghostFileIds);
+    mgmtData->ghostPageNums = NULL;
+    mgmtData->ghostFileIds = NULL;
+    if (numEntries > 0){
+        mgmtData->ghostPageNums = (PageNumber *) allocCacheAligned(sizeof(PageNumber) * numEntries);
+        mgmtData->ghostFileIds = (int *) allocCacheAligned(sizeof(int) * numEntries);
+        for (int i = 0; i < numEntries; i++){
+            mgmtData->ghostPageNums[i] = NO_PAGE;
+        }
+    }
+    mgmtData->ghostCapacity = numEntries;
+    mgmtData->ghostNext = 0;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+// Buffer Manager Interface Files
+RC registerPageFile(BM_BufferPool *const bm, char *const pageFileName, int *fileId){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    // Reuse the slot of an unregistered file, else add one
+    int slot = 0;
+    while (slot < mgmtData->numFiles && mgmtData->files[slot].registered){
+        slot ++;
+    }
+    if (slot == mgmtData->numFiles){
+        BM_PoolFile *files = (BM_PoolFile *) realloc(mgmtData->files, sizeof(BM_PoolFile) * (mgmtData->numFiles + 1));
+        if (files == NULL){
+            pthread_mutex_unlock(&(bm->mgmtData->latch));
+            THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not grow the file table");
+        }
+        mgmtData->files = files;
+        mgmtData->files[slot].registered = FALSE;
+        mgmtData->numFiles ++;
+    }
+    RC result = openPoolFile(mgmtData, pageFileName, &(mgmtData->files[slot].fileHandle));
+    if (result == RC_OK){
+        mgmtData->files[slot].registered = TRUE;
+        mgmtData->files[slot].numPages = mgmtData->files[slot].fileHandle.totalNumPages;
+        mgmtData->files[slot].freshPage = NO_PAGE;
+        mgmtData->files[slot].defragmenting = FALSE;
+        if (slot == BM_DEFAULT_FILE){
+            bm->pageFile = pageFileName;
+        }
+        *fileId = slot;
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC unregisterPageFile(BM_BufferPool *const bm, const int fileId){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result = dropFilePagesLocked(bm, fileId, TRUE);
+    if (result == RC_OK){
+        result = closePageFile(&(bm->mgmtData->files[fileId].fileHandle));
+        bm->mgmtData->files[fileId].registered = FALSE;
+        bm->mgmtData->files[fileId].defragmenting = FALSE; // a running defragmentation stops at its next step
+        if (fileId == BM_DEFAULT_FILE){
+            bm->pageFile = NULL;
+        }
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC forceFlushFile(BM_BufferPool *const bm, const int fileId){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result = forceFlushFileLocked(bm, fileId);
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC dropFilePages(BM_BufferPool *const bm, const int fileId){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result = dropFilePagesLocked(bm, fileId, FALSE);
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC forceFlushFileLocked(BM_BufferPool *const bm, const int fileId){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (!isRegisteredFile(bm, fileId)){
+        THROW(RC_BUFFERPOOL_INVALID_FILE,"File not registered in the buffer pool");
+    }
+    RC result = flushFileFrames(bm, fileId);
+    if (result != RC_OK){
+        return result;
+    }
+    return syncPoolFile(mgmtData, fileId);
+}
+
+// The frames of the file become empty, they keep their queue position and are reused before any eviction
+RC dropFilePagesLocked(BM_BufferPool *const bm, const int fileId, bool writeDirty){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (!isRegisteredFile(bm, fileId)){
+        THROW(RC_BUFFERPOOL_INVALID_FILE,"File not registered in the buffer pool");
+    }
+    for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+        if (mgmtData->framePageNums[i] != NO_PAGE && mgmtData->frameFileIds[i] == fileId && mgmtData->frameFixCounts[i] > 0){
+            THROW(RC_BUFFER_WITH_PINNED_PAGES,"Cannot drop the pages of a file while one is pinned");
+        }
+    }
+    if (writeDirty){
+        RC result = forceFlushFileLocked(bm, fileId);
+        if (result != RC_OK){
+            return result;
+        }
+    }
+    for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+        if (mgmtData->framePageNums[i] == NO_PAGE || mgmtData->frameFileIds[i] != fileId){
+            continue;
+        }
+        mgmtData->frameDirtyFlags[i] = FALSE;
+        setFramePage(bm, i, BM_DEFAULT_FILE, NO_PAGE);
+    }
+    // New pages were written or discarded with their frames, the file no longer needs to grow for them
+    mgmtData->files[fileId].numPages = mgmtData->files[fileId].fileHandle.totalNumPages;
+    if (mgmtData->ghostCapacity > 0){ // pages of a dropped file must not count as ghost hits if it is registered again
+        for (int i = 0; i < mgmtData->ghostCapacity; i++){
+            if (mgmtData->ghostFileIds[i] == fileId){
+                mgmtData->ghostPageNums[i] = NO_PAGE;
+            }
+        }
+    }
+    return RC_OK;
+}
+
+RC setFileDurability(BM_BufferPool *const bm, const int fileId, const SM_Durability *durability){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result;
+    if (!isRegisteredFile(bm, fileId)){
+        RC_message = "File not registered in the buffer pool";
+        result = RC_BUFFERPOOL_INVALID_FILE;
+    } else {
+        result = setDurability(&(bm->mgmtData->files[fileId].fileHandle), durability);
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC backupPoolFile(BM_BufferPool *const bm, const int fileId, char *archiveName, const bool incremental, SM_BackupInfo *info){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result = forceFlushFileLocked(bm, fileId);
+    if (result == RC_OK){
+        result = backupPageFile(&(bm->mgmtData->files[fileId].fileHandle), archiveName, incremental, info);
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+// Opens a file with the checksums and durability of the pool
+RC openPoolFile(BM_BufferPoolManagementInformation *mgmtData, char *const pageFileName, SM_FileHandle *fileHandle){
+    RC result = openPageFile(pageFileName, fileHandle);
+    if (result != RC_OK){
+        return result;
+    }
+    // The first file gives its page size to a pool created without one
+    if (mgmtData->allocation.pageSize == 0){
+        mgmtData->allocation.pageSize = fileHandle->pageSize;
+    }
+    if (fileHandle->pageSize != mgmtData->allocation.pageSize){
+        closePageFile(fileHandle);
+        THROW(RC_INVALID_PAGE_SIZE,"The pages of the file are not the size of the frames of the pool");
+    }
+    if (mgmtData->pageChecksums){
+        result = enablePageChecksums(fileHandle);
+    }
+    if (result == RC_OK && mgmtData->durability.mode != SM_DURABILITY_NONE){
+        result = setDurability(fileHandle, &(mgmtData->durability));
+    }
+    if (result == RC_OK && mgmtData->doubleWrite){
+        result = enableDoubleWrite(fileHandle);
+    }
+    if (result == RC_OK && mgmtData->changeTracking){
+        result = enableChangeTracking(fileHandle);
+    }
+    if (result != RC_OK){
+        closePageFile(fileHandle);
+    }
+    return result;
+}
+
+// Frames are a power of two bytes, so the hit path finds a frame with a shift whatever the page size
+char *frameData(const BM_BufferPoolManagementInformation *mgmtData, const int frameIndex){
+    return mgmtData->framePool + ((size_t) frameIndex << mgmtData->pageShift);
+}
+
+// End of a flush: the written pages reach the disk, unless the file is in SM_DURABILITY_NONE
+RC syncPoolFile(BM_BufferPoolManagementInformation *mgmtData, const int fileId){
+    SM_FileHandle *fileHandle = &(mgmtData->files[fileId].fileHandle);
+    if (fileHandle->mgmtInfo.durability.mode == SM_DURABILITY_NONE){
+        return RC_OK;
+    }
+    return syncPageFile(fileHandle);
+}
+
+void closePoolFiles(BM_BufferPoolManagementInformation *mgmtData){
+    for (int i = 0; i < mgmtData->numFiles; i++){
+        if (mgmtData->files[i].registered){
+            closePageFile(&(mgmtData->files[i].fileHandle));
+        }
+    }
+    free(mgmtData->files);
+    mgmtData->files = NULL;
+    mgmtData->numFiles = 0;
+}
+
 
 
 // Buffer Manager Interface Access Pages
@@ -81,24 +657,73 @@ RC markDirty (BM_BufferPool *const bm, BM_PageHandle *const page){
     if (bm->mgmtData == NULL){
         THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
     }
-    int frameIndex = getFrameIndex(bm,page->pageNum);
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int frameIndex = getFrameIndex(bm,page->fileId,page->pageNum);
     if (frameIndex < 0){ // not frame corresponding to the page
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
         THROW(RC_FRAME_NOT_FOUND,"No frame corresponding to the page");
     }
-    BM_FrameInfo *frameInfo = &(bm->mgmtData->frameInfoPool[frameIndex]);
-    frameInfo->isDirty = TRUE;
+    bm->mgmtData->frameDirtyFlags[frameIndex] = TRUE;
+    if (bm->mgmtData->trace != NULL){
+        traceEvent(bm->mgmtData->trace, BM_TRACE_DIRTY, page->fileId, page->pageNum);
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
     return RC_OK;
 }
 
+RC markDirtyLSN (BM_BufferPool *const bm, BM_PageHandle *const page, const LSN lsn){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int frameIndex = getFrameIndex(bm,page->fileId,page->pageNum);
+    if (frameIndex < 0){ // not frame corresponding to the page
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        THROW(RC_FRAME_NOT_FOUND,"No frame corresponding to the page");
+    }
+    // The trailer is the stamp of the frame, else the caller wrote data there that a stamp would clobber
+    char *trailer = frameData(bm->mgmtData, frameIndex) + BM_PAGE_DATA_BYTES(bm->mgmtData->allocation.pageSize);
+    LSN stamped;
+    memcpy(&stamped, trailer, BM_PAGE_LSN_BYTES);
+    LSN frameLsn = bm->mgmtData->frameLsns[frameIndex];
+    if ((frameLsn > 0) ? stamped != frameLsn : (stamped < 0 || stamped > lsn)){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        THROW(RC_PAGE_LSN_TRAILER_IN_USE,"The page has data in its LSN trailer");
+    }
+    bm->mgmtData->frameDirtyFlags[frameIndex] = TRUE;
+    // Changes can be logged by several threads, the page holds up to the latest record
+    if (lsn > frameLsn){
+        bm->mgmtData->frameLsns[frameIndex] = lsn;
+        memcpy(trailer, &lsn, BM_PAGE_LSN_BYTES);
+    }
+    if (bm->mgmtData->trace != NULL){
+        traceEvent(bm->mgmtData->trace, BM_TRACE_DIRTY, page->fileId, page->pageNum);
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+LSN getPageLSN (const char *pageData){
+    LSN lsn;
+    memcpy(&lsn, pageData + BM_PAGE_LSN_OFFSET, BM_PAGE_LSN_BYTES);
+    return lsn;
+}
+
 RC unpinPage (BM_BufferPool *const bm, BM_PageHandle *const page){
     if (bm->mgmtData == NULL){
         THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
     }
-    BM_FrameInfo *frameInfo = &(bm->mgmtData->frameInfoPool[getFrameIndex(bm,page->pageNum)]);
-    if (frameInfo->fixCount <= 0){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int frameIndex = getFrameIndex(bm,page->fileId,page->pageNum);
+    if (frameIndex < 0 || bm->mgmtData->frameFixCounts[frameIndex] <= 0){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
         THROW(RC_FIX_COUNT_ZERO,"Cannot unpin a page that is not pinned");
     }
-    frameInfo->fixCount --;
+    bm->mgmtData->frameFixCounts[frameIndex] --;
+    if (bm->mgmtData->trace != NULL){
+        traceEvent(bm->mgmtData->trace, BM_TRACE_UNPIN, page->fileId, page->pageNum);
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
     return RC_OK;
 }
 
@@ -106,49 +731,161 @@ RC forcePage (BM_BufferPool *const bm, BM_PageHandle *const page){
     if (bm->mgmtData == NULL){
         THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
     }
-    int frameIndex = getFrameIndex(bm,page->pageNum);
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int frameIndex = getFrameIndex(bm,page->fileId,page->pageNum);
     if (frameIndex < 0){ // not frame corresponding to the page
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
         THROW(RC_FRAME_NOT_FOUND,"No frame corresponding to the page");
     }
-    BM_FrameInfo *frameInfo = &(bm->mgmtData->frameInfoPool[frameIndex]);
-    return forceFrame(bm, frameInfo, frameIndex);
+    RC result = flushFrame(bm, frameIndex);
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
 }
 
 RC pinPage (BM_BufferPool *const bm, BM_PageHandle *const page, const PageNumber pageNum){
+    return pinFilePage(bm, page, BM_DEFAULT_FILE, pageNum);
+}
+
+RC pinFilePage (BM_BufferPool *const bm, BM_PageHandle *const page, const int fileId, const PageNumber pageNum){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    bool timed = ((pinSampleCounter++ & ((1u << BM_STATS_PIN_SAMPLE_SHIFT) - 1)) == 0);
+    long long start = timed ? nowNanos() : 0;
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result = pinPageLocked(bm, page, fileId, pageNum);
+    if (timed){
+        histogramRecord(&(bm->mgmtData->stats.pinLatency), nowNanos() - start);
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC newPage (BM_BufferPool *const bm, BM_PageHandle *const page){
+    return newFilePage(bm, page, BM_DEFAULT_FILE);
+}
+
+RC newFilePage (BM_BufferPool *const bm, BM_PageHandle *const page, const int fileId){
     if (bm->mgmtData == NULL){
         THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
     }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    if (!isRegisteredFile(bm, fileId)){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        THROW(RC_BUFFERPOOL_INVALID_FILE,"File not registered in the buffer pool");
+    }
+    BM_PoolFile *file = &(bm->mgmtData->files[fileId]);
+    PageNumber pageNum;
+    RC result = takeFreePage(&(file->fileHandle), &pageNum);
+    bool takenFree = (result == RC_OK);
+    if (result == RC_NO_FREE_PAGE){
+        // The page after the last one, pinning it takes the new page path (no read, extension deferred to its first write)
+        pageNum = file->numPages;
+    } else if (result != RC_OK){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        return result;
+    }
+    file->freshPage = pageNum; // a freed page holds dead data, it is not read either
+    result = pinPageLocked(bm, page, fileId, pageNum);
+    file->freshPage = NO_PAGE;
+    if (result != RC_OK && takenFree){
+        // No frame for it (e.g. every frame pinned), the page goes back to the free map instead of leaking
+        freePage(pageNum, &(file->fileHandle));
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC deletePage (BM_BufferPool *const bm, const PageNumber pageNum){
+    return deleteFilePage(bm, BM_DEFAULT_FILE, pageNum);
+}
+
+RC deleteFilePage (BM_BufferPool *const bm, const int fileId, const PageNumber pageNum){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (!isRegisteredFile(bm, fileId)){
+        pthread_mutex_unlock(&(mgmtData->latch));
+        THROW(RC_BUFFERPOOL_INVALID_FILE,"File not registered in the buffer pool");
+    }
+    int frameIndex = getFrameIndex(bm, fileId, pageNum);
+    if (frameIndex >= 0){
+        if (mgmtData->frameFixCounts[frameIndex] > 0){
+            pthread_mutex_unlock(&(mgmtData->latch));
+            THROW(RC_BUFFER_WITH_PINNED_PAGES,"Cannot delete a pinned page");
+        }
+        // The frame becomes empty like the frames of a dropped file, its content is dead
+        mgmtData->frameDirtyFlags[frameIndex] = FALSE;
+        setFramePage(bm, frameIndex, fileId, NO_PAGE);
+    }
+    BM_PoolFile *file = &(mgmtData->files[fileId]);
+    RC result = RC_OK;
+    if (pageNum >= file->fileHandle.totalNumPages && pageNum < file->numPages){ // a new page never written
+        result = extendPageFile(file->numPages, &(file->fileHandle));
+    }
+    if (result == RC_OK){
+        result = freePage(pageNum, &(file->fileHandle));
+    }
+    pthread_mutex_unlock(&(mgmtData->latch));
+    return result;
+}
+
+RC pinPageLocked (BM_BufferPool *const bm, BM_PageHandle *const page, const int fileId, const PageNumber pageNum){
+    if (!isRegisteredFile(bm, fileId)){
+        THROW(RC_BUFFERPOOL_INVALID_FILE,"File not registered in the buffer pool");
+    }
     // First we check if the page is already buffered
     page->pageNum = pageNum;
-    int frameIndex = getFrameIndex(bm,pageNum);
+    page->fileId = fileId;
+    bm->mgmtData->stats.numPins ++;
+    bm->mgmtData->accessClock ++;
+    int frameIndex = getFrameIndex(bm,fileId,pageNum);
     if (frameIndex >= 0){
-        BM_FrameInfo *frameInfo = &(bm->mgmtData->frameInfoPool[frameIndex]);
-        page->data = &(bm->mgmtData->framePool[frameIndex * PAGE_SIZE]);
-        frameInfo->fixCount ++;
+        bm->mgmtData->stats.numHits ++;
+        if (bm->mgmtData->trace != NULL){
+            traceEvent(bm->mgmtData->trace, BM_TRACE_PIN_HIT, fileId, pageNum);
+        }
+        page->data = frameData(bm->mgmtData, frameIndex);
+        bm->mgmtData->frameFixCounts[frameIndex] ++;
+        bm->mgmtData->frameAccessCounts[frameIndex] ++;
+        bm->mgmtData->frameLastAccess[frameIndex] = bm->mgmtData->accessClock;
         if (bm->strategy == RS_LRU){ // update last access time of page (by changing its position in the queue)
-            int position = getPositionQueue(pageNum, bm->mgmtData->strategyBuffer, bm->numPages);
-            updateQueue(position, (void **) bm->mgmtData->strategyBuffer, bm->numPages); // Could be optimized to only traverse the queue one time
+            int queueLength = bm->mgmtData->numInitializedFrames;
+            int position = getPositionQueue(frameIndex, bm->mgmtData->strategyBuffer, queueLength);
+            updateQueue(position, bm->mgmtData->strategyBuffer, queueLength);
         }
         return RC_OK;
     }
     // The requested page is not buffered, we need to read it from disk
-    // First we ensure that the page file has at least pageNum+1 pages
-    ensureCapacity(pageNum+1, &(bm->mgmtData->fileHandle));
+    bm->mgmtData->stats.numMisses ++;
+    if (bm->mgmtData->trace != NULL){
+        traceEvent(bm->mgmtData->trace, BM_TRACE_PIN_MISS, fileId, pageNum);
+    }
+    if (bm->mgmtData->ghostCapacity > 0 && ghostListHit(bm, fileId, pageNum)){
+        bm->mgmtData->numGhostHits ++;
+    }
+    // Pages past the end of the file are not read (see loadPage), the file grows when they are written
     // Next we look for an empty frame
-    for (int i = 0; i < bm->numPages; i++){
-        BM_FrameInfo *frameInfo = &(bm->mgmtData->frameInfoPool[i]);
-        if (frameInfo->pageNum == NO_PAGE){
-            page->data = &(bm->mgmtData->framePool[i * PAGE_SIZE]);
-            RC result = readPageFromDisk(bm,page);
-            if (result != RC_OK){
-                return result;
-            }
-            frameInfo->pageNum = pageNum;
-            frameInfo->fixCount = 1;
-            return RC_OK;
+    if (bm->mgmtData->numUsedFrames < bm->numPages){
+        frameIndex = findEmptyFrame(bm);
+        RC result = loadPage(bm, page, frameIndex);
+        if (result != RC_OK){
+            return result;
         }
+        setFramePage(bm, frameIndex, fileId, pageNum);
+        bm->mgmtData->frameFixCounts[frameIndex] = 1;
+        bm->mgmtData->frameAccessCounts[frameIndex] = 1;
+        bm->mgmtData->frameLastAccess[frameIndex] = bm->mgmtData->accessClock;
+        bm->mgmtData->frameLsns[frameIndex] = 0;
+        // The frame now holds the newest page (frames emptied by a resize can be anywhere in the queue)
+        int queueLength = bm->mgmtData->numInitializedFrames;
+        int position = getPositionQueue(frameIndex, bm->mgmtData->strategyBuffer, queueLength);
+        updateQueue(position, bm->mgmtData->strategyBuffer, queueLength);
+        return RC_OK;
     }
-    
+
     // No empty frame, we need to evict a page from the buffer
     if (bm->strategy == RS_FIFO){
         return evictFIFO(bm, page);
@@ -160,125 +897,681 @@ RC pinPage (BM_BufferPool *const bm, BM_PageHandle *const page, const PageNumber
 
 // Statistics Interface
 PageNumber *getFrameContents (BM_BufferPool *const bm){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
     PageNumber * frameContent = (PageNumber *) malloc (sizeof(PageNumber) * bm->numPages);
-    for (int i = 0; i < bm->numPages; i++){
-        frameContent[i] = bm->mgmtData->frameInfoPool[i].pageNum;
+    int numInitializedFrames = bm->mgmtData->numInitializedFrames;
+    memcpy(frameContent, bm->mgmtData->framePageNums, sizeof(PageNumber) * numInitializedFrames);
+    for (int i = numInitializedFrames; i < bm->numPages; i++){ // frames never used are empty
+        frameContent[i] = NO_PAGE;
     }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
     return frameContent;
 }
 
 bool *getDirtyFlags (BM_BufferPool *const bm){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
     bool * dirtyFlags = (bool *) malloc (sizeof(bool) * bm->numPages);
-    for (int i = 0; i < bm->numPages; i++){
-        dirtyFlags[i] = bm->mgmtData->frameInfoPool[i].isDirty; // an empty frame is always clean
-    }
+    int numInitializedFrames = bm->mgmtData->numInitializedFrames;
+    memcpy(dirtyFlags, bm->mgmtData->frameDirtyFlags, sizeof(bool) * numInitializedFrames);
+    memset(&dirtyFlags[numInitializedFrames], FALSE, sizeof(bool) * (bm->numPages - numInitializedFrames)); // an empty frame is always clean
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
     return dirtyFlags;
 }
 
 int *getFixCounts (BM_BufferPool *const bm){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
     int * fixCounts = (int *) malloc (sizeof(int) * bm->numPages);
+    int numInitializedFrames = bm->mgmtData->numInitializedFrames;
+    memcpy(fixCounts, bm->mgmtData->frameFixCounts, sizeof(int) * numInitializedFrames);
+    memset(&fixCounts[numInitializedFrames], 0, sizeof(int) * (bm->numPages - numInitializedFrames)); // an empty frame has always 0 fix
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return fixCounts;
+}
+
+// -1 for empty frames
+int *getFrameFileIds (BM_BufferPool *const bm){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int * fileIds = (int *) malloc (sizeof(int) * bm->numPages);
     for (int i = 0; i < bm->numPages; i++){
-        fixCounts[i] = bm->mgmtData->frameInfoPool[i].fixCount; // an empty frame has always 0 fix
+        bool used = i < bm->mgmtData->numInitializedFrames && bm->mgmtData->framePageNums[i] != NO_PAGE;
+        fileIds[i] = used ? bm->mgmtData->frameFileIds[i] : -1;
     }
-    return fixCounts;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return fileIds;
 }
 
+// The counters are read under the latch, a budget manager reads them while other threads pin
 int getNumReadIO (BM_BufferPool *const bm){
-    return bm->mgmtData->numReadIO;
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int numReadIO = (int) bm->mgmtData->stats.numReadIO;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return numReadIO;
 }
 
 int getNumWriteIO (BM_BufferPool *const bm){
-    return bm->mgmtData->numWriteIO;
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int numWriteIO = (int) bm->mgmtData->stats.numWriteIO;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return numWriteIO;
+}
+
+int getNumGhostHits (BM_BufferPool *const bm){
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    int numGhostHits = bm->mgmtData->numGhostHits;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return numGhostHits;
+}
+
+RC getPoolStats (BM_BufferPool *const bm, BM_Stats *stats){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    *stats = bm->mgmtData->stats;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+RC startPoolTrace (BM_BufferPool *const bm, const char *traceFileName){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    if (bm->mgmtData->trace != NULL){ // a new trace replaces the current one
+        closeTrace(bm->mgmtData->trace);
+    }
+    BM_Trace *trace = openTrace(traceFileName, bm->numPages, bm->strategy);
+    bm->mgmtData->trace = trace;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    if (trace == NULL){
+        THROW(RC_FILE_NOT_FOUND,"Could not create the trace file");
+    }
+    return RC_OK;
+}
+
+RC stopPoolTrace (BM_BufferPool *const bm){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    RC result = RC_OK;
+    if (bm->mgmtData->trace != NULL){
+        result = closeTrace(bm->mgmtData->trace);
+        bm->mgmtData->trace = NULL;
+    }
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return result;
+}
+
+RC setPoolLog (BM_BufferPool *const bm, LM_Log *log){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    bm->mgmtData->log = log;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+RC resetPoolStats (BM_BufferPool *const bm){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    memset(&(bm->mgmtData->stats), 0, sizeof(BM_Stats));
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+RC getPoolSnapshot (BM_BufferPool *const bm, BM_FrameSnapshot *frames, const int firstFrame, const int maxFrames, int *numFrames){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    int count = 0;
+    for (int i = firstFrame; i < bm->numPages && count < maxFrames; i++, count++){
+        BM_FrameSnapshot *frame = &frames[count];
+        if (i >= mgmtData->numInitializedFrames || mgmtData->framePageNums[i] == NO_PAGE){
+            frame->pageNum = NO_PAGE;
+            frame->fileId = -1;
+            frame->fixCount = 0;
+            frame->dirty = FALSE;
+            frame->accessCount = 0;
+            frame->age = 0;
+            continue;
+        }
+        frame->pageNum = mgmtData->framePageNums[i];
+        frame->fileId = mgmtData->frameFileIds[i];
+        frame->fixCount = mgmtData->frameFixCounts[i];
+        frame->dirty = mgmtData->frameDirtyFlags[i];
+        frame->accessCount = mgmtData->frameAccessCounts[i];
+        frame->age = mgmtData->accessClock - mgmtData->frameLastAccess[i];
+    }
+    *numFrames = count;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+RC getFileSummaries (BM_BufferPool *const bm, BM_PoolSummary *summaries, const int maxFiles, int *numSummaries){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    int count = (mgmtData->numFiles < maxFiles) ? mgmtData->numFiles : maxFiles;
+    for (int f = 0; f < count; f++){
+        memset(&summaries[f], 0, sizeof(BM_PoolSummary));
+        summaries[f].fileId = f;
+    }
+    for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+        int fileId = mgmtData->frameFileIds[i];
+        if (mgmtData->framePageNums[i] == NO_PAGE || fileId >= count){
+            continue;
+        }
+        BM_PoolSummary *summary = &summaries[fileId];
+        summary->numFrames ++;
+        summary->numDirty += mgmtData->frameDirtyFlags[i] ? 1 : 0;
+        summary->numPinned += (mgmtData->frameFixCounts[i] > 0) ? 1 : 0;
+        summary->accessCount += mgmtData->frameAccessCounts[i];
+    }
+    *numSummaries = count;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+RC getPageRangeSummaries (BM_BufferPool *const bm, const int fileId, const int rangeSize, BM_PoolSummary *summaries,
+        const int maxRanges, int *numSummaries){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    if (rangeSize <= 0){
+        THROW(RC_BUFFERPOOL_INVALID_SIZE,"A page range needs at least one page");
+    }
+    pthread_mutex_lock(&(bm->mgmtData->latch));
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (!isRegisteredFile(bm, fileId)){
+        pthread_mutex_unlock(&(bm->mgmtData->latch));
+        THROW(RC_BUFFERPOOL_INVALID_FILE,"File not registered in the buffer pool");
+    }
+    for (int r = 0; r < maxRanges; r++){
+        memset(&summaries[r], 0, sizeof(BM_PoolSummary));
+        summaries[r].fileId = fileId;
+        summaries[r].firstPage = (PageNumber) r * rangeSize;
+    }
+    int count = 0; // ranges up to the last one holding a buffered page
+    for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+        PageNumber range = mgmtData->framePageNums[i] / rangeSize;
+        if (mgmtData->framePageNums[i] == NO_PAGE || mgmtData->frameFileIds[i] != fileId || range >= maxRanges){
+            continue;
+        }
+        BM_PoolSummary *summary = &summaries[range];
+        summary->numFrames ++;
+        summary->numDirty += mgmtData->frameDirtyFlags[i] ? 1 : 0;
+        summary->numPinned += (mgmtData->frameFixCounts[i] > 0) ? 1 : 0;
+        summary->accessCount += mgmtData->frameAccessCounts[i];
+        if (range >= count){
+            count = (int) range + 1;
+        }
+    }
+    *numSummaries = count;
+    pthread_mutex_unlock(&(bm->mgmtData->latch));
+    return RC_OK;
+}
+
+long long getHistogramPercentile (const BM_Histogram *histogram, double percentile){
+    long long rank = (long long) (percentile / 100.0 * histogram->totalCount);
+    long long seen = 0;
+    for (int bucket = 0; bucket < BM_HISTOGRAM_BUCKETS; bucket++){
+        seen += histogram->counts[bucket];
+        if (seen > rank || (seen == histogram->totalCount && seen > 0)){
+            return histogramBucketValue(bucket);
+        }
+    }
+    return 0;
+}
+
+RC getPoolAllocationInfo (BM_BufferPool *const bm, BM_PoolAllocationInfo *info){
+    if (bm->mgmtData == NULL){
+        THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+    }
+    *info = bm->mgmtData->allocation;
+    return RC_OK;
 }
 
 // Strategy eviction function
 RC evictFIFO(BM_BufferPool *const bm, BM_PageHandle *page){
-    // strategyBuffer is a queue of FrameInfo pointer where the key is the page time of insertion in the buffer
-    BM_FrameInfo ** strategyBuffer = bm->mgmtData->strategyBuffer;
+    // strategyBuffer is a queue of frame indexes where the key is the page time of insertion in the buffer
+    return evictFromQueue(bm, page);
+}
+
+RC evictLRU(BM_BufferPool *const bm, BM_PageHandle *page){
+    // strategyBuffer is a queue of frame indexes where the key is the page time of last access
+    return evictFromQueue(bm, page);
+}
+
+RC evictFromQueue(BM_BufferPool *const bm, BM_PageHandle *page){
+    int *strategyBuffer = bm->mgmtData->strategyBuffer;
     // First we need to find the first frame that can be evicted ,i.e. that has no fix
-    for (int i = 0; i<bm->numPages; i++){
-        BM_FrameInfo *frameInfo = strategyBuffer[i];
-        if (frameInfo->fixCount == 0){
-            int frameIndex = getFrameIndex(bm, frameInfo->pageNum);
-            if (frameInfo->isDirty == TRUE){
-                forceFrame(bm, frameInfo, frameIndex);
-                frameInfo->isDirty = FALSE;
-            }
-            page->data = &(bm->mgmtData->framePool[frameIndex*PAGE_SIZE]);
-            RC result = readPageFromDisk(bm,page);
-            if (result != RC_OK){
-                return result;
-            }
-            frameInfo->pageNum = page->pageNum;
-            frameInfo->fixCount = 1;
-            updateQueue(i, (void **) strategyBuffer, bm->numPages);
-            return RC_OK;
+    int position = findLocalVictim(bm);
+    if (position < 0){
+        position = scanFindUnpinned(strategyBuffer, bm->mgmtData->frameFixCounts, bm->mgmtData->numInitializedFrames);
+    }
+    if (position < 0){
+        THROW(RC_FULL_BUFFER,"The Buffer is full of pinned pages");
+    }
+    int frameIndex = strategyBuffer[position];
+    if (bm->mgmtData->frameDirtyFlags[frameIndex] == TRUE){
+        // A page that could not be written (or whose log could not be flushed) stays in its frame
+        RC result = forceFrame(bm, frameIndex);
+        if (result != RC_OK){
+            return result;
         }
+        bm->mgmtData->stats.numDirtyEvictions ++;
+    } else {
+        bm->mgmtData->stats.numCleanEvictions ++;
+    }
+    recordGhost(bm, frameIndex);
+    RC result = loadPage(bm, page, frameIndex);
+    if (result != RC_OK){
+        // The evicted page is gone and the frame holds whatever the failed read left, it becomes empty
+        setFramePage(bm, frameIndex, page->fileId, NO_PAGE);
+        return result;
     }
-    THROW(RC_FULL_BUFFER,"The Buffer is full of pinned pages");
+    setFramePage(bm, frameIndex, page->fileId, page->pageNum);
+    bm->mgmtData->frameFixCounts[frameIndex] = 1;
+    bm->mgmtData->frameAccessCounts[frameIndex] = 1;
+    bm->mgmtData->frameLastAccess[frameIndex] = bm->mgmtData->accessClock;
+    bm->mgmtData->frameLsns[frameIndex] = 0;
+    updateQueue(position, strategyBuffer, bm->mgmtData->numInitializedFrames);
+    return RC_OK;
 }
 
-RC evictLRU(BM_BufferPool *const bm, BM_PageHandle *page){
-    // strategyBuffer is a queue of FrameInfo pointer where the key is the page time of last access
-    BM_FrameInfo ** strategyBuffer = bm->mgmtData->strategyBuffer;
-    // First we need to find the first frame that can be evicted ,i.e. that has no fix
-    for (int i = 0; i<bm->numPages; i++){
-        BM_FrameInfo *frameInfo = strategyBuffer[i];
-        if (frameInfo->fixCount == 0){
-            int frameIndex = getFrameIndex(bm, frameInfo->pageNum);
-            if (frameInfo->isDirty == TRUE){
-                forceFrame(bm, frameInfo, frameIndex);
-                frameInfo->isDirty = FALSE;
-            }
-            page->data = &(bm->mgmtData->framePool[frameIndex*PAGE_SIZE]);
-            RC result = readPageFromDisk(bm,page);
+// Utility
+RC readPageFromDisk(BM_BufferPool *const bm, BM_PageHandle *page){
+    bm->mgmtData->stats.numReadIO ++;
+    long long start = nowNanos();
+    RC result = readBlock(page->pageNum, &(bm->mgmtData->files[page->fileId].fileHandle), page->data);
+    histogramRecord(&(bm->mgmtData->stats.readLatency), nowNanos() - start);
+    return result;
+}
+
+// Fills the frame with the page: read from the file, or zeroed and dirty when the page is past the end of the file
+// or was just taken from the free map
+RC loadPage(BM_BufferPool *const bm, BM_PageHandle *page, int frameIndex){
+    BM_PoolFile *file = &(bm->mgmtData->files[page->fileId]);
+    page->data = frameData(bm->mgmtData, frameIndex);
+    if (page->pageNum < file->fileHandle.totalNumPages && page->pageNum != file->freshPage){
+        return readPageFromDisk(bm, page);
+    }
+    bm->mgmtData->stats.numNewPages ++;
+    memset(page->data, 0, bm->mgmtData->allocation.pageSize);
+    bm->mgmtData->frameDirtyFlags[frameIndex] = TRUE;
+    if (page->pageNum >= file->numPages){
+        file->numPages = page->pageNum + 1;
+    }
+    return RC_OK;
+}
+
+void updateQueue(int pos, int *queue, int queue_length){
+    int updatedElement = queue[pos];
+    memmove(&queue[pos], &queue[pos+1], sizeof(int) * (queue_length - pos - 1));
+    queue[queue_length-1] = updatedElement;
+}
+
+int getPositionQueue(int frameIndex, int *queue, int queue_length){
+    return scanFindInt(queue, queue_length, frameIndex);
+}
+
+int getFrameIndex(BM_BufferPool *const bm, int fileId, PageNumber pageNum){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (pageNum < 0 || !isRegisteredFile(bm, fileId)){ // NO_PAGE marks empty frames, it is never buffered
+        return -1;
+    }
+    if (mgmtData->pageTable != NULL){
+        return pageTableLookup(mgmtData, fileId, pageNum);
+    }
+    // The same page number can be buffered for several files, resume the scan after a match of another file
+    int length = mgmtData->numInitializedFrames;
+    for (int start = 0; start < length; ){
+        int found = scanFindLong(&(mgmtData->framePageNums[start]), length - start, pageNum);
+        if (found < 0){
+            return -1;
+        }
+        if (mgmtData->frameFileIds[start + found] == fileId){
+            return start + found;
+        }
+        start += found + 1;
+    }
+    return -1;
+}
+
+bool isRegisteredFile(BM_BufferPool *const bm, int fileId){
+    return fileId >= 0 && fileId < bm->mgmtData->numFiles && bm->mgmtData->files[fileId].registered;
+}
+
+RC forceFrame(BM_BufferPool *const bm, int frameIndex){
+    return writeFrames(bm, &frameIndex, 1);
+}
+
+// Writes up to SM_DWB_PAGES frames of one file with one writeBlocks (one double-write batch)
+RC writeFrames(BM_BufferPool *const bm, const int *frames, const int numFrames){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    BM_PoolFile *file = &(mgmtData->files[mgmtData->frameFileIds[frames[0]]]);
+    PageNumber pageNums[SM_DWB_PAGES];
+    SM_PageHandle pages[SM_DWB_PAGES];
+    LSN lsn = 0;
+    bool extend = FALSE;
+    for (int i = 0; i < numFrames; i++){
+        lsn = (mgmtData->frameLsns[frames[i]] > lsn) ? mgmtData->frameLsns[frames[i]] : lsn;
+        extend |= (mgmtData->framePageNums[frames[i]] >= file->fileHandle.totalNumPages);
+    }
+    // Write-ahead rule: the log records of the changes reach the disk before the pages
+    if (mgmtData->log != NULL && lsn > 0){
+        bool logFlush = (getDurableLSN(mgmtData->log) < lsn);
+        RC result = flushLog(mgmtData->log, lsn);
+        if (result != RC_OK){
+            return result;
+        }
+        if (logFlush){
+            mgmtData->stats.numLogFlushes ++;
+        }
+    }
+    if (extend){
+        // First write of a new page: the file is extended once for all the new pages of the pool
+        RC result = extendPageFile(file->numPages, &(file->fileHandle));
+        if (result != RC_OK){
+            return result;
+        }
+    }
+    for (int i = 0; i < numFrames; i++){
+        pageNums[i] = mgmtData->framePageNums[frames[i]];
+        pages[i] = frameData(mgmtData, frames[i]);
+    }
+    long long start = nowNanos();
+    RC result = writeBlocks(&(file->fileHandle), numFrames, pageNums, pages);
+    if (result != RC_OK){
+        return result; // the frames stay dirty, the next eviction or flush writes them again
+    }
+    long long perPage = (nowNanos() - start) / numFrames;
+    for (int i = 0; i < numFrames; i++){
+        mgmtData->stats.numWriteIO ++;
+        mgmtData->frameDirtyFlags[frames[i]] = FALSE;
+        histogramRecord(&(mgmtData->stats.writeLatency), perPage);
+    }
+    return RC_OK;
+}
+
+// Flushes the dirty unpinned frames of a file, SM_DWB_PAGES at a time
+RC flushFileFrames(BM_BufferPool *const bm, const int fileId){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    int batch[SM_DWB_PAGES];
+    int numFrames = 0;
+    for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+        if (mgmtData->framePageNums[i] == NO_PAGE || mgmtData->frameFileIds[i] != fileId
+                || mgmtData->frameDirtyFlags[i] != TRUE || mgmtData->frameFixCounts[i] != 0){
+            continue;
+        }
+        if (mgmtData->trace != NULL){
+            traceEvent(mgmtData->trace, BM_TRACE_FLUSH, fileId, mgmtData->framePageNums[i]);
+        }
+        batch[numFrames ++] = i;
+        if (numFrames == SM_DWB_PAGES){
+            RC result = writeFrames(bm, batch, numFrames);
             if (result != RC_OK){
                 return result;
             }
-            frameInfo->pageNum = page->pageNum;
-            frameInfo->fixCount = 1;
-            updateQueue(i, (void **) strategyBuffer, bm->numPages);
-            return RC_OK;
+            mgmtData->stats.numFlushes += numFrames; // counted once written, as the dirty flags are cleared
+            numFrames = 0;
+        }
+    }
+    if (numFrames > 0){
+        RC result = writeFrames(bm, batch, numFrames);
+        if (result != RC_OK){
+            return result;
         }
+        mgmtData->stats.numFlushes += numFrames;
     }
-    THROW(RC_FULL_BUFFER,"The Buffer is full of pinned pages");
+    return RC_OK;
 }
 
-// Utility
-RC readPageFromDisk(BM_BufferPool *const bm, BM_PageHandle *page){
-    bm->mgmtData->numReadIO ++;
-    return readBlock(page->pageNum, &(bm->mgmtData->fileHandle), page->data);
+int findEmptyFrame(BM_BufferPool *const bm){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    BM_PoolAllocationInfo *allocation = &(mgmtData->allocation);
+    if (allocation->numaPolicy == BM_NUMA_PARTITION && allocation->numNumaNodes > 1){
+        // Look in the range of the caller's node first, a range past the last frame of the pool is empty
+        int start, end;
+        getNodeFrameRange(allocation, getCurrentNumaNode(), bm->numPages, &start, &end);
+        if (start < end){
+            int initializedEnd = (end < mgmtData->numInitializedFrames) ? end : mgmtData->numInitializedFrames;
+            if (initializedEnd > start){
+                int localIndex = scanFindLong(&(mgmtData->framePageNums[start]), initializedEnd - start, NO_PAGE);
+                if (localIndex >= 0){
+                    return start + localIndex;
+                }
+            }
+            if (end > mgmtData->numInitializedFrames){ // the first unused frame of the range, frames below it join the queue empty
+                int frameIndex = (start > mgmtData->numInitializedFrames) ? start : mgmtData->numInitializedFrames;
+                if (frameIndex < end && frameIndex < bm->numPages){
+                    initializeFrames(bm, frameIndex + 1);
+                    return frameIndex;
+                }
+            }
+        }
+    }
+    int frameIndex = scanFindLong(mgmtData->framePageNums, mgmtData->numInitializedFrames, NO_PAGE);
+    if (frameIndex < 0 && mgmtData->numInitializedFrames < bm->numPages){
+        frameIndex = mgmtData->numInitializedFrames;
+        initializeFrames(bm, frameIndex + 1);
+    }
+    return frameIndex;
 }
 
-void updateQueue(int pos, void **queue, int queue_length){
-    void * updatedElement = queue[pos];
-    for(int i = pos; i < queue_length -1; i++){
-        queue[i] = queue[i+1];
+void initializeFrames(BM_BufferPool *const bm, int numFrames){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    for (int i = mgmtData->numInitializedFrames; i < numFrames; i++){
+        mgmtData->framePageNums[i] = NO_PAGE;
+        mgmtData->frameFileIds[i] = BM_DEFAULT_FILE;
+        mgmtData->frameFixCounts[i] = 0;
+        mgmtData->frameDirtyFlags[i] = FALSE;
+        mgmtData->frameAccessCounts[i] = 0;
+        mgmtData->frameLastAccess[i] = 0;
+        mgmtData->frameLsns[i] = 0;
+        mgmtData->strategyBuffer[i] = i; // the queue holds exactly the initialized frames
+    }
+    if (numFrames > mgmtData->numInitializedFrames){
+        mgmtData->numInitializedFrames = numFrames;
     }
-    queue[queue_length-1] = updatedElement;
 }
 
-int getPositionQueue(PageNumber pageNum, BM_FrameInfo **queue, int queue_length){
-    for(int i=0; i < queue_length; i++){
-        if (queue[i]->pageNum == pageNum){
+int findLocalVictim(BM_BufferPool *const bm){
+    BM_PoolAllocationInfo *allocation = &(bm->mgmtData->allocation);
+    if (allocation->numaPolicy != BM_NUMA_PARTITION || allocation->numNumaNodes <= 1){
+        return -1;
+    }
+    int start, end;
+    getNodeFrameRange(allocation, getCurrentNumaNode(), bm->numPages, &start, &end);
+    if (start >= end){ // the pool has no frame on the node, the caller searches the whole queue
+        return -1;
+    }
+    for (int i = 0; i < bm->mgmtData->numInitializedFrames; i++){
+        int frameIndex = bm->mgmtData->strategyBuffer[i];
+        if (bm->mgmtData->frameFixCounts[frameIndex] == 0 && frameIndex >= start && frameIndex < end){
             return i;
         }
     }
     return -1;
+}
 
+// fileId is ignored when emptying the frame
+void setFramePage(BM_BufferPool *const bm, int frameIndex, int fileId, PageNumber pageNum){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (mgmtData->framePageNums[frameIndex] != NO_PAGE){
+        if (mgmtData->pageTable != NULL){
+            pageTableRemove(mgmtData, frameIndex);
+        }
+        mgmtData->numUsedFrames --;
+    }
+    mgmtData->framePageNums[frameIndex] = pageNum;
+    if (pageNum != NO_PAGE){
+        mgmtData->frameFileIds[frameIndex] = fileId;
+        if (mgmtData->pageTable != NULL){
+            pageTableInsert(mgmtData, frameIndex);
+        }
+        mgmtData->numUsedFrames ++;
+    }
 }
 
-int getFrameIndex(BM_BufferPool *const bm, PageNumber pageNum){ 
-    for (int i = 0; i<bm->numPages; i++){
-        if (bm->mgmtData->frameInfoPool[i].pageNum == pageNum){
-            return i;
+void recordGhost(BM_BufferPool *const bm, int frameIndex){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (mgmtData->ghostCapacity == 0){
+        return;
+    }
+    mgmtData->ghostPageNums[mgmtData->ghostNext] = mgmtData->framePageNums[frameIndex];
+    mgmtData->ghostFileIds[mgmtData->ghostNext] = mgmtData->frameFileIds[frameIndex];
+    mgmtData->ghostNext = (mgmtData->ghostNext + 1) % mgmtData->ghostCapacity;
+}
+
+bool ghostListHit(BM_BufferPool *const bm, int fileId, PageNumber pageNum){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    for (int start = 0; start < mgmtData->ghostCapacity; ){
+        int found = scanFindLong(&(mgmtData->ghostPageNums[start]), mgmtData->ghostCapacity - start, pageNum);
+        if (found < 0){
+            return FALSE;
+        }
+        if (mgmtData->ghostFileIds[start + found] == fileId){
+            mgmtData->ghostPageNums[start + found] = NO_PAGE;
+            return TRUE;
+        }
+        start += found + 1;
+    }
+    return FALSE;
+}
+
+RC flushFrame(BM_BufferPool *const bm, int frameIndex){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    if (mgmtData->trace != NULL){
+        traceEvent(mgmtData->trace, BM_TRACE_FLUSH, mgmtData->frameFileIds[frameIndex], mgmtData->framePageNums[frameIndex]);
+    }
+    RC result = forceFrame(bm, frameIndex);
+    if (result == RC_OK){ // a failed write is not a flush
+        mgmtData->stats.numFlushes ++;
+    }
+    return result;
+}
+
+void histogramRecord(BM_Histogram *histogram, long long nanos){
+    if (nanos < 0){
+        nanos = 0;
+    }
+    histogram->counts[histogramBucket(nanos)] ++;
+    histogram->totalCount ++;
+    histogram->totalNanos += nanos;
+    if (nanos > histogram->maxNanos){
+        histogram->maxNanos = nanos;
+    }
+}
+
+// Values from 2^k to 2^(k+1) share BM_HISTOGRAM_SUB_BUCKETS buckets, indexed by the bits following the leading one
+int histogramBucket(long long nanos){
+    if (nanos < BM_HISTOGRAM_SUB_BUCKETS){
+        return (int) nanos;
+    }
+    int shift = 63 - __builtin_clzll((unsigned long long) nanos) - BM_HISTOGRAM_SUB_BUCKET_BITS;
+    return (shift + 1) * BM_HISTOGRAM_SUB_BUCKETS + (int) ((nanos >> shift) - BM_HISTOGRAM_SUB_BUCKETS);
+}
+
+long long histogramBucketValue(int bucket){
+    if (bucket < BM_HISTOGRAM_SUB_BUCKETS){
+        return bucket;
+    }
+    int shift = bucket / BM_HISTOGRAM_SUB_BUCKETS - 1;
+    return (long long) (BM_HISTOGRAM_SUB_BUCKETS + bucket % BM_HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+long long nowNanos(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void rebuildPageTable(BM_BufferPool *const bm){
+    BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+    free(mgmtData->pageTable);
+    mgmtData->pageTable = NULL;
+    mgmtData->pageTableBits = 0;
+    if (bm->numPages <= BM_SCAN_MAX_FRAMES){
+        return;
+    }
+    // At least twice as many slots as frames keeps probe sequences short
+    while ((1 << mgmtData->pageTableBits) < 2 * bm->numPages){
+        mgmtData->pageTableBits ++;
+    }
+    // calloc of a large table maps fresh zero pages, so slots are only committed as pages are inserted
+    mgmtData->pageTable = (int *) calloc(1 << mgmtData->pageTableBits, sizeof(int));
+    for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+        if (mgmtData->framePageNums[i] != NO_PAGE){
+            pageTableInsert(mgmtData, i);
+        }
+    }
+}
+
+// Fibonacci hashing of (fileId, pageNum) packed in 64 bits, keeps the top pageTableBits bits
+static inline int pageTableSlot(BM_BufferPoolManagementInformation *mgmtData, int fileId, PageNumber pageNum){
+    // pages below 2^48 and file ids below 2^16 give distinct keys
+    unsigned long long key = ((unsigned long long) fileId << 48) ^ (unsigned long long) pageNum;
+    return (int) ((key * 11400714819323198485ull) >> (64 - mgmtData->pageTableBits));
+}
+
+static inline int pageTableFrameSlot(BM_BufferPoolManagementInformation *mgmtData, int frameIndex){
+    return pageTableSlot(mgmtData, mgmtData->frameFileIds[frameIndex], mgmtData->framePageNums[frameIndex]);
+}
+
+int pageTableLookup(BM_BufferPoolManagementInformation *mgmtData, int fileId, PageNumber pageNum){
+    int mask = (1 << mgmtData->pageTableBits) - 1;
+    for (int slot = pageTableSlot(mgmtData, fileId, pageNum); mgmtData->pageTable[slot] != 0; slot = (slot + 1) & mask){
+        int frameIndex = mgmtData->pageTable[slot] - 1;
+        if (mgmtData->framePageNums[frameIndex] == pageNum && mgmtData->frameFileIds[frameIndex] == fileId){
+            return frameIndex;
         }
     }
     return -1;
 }
 
-RC forceFrame(BM_BufferPool *const bm, BM_FrameInfo * frameInfo, int frameIndex){
-    bm->mgmtData->numWriteIO ++;
-    frameInfo->isDirty = FALSE;
-    return writeBlock(frameInfo->pageNum, &(bm->mgmtData->fileHandle), &(bm->mgmtData->framePool[frameIndex*PAGE_SIZE]));
-}
\ No newline at end of file
+void pageTableInsert(BM_BufferPoolManagementInformation *mgmtData, int frameIndex){
+    int mask = (1 << mgmtData->pageTableBits) - 1;
+    int slot = pageTableFrameSlot(mgmtData, frameIndex);
+    while (mgmtData->pageTable[slot] != 0){
+        slot = (slot + 1) & mask;
+    }
+    mgmtData->pageTable[slot] = frameIndex + 1;
+}
+
+// Linear probing removal with backward shift, so lookups never need tombstones
+void pageTableRemove(BM_BufferPoolManagementInformation *mgmtData, int frameIndex){
+    int mask = (1 << mgmtData->pageTableBits) - 1;
+    int slot = pageTableFrameSlot(mgmtData, frameIndex);
+    while (mgmtData->pageTable[slot] != frameIndex + 1){
+        slot = (slot + 1) & mask;
+    }
+    int next = (slot + 1) & mask;
+    while (mgmtData->pageTable[next] != 0){
+        int home = pageTableFrameSlot(mgmtData, mgmtData->pageTable[next] - 1);
+        // the entry at next can fill the hole if its home slot is not in the cyclic range (slot, next]
+        if (((next - home) & mask) >= ((next - slot) & mask)){
+            mgmtData->pageTable[slot] = mgmtData->pageTable[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    mgmtData->pageTable[slot] = 0;
+}
+
+void *allocCacheAligned(size_t size){
+    size_t roundedSize = (size + BM_CACHE_LINE_SIZE - 1) / BM_CACHE_LINE_SIZE * BM_CACHE_LINE_SIZE;
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, BM_CACHE_LINE_SIZE, roundedSize) != 0){
+        return NULL;
+    }
+    return ptr;
+}
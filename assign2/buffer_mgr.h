@@ -8,6 +8,12 @@
 #include "dt.h"
 
 #include "storage_mgr.h"
+#include "storage_mgr_backup.h"
+
+#include "buffer_mgr_trace.h"
+#include "log_mgr.h"
+
+#include <pthread.h>
 
 // Replacement Strategies
 typedef enum ReplacementStrategy {
@@ -18,27 +24,169 @@ typedef enum ReplacementStrategy {
 	RS_LRU_K = 4
 } ReplacementStrategy;
 
-// Data Types and Structures
-typedef int PageNumber;
+// Data Types and Structures (PageNumber is 64 bits, see storage_mgr.h)
 #define NO_PAGE -1
 
-typedef struct BM_FrameInfo {
-	PageNumber pageNum;
-	bool isDirty;
+// A pool caches pages of several page files, pages are addressed by (fileId, pageNum).
+// The page file given to initBufferPool (if any) is BM_DEFAULT_FILE, the one used by pinPage
+#define BM_DEFAULT_FILE 0
+
+typedef struct BM_PoolFile {
+	bool registered; // FALSE for a free slot, its fileId is reused by the next registerPageFile
+	SM_FileHandle fileHandle;
+	PageNumber numPages; // fileHandle.totalNumPages plus the new pages not written yet, the file is extended when one is written
+	PageNumber freshPage; // page newFilePage took from the free map while it pins it, loaded without reading (else NO_PAGE)
+	bool defragmenting; // the defragmentation of the pool works on this file (see buffer_mgr_defrag.h)
+} BM_PoolFile;
+
+// Pool configuration
+typedef enum BM_HugePageMode {
+	BM_HUGEPAGES_NONE = 0,
+	BM_HUGEPAGES_TRANSPARENT = 1, // 2MB aligned mapping advised with MADV_HUGEPAGE
+	BM_HUGEPAGES_EXPLICIT = 2 // MAP_HUGETLB from the reserved huge page pool, falls back to transparent
+} BM_HugePageMode;
+
+typedef enum BM_NumaPolicy {
+	BM_NUMA_NONE = 0,
+	BM_NUMA_INTERLEAVE = 1, // frames interleaved page by page over all nodes
+	BM_NUMA_PARTITION = 2 // frames split in one contiguous range per node, eviction prefers the caller's node
+} BM_NumaPolicy;
+
+typedef struct BM_PoolConfig {
+	BM_HugePageMode hugePages;
+	BM_NumaPolicy numaPolicy;
+	int maxNumPages; // address space reserved for resizeBufferPool to grow into, 0 for BM_RESERVE_FACTOR * numPages
+	bool pageChecksums; // enablePageChecksums on the files of the pool, a page read that fails its checksum fails the pin
+	SM_Durability durability; // setDurability on the files of the pool, forceFlushPool syncs them unless the mode is none
+	bool doubleWrite; // enableDoubleWrite on the files of the pool, flushes write SM_DWB_PAGES pages per batch
+	int pageSize; // size of every frame and of the pages of every file of the pool, 0 for the size of the page file
+	// (PAGE_SIZE without one). A pool holds a single page size, registering a file of another size fails
+	bool changeTracking; // enableChangeTracking on the files of the pool, for incremental backups (backupPoolFile)
+} BM_PoolConfig;
+
+#define BM_DEFAULT_POOL_CONFIG { BM_HUGEPAGES_NONE, BM_NUMA_NONE, 0, FALSE, { SM_DURABILITY_NONE, 0, 0 }, FALSE, 0, FALSE }
+
+// Reserving address space is free until frames are touched, so by default a pool can grow 4 times
+#define BM_RESERVE_FACTOR 4
+
+// What the pool actually got, a requested mode the system does not provide falls back to a weaker one
+typedef struct BM_PoolAllocationInfo {
+	BM_HugePageMode hugePages;
+	BM_NumaPolicy numaPolicy;
+	int numNumaNodes;
+	int framesPerNode; // size of each node range for BM_NUMA_PARTITION, kept on resize (see getNodeFrameRange)
+	int reservedFrames; // numPages can grow up to this many frames
+	size_t framePoolBytes; // mapped size of framePool
+	int pageSize; // bytes per frame
+} BM_PoolAllocationInfo;
+
+// Statistics
+// HDR-style latency histogram in nanoseconds: values below BM_HISTOGRAM_SUB_BUCKETS have their own bucket,
+// every power of two above is split in BM_HISTOGRAM_SUB_BUCKETS linear buckets (relative error below 1/8)
+#define BM_HISTOGRAM_SUB_BUCKET_BITS 3
+#define BM_HISTOGRAM_SUB_BUCKETS (1 << BM_HISTOGRAM_SUB_BUCKET_BITS)
+#define BM_HISTOGRAM_BUCKETS ((64 - BM_HISTOGRAM_SUB_BUCKET_BITS + 1) * BM_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct BM_Histogram {
+	long long counts[BM_HISTOGRAM_BUCKETS];
+	long long totalCount;
+	long long totalNanos;
+	long long maxNanos;
+} BM_Histogram;
+
+// One pin in 2^BM_STATS_PIN_SAMPLE_SHIFT per thread is timed, reading the clock on every pin would double the cost of a hit
+#ifndef BM_STATS_PIN_SAMPLE_SHIFT
+#define BM_STATS_PIN_SAMPLE_SHIFT 4
+#endif
+
+// Counters of a pool, updated under its latch (every call already holds it) so they are exact with any number of threads
+typedef struct BM_Stats {
+	long long numPins;
+	long long numHits;
+	long long numMisses;
+	long long numCleanEvictions;
+	long long numDirtyEvictions; // evictions that wrote the page, by pinPage or by shrinking the pool
+	long long numFlushes; // pages written by forcePage, forceFlushPool, forceFlushFile and unregisterPageFile
+	long long numNewPages; // misses on pages past the end of the file or reused by newPage, zeroed and dirty without a read
+	long long numReadIO; // numMisses - numNewPages
+	long long numCheckpointWrites; // pages written by checkpoint steps (see buffer_mgr_checkpoint.h)
+	long long numWriteIO; // numDirtyEvictions + numFlushes + numCheckpointWrites
+	long long numLogFlushes; // page writes that had to flush the log first (write-ahead rule)
+	BM_Histogram pinLatency; // sampled, includes waiting for the latch
+	BM_Histogram readLatency;
+	BM_Histogram writeLatency;
+} BM_Stats;
+
+// Introspection
+// State of one frame, all frames of a snapshot are copied in one pass under the pool latch
+typedef struct BM_FrameSnapshot {
+	PageNumber pageNum; // NO_PAGE for an empty frame
+	int fileId; // -1 for an empty frame
 	int fixCount;
-} BM_FrameInfo;
+	bool dirty;
+	int accessCount; // pins of the page since it was loaded in the frame
+	long long age; // pins of the pool since the last pin of the page
+} BM_FrameSnapshot;
+
+// Aggregate over the frames holding pages of one file, or of one page range of a file
+typedef struct BM_PoolSummary {
+	int fileId;
+	PageNumber firstPage; // first page of the range (0 for a file summary)
+	int numFrames;
+	int numDirty;
+	int numPinned;
+	long long accessCount;
+} BM_PoolSummary;
+
+// Frame metadata is stored as a structure of arrays: every array starts on its own cache line
+// so pin/unpin writes to fixCounts/dirtyFlags never share a line with the pageNums scanned by lookups
+#define BM_CACHE_LINE_SIZE 64
+
+// Pools up to this many frames find pages with a vectorized scan of framePageNums,
+// larger pools maintain a hash page table
+#ifndef BM_SCAN_MAX_FRAMES
+#define BM_SCAN_MAX_FRAMES 16
+#endif
 
 typedef struct BM_BufferPoolManagementInformation {
 	char *framePool; // Contains the data of pages
-	BM_FrameInfo *frameInfoPool; // Contains all the page Handle
-	BM_FrameInfo **strategyBuffer; // Queue for FIFO and LRU
-	SM_FileHandle fileHandle;
-	int numReadIO;
-	int numWriteIO;
+	int pageShift; // Frames are PAGE_SIZE << pageShift bytes (allocation.pageSize), frame i starts at i << log2 of it
+	PageNumber *framePageNums; // Page held by each frame (NO_PAGE if empty), packed for lookup scans
+	int *frameFileIds; // File of the page held by each frame
+	int *frameFixCounts; // Fix count of each frame
+	bool *frameDirtyFlags; // Dirty flag of each frame
+	int *frameAccessCounts; // Pins of the page of each frame since it was loaded
+	long long *frameLastAccess; // accessClock at the last pin of each frame
+	LSN *frameLsns; // LSN of the last log record that changed the page of each frame (markDirtyLSN), 0 if none
+	long long accessClock; // Pins of the pool since init, the clock of frame ages
+	int *strategyBuffer; // Queue of frame indexes for FIFO and LRU, holds the numInitializedFrames first frames
+	int numInitializedFrames; // Frames below it have metadata, the others were never used and are set up on demand
+	int *pageTable; // Open addressing table of frame index + 1 keyed by (fileId, pageNum), 0 is a free slot (NULL when scanning)
+	int pageTableBits; // The page table has 2^pageTableBits slots
+	int numUsedFrames; // Frames holding a page, an empty frame can only exist while it is below numPages
+	BM_PoolAllocationInfo allocation;
+	pthread_mutex_t latch; // Held by every call on the pool, so resizing can run while other threads use it
+	PageNumber *ghostPageNums; // Ring of recently evicted pages (NO_PAGE once hit), see setGhostListSize
+	int *ghostFileIds;
+	int ghostCapacity; // 0 when the ghost list is off
+	int ghostNext; // Slot overwritten by the next eviction
+	int numGhostHits; // Misses on a page of the ghost list, they would have hit with ghostCapacity more frames
+	BM_PoolFile *files; // Indexed by fileId
+	int numFiles; // Slots in files, registered or not
+	bool pageChecksums; // Files registered later get checksums too
+	SM_Durability durability; // and this durability
+	bool doubleWrite; // and a double-write buffer
+	bool changeTracking; // and a change map
+	BM_Stats stats;
+	BM_Trace *trace; // NULL unless startPoolTrace was called
+	LM_Log *log; // NULL unless setPoolLog was called
+	struct BM_Checkpoint *checkpoint; // Current or last checkpoint, NULL before the first beginCheckpoint
+	struct BM_BudgetManager *budget; // Manager that sizes the pool (see buffer_mgr_budget.h), NULL if none
+	struct BM_Defrag *defrag; // Current or last defragmentation, NULL before the first beginDefrag
 } BM_BufferPoolManagementInformation;
 
 typedef struct BM_BufferPool {
-	char *pageFile;
+	char *pageFile; // File of BM_DEFAULT_FILE, NULL if the pool was created without one
 	int numPages;
 	ReplacementStrategy strategy;
 	BM_BufferPoolManagementInformation *mgmtData; // use this one to store the bookkeeping info your buffer
@@ -47,6 +195,7 @@ typedef struct BM_BufferPool {
 
 typedef struct BM_PageHandle {
 	PageNumber pageNum;
+	int fileId; // set by pinPage (BM_DEFAULT_FILE) and pinFilePage
 	char *data;
 } BM_PageHandle;
 
@@ -61,32 +210,106 @@ typedef struct BM_PageHandle {
 RC initBufferPool(BM_BufferPool *const bm, char *const pageFileName, 
 		const int numPages, ReplacementStrategy strategy,
 		void *stratData);
-RC shutdownBufferPool(BM_BufferPool *const bm);
+RC initBufferPoolWithConfig(BM_BufferPool *const bm, char *const pageFileName,
+		const int numPages, ReplacementStrategy strategy,
+		void *stratData, const BM_PoolConfig *config); // config NULL means BM_DEFAULT_POOL_CONFIG
+RC shutdownBufferPool(BM_BufferPool *const bm); // Also unregisters the pool from its budget manager
 RC forceFlushPool(BM_BufferPool *const bm);
+RC resizeBufferPool(BM_BufferPool *const bm, const int newNumPages); // Pinned frames are never moved, fails if one is beyond newNumPages
+// A pool registered in a budget manager is resized by it (resizeBudgetPool), resizeBufferPool fails with RC_BUFFERPOOL_INVALID_SIZE
+int getPoolNumPages(BM_BufferPool *const bm); // numPages read under the latch
+RC setGhostListSize(BM_BufferPool *const bm, const int numEntries); // Remember the last numEntries evicted pages (0 turns it off)
+
+// Buffer Manager Interface Files
+RC registerPageFile(BM_BufferPool *const bm, char *const pageFileName, int *fileId);
+RC unregisterPageFile(BM_BufferPool *const bm, const int fileId); // Writes the dirty pages of the file and drops them, fails if one is pinned
+RC forceFlushFile(BM_BufferPool *const bm, const int fileId);
+RC dropFilePages(BM_BufferPool *const bm, const int fileId); // Discards the pages of the file without writing them, fails if one is pinned
+RC setFileDurability(BM_BufferPool *const bm, const int fileId, const SM_Durability *durability); // See setDurability
+// Writes the dirty pages of the file then backs it up (see storage_mgr_backup.h), the pool waits for the copy.
+// Pages pinned at that time are left dirty, they go to the next backup
+RC backupPoolFile(BM_BufferPool *const bm, const int fileId, char *archiveName, const bool incremental, SM_BackupInfo *info);
+
+// Write-ahead logging: with a log, a page is written only once the log is flushed up to its LSN. markDirtyLSN also
+// stamps the LSN in the last BM_PAGE_LSN_BYTES bytes of the page, so a page read after a crash tells which records
+// it already contains (see openLogScan). Pages that are only marked with markDirty are written as before.
+// In a pool of bigger pages the LSN is at the end of the page too: getPageLSN(data + pageSize - PAGE_SIZE).
+// That trailer is reserved on pages given to markDirtyLSN, their data fits in BM_PAGE_DATA_BYTES(pageSize) bytes.
+// markDirtyLSN checks the trailer still holds the last stamp of the frame (0 or an earlier LSN for a page not stamped
+// since it was read) and fails with RC_PAGE_LSN_TRAILER_IN_USE, without stamping, when the caller wrote over it.
+#define BM_PAGE_LSN_BYTES ((int) sizeof(LSN))
+#define BM_PAGE_LSN_OFFSET (PAGE_SIZE - BM_PAGE_LSN_BYTES)
+#define BM_PAGE_DATA_BYTES(pageSize) ((pageSize) - BM_PAGE_LSN_BYTES)
+RC setPoolLog(BM_BufferPool *const bm, LM_Log *log); // NULL detaches the log, the log outlives the pool
+LSN getPageLSN(const char *pageData); // LSN stamped by markDirtyLSN (garbage in a page never stamped)
 
 // Buffer Manager Interface Access Pages
 RC markDirty (BM_BufferPool *const bm, BM_PageHandle *const page);
 RC unpinPage (BM_BufferPool *const bm, BM_PageHandle *const page);
 RC forcePage (BM_BufferPool *const bm, BM_PageHandle *const page);
+RC markDirtyLSN (BM_BufferPool *const bm, BM_PageHandle *const page, const LSN lsn); // markDirty for a change logged at lsn
 RC pinPage (BM_BufferPool *const bm, BM_PageHandle *const page, 
 		const PageNumber pageNum);
+RC pinFilePage (BM_BufferPool *const bm, BM_PageHandle *const page,
+		const int fileId, const PageNumber pageNum);
+RC newPage (BM_BufferPool *const bm, BM_PageHandle *const page); // Pins a new zeroed page, a free page of the file if any else one at its end
+RC newFilePage (BM_BufferPool *const bm, BM_PageHandle *const page, const int fileId);
+RC deletePage (BM_BufferPool *const bm, const PageNumber pageNum); // Drops the page without writing it and frees it in the page file
+RC deleteFilePage (BM_BufferPool *const bm, const int fileId, const PageNumber pageNum);
 
 // Statistics Interface
 PageNumber *getFrameContents (BM_BufferPool *const bm);
 bool *getDirtyFlags (BM_BufferPool *const bm);
 int *getFixCounts (BM_BufferPool *const bm);
+int *getFrameFileIds (BM_BufferPool *const bm);
 int getNumReadIO (BM_BufferPool *const bm);
 int getNumWriteIO (BM_BufferPool *const bm);
+int getNumGhostHits (BM_BufferPool *const bm);
+RC getPoolStats (BM_BufferPool *const bm, BM_Stats *stats); // Consistent copy of the counters
+RC startPoolTrace (BM_BufferPool *const bm, const char *traceFileName); // Record pins, unpins, dirty marks and flushes (see buffer_mgr_trace.h)
+RC stopPoolTrace (BM_BufferPool *const bm);
+RC resetPoolStats (BM_BufferPool *const bm);
+long long getHistogramPercentile (const BM_Histogram *histogram, double percentile); // Lower bound of the bucket, in nanoseconds
+
+// Introspection without allocation, buffers belong to the caller
+RC getPoolSnapshot (BM_BufferPool *const bm, BM_FrameSnapshot *frames, const int firstFrame, const int maxFrames,
+		int *numFrames); // Frames firstFrame to firstFrame + numFrames - 1, all taken consistently
+RC getFileSummaries (BM_BufferPool *const bm, BM_PoolSummary *summaries, const int maxFiles,
+		int *numSummaries); // summaries[fileId] for every fileId below maxFiles
+RC getPageRangeSummaries (BM_BufferPool *const bm, const int fileId, const int rangeSize, BM_PoolSummary *summaries,
+		const int maxRanges, int *numSummaries); // summaries[r] covers pages r * rangeSize to (r + 1) * rangeSize - 1
+RC getPoolAllocationInfo (BM_BufferPool *const bm, BM_PoolAllocationInfo *info);
 
 // Strategy eviction function
 RC evictFIFO(BM_BufferPool *const bm, BM_PageHandle *page); // Find a page that can be evicted and flush it to disk if necessary 
 RC evictLRU(BM_BufferPool *const bm, BM_PageHandle *page);
+RC evictFromQueue(BM_BufferPool *const bm, BM_PageHandle *page); // Evict the first unpinned frame of strategyBuffer
 
 // Utility
 RC readPageFromDisk(BM_BufferPool *const bm, BM_PageHandle *page);
-int getPositionQueue(PageNumber pageNum, BM_FrameInfo **queue, int queue_length); // Return -1 if no match
-void updateQueue(int pos, void **queue, int queue_length); // Remove and add back the object a index pos
-int getFrameIndex(BM_BufferPool *const bm, PageNumber pageNum); // -1 if page not in buffer
-RC forceFrame (BM_BufferPool *const bm, BM_FrameInfo *frameInfo, int frameIndex);
+RC loadPage(BM_BufferPool *const bm, BM_PageHandle *page, int frameIndex);
+int getPositionQueue(int frameIndex, int *queue, int queue_length); // Return -1 if no match
+void updateQueue(int pos, int *queue, int queue_length); // Remove and add back the object a index pos
+int getFrameIndex(BM_BufferPool *const bm, int fileId, PageNumber pageNum); // -1 if page not in buffer
+RC resizePoolFrames(BM_BufferPool *const bm, const int newNumPages, const bool byBudget); // resizeBufferPool, byBudget for the budget manager
+RC setPoolBudget(BM_BufferPool *const bm, struct BM_BudgetManager *budget, const int maxFrames); // Fails if numPages is above maxFrames, NULL for none
+bool isRegisteredFile(BM_BufferPool *const bm, int fileId);
+RC forceFrame (BM_BufferPool *const bm, int frameIndex);
+RC flushFrame (BM_BufferPool *const bm, int frameIndex); // forceFrame outside of an eviction, counted and traced as a flush
+RC writeFrames(BM_BufferPool *const bm, const int *frames, const int numFrames); // Up to SM_DWB_PAGES frames of one file in one batch, not counted as flushes. The frames are clean only once written
+int findEmptyFrame(BM_BufferPool *const bm); // Prefers the caller's NUMA node, -1 if every frame holds a page
+void initializeFrames(BM_BufferPool *const bm, int numFrames); // Set up frames up to numFrames as empty and append them to the queue
+int findLocalVictim(BM_BufferPool *const bm); // Queue position of the first unpinned frame on the caller's NUMA node, -1 if none or not partitioned
+void setFramePage(BM_BufferPool *const bm, int frameIndex, int fileId, PageNumber pageNum); // Keep the page table in sync with framePageNums
+void recordGhost(BM_BufferPool *const bm, int frameIndex); // Add the page of a frame being evicted to the ghost list
+bool ghostListHit(BM_BufferPool *const bm, int fileId, PageNumber pageNum); // Remove the page from the ghost list, FALSE if it was not there
+void histogramRecord(BM_Histogram *histogram, long long nanos);
+int histogramBucket(long long nanos);
+long long histogramBucketValue(int bucket); // Smallest value counted in the bucket
+void rebuildPageTable(BM_BufferPool *const bm); // Size (or drop) the page table for numPages and insert every buffered page
+int pageTableLookup(BM_BufferPoolManagementInformation *mgmtData, int fileId, PageNumber pageNum); // -1 if page not in table
+void pageTableInsert(BM_BufferPoolManagementInformation *mgmtData, int frameIndex);
+void pageTableRemove(BM_BufferPoolManagementInformation *mgmtData, int frameIndex);
+void *allocCacheAligned(size_t size); // Cache line aligned allocation, size is rounded up to whole lines
 
 #endif
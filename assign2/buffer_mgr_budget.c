@@ -0,0 +1,211 @@
+#include <stdlib.h>
+
+#include "buffer_mgr_budget.h"
+
+// local functions
+static int findBudgetPool (BM_BudgetManager *const mgr, BM_BufferPool *const bm);
+static int usedFrames (BM_BudgetManager *const mgr);
+
+RC
+initBudgetManager (BM_BudgetManager *const mgr, const int totalFrames, const int framesPerStep)
+{
+	if (totalFrames <= 0 || framesPerStep <= 0){
+		THROW(RC_BUFFERPOOL_INVALID_SIZE,"A budget needs frames to give");
+	}
+	mgr->totalFrames = totalFrames;
+	mgr->framesPerStep = framesPerStep;
+	mgr->numPools = 0;
+	pthread_mutex_init(&(mgr->latch), NULL);
+	return RC_OK;
+}
+
+RC
+shutdownBudgetManager (BM_BudgetManager *const mgr)
+{
+	pthread_mutex_lock(&(mgr->latch));
+	for (int i = 0; i < mgr->numPools; i++){
+		setGhostListSize(mgr->pools[i].bm, 0);
+		setPoolBudget(mgr->pools[i].bm, NULL, 0);
+	}
+	mgr->numPools = 0;
+	pthread_mutex_unlock(&(mgr->latch));
+	pthread_mutex_destroy(&(mgr->latch));
+	return RC_OK;
+}
+
+RC
+registerBudgetPool (BM_BudgetManager *const mgr, BM_BufferPool *const bm, const int minFrames)
+{
+	if (bm->mgmtData == NULL){
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+	}
+	pthread_mutex_lock(&(mgr->latch));
+	if (mgr->numPools == BM_BUDGET_MAX_POOLS || findBudgetPool(mgr, bm) >= 0){
+		pthread_mutex_unlock(&(mgr->latch));
+		THROW(RC_BUFFERPOOL_INVALID_SIZE,"Pool already registered or too many pools");
+	}
+	// From now on only the manager resizes the pool
+	RC result = setPoolBudget(bm, mgr, mgr->totalFrames - usedFrames(mgr));
+	if (result == RC_OK){
+		result = setGhostListSize(bm, mgr->framesPerStep);
+		if (result != RC_OK){
+			setPoolBudget(bm, NULL, 0);
+		}
+	}
+	if (result == RC_OK){
+		BM_BudgetPool *pool = &(mgr->pools[mgr->numPools++]);
+		pool->bm = bm;
+		pool->minFrames = (minFrames > 0) ? minFrames : 1;
+		pool->lastGhostHits = getNumGhostHits(bm);
+		pool->gain = 0;
+	}
+	pthread_mutex_unlock(&(mgr->latch));
+	return result;
+}
+
+RC
+unregisterBudgetPool (BM_BudgetManager *const mgr, BM_BufferPool *const bm)
+{
+	pthread_mutex_lock(&(mgr->latch));
+	int index = findBudgetPool(mgr, bm);
+	if (index < 0){
+		pthread_mutex_unlock(&(mgr->latch));
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Pool not registered in the budget");
+	}
+	mgr->pools[index] = mgr->pools[--mgr->numPools];
+	setPoolBudget(bm, NULL, 0);
+	pthread_mutex_unlock(&(mgr->latch));
+	return setGhostListSize(bm, 0);
+}
+
+/* The receiver is the pool with the most ghost hits since the last call. It takes unused frames of the budget first,
+ * then frames of the pool with the fewest ghost hits that can shrink (a pool with pinned pages at its end cannot) */
+RC
+rebalanceBudget (BM_BudgetManager *const mgr, int *framesMoved)
+{
+	*framesMoved = 0;
+	pthread_mutex_lock(&(mgr->latch));
+	int receiver = -1;
+	for (int i = 0; i < mgr->numPools; i++){
+		BM_BudgetPool *pool = &(mgr->pools[i]);
+		int ghostHits = getNumGhostHits(pool->bm);
+		pool->gain = ghostHits - pool->lastGhostHits;
+		pool->lastGhostHits = ghostHits;
+		if (pool->gain > 0 && (receiver < 0 || pool->gain > mgr->pools[receiver].gain)){
+			receiver = i;
+		}
+	}
+	if (receiver < 0){
+		pthread_mutex_unlock(&(mgr->latch));
+		return RC_OK;
+	}
+
+	BM_BufferPool *receiverPool = mgr->pools[receiver].bm;
+	BM_PoolAllocationInfo allocation;
+	getPoolAllocationInfo(receiverPool, &allocation);
+	int receiverPages = getPoolNumPages(receiverPool);
+	int growth = mgr->framesPerStep;
+	if (receiverPages + growth > allocation.reservedFrames){
+		growth = allocation.reservedFrames - receiverPages;
+	}
+	int freeFrames = mgr->totalFrames - usedFrames(mgr);
+	int needed = (growth > freeFrames) ? growth - freeFrames : 0;
+
+	// Donors are tried from the smallest gain up, only pools gaining less than the receiver qualify
+	bool tried[BM_BUDGET_MAX_POOLS] = { FALSE };
+	while (needed > 0){
+		int donor = -1;
+		for (int i = 0; i < mgr->numPools; i++){
+			BM_BudgetPool *pool = &(mgr->pools[i]);
+			if (i == receiver || tried[i] || pool->gain >= mgr->pools[receiver].gain
+					|| getPoolNumPages(pool->bm) - needed < pool->minFrames){
+				continue;
+			}
+			if (donor < 0 || pool->gain < mgr->pools[donor].gain){
+				donor = i;
+			}
+		}
+		if (donor < 0){ // only the frames that were free can be given
+			growth -= needed;
+			break;
+		}
+		tried[donor] = TRUE;
+		BM_BufferPool *donorPool = mgr->pools[donor].bm;
+		if (resizePoolFrames(donorPool, getPoolNumPages(donorPool) - needed, TRUE) == RC_OK){
+			needed = 0;
+		}
+	}
+
+	RC result = RC_OK;
+	if (growth > 0){
+		result = resizePoolFrames(receiverPool, receiverPages + growth, TRUE);
+		if (result == RC_OK){
+			*framesMoved = growth;
+		}
+	}
+	pthread_mutex_unlock(&(mgr->latch));
+	return result;
+}
+
+int
+getBudgetAllocation (BM_BudgetManager *const mgr, BM_BudgetAllocation *allocations, const int maxPools)
+{
+	pthread_mutex_lock(&(mgr->latch));
+	int numPools = mgr->numPools;
+	for (int i = 0; i < numPools && i < maxPools; i++){
+		allocations[i].bm = mgr->pools[i].bm;
+		allocations[i].numPages = getPoolNumPages(mgr->pools[i].bm);
+		allocations[i].gain = mgr->pools[i].gain;
+	}
+	pthread_mutex_unlock(&(mgr->latch));
+	return numPools;
+}
+
+RC
+resizeBudgetPool (BM_BudgetManager *const mgr, BM_BufferPool *const bm, const int newNumPages)
+{
+	pthread_mutex_lock(&(mgr->latch));
+	int index = findBudgetPool(mgr, bm);
+	if (index < 0){
+		pthread_mutex_unlock(&(mgr->latch));
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Pool not registered in the budget");
+	}
+	int numPages = getPoolNumPages(bm);
+	if (newNumPages < mgr->pools[index].minFrames || newNumPages - numPages > mgr->totalFrames - usedFrames(mgr)){
+		pthread_mutex_unlock(&(mgr->latch));
+		THROW(RC_BUFFERPOOL_INVALID_SIZE,"The size does not fit in the frame budget");
+	}
+	RC result = resizePoolFrames(bm, newNumPages, TRUE);
+	pthread_mutex_unlock(&(mgr->latch));
+	return result;
+}
+
+int
+getBudgetFreeFrames (BM_BudgetManager *const mgr)
+{
+	pthread_mutex_lock(&(mgr->latch));
+	int freeFrames = mgr->totalFrames - usedFrames(mgr);
+	pthread_mutex_unlock(&(mgr->latch));
+	return freeFrames;
+}
+
+int
+findBudgetPool (BM_BudgetManager *const mgr, BM_BufferPool *const bm)
+{
+	for (int i = 0; i < mgr->numPools; i++){
+		if (mgr->pools[i].bm == bm){
+			return i;
+		}
+	}
+	return -1;
+}
+
+int
+usedFrames (BM_BudgetManager *const mgr)
+{
+	int frames = 0;
+	for (int i = 0; i < mgr->numPools; i++){
+		frames += getPoolNumPages(mgr->pools[i].bm);
+	}
+	return frames;
+}
@@ -0,0 +1,47 @@
+#ifndef BUFFER_MGR_BUDGET_H
+#define BUFFER_MGR_BUDGET_H
+
+#include "buffer_mgr.h"
+
+/* Frame budget shared by several buffer pools.
+ * The manager owns totalFrames frames, the sum of numPages of its pools never exceeds it: a registered pool is only
+ * resized by the manager (rebalanceBudget, resizeBudgetPool), resizeBufferPool fails for it. The manager reads numPages
+ * under the latch of each pool and keeps its own latch while it resizes, so the sum it checks cannot change meanwhile.
+ * Every pool keeps a ghost list of its last framesPerStep evictions: a miss on a ghost page would have
+ * hit with framesPerStep more frames, so the ghost hits since the last rebalance estimate the gain of a step.
+ * rebalanceBudget moves framesPerStep frames from the pool that gains least to the one that gains most. */
+
+#define BM_BUDGET_MAX_POOLS 64
+
+typedef struct BM_BudgetPool {
+	BM_BufferPool *bm;
+	int minFrames; // never shrunk below this
+	int lastGhostHits; // ghost hits of the pool at the last rebalance
+	int gain; // ghost hits during the last interval
+} BM_BudgetPool;
+
+typedef struct BM_BudgetManager {
+	int totalFrames; // hard cap on the frames of all pools
+	int framesPerStep; // frames moved by one rebalance, also the ghost list size of every pool
+	int numPools;
+	BM_BudgetPool pools[BM_BUDGET_MAX_POOLS];
+	pthread_mutex_t latch;
+} BM_BudgetManager;
+
+// Allocation of one pool as published by getBudgetAllocation
+typedef struct BM_BudgetAllocation {
+	BM_BufferPool *bm;
+	int numPages;
+	int gain;
+} BM_BudgetAllocation;
+
+RC initBudgetManager(BM_BudgetManager *const mgr, const int totalFrames, const int framesPerStep);
+RC shutdownBudgetManager(BM_BudgetManager *const mgr); // Pools stay open, their ghost lists are turned off
+RC registerBudgetPool(BM_BudgetManager *const mgr, BM_BufferPool *const bm, const int minFrames); // Fails if numPages does not fit the budget
+RC unregisterBudgetPool(BM_BudgetManager *const mgr, BM_BufferPool *const bm);
+RC rebalanceBudget(BM_BudgetManager *const mgr, int *framesMoved); // One step, framesMoved is 0 when nothing is worth moving
+RC resizeBudgetPool(BM_BudgetManager *const mgr, BM_BufferPool *const bm, const int newNumPages); // Fails beyond the free frames of the budget or below minFrames
+int getBudgetAllocation(BM_BudgetManager *const mgr, BM_BudgetAllocation *allocations, const int maxPools); // Returns the number of pools
+int getBudgetFreeFrames(BM_BudgetManager *const mgr); // Frames of the budget no pool uses
+
+#endif
@@ -0,0 +1,374 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer_mgr_checkpoint.h"
+
+// A page listed by beginCheckpoint
+typedef struct BM_CheckpointEntry {
+	PageNumber pageNum;
+	int fileId;
+	int retries;
+} BM_CheckpointEntry;
+
+// Pages still to write, a ring so that pinned pages go to the back
+typedef struct BM_Checkpoint {
+	BM_CheckpointConfig config;
+	BM_CheckpointInfo info;
+	long long startNanos;
+	int capacity;
+	int head;
+	int count;
+	BM_CheckpointEntry entries[];
+} BM_Checkpoint;
+
+// local functions
+static RC writeStep (BM_BufferPool *const bm, BM_Checkpoint *checkpoint);
+static RC writeBatch (BM_BufferPool *const bm, BM_Checkpoint *checkpoint, const int *frames,
+		const BM_CheckpointEntry *entries, int numFrames);
+static RC finishCheckpoint (BM_BufferPool *const bm, BM_Checkpoint *checkpoint);
+static RC appendCheckpointRecord (LM_Log *log, BM_CheckpointRecordType type, long long id, LSN beginLsn, LSN *lsn);
+static BM_CheckpointEntry popEntry (BM_Checkpoint *checkpoint);
+static void pushEntry (BM_Checkpoint *checkpoint, BM_CheckpointEntry entry);
+static int compareEntries (const void *a, const void *b);
+static long long monotonicNanos (void);
+static void sleepUntil (long long nanos);
+
+/************************************************************
+ *                    checkpoint                            *
+ ************************************************************/
+RC
+beginCheckpoint (BM_BufferPool *const bm, const BM_CheckpointConfig *config)
+{
+	const BM_CheckpointConfig defaultConfig = { 0, 0, 0 };
+
+	if (bm->mgmtData == NULL){
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+	}
+	if (config == NULL){
+		config = &defaultConfig;
+	}
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+	pthread_mutex_lock(&(mgmtData->latch));
+	BM_Checkpoint *last = mgmtData->checkpoint;
+	if (last != NULL && !last->info.done){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		THROW(RC_CHECKPOINT_IN_PROGRESS,"A checkpoint of the pool is not done");
+	}
+
+	int numPages = 0;
+	for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+		if (mgmtData->framePageNums[i] != NO_PAGE && (mgmtData->frameDirtyFlags[i] || mgmtData->frameFixCounts[i] > 0)){
+			numPages++;
+		}
+	}
+	BM_Checkpoint *checkpoint = (BM_Checkpoint *) malloc(sizeof(BM_Checkpoint) + sizeof(BM_CheckpointEntry) * numPages);
+	if (checkpoint == NULL){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not allocate the checkpoint");
+	}
+	checkpoint->config = *config;
+	if (checkpoint->config.pagesPerStep <= 0){
+		checkpoint->config.pagesPerStep = BM_CHECKPOINT_DEFAULT_STEP;
+	}
+	if (checkpoint->config.pagesPerStep > SM_DWB_PAGES){
+		checkpoint->config.pagesPerStep = SM_DWB_PAGES;
+	}
+	memset(&(checkpoint->info), 0, sizeof(BM_CheckpointInfo));
+	checkpoint->info.id = (last != NULL) ? last->info.id + 1 : 1;
+	checkpoint->info.numPages = numPages;
+	checkpoint->startNanos = monotonicNanos();
+	checkpoint->capacity = numPages;
+	checkpoint->head = 0;
+	checkpoint->count = 0;
+	for (int i = 0; i < mgmtData->numInitializedFrames; i++){
+		if (mgmtData->framePageNums[i] != NO_PAGE && (mgmtData->frameDirtyFlags[i] || mgmtData->frameFixCounts[i] > 0)){
+			BM_CheckpointEntry entry = { mgmtData->framePageNums[i], mgmtData->frameFileIds[i], 0 };
+			checkpoint->entries[checkpoint->count++] = entry;
+		}
+	}
+	// Written in file order, so a batch holds pages of one file and the disk sees them in order
+	qsort(checkpoint->entries, checkpoint->count, sizeof(BM_CheckpointEntry), compareEntries);
+
+	// The list and the record are taken under the latch: a change logged before beginLsn is in a listed page
+	// (it was marked dirty) or in a page on disk, or its page is pinned by the thread that logged it (listed too)
+	if (mgmtData->log != NULL){
+		RC result = appendCheckpointRecord(mgmtData->log, BM_CHECKPOINT_BEGIN, checkpoint->info.id, 0,
+				&(checkpoint->info.beginLsn));
+		if (result != RC_OK){
+			pthread_mutex_unlock(&(mgmtData->latch));
+			free(checkpoint);
+			return result;
+		}
+	}
+	free(last);
+	mgmtData->checkpoint = checkpoint;
+	pthread_mutex_unlock(&(mgmtData->latch));
+	return RC_OK;
+}
+
+RC
+checkpointStep (BM_BufferPool *const bm, BM_CheckpointInfo *info)
+{
+	if (bm->mgmtData == NULL){
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+	}
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+	pthread_mutex_lock(&(mgmtData->latch));
+	BM_Checkpoint *checkpoint = mgmtData->checkpoint;
+	if (checkpoint == NULL){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		THROW(RC_NO_CHECKPOINT,"No checkpoint was begun");
+	}
+	RC result = RC_OK;
+	if (!checkpoint->info.done){
+		long long start = monotonicNanos();
+		result = writeStep(bm, checkpoint);
+		if (result == RC_OK && checkpoint->count == 0){
+			result = finishCheckpoint(bm, checkpoint);
+		}
+		long long end = monotonicNanos();
+		if (end - start > checkpoint->info.maxStepNanos){
+			checkpoint->info.maxStepNanos = end - start;
+		}
+		checkpoint->info.elapsedNanos = end - checkpoint->startNanos;
+	}
+	if (info != NULL){
+		*info = checkpoint->info;
+	}
+	pthread_mutex_unlock(&(mgmtData->latch));
+	return result;
+}
+
+/* Steps start at most once per pagesPerStep / pagesPerSecond seconds. A checkpoint that falls behind its rate
+ * (slow writes) does not catch up with a burst, and a step that only met pinned pages waits BM_CHECKPOINT_RETRY_NANOS */
+RC
+runCheckpoint (BM_BufferPool *const bm, const BM_CheckpointConfig *config, BM_CheckpointInfo *info)
+{
+	BM_CheckpointInfo progress;
+	int pagesPerSecond = (config != NULL) ? config->pagesPerSecond : 0;
+
+	RC result = beginCheckpoint(bm, config);
+	if (result != RC_OK){
+		return result;
+	}
+	memset(&progress, 0, sizeof(progress));
+	long long next = monotonicNanos();
+	for (;;){
+		int written = progress.numWritten;
+		int retries = progress.numRetries;
+		long long now = monotonicNanos();
+		if (next < now){
+			next = now;
+		}
+		result = checkpointStep(bm, &progress);
+		if (result != RC_OK || progress.done){
+			break;
+		}
+		if (pagesPerSecond > 0){
+			next += (progress.numWritten - written) * 1000000000LL / pagesPerSecond;
+		}
+		if (progress.numWritten == written && progress.numRetries > retries){
+			long long retry = monotonicNanos() + BM_CHECKPOINT_RETRY_NANOS;
+			next = (next > retry) ? next : retry;
+		}
+		sleepUntil(next);
+	}
+	if (info != NULL){
+		*info = progress;
+	}
+	return result;
+}
+
+RC
+getCheckpointInfo (BM_BufferPool *const bm, BM_CheckpointInfo *info)
+{
+	if (bm->mgmtData == NULL){
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+	}
+	pthread_mutex_lock(&(bm->mgmtData->latch));
+	BM_Checkpoint *checkpoint = bm->mgmtData->checkpoint;
+	if (checkpoint == NULL){
+		pthread_mutex_unlock(&(bm->mgmtData->latch));
+		THROW(RC_NO_CHECKPOINT,"No checkpoint was begun");
+	}
+	*info = checkpoint->info;
+	if (!info->done){
+		info->elapsedNanos = monotonicNanos() - checkpoint->startNanos;
+	}
+	pthread_mutex_unlock(&(bm->mgmtData->latch));
+	return RC_OK;
+}
+
+/************************************************************
+ *                    steps                                 *
+ ************************************************************/
+// Visits each listed page at most once and writes up to pagesPerStep of them, with the latch held
+RC
+writeStep (BM_BufferPool *const bm, BM_Checkpoint *checkpoint)
+{
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+	int frames[SM_DWB_PAGES];
+	BM_CheckpointEntry entries[SM_DWB_PAGES];
+	int numFrames = 0, numWrites = 0;
+
+	for (int toVisit = checkpoint->count; toVisit > 0 && numWrites < checkpoint->config.pagesPerStep; toVisit--){
+		BM_CheckpointEntry entry = popEntry(checkpoint);
+		int frameIndex = getFrameIndex(bm, entry.fileId, entry.pageNum);
+		if (frameIndex < 0 || (!mgmtData->frameDirtyFlags[frameIndex] && mgmtData->frameFixCounts[frameIndex] == 0)){
+			checkpoint->info.numSkipped++; // an evicted page was written by its eviction
+			continue;
+		}
+		if (mgmtData->frameFixCounts[frameIndex] > 0){
+			checkpoint->info.numRetries++;
+			if (checkpoint->config.maxRetries > 0 && ++entry.retries >= checkpoint->config.maxRetries){
+				checkpoint->info.numAbandoned++;
+			} else {
+				pushEntry(checkpoint, entry);
+			}
+			continue;
+		}
+		if (numFrames > 0 && entries[0].fileId != entry.fileId){
+			RC result = writeBatch(bm, checkpoint, frames, entries, numFrames);
+			if (result != RC_OK){
+				pushEntry(checkpoint, entry);
+				return result;
+			}
+			numFrames = 0;
+		}
+		frames[numFrames] = frameIndex;
+		entries[numFrames++] = entry;
+		numWrites++;
+	}
+	return (numFrames > 0) ? writeBatch(bm, checkpoint, frames, entries, numFrames) : RC_OK;
+}
+
+// Pages of a failed write stay dirty (see writeFrames) and go back to the list, a later step retries them
+RC
+writeBatch (BM_BufferPool *const bm, BM_Checkpoint *checkpoint, const int *frames, const BM_CheckpointEntry *entries,
+		int numFrames)
+{
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+
+	if (mgmtData->trace != NULL){
+		for (int i = 0; i < numFrames; i++){
+			traceEvent(mgmtData->trace, BM_TRACE_FLUSH, entries[i].fileId, entries[i].pageNum);
+		}
+	}
+	PageNumber firstPage = entries[0].pageNum, lastPage = entries[0].pageNum;
+	for (int i = 1; i < numFrames; i++){ // in order, but for pages that were pinned and tried again
+		firstPage = (entries[i].pageNum < firstPage) ? entries[i].pageNum : firstPage;
+		lastPage = (entries[i].pageNum > lastPage) ? entries[i].pageNum : lastPage;
+	}
+	RC result = writeFrames(bm, frames, numFrames);
+	if (result != RC_OK){
+		for (int i = 0; i < numFrames; i++){
+			pushEntry(checkpoint, entries[i]);
+		}
+		return result;
+	}
+	mgmtData->stats.numCheckpointWrites += numFrames;
+	checkpoint->info.numWritten += numFrames;
+	return startWriteback(&(mgmtData->files[entries[0].fileId].fileHandle), firstPage, lastPage);
+}
+
+// Every file is synced whatever its durability mode, then the end record makes the checkpoint usable for recovery
+RC
+finishCheckpoint (BM_BufferPool *const bm, BM_Checkpoint *checkpoint)
+{
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+
+	for (int fileId = 0; fileId < mgmtData->numFiles; fileId++){
+		if (mgmtData->files[fileId].registered){
+			RC result = syncPageFile(&(mgmtData->files[fileId].fileHandle));
+			if (result != RC_OK){
+				return result;
+			}
+		}
+	}
+	if (checkpoint->info.numAbandoned > 0){
+		checkpoint->info.done = TRUE;
+		THROW(RC_BUFFER_WITH_PINNED_PAGES,"Pages of the checkpoint stayed pinned, it has no end record");
+	}
+	if (mgmtData->log != NULL){
+		LSN lsn;
+		RC result = appendCheckpointRecord(mgmtData->log, BM_CHECKPOINT_END, checkpoint->info.id,
+				checkpoint->info.beginLsn, &lsn);
+		if (result == RC_OK){
+			result = flushLog(mgmtData->log, lsn);
+		}
+		if (result != RC_OK){
+			return result;
+		}
+	}
+	checkpoint->info.done = TRUE;
+	return RC_OK;
+}
+
+/************************************************************
+ *                    utility                               *
+ ************************************************************/
+RC
+appendCheckpointRecord (LM_Log *log, BM_CheckpointRecordType type, long long id, LSN beginLsn, LSN *lsn)
+{
+	BM_CheckpointRecord record;
+
+	memset(&record, 0, sizeof(record));
+	record.magic = BM_CHECKPOINT_RECORD_MAGIC;
+	record.type = type;
+	record.id = id;
+	record.beginLsn = beginLsn;
+	return appendLogRecord(log, &record, sizeof(record), lsn);
+}
+
+BM_CheckpointEntry
+popEntry (BM_Checkpoint *checkpoint)
+{
+	BM_CheckpointEntry entry = checkpoint->entries[checkpoint->head];
+
+	checkpoint->head = (checkpoint->head + 1) % checkpoint->capacity;
+	checkpoint->count--;
+	return entry;
+}
+
+// There is always room: the ring only holds entries popped from it
+void
+pushEntry (BM_Checkpoint *checkpoint, BM_CheckpointEntry entry)
+{
+	checkpoint->entries[(checkpoint->head + checkpoint->count) % checkpoint->capacity] = entry;
+	checkpoint->count++;
+}
+
+int
+compareEntries (const void *a, const void *b)
+{
+	const BM_CheckpointEntry *x = (const BM_CheckpointEntry *) a;
+	const BM_CheckpointEntry *y = (const BM_CheckpointEntry *) b;
+
+	if (x->fileId != y->fileId){
+		return (x->fileId < y->fileId) ? -1 : 1;
+	}
+	return (x->pageNum < y->pageNum) ? -1 : (x->pageNum > y->pageNum);
+}
+
+long long
+monotonicNanos (void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void
+sleepUntil (long long nanos)
+{
+	struct timespec deadline;
+
+	deadline.tv_sec = nanos / 1000000000LL;
+	deadline.tv_nsec = nanos % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR){
+		// interrupted by a signal, sleep the rest
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef BUFFER_MGR_CHECKPOINT_H
+#define BUFFER_MGR_CHECKPOINT_H
+
+#include "buffer_mgr.h"
+
+/* Fuzzy checkpoints of a buffer pool.
+ * beginCheckpoint takes the list of the pages that are dirty or pinned at that moment (a pinned page may be changed
+ * before it is marked dirty) and, if the pool has a log, appends a begin record. Pages are then written a few at a time
+ * by checkpointStep, each step holds the pool latch for at most pagesPerStep writes, so pins of other threads wait for
+ * one short step instead of a whole forceFlushPool. A page that is pinned goes to the back of the list and is tried again
+ * by a later step, a page that is already clean (or was evicted, which wrote it) is skipped, and pages dirtied after the
+ * begin are left to the next checkpoint. The step that empties the list syncs every file of the pool and, with a log,
+ * appends and flushes an end record: every change logged before beginLsn is then in the page files.
+ *
+ * runCheckpoint runs a whole checkpoint in the calling thread at pagesPerSecond, sleeping without the latch between
+ * steps. The pages of a step are written in (fileId, pageNum) order and pushed to the disk at once (startWriteback),
+ * so the final sync has little left to wait for. */
+
+#define BM_CHECKPOINT_DEFAULT_STEP 8
+#define BM_CHECKPOINT_RETRY_NANOS 1000000LL // runCheckpoint waits this long after a step that only met pinned pages
+
+typedef struct BM_CheckpointConfig {
+	int pagesPerSecond; // write rate of runCheckpoint, 0 for no limit
+	int pagesPerStep; // writes per latch hold, 0 for BM_CHECKPOINT_DEFAULT_STEP (at most SM_DWB_PAGES)
+	int maxRetries; // a page still pinned after this many tries is abandoned, 0 to wait for it forever
+} BM_CheckpointConfig;
+
+// Progress of the current (or last) checkpoint of a pool
+typedef struct BM_CheckpointInfo {
+	long long id; // checkpoints of the pool are numbered from 1
+	LSN beginLsn; // LSN of the begin record, 0 without a log
+	int numPages; // pages listed by beginCheckpoint
+	int numWritten;
+	int numSkipped; // clean or evicted by the time they were reached
+	int numRetries; // tries that found the page pinned
+	int numAbandoned; // pages given up after maxRetries, the checkpoint then has no end record
+	bool done;
+	long long elapsedNanos; // from beginCheckpoint to the last step (so far while not done)
+	long long maxStepNanos; // longest step, the longest a pin may have waited for the checkpoint
+} BM_CheckpointInfo;
+
+// Begin and end records in the log
+#define BM_CHECKPOINT_RECORD_MAGIC 0x54504B43 // "CKPT"
+
+typedef enum BM_CheckpointRecordType {
+	BM_CHECKPOINT_BEGIN = 0,
+	BM_CHECKPOINT_END = 1
+} BM_CheckpointRecordType;
+
+typedef struct BM_CheckpointRecord {
+	unsigned int magic;
+	int type; // BM_CheckpointRecordType
+	long long id;
+	LSN beginLsn; // 0 in a begin record
+} BM_CheckpointRecord;
+
+RC beginCheckpoint(BM_BufferPool *const bm, const BM_CheckpointConfig *config); // config NULL for the defaults, RC_CHECKPOINT_IN_PROGRESS if one is not done
+RC checkpointStep(BM_BufferPool *const bm, BM_CheckpointInfo *info); // info may be NULL, RC_NO_CHECKPOINT if none was begun
+RC runCheckpoint(BM_BufferPool *const bm, const BM_CheckpointConfig *config, BM_CheckpointInfo *info); // begin and steps until done
+RC getCheckpointInfo(BM_BufferPool *const bm, BM_CheckpointInfo *info); // RC_NO_CHECKPOINT if none was begun
+
+#endif
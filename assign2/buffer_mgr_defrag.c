@@ -0,0 +1,424 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer_mgr_defrag.h"
+
+// Places and the physical pages as the moves left them
+typedef struct BM_Defrag {
+	BM_DefragConfig config;
+	BM_DefragInfo info;
+	long long startNanos;
+	PageNumber *places; // places[i] is the page that goes on physical page i
+	PageNumber next; // first place not reached
+	PageNumber *owners; // owners[physical] is the page a move put there (or found there), -1 for none
+	PageNumber numOwners;
+	PageNumber *freeSlots; // stack of the physical pages left by moves to a place
+	PageNumber numFreeSlots;
+	PageNumber scanHint; // physical pages past the places and before physicalPagesBefore are free from there on
+	PageNumber end; // first physical page past the ones taken by the moves
+} BM_Defrag;
+
+// local functions
+static RC moveStep (BM_BufferPool *const bm, BM_Defrag *defrag);
+static RC movePages (BM_BufferPool *const bm, BM_Defrag *defrag, int numPages, const PageNumber *pageNums,
+		const PageNumber *physicalPages);
+static RC finishDefrag (BM_BufferPool *const bm, BM_Defrag *defrag);
+static PageNumber takeFreeSlot (BM_Defrag *defrag, SM_FileHandle *fHandle, PageNumber batchStart);
+static PageNumber getOwner (BM_Defrag *defrag, PageNumber physicalPage);
+static RC setOwner (BM_Defrag *defrag, PageNumber physicalPage, PageNumber pageNum);
+static long long monotonicNanos (void);
+static void sleepUntil (long long nanos);
+
+/************************************************************
+ *                    defragmentation                       *
+ ************************************************************/
+RC
+beginDefrag (BM_BufferPool *const bm, const int fileId, const PageNumber *order, PageNumber numOrdered,
+		const BM_DefragConfig *config)
+{
+	const BM_DefragConfig defaultConfig = { 0, 0 };
+
+	if (bm->mgmtData == NULL){
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+	}
+	if (config == NULL){
+		config = &defaultConfig;
+	}
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+	pthread_mutex_lock(&(mgmtData->latch));
+	BM_Defrag *last = mgmtData->defrag;
+	if (last != NULL && !last->info.done){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		THROW(RC_DEFRAG_IN_PROGRESS,"A defragmentation of the pool is not done");
+	}
+	if (!isRegisteredFile(bm, fileId)){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		THROW(RC_BUFFERPOOL_INVALID_FILE,"File not registered in the buffer pool");
+	}
+	for (PageNumber i = 0; i < numOrdered; i++){
+		if (order[i] < 0 || order[i] >= mgmtData->files[fileId].numPages){
+			pthread_mutex_unlock(&(mgmtData->latch));
+			THROW(RC_READ_NON_EXISTING_PAGE,"The page do not exist");
+		}
+	}
+	SM_FileHandle *fHandle = &(mgmtData->files[fileId].fileHandle);
+	RC result = enablePageIndirection(fHandle);
+	if (result != RC_OK){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		return result;
+	}
+
+	PageNumber totalNumPages = fHandle->totalNumPages;
+	PageNumber numPhysicalPages = fHandle->mgmtInfo.numPhysicalPages;
+	BM_Defrag *defrag = (BM_Defrag *) malloc(sizeof(BM_Defrag));
+	char *seen = (char *) calloc(totalNumPages + 1, 1);
+	if (defrag != NULL){
+		defrag->places = (PageNumber *) malloc(sizeof(PageNumber) * (totalNumPages + 1));
+		defrag->freeSlots = (PageNumber *) malloc(sizeof(PageNumber) * (totalNumPages + 1));
+		defrag->numOwners = numPhysicalPages + 1;
+		defrag->owners = (PageNumber *) malloc(sizeof(PageNumber) * defrag->numOwners);
+	}
+	if (defrag == NULL || seen == NULL || defrag->places == NULL || defrag->freeSlots == NULL || defrag->owners == NULL){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		freeDefrag(defrag);
+		free(seen);
+		THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not allocate the defragmentation");
+	}
+	defrag->config = *config;
+	if (defrag->config.pagesPerStep <= 0){
+		defrag->config.pagesPerStep = BM_DEFRAG_DEFAULT_STEP;
+	}
+	if (defrag->config.pagesPerStep > BM_DEFRAG_MAX_STEP){
+		defrag->config.pagesPerStep = BM_DEFRAG_MAX_STEP;
+	}
+
+	// The ordered pages first, then the others by page number, pages without a physical page have no place
+	PageNumber numPlaces = 0;
+	for (PageNumber i = 0; i < numOrdered; i++){
+		PageNumber pageNum = order[i];
+		if (pageNum < totalNumPages && !seen[pageNum] && getPhysicalPage(fHandle, pageNum) != SM_NO_PHYSICAL_PAGE){
+			seen[pageNum] = 1;
+			defrag->places[numPlaces++] = pageNum;
+		}
+	}
+	for (PageNumber pageNum = 0; pageNum < totalNumPages; pageNum++){
+		if (!seen[pageNum] && getPhysicalPage(fHandle, pageNum) != SM_NO_PHYSICAL_PAGE){
+			defrag->places[numPlaces++] = pageNum;
+		}
+	}
+	free(seen);
+	for (PageNumber i = 0; i < defrag->numOwners; i++){
+		defrag->owners[i] = -1;
+	}
+	for (PageNumber pageNum = 0; pageNum < totalNumPages; pageNum++){
+		PageNumber physical = getPhysicalPage(fHandle, pageNum);
+		if (physical != SM_NO_PHYSICAL_PAGE){
+			defrag->owners[physical] = pageNum;
+		}
+	}
+	defrag->next = 0;
+	defrag->numFreeSlots = 0;
+	defrag->scanHint = numPlaces;
+	defrag->end = numPhysicalPages;
+	memset(&(defrag->info), 0, sizeof(BM_DefragInfo));
+	defrag->info.fileId = fileId;
+	defrag->info.numPages = numPlaces;
+	defrag->info.physicalPagesBefore = numPhysicalPages;
+	defrag->startNanos = monotonicNanos();
+
+	freeDefrag(last);
+	mgmtData->defrag = defrag;
+	mgmtData->files[fileId].defragmenting = TRUE;
+	pthread_mutex_unlock(&(mgmtData->latch));
+	return RC_OK;
+}
+
+RC
+defragStep (BM_BufferPool *const bm, BM_DefragInfo *info)
+{
+	if (bm->mgmtData == NULL){
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+	}
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+	pthread_mutex_lock(&(mgmtData->latch));
+	BM_Defrag *defrag = mgmtData->defrag;
+	if (defrag == NULL){
+		pthread_mutex_unlock(&(mgmtData->latch));
+		THROW(RC_NO_DEFRAG,"No defragmentation was begun");
+	}
+	RC result = RC_OK;
+	if (!defrag->info.done && !mgmtData->files[defrag->info.fileId].defragmenting){
+		// The file was unregistered, its slot may hold another file by now
+		defrag->info.done = TRUE;
+		RC_message = "The file of the defragmentation left the buffer pool";
+		result = RC_BUFFERPOOL_INVALID_FILE;
+	} else if (!defrag->info.done){
+		long long start = monotonicNanos();
+		result = moveStep(bm, defrag);
+		if (result == RC_OK && defrag->next == defrag->info.numPages){
+			result = finishDefrag(bm, defrag);
+		}
+		long long end = monotonicNanos();
+		if (end - start > defrag->info.maxStepNanos){
+			defrag->info.maxStepNanos = end - start;
+		}
+		defrag->info.elapsedNanos = end - defrag->startNanos;
+	}
+	if (info != NULL){
+		*info = defrag->info;
+	}
+	pthread_mutex_unlock(&(mgmtData->latch));
+	return result;
+}
+
+/* Steps start at most once per pagesPerStep / pagesPerSecond seconds, a step counts the moves to a place and out of
+ * the way of one */
+RC
+runDefrag (BM_BufferPool *const bm, const int fileId, const PageNumber *order, PageNumber numOrdered,
+		const BM_DefragConfig *config, BM_DefragInfo *info)
+{
+	BM_DefragInfo progress;
+	int pagesPerSecond = (config != NULL) ? config->pagesPerSecond : 0;
+
+	RC result = beginDefrag(bm, fileId, order, numOrdered, config);
+	if (result != RC_OK){
+		return result;
+	}
+	memset(&progress, 0, sizeof(progress));
+	long long next = monotonicNanos();
+	for (;;){
+		PageNumber moved = progress.numMoved + progress.numDisplaced;
+		long long now = monotonicNanos();
+		if (next < now){
+			next = now;
+		}
+		result = defragStep(bm, &progress);
+		if (result != RC_OK || progress.done){
+			break;
+		}
+		if (pagesPerSecond > 0){
+			next += (progress.numMoved + progress.numDisplaced - moved) * 1000000000LL / pagesPerSecond;
+		}
+		sleepUntil(next);
+	}
+	if (info != NULL){
+		*info = progress;
+	}
+	return result;
+}
+
+RC
+getDefragInfo (BM_BufferPool *const bm, BM_DefragInfo *info)
+{
+	if (bm->mgmtData == NULL){
+		THROW(RC_BUFFERPOOL_NOT_INITIALIZED,"Buffer not open");
+	}
+	pthread_mutex_lock(&(bm->mgmtData->latch));
+	BM_Defrag *defrag = bm->mgmtData->defrag;
+	if (defrag == NULL){
+		pthread_mutex_unlock(&(bm->mgmtData->latch));
+		THROW(RC_NO_DEFRAG,"No defragmentation was begun");
+	}
+	*info = defrag->info;
+	if (!info->done){
+		info->elapsedNanos = monotonicNanos() - defrag->startNanos;
+	}
+	pthread_mutex_unlock(&(bm->mgmtData->latch));
+	return RC_OK;
+}
+
+void
+freeDefrag (struct BM_Defrag *defrag)
+{
+	if (defrag == NULL){
+		return;
+	}
+	free(defrag->places);
+	free(defrag->owners);
+	free(defrag->freeSlots);
+	free(defrag);
+}
+
+/************************************************************
+ *                    steps                                 *
+ ************************************************************/
+// Takes the next pages that are not at their place, up to pagesPerStep, and moves them there, with the latch held
+RC
+moveStep (BM_BufferPool *const bm, BM_Defrag *defrag)
+{
+	SM_FileHandle *fHandle = &(bm->mgmtData->files[defrag->info.fileId].fileHandle);
+	PageNumber pageNums[BM_DEFRAG_MAX_STEP], targets[BM_DEFRAG_MAX_STEP];
+	PageNumber displaced[BM_DEFRAG_MAX_STEP], slots[BM_DEFRAG_MAX_STEP], oldPages[BM_DEFRAG_MAX_STEP];
+	PageNumber batchStart = defrag->next, next = defrag->next, numPlaced = 0, numSkipped = 0;
+	int numPages = 0, numDisplaced = 0;
+
+	while (next < defrag->info.numPages && numPages < defrag->config.pagesPerStep){
+		PageNumber pageNum = defrag->places[next];
+		PageNumber physical = getPhysicalPage(fHandle, pageNum);
+		if (physical == SM_NO_PHYSICAL_PAGE){
+			numSkipped++; // freed since the begin
+		} else if (physical == next){
+			numPlaced++;
+		} else {
+			pageNums[numPages] = pageNum;
+			targets[numPages++] = next;
+		}
+		next++;
+	}
+
+	// The pages on the places of the batch go past the places first, so each place is free when its page comes
+	for (int i = 0; i < numPages; i++){
+		PageNumber owner = getOwner(defrag, targets[i]);
+		if (owner < 0 || getPhysicalPage(fHandle, owner) != targets[i]){
+			continue; // free, or its page was freed since
+		}
+		displaced[numDisplaced] = owner;
+		slots[numDisplaced] = takeFreeSlot(defrag, fHandle, batchStart);
+		RC result = setOwner(defrag, slots[numDisplaced], owner);
+		if (result != RC_OK){
+			return result;
+		}
+		numDisplaced++;
+	}
+	if (numDisplaced > 0){
+		RC result = movePages(bm, defrag, numDisplaced, displaced, slots);
+		if (result != RC_OK){
+			return result;
+		}
+		defrag->info.numDisplaced += numDisplaced;
+	}
+
+	for (int i = 0; i < numPages; i++){
+		oldPages[i] = getPhysicalPage(fHandle, pageNums[i]);
+	}
+	if (numPages > 0){
+		RC result = movePages(bm, defrag, numPages, pageNums, targets);
+		if (result != RC_OK){
+			return result;
+		}
+	}
+	for (int i = 0; i < numPages; i++){
+		RC result = setOwner(defrag, targets[i], pageNums[i]);
+		if (result != RC_OK){
+			return result;
+		}
+		if (getOwner(defrag, oldPages[i]) == pageNums[i]){
+			defrag->owners[oldPages[i]] = -1;
+			defrag->freeSlots[defrag->numFreeSlots++] = oldPages[i];
+		}
+	}
+	defrag->next = next;
+	defrag->info.numMoved += numPages;
+	defrag->info.numPlaced += numPlaced + numPages;
+	defrag->info.numSkipped += numSkipped;
+	return RC_OK;
+}
+
+// Moves pages to physical pages, with the image of their frame when it is clean and nobody can change it
+RC
+movePages (BM_BufferPool *const bm, BM_Defrag *defrag, int numPages, const PageNumber *pageNums,
+		const PageNumber *physicalPages)
+{
+	BM_BufferPoolManagementInformation *mgmtData = bm->mgmtData;
+	SM_PageHandle images[BM_DEFRAG_MAX_STEP];
+
+	for (int i = 0; i < numPages; i++){
+		int frameIndex = getFrameIndex(bm, defrag->info.fileId, pageNums[i]);
+		images[i] = NULL; // copied in the file
+		if (frameIndex >= 0 && !mgmtData->frameDirtyFlags[frameIndex] && mgmtData->frameFixCounts[frameIndex] == 0){
+			images[i] = mgmtData->framePool + ((size_t) frameIndex << mgmtData->pageShift);
+		}
+	}
+	return relocatePages(&(mgmtData->files[defrag->info.fileId].fileHandle), numPages, pageNums, physicalPages, images);
+}
+
+// The file ends at its last physical page in use, the places and the pages written since the begin
+RC
+finishDefrag (BM_BufferPool *const bm, BM_Defrag *defrag)
+{
+	SM_FileHandle *fHandle = &(bm->mgmtData->files[defrag->info.fileId].fileHandle);
+
+	RC result = truncatePageFile(fHandle);
+	if (result != RC_OK){
+		return result;
+	}
+	defrag->info.physicalPagesAfter = fHandle->mgmtInfo.numPhysicalPages;
+	defrag->info.done = TRUE;
+	bm->mgmtData->files[defrag->info.fileId].defragmenting = FALSE;
+	return RC_OK;
+}
+
+/************************************************************
+ *                    utility                               *
+ ************************************************************/
+/* A free physical page outside the places still to fill: one left by a move, else one past the places that was free
+ * at the begin, else a new one at the end of the file. The storage manager only gives new pages at the end, so a
+ * physical page the defragmentation knows as free stays free */
+PageNumber
+takeFreeSlot (BM_Defrag *defrag, SM_FileHandle *fHandle, PageNumber batchStart)
+{
+	while (defrag->numFreeSlots > 0){
+		PageNumber slot = defrag->freeSlots[--defrag->numFreeSlots];
+		if ((slot < batchStart || slot >= defrag->info.numPages) && getOwner(defrag, slot) < 0){
+			return slot; // a place still to fill is left free for its page
+		}
+	}
+	while (defrag->scanHint < defrag->info.physicalPagesBefore){
+		PageNumber slot = defrag->scanHint++;
+		if (getOwner(defrag, slot) < 0){
+			return slot;
+		}
+	}
+	if (defrag->end < fHandle->mgmtInfo.numPhysicalPages){
+		defrag->end = fHandle->mgmtInfo.numPhysicalPages;
+	}
+	return defrag->end++;
+}
+
+PageNumber
+getOwner (BM_Defrag *defrag, PageNumber physicalPage)
+{
+	return (physicalPage >= 0 && physicalPage < defrag->numOwners) ? defrag->owners[physicalPage] : -1;
+}
+
+RC
+setOwner (BM_Defrag *defrag, PageNumber physicalPage, PageNumber pageNum)
+{
+	if (physicalPage >= defrag->numOwners){
+		PageNumber numOwners = (physicalPage + 1 > 2 * defrag->numOwners) ? physicalPage + 1 : 2 * defrag->numOwners;
+		PageNumber *owners = (PageNumber *) realloc(defrag->owners, sizeof(PageNumber) * numOwners);
+		if (owners == NULL){
+			THROW(RC_BUFFERPOOL_ALLOCATION_FAILED,"Could not grow the physical pages of the defragmentation");
+		}
+		for (PageNumber i = defrag->numOwners; i < numOwners; i++){
+			owners[i] = -1;
+		}
+		defrag->owners = owners;
+		defrag->numOwners = numOwners;
+	}
+	defrag->owners[physicalPage] = pageNum;
+	return RC_OK;
+}
+
+long long
+monotonicNanos (void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void
+sleepUntil (long long nanos)
+{
+	struct timespec deadline;
+
+	deadline.tv_sec = nanos / 1000000000LL;
+	deadline.tv_nsec = nanos % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR){
+		// interrupted by a signal, sleep the rest
+	}
+}
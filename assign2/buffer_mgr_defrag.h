@@ -0,0 +1,55 @@
+#ifndef BUFFER_MGR_DEFRAG_H
+#define BUFFER_MGR_DEFRAG_H
+
+#include "buffer_mgr.h"
+
+/* Online defragmentation of a page file of a buffer pool.
+ * beginDefrag turns page indirection on for the file (see enablePageIndirection) and fixes the physical place of every
+ * page with data: the pages of order first, in that order, then the others by page number, so the i-th of them ends on
+ * physical page i and a scan in that order reads the file front to back. defragStep then moves at most pagesPerStep
+ * pages, each step holds the pool latch like a checkpoint step, so pins of other threads wait for one short step.
+ * A step first moves the pages in the way (on the places of its pages) to free physical pages past the places, then
+ * its pages to their places (relocatePages): a page is on disk at its new place before the map points at it, so a
+ * crash leaves every page at its old or its new place. The image of a clean frame is written as is, the others are
+ * copied in the file; a dirty frame stays dirty and its next write goes to the new place.
+ * Pages freed after the begin are skipped, pages written for the first time after it go past the places. The step
+ * that places the last page truncates the file to the last physical page in use.
+ *
+ * runDefrag runs a whole defragmentation in the calling thread at pagesPerSecond, sleeping without the latch between
+ * steps. A compressed file is refused (RC_NO_PAGE_INDIRECTION): its page map already packs its pages. */
+
+#define BM_DEFRAG_DEFAULT_STEP 16
+#define BM_DEFRAG_MAX_STEP 256
+
+typedef struct BM_DefragConfig {
+	int pagesPerSecond; // moves per second of runDefrag, 0 for no limit
+	int pagesPerStep; // moves per latch hold, 0 for BM_DEFRAG_DEFAULT_STEP (at most BM_DEFRAG_MAX_STEP)
+} BM_DefragConfig;
+
+// Progress of the current (or last) defragmentation of a pool
+typedef struct BM_DefragInfo {
+	int fileId;
+	PageNumber numPages; // pages given a place by beginDefrag
+	PageNumber numPlaced; // pages at their place so far, moved or not
+	PageNumber numMoved; // moves to a place
+	PageNumber numDisplaced; // moves out of the place of another page
+	PageNumber numSkipped; // freed by the time they were reached
+	PageNumber physicalPagesBefore; // physical pages of the file at the begin
+	PageNumber physicalPagesAfter; // and after the truncation, 0 while not done
+	bool done;
+	long long elapsedNanos; // from beginDefrag to the last step (so far while not done)
+	long long maxStepNanos; // longest step, the longest a pin may have waited for the defragmentation
+} BM_DefragInfo;
+
+// order (may be NULL) lists pages to place first, duplicates and pages without data are ignored.
+// config NULL for the defaults, RC_DEFRAG_IN_PROGRESS if one is not done
+RC beginDefrag(BM_BufferPool *const bm, const int fileId, const PageNumber *order, PageNumber numOrdered,
+		const BM_DefragConfig *config);
+RC defragStep(BM_BufferPool *const bm, BM_DefragInfo *info); // info may be NULL, RC_NO_DEFRAG if none was begun
+RC runDefrag(BM_BufferPool *const bm, const int fileId, const PageNumber *order, PageNumber numOrdered,
+		const BM_DefragConfig *config, BM_DefragInfo *info); // begin and steps until done
+RC getDefragInfo(BM_BufferPool *const bm, BM_DefragInfo *info); // RC_NO_DEFRAG if none was begun
+
+void freeDefrag(struct BM_Defrag *defrag); // for shutdownBufferPool
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "buffer_mgr_memory.h"
+
+// local functions
+static char *mapAligned (size_t size, size_t alignment);
+static int bindToNodes (void *addr, size_t size, int mode, unsigned long nodeMask);
+
+char *
+allocFramePool (int numPages, int reservedFrames, int pageSize, const BM_PoolConfig *config, BM_PoolAllocationInfo *allocation)
+{
+	size_t systemPageSize = (size_t) sysconf(_SC_PAGESIZE);
+	size_t bytes = (size_t) pageSize * reservedFrames;
+	char *framePool = MAP_FAILED;
+
+	allocation->hugePages = config->hugePages;
+	allocation->numaPolicy = config->numaPolicy;
+	allocation->numNumaNodes = getNumNumaNodes();
+	allocation->framesPerNode = numPages;
+	allocation->reservedFrames = reservedFrames;
+	allocation->pageSize = pageSize;
+
+	/* Huge pages, explicit ones come from the reserved pool and may not be available.
+	 * They are reserved for the whole mapping (no MAP_NORESERVE) so a fault can never fail with SIGBUS */
+	if (allocation->hugePages != BM_HUGEPAGES_NONE){
+		bytes = (bytes + BM_HUGE_PAGE_SIZE - 1) / BM_HUGE_PAGE_SIZE * BM_HUGE_PAGE_SIZE;
+	}
+	if (allocation->hugePages == BM_HUGEPAGES_EXPLICIT){
+		framePool = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (framePool == MAP_FAILED){
+			allocation->hugePages = BM_HUGEPAGES_TRANSPARENT;
+		}
+	}
+	if (allocation->hugePages == BM_HUGEPAGES_TRANSPARENT){
+		framePool = mapAligned(bytes, BM_HUGE_PAGE_SIZE);
+		if (framePool != MAP_FAILED && madvise(framePool, bytes, MADV_HUGEPAGE) != 0){
+			allocation->hugePages = BM_HUGEPAGES_NONE;
+		}
+	}
+	if (framePool == MAP_FAILED){
+		allocation->hugePages = BM_HUGEPAGES_NONE;
+		bytes = (bytes + systemPageSize - 1) / systemPageSize * systemPageSize;
+		framePool = mapAligned(bytes, systemPageSize);
+		if (framePool == MAP_FAILED){
+			return NULL;
+		}
+	}
+	allocation->framePoolBytes = bytes;
+
+	/* NUMA placement, done before the first touch so the policy decides where pages are faulted in */
+	int numNodes = allocation->numNumaNodes;
+	if (allocation->numaPolicy == BM_NUMA_INTERLEAVE){
+		unsigned long allNodes = (numNodes >= (int) (8 * sizeof(unsigned long))) ? ~0UL : (1UL << numNodes) - 1;
+		if (bindToNodes(framePool, bytes, MPOL_INTERLEAVE, allNodes) != 0){
+			allocation->numaPolicy = BM_NUMA_NONE;
+		}
+	} else if (allocation->numaPolicy == BM_NUMA_PARTITION){
+		/* Node ranges are aligned on the mapping page size so each one can get its own policy,
+		 * the last node also gets the reserved frames the pool may grow into */
+		size_t unit = (allocation->hugePages == BM_HUGEPAGES_NONE) ? systemPageSize : BM_HUGE_PAGE_SIZE;
+		int framesPerUnit = (unit > (size_t) pageSize) ? (int) (unit / pageSize) : 1;
+		int framesPerNode = (numPages + numNodes - 1) / numNodes;
+		framesPerNode = (framesPerNode + framesPerUnit - 1) / framesPerUnit * framesPerUnit;
+		allocation->framesPerNode = framesPerNode;
+		for (int node = 0; node < numNodes && (size_t) node * framesPerNode * pageSize < bytes; node++){
+			size_t start = (size_t) node * framesPerNode * pageSize;
+			size_t length = (size_t) framesPerNode * pageSize;
+			if (node == numNodes - 1 || start + length > bytes){
+				length = bytes - start;
+			}
+			if (bindToNodes(framePool + start, length, MPOL_PREFERRED, 1UL << node) != 0){
+				allocation->numaPolicy = BM_NUMA_NONE;
+				allocation->framesPerNode = numPages;
+				break;
+			}
+		}
+	}
+	return framePool;
+}
+
+void
+freeFramePool (char *framePool, const BM_PoolAllocationInfo *allocation)
+{
+	if (framePool != NULL){
+		munmap(framePool, allocation->framePoolBytes);
+	}
+}
+
+void
+releaseFrames (char *framePool, int firstFrame, int numFrames, int pageSize)
+{
+	if (numFrames > 0){
+		madvise(framePool + (size_t) firstFrame * pageSize, (size_t) numFrames * pageSize, MADV_DONTNEED);
+	}
+}
+
+int
+getNumNumaNodes (void)
+{
+	/* The online node list looks like "0" or "0-1" or "0,2-3", the last id gives the node count */
+	char list[256];
+	FILE *f = fopen("/sys/devices/system/node/online", "r");
+	if (f == NULL){
+		return 1;
+	}
+	size_t length = fread(list, 1, sizeof(list) - 1, f);
+	fclose(f);
+	list[length] = '\0';
+	int end = (int) length;
+	while (end > 0 && (list[end - 1] < '0' || list[end - 1] > '9')){
+		end --;
+	}
+	int start = end;
+	while (start > 0 && list[start - 1] >= '0' && list[start - 1] <= '9'){
+		start --;
+	}
+	if (start == end){
+		return 1;
+	}
+	return atoi(&list[start]) + 1;
+}
+
+int
+getCurrentNumaNode (void)
+{
+	unsigned int cpu = 0;
+	unsigned int node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0){
+		return 0;
+	}
+	return (int) node;
+}
+
+int
+getFrameNumaNode (const BM_PoolAllocationInfo *allocation, int frameIndex)
+{
+	if (allocation->numaPolicy != BM_NUMA_PARTITION){
+		return 0;
+	}
+	int node = frameIndex / allocation->framesPerNode;
+	return (node < allocation->numNumaNodes) ? node : allocation->numNumaNodes - 1;
+}
+
+void
+getNodeFrameRange (const BM_PoolAllocationInfo *allocation, int node, int numPages, int *start, int *end)
+{
+	long long first = (long long) node * allocation->framesPerNode;
+	long long last = (node >= allocation->numNumaNodes - 1) ? numPages : first + allocation->framesPerNode;
+	*start = (first < numPages) ? (int) first : numPages;
+	*end = (last < numPages) ? (int) last : numPages;
+}
+
+// Anonymous mapping whose start is a multiple of alignment, the extra head and tail are unmapped
+char *
+mapAligned (size_t size, size_t alignment)
+{
+	char *raw = mmap(NULL, size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (raw == MAP_FAILED){
+		return MAP_FAILED;
+	}
+	char *aligned = (char *) (((unsigned long) raw + alignment - 1) / alignment * alignment);
+	if (aligned > raw){
+		munmap(raw, aligned - raw);
+	}
+	if (aligned + size < raw + size + alignment){
+		munmap(aligned + size, (raw + size + alignment) - (aligned + size));
+	}
+	return aligned;
+}
+
+// mbind through the raw system call so the pool does not depend on libnuma
+int
+bindToNodes (void *addr, size_t size, int mode, unsigned long nodeMask)
+{
+	return (int) syscall(SYS_mbind, addr, size, mode, &nodeMask, 8 * sizeof(unsigned long), 0);
+}
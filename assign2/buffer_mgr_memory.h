@@ -0,0 +1,25 @@
+#ifndef BUFFER_MGR_MEMORY_H
+#define BUFFER_MGR_MEMORY_H
+
+#include "buffer_mgr.h"
+
+#define BM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Allocation of the frame pool with huge pages and NUMA placement.
+ * Address space is reserved for reservedFrames frames so the pool can grow without moving pinned frames,
+ * memory is only committed when a frame is first touched.
+ * allocation is filled with what was effectively obtained. */
+char *allocFramePool(int numPages, int reservedFrames, int pageSize, const BM_PoolConfig *config, BM_PoolAllocationInfo *allocation);
+void freeFramePool(char *framePool, const BM_PoolAllocationInfo *allocation);
+// Give the memory of frames back to the system, the address space stays reserved
+void releaseFrames(char *framePool, int firstFrame, int numFrames, int pageSize);
+
+// NUMA helpers, a machine without NUMA support is seen as a single node 0
+int getNumNumaNodes(void);
+int getCurrentNumaNode(void);
+int getFrameNumaNode(const BM_PoolAllocationInfo *allocation, int frameIndex);
+// Frames [*start, *end) of the range of node in a pool of numPages frames (the last node also has the frames past the
+// ranges). framesPerNode is fixed at the allocation, so the range is empty when it starts past the last frame
+void getNodeFrameRange(const BM_PoolAllocationInfo *allocation, int node, int numPages, int *start, int *end);
+
+#endif
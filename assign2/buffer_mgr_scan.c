@@ -0,0 +1,263 @@
+#include <pthread.h>
+
+#include "buffer_mgr_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// local functions
+static int scanFindIntScalar (const int *values, int length, int key);
+static int scanFindLongScalar (const long long *values, int length, long long key);
+static int scanFindUnpinnedScalar (const int *queue, const int *fixCounts, int length);
+static void resolveImplementation (void);
+static void useImplementation (ScanImplementation implementation);
+
+// Dispatch pointers, set once by resolveImplementation (pthread_once orders that write before every scan).
+// Only setScanImplementation changes them afterwards
+static pthread_once_t resolveOnce = PTHREAD_ONCE_INIT;
+static int (*findIntImpl) (const int *, int, int) = scanFindIntScalar;
+static int (*findLongImpl) (const long long *, int, long long) = scanFindLongScalar;
+static int (*findUnpinnedImpl) (const int *, const int *, int) = scanFindUnpinnedScalar;
+static ScanImplementation currentImplementation = SCAN_SCALAR;
+
+/************************************************************
+ *                    scalar fallback                       *
+ ************************************************************/
+int
+scanFindIntScalar (const int *values, int length, int key)
+{
+	for (int i = 0; i < length; i++){
+		if (values[i] == key){
+			return i;
+		}
+	}
+	return -1;
+}
+
+int
+scanFindLongScalar (const long long *values, int length, long long key)
+{
+	for (int i = 0; i < length; i++){
+		if (values[i] == key){
+			return i;
+		}
+	}
+	return -1;
+}
+
+int
+scanFindUnpinnedScalar (const int *queue, const int *fixCounts, int length)
+{
+	for (int i = 0; i < length; i++){
+		if (fixCounts[queue[i]] == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+#ifdef SCAN_X86
+/************************************************************
+ *                    SSE2                                  *
+ ************************************************************/
+__attribute__((target("sse2")))
+static int
+scanFindIntSSE2 (const int *values, int length, int key)
+{
+	__m128i needle = _mm_set1_epi32(key);
+	if (length < 4){
+		return scanFindIntScalar(values, length, key);
+	}
+	int i = 0;
+	for (; i + 4 <= length; i += 4){
+		__m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &values[i]), needle);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	if (i < length){ // the last 4 values overlap the ones already compared, so only the new ones can match
+		i = length - 4;
+		__m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &values[i]), needle);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return -1;
+}
+
+// SSE2 has no 64-bit compare: both 32-bit halves must be equal, the mask keeps one bit per 64-bit lane
+__attribute__((target("sse2")))
+static int
+scanFindLongSSE2 (const long long *values, int length, long long key)
+{
+	__m128i needle = _mm_set1_epi64x(key);
+	int i = 0;
+	for (; i + 2 <= length; i += 2){
+		__m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &values[i]), needle);
+		equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(equal));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	if (i < length && values[i] == key){
+		return i;
+	}
+	return -1;
+}
+
+/************************************************************
+ *                    AVX2                                  *
+ ************************************************************/
+__attribute__((target("avx2")))
+static int
+scanFindIntAVX2 (const int *values, int length, int key)
+{
+	__m256i needle = _mm256_set1_epi32(key);
+	if (length < 8){
+		return scanFindIntScalar(values, length, key);
+	}
+	int i = 0;
+	for (; i + 8 <= length; i += 8){
+		__m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &values[i]), needle);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	if (i < length){ // the last 8 values overlap the ones already compared, so only the new ones can match
+		i = length - 8;
+		__m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &values[i]), needle);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return -1;
+}
+
+__attribute__((target("avx2")))
+static int
+scanFindLongAVX2 (const long long *values, int length, long long key)
+{
+	__m256i needle = _mm256_set1_epi64x(key);
+	if (length < 4){
+		return scanFindLongScalar(values, length, key);
+	}
+	int i = 0;
+	for (; i + 4 <= length; i += 4){
+		__m256i equal = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) &values[i]), needle);
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(equal));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	if (i < length){ // the last 4 values overlap the ones already compared, so only the new ones can match
+		i = length - 4;
+		__m256i equal = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) &values[i]), needle);
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(equal));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return -1;
+}
+
+// The fix counts are gathered in queue order so the first unpinned frame of the queue is found
+__attribute__((target("avx2")))
+static int
+scanFindUnpinnedAVX2 (const int *queue, const int *fixCounts, int length)
+{
+	__m256i zero = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 8 <= length; i += 8){
+		__m256i frames = _mm256_loadu_si256((const __m256i *) &queue[i]);
+		__m256i counts = _mm256_i32gather_epi32(fixCounts, frames, 4);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(counts, zero)));
+		if (mask != 0){
+			return i + __builtin_ctz(mask);
+		}
+	}
+	int rest = scanFindUnpinnedScalar(&queue[i], fixCounts, length - i);
+	return (rest < 0) ? -1 : i + rest;
+}
+#endif
+
+/************************************************************
+ *                    dispatch                              *
+ ************************************************************/
+static void
+resolveImplementation (void)
+{
+	ScanImplementation best = SCAN_SCALAR;
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")){
+		best = SCAN_AVX2;
+	} else if (__builtin_cpu_supports("sse2")){
+		best = SCAN_SSE2;
+	}
+#endif
+	useImplementation(best);
+}
+
+int
+scanFindInt (const int *values, int length, int key)
+{
+	pthread_once(&resolveOnce, resolveImplementation);
+	return findIntImpl(values, length, key);
+}
+
+int
+scanFindLong (const long long *values, int length, long long key)
+{
+	pthread_once(&resolveOnce, resolveImplementation);
+	return findLongImpl(values, length, key);
+}
+
+int
+scanFindUnpinned (const int *queue, const int *fixCounts, int length)
+{
+	pthread_once(&resolveOnce, resolveImplementation);
+	return findUnpinnedImpl(queue, fixCounts, length);
+}
+
+ScanImplementation
+getScanImplementation (void)
+{
+	pthread_once(&resolveOnce, resolveImplementation);
+	return currentImplementation;
+}
+
+void
+setScanImplementation (ScanImplementation implementation)
+{
+	pthread_once(&resolveOnce, resolveImplementation);
+	useImplementation(implementation);
+}
+
+void
+useImplementation (ScanImplementation implementation)
+{
+	currentImplementation = SCAN_SCALAR;
+	findIntImpl = scanFindIntScalar;
+	findLongImpl = scanFindLongScalar;
+	findUnpinnedImpl = scanFindUnpinnedScalar;
+#ifdef SCAN_X86
+	if (implementation >= SCAN_SSE2 && __builtin_cpu_supports("sse2")){
+		currentImplementation = SCAN_SSE2;
+		findIntImpl = scanFindIntSSE2;
+		findLongImpl = scanFindLongSSE2;
+	}
+	if (implementation >= SCAN_AVX2 && __builtin_cpu_supports("avx2")){
+		currentImplementation = SCAN_AVX2;
+		findIntImpl = scanFindIntAVX2;
+		findLongImpl = scanFindLongAVX2;
+		findUnpinnedImpl = scanFindUnpinnedAVX2;
+	}
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef BUFFER_MGR_SCAN_H
+#define BUFFER_MGR_SCAN_H
+
+/* Vectorized scans over the frame metadata arrays.
+ * The implementation (AVX2, SSE2 or scalar) is chosen at runtime from the CPU features
+ * the first time a scan is called, once for all threads (pthread_once). */
+
+typedef enum ScanImplementation {
+	SCAN_SCALAR = 0,
+	SCAN_SSE2 = 1,
+	SCAN_AVX2 = 2
+} ScanImplementation;
+
+// Index of the first element equal to key, -1 if none
+int scanFindInt(const int *values, int length, int key);
+int scanFindLong(const long long *values, int length, long long key);
+
+// Position of the first frame of the queue whose fix count is 0, -1 if all are pinned
+int scanFindUnpinned(const int *queue, const int *fixCounts, int length);
+
+// Implementation selected for this CPU
+ScanImplementation getScanImplementation(void);
+
+// Test and benchmark hook: force an implementation, the best supported one below it is used if the CPU lacks the
+// requested instruction set. Not thread safe: call it only while no other thread scans (no pool in use by another
+// thread), the dispatch pointers are written without synchronization
+void setScanImplementation(ScanImplementation implementation);
+
+#endif
@@ -11,52 +11,53 @@ static void printStrat (BM_BufferPool *const bm);
 void 
 printPoolContent (BM_BufferPool *const bm)
 {
-	PageNumber *frameContent;
-	bool *dirty;
-	int *fixCount;
+	BM_FrameSnapshot *frames;
+	int numFrames;
 	int i;
 
-	frameContent = getFrameContents(bm);
-	dirty = getDirtyFlags(bm);
-	fixCount = getFixCounts(bm);
+	frames = (BM_FrameSnapshot *) malloc(sizeof(BM_FrameSnapshot) * bm->numPages);
+	if (getPoolSnapshot(bm, frames, 0, bm->numPages, &numFrames) != RC_OK)
+		numFrames = 0;
 
 	printf("{");
 	printStrat(bm);
 	printf(" %i}: ", bm->numPages);
 
-	for (i = 0; i < bm->numPages; i++)
-		printf("%s[%i%s%i]", ((i == 0) ? "" : ",") , frameContent[i], (dirty[i] ? "x": " "), fixCount[i]);
+	for (i = 0; i < numFrames; i++)
+		printf("%s[%lld%s%i]", ((i == 0) ? "" : ",") , frames[i].pageNum, (frames[i].dirty ? "x": " "), frames[i].fixCount);
 	printf("\n");
+	free(frames);
 }
 
+/* One snapshot gives page, dirty flag and fix count of the same instant */
 char *
 sprintPoolContent (BM_BufferPool *const bm)
 {
-	PageNumber *frameContent;
-	bool *dirty;
-	int *fixCount;
+	BM_FrameSnapshot *frames;
+	int numFrames;
 	int i;
 	char *message;
 	int pos = 0;
 
 	message = (char *) malloc(256 + (22 * bm->numPages));
-	frameContent = getFrameContents(bm);
-	dirty = getDirtyFlags(bm);
-	fixCount = getFixCounts(bm);
+	message[0] = '\0';
+	frames = (BM_FrameSnapshot *) malloc(sizeof(BM_FrameSnapshot) * bm->numPages);
+	if (getPoolSnapshot(bm, frames, 0, bm->numPages, &numFrames) != RC_OK)
+		numFrames = 0;
 
-	for (i = 0; i < bm->numPages; i++)
-		pos += sprintf(message + pos, "%s[%i%s%i]", ((i == 0) ? "" : ",") , frameContent[i], (dirty[i] ? "x": " "), fixCount[i]);
+	for (i = 0; i < numFrames; i++)
+		pos += sprintf(message + pos, "%s[%lld%s%i]", ((i == 0) ? "" : ",") , frames[i].pageNum, (frames[i].dirty ? "x": " "), frames[i].fixCount);
 
+	free(frames);
 	return message;
 }
 
-
 void
 printPageContent (BM_PageHandle *const page)
 {
 	int i;
 
-	printf("[Page %i]\n", page->pageNum);
+	printf("[Page %lld]\n", page->pageNum);
 
 	for (i = 1; i <= PAGE_SIZE; i++)
 		printf("%02X%s%s", page->data[i], (i % 8) ? "" : " ", (i % 64) ? "" : "\n");
@@ -70,7 +71,7 @@ sprintPageContent (BM_PageHandle *const page)
 	int pos = 0;
 
 	message = (char *) malloc(30 + (2 * PAGE_SIZE) + (PAGE_SIZE % 64) + (PAGE_SIZE % 8));
-	pos += sprintf(message + pos, "[Page %i]\n", page->pageNum);
+	pos += sprintf(message + pos, "[Page %lld]\n", page->pageNum);
 
 	for (i = 1; i <= PAGE_SIZE; i++)
 		pos += sprintf(message + pos, "%02X%s%s", page->data[i], (i % 8) ? "" : " ", (i % 64) ? "" : "\n");
@@ -78,6 +79,53 @@ sprintPageContent (BM_PageHandle *const page)
 	return message;
 }
 
+void
+printPoolAllocation (BM_BufferPool *const bm)
+{
+	BM_PoolAllocationInfo info;
+	const char *hugePages[] = { "none", "transparent", "explicit" };
+	const char *numaPolicies[] = { "none", "interleave", "partition" };
+
+	if (getPoolAllocationInfo(bm, &info) != RC_OK)
+		return;
+
+	printf("{");
+	printStrat(bm);
+	printf(" %i}: %zu bytes (%i byte pages), huge pages %s, NUMA %s over %i node(s)", bm->numPages, info.framePoolBytes,
+			info.pageSize, hugePages[info.hugePages], numaPolicies[info.numaPolicy], info.numNumaNodes);
+	if (info.numaPolicy == BM_NUMA_PARTITION)
+		printf(", %i frames per node", info.framesPerNode);
+	printf("\n");
+}
+
+void
+printPoolStats (BM_BufferPool *const bm)
+{
+	BM_Stats stats;
+	const char *names[] = { "pin", "read", "write" };
+
+	if (getPoolStats(bm, &stats) != RC_OK)
+		return;
+
+	printf("{");
+	printStrat(bm);
+	printf(" %i}: %lld pins, %lld hits (%.1f%%), %lld misses, %lld clean and %lld dirty evictions, %lld flushes, %lld new pages, %lld reads, %lld writes (%lld by checkpoints), %lld log flushes\n",
+			bm->numPages, stats.numPins, stats.numHits, (stats.numPins > 0) ? 100.0 * stats.numHits / stats.numPins : 0.0,
+			stats.numMisses, stats.numCleanEvictions, stats.numDirtyEvictions, stats.numFlushes, stats.numNewPages,
+			stats.numReadIO, stats.numWriteIO, stats.numCheckpointWrites, stats.numLogFlushes);
+
+	const BM_Histogram *histograms[] = { &stats.pinLatency, &stats.readLatency, &stats.writeLatency };
+	for (int i = 0; i < 3; i++)
+	{
+		const BM_Histogram *h = histograms[i];
+		if (h->totalCount == 0)
+			continue;
+		printf("  %s latency (ns): count %lld, mean %lld, p50 %lld, p99 %lld, p99.9 %lld, max %lld\n", names[i],
+				h->totalCount, h->totalNanos / h->totalCount, getHistogramPercentile(h, 50), getHistogramPercentile(h, 99),
+				getHistogramPercentile(h, 99.9), h->maxNanos);
+	}
+}
+
 void
 printStrat (BM_BufferPool *const bm)
 {
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "buffer_mgr_trace.h"
+
+BM_Trace *
+openTrace (const char *fileName, int numPages, int strategy)
+{
+	BM_TraceHeader header = { BM_TRACE_MAGIC, BM_TRACE_VERSION, numPages, strategy, 0 };
+	BM_Trace *trace = (BM_Trace *) malloc(sizeof(BM_Trace));
+
+	if (trace == NULL){
+		return NULL;
+	}
+	trace->fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (trace->fd < 0 || write(trace->fd, &header, sizeof(header)) != sizeof(header)){
+		if (trace->fd >= 0){
+			close(trace->fd);
+		}
+		free(trace);
+		return NULL;
+	}
+	trace->numEvents = 0;
+	return trace;
+}
+
+void
+traceEvent (BM_Trace *trace, BM_TraceEventType type, int fileId, long long pageNum)
+{
+	BM_TraceEvent *event = &(trace->buffer[trace->numEvents++]);
+
+	event->type = (uint8_t) type;
+	event->pageHigh = (int8_t) (pageNum >> 32);
+	event->fileId = (uint16_t) fileId;
+	event->pageLow = (uint32_t) pageNum;
+	if (trace->numEvents == BM_TRACE_BUFFER_EVENTS){
+		flushTrace(trace);
+	}
+}
+
+RC
+flushTrace (BM_Trace *trace)
+{
+	size_t bytes = sizeof(BM_TraceEvent) * trace->numEvents;
+
+	trace->numEvents = 0;
+	if (bytes > 0 && write(trace->fd, trace->buffer, bytes) != (ssize_t) bytes){
+		THROW(RC_WRITE_FAILED, "Could not write the trace");
+	}
+	return RC_OK;
+}
+
+RC
+closeTrace (BM_Trace *trace)
+{
+	RC result = flushTrace(trace);
+
+	close(trace->fd);
+	free(trace);
+	return result;
+}
+
+RC
+readTrace (const char *fileName, BM_TraceHeader *header, BM_TraceEvent **events, long long *numEvents)
+{
+	FILE *f = fopen(fileName, "rb");
+	long size;
+
+	if (f == NULL){
+		THROW(RC_FILE_NOT_FOUND, "Trace file not found");
+	}
+	if (fread(header, sizeof(BM_TraceHeader), 1, f) != 1 || header->magic != BM_TRACE_MAGIC
+			|| header->version < 1 || header->version > BM_TRACE_VERSION){
+		fclose(f);
+		THROW(RC_READ_NON_EXISTING_PAGE, "Not a buffer pool trace");
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f) - (long) sizeof(BM_TraceHeader);
+	fseek(f, sizeof(BM_TraceHeader), SEEK_SET);
+
+	*numEvents = size / (long) sizeof(BM_TraceEvent);
+	*events = (BM_TraceEvent *) malloc(sizeof(BM_TraceEvent) * (*numEvents + 1));
+	if (*events == NULL || (long long) fread(*events, sizeof(BM_TraceEvent), *numEvents, f) != *numEvents){
+		free(*events);
+		*events = NULL;
+		fclose(f);
+		THROW(RC_READ_NON_EXISTING_PAGE, "Truncated trace");
+	}
+	fclose(f);
+	return RC_OK;
+}
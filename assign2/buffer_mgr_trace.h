@@ -0,0 +1,61 @@
+#ifndef BUFFER_MGR_TRACE_H
+#define BUFFER_MGR_TRACE_H
+
+#include <stdint.h>
+
+#include "dberror.h"
+
+/* Binary trace of the page accesses of a buffer pool.
+ * A trace file is a BM_TraceHeader followed by 8 byte BM_TraceEvent records in the order the pool handled them.
+ * Events are recorded while the caller holds the pool latch, so the pool buffer needs no synchronization of its own,
+ * it is written to the file when full and when tracing stops. */
+
+#define BM_TRACE_MAGIC 0x45434152544d4240ULL // "@BMTRACE" in little endian
+#define BM_TRACE_VERSION 2 // version 1 had a 32 bit pageNum where pageHigh is, both are read
+#define BM_TRACE_BUFFER_EVENTS 4096
+
+typedef enum BM_TraceEventType {
+	BM_TRACE_PIN_HIT = 0,
+	BM_TRACE_PIN_MISS = 1,
+	BM_TRACE_UNPIN = 2,
+	BM_TRACE_DIRTY = 3,
+	BM_TRACE_FLUSH = 4 // page written by forcePage or a flush, not by an eviction
+} BM_TraceEventType;
+
+typedef struct BM_TraceHeader {
+	uint64_t magic;
+	uint32_t version;
+	int32_t numPages; // size of the pool when tracing started
+	int32_t strategy;
+	int32_t reserved;
+} BM_TraceHeader;
+
+// The page number is split in 40 bits (8 + 32) so events stay 8 bytes, see getTraceEventPage
+typedef struct BM_TraceEvent {
+	uint8_t type;
+	int8_t pageHigh;
+	uint16_t fileId;
+	uint32_t pageLow;
+} BM_TraceEvent;
+
+typedef struct BM_Trace {
+	int fd;
+	int numEvents; // events waiting in buffer
+	BM_TraceEvent buffer[BM_TRACE_BUFFER_EVENTS];
+} BM_Trace;
+
+BM_Trace *openTrace(const char *fileName, int numPages, int strategy); // NULL if the file cannot be created
+void traceEvent(BM_Trace *trace, BM_TraceEventType type, int fileId, long long pageNum);
+RC flushTrace(BM_Trace *trace);
+RC closeTrace(BM_Trace *trace); // Flushes and frees the trace
+
+static inline long long
+getTraceEventPage (const BM_TraceEvent *event)
+{
+	return ((long long) event->pageHigh << 32) | event->pageLow;
+}
+
+// Load a whole trace, events is malloc'd and belongs to the caller
+RC readTrace(const char *fileName, BM_TraceHeader *header, BM_TraceEvent **events, long long *numEvents);
+
+#endif
@@ -14,6 +14,18 @@ typedef int RC;
 #define RC_FILE_HANDLE_NOT_INIT 2
 #define RC_WRITE_FAILED 3
 #define RC_READ_NON_EXISTING_PAGE 4
+#define RC_NO_FREE_PAGE 5
+#define RC_INVALID_FREE_PAGE 6
+#define RC_CHECKSUM_MISMATCH 7
+#define RC_READ_FAILED 8
+#define RC_SYNC_FAILED 9
+#define RC_INVALID_DURABILITY 10
+#define RC_INVALID_PAGE_SIZE 11
+#define RC_NO_CHANGE_TRACKING 12
+#define RC_NO_BASE_BACKUP 13
+#define RC_INVALID_BACKUP 14
+#define RC_BACKUP_CHAIN_BROKEN 15
+#define RC_NO_PAGE_INDIRECTION 16
 
 /* (ADDED) return code for buffer manager */
 #define RC_BUFFER_WITH_PINNED_PAGES 100
@@ -22,6 +34,14 @@ typedef int RC;
 #define RC_FRAME_NOT_FOUND 103
 #define RC_STRATEGY_NOT_IMPLEMENTED 104
 #define RC_BUFFERPOOL_NOT_INITIALIZED 105
+#define RC_BUFFERPOOL_ALLOCATION_FAILED 106
+#define RC_BUFFERPOOL_INVALID_SIZE 107
+#define RC_BUFFERPOOL_INVALID_FILE 108
+#define RC_CHECKPOINT_IN_PROGRESS 109
+#define RC_NO_CHECKPOINT 110
+#define RC_DEFRAG_IN_PROGRESS 111
+#define RC_NO_DEFRAG 112
+#define RC_PAGE_LSN_TRAILER_IN_USE 113
 
 #define RC_RM_COMPARE_VALUE_OF_DIFFERENT_DATATYPE 200
 #define RC_RM_EXPR_RESULT_IS_NOT_BOOLEAN 201
@@ -35,6 +55,12 @@ typedef int RC;
 #define RC_IM_N_TO_LAGE 302
 #define RC_IM_NO_MORE_ENTRIES 303
 
+/* return codes of the log manager */
+#define RC_LOG_INVALID_LSN 400
+#define RC_LOG_END 401
+#define RC_LOG_RECORD_TOO_LARGE 402
+#define RC_LOG_CORRUPTED 403
+
 /* holder for error messages */
 extern char *RC_message;
 
@@ -0,0 +1,285 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log_mgr.h"
+#include "storage_mgr_checksum.h"
+
+#define LM_MAX_RECORD_BYTES (LM_LOG_BUFFER_BYTES - (int) sizeof(LM_RecordHeader))
+
+// local functions
+static uint32_t recordChecksum (uint32_t length, const void *data);
+static RC writeLogBuffer (LM_Log *log, bool sync);
+static RC readRecord (int fd, LSN position, char **record, int *capacity, int *length);
+static RC writeAll (int fd, const char *data, size_t length, off_t offset);
+
+/************************************************************
+ *                    log                                   *
+ ************************************************************/
+RC
+openLog (const char *fileName, LM_Log *log)
+{
+	LM_LogHeader header;
+	struct stat st;
+	int fd = open(fileName, O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0)
+		THROW(RC_FILE_NOT_FOUND, "Could not open the log");
+	if (fstat(fd, &st) != 0){
+		close(fd);
+		THROW(RC_FILE_NOT_FOUND, "Could not open the log");
+	}
+	if (st.st_size == 0){
+		header.magic = LM_LOG_MAGIC;
+		header.version = LM_LOG_VERSION;
+		header.reserved = 0;
+		if (writeAll(fd, (const char *) &header, sizeof(header), 0) != RC_OK || fdatasync(fd) != 0){
+			close(fd);
+			THROW(RC_WRITE_FAILED, "Could not create the log");
+		}
+	} else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != LM_LOG_MAGIC
+			|| header.version != LM_LOG_VERSION){
+		close(fd);
+		THROW(RC_LOG_CORRUPTED, "Not a log file");
+	}
+
+	// The log ends after the last record that reads back whole, a torn one left by a crash is cut off
+	LSN end = sizeof(LM_LogHeader);
+	char *record = NULL;
+	int capacity = 0, length;
+	while (readRecord(fd, end, &record, &capacity, &length) == RC_OK)
+		end += sizeof(LM_RecordHeader) + length;
+	free(record);
+	if (end < st.st_size && (ftruncate(fd, end) != 0 || fdatasync(fd) != 0)){
+		close(fd);
+		THROW(RC_WRITE_FAILED, "Could not cut the torn end of the log");
+	}
+
+	memset(log, 0, sizeof(LM_Log));
+	log->fd = fd;
+	log->buffers[0] = (char *) malloc(LM_LOG_BUFFER_BYTES);
+	log->buffers[1] = (char *) malloc(LM_LOG_BUFFER_BYTES);
+	log->bufferStartLsn = end;
+	log->nextLsn = end;
+	log->writtenLsn = end;
+	log->durableLsn = end;
+	pthread_mutex_init(&(log->latch), NULL);
+	pthread_cond_init(&(log->ioDone), NULL);
+	return RC_OK;
+}
+
+RC
+closeLog (LM_Log *log)
+{
+	RC result = flushLog(log, log->nextLsn);
+
+	close(log->fd);
+	free(log->buffers[0]);
+	free(log->buffers[1]);
+	pthread_mutex_destroy(&(log->latch));
+	pthread_cond_destroy(&(log->ioDone));
+	return result;
+}
+
+RC
+appendLogRecord (LM_Log *log, const void *data, int length, LSN *lsn)
+{
+	LM_RecordHeader header;
+	int recordBytes = sizeof(LM_RecordHeader) + length;
+
+	if (length < 0 || length > LM_MAX_RECORD_BYTES)
+		THROW(RC_LOG_RECORD_TOO_LARGE, "The record does not fit in the log buffer");
+	header.length = (uint32_t) length;
+	header.checksum = recordChecksum(header.length, data);
+	pthread_mutex_lock(&(log->latch));
+	// A full buffer is written (not synced) by the appender, unless a write is already under way
+	while (!log->failed && log->bufferUsed + recordBytes > LM_LOG_BUFFER_BYTES){
+		if (log->ioInProgress)
+			pthread_cond_wait(&(log->ioDone), &(log->latch));
+		else
+			writeLogBuffer(log, FALSE);
+	}
+	if (log->failed){
+		pthread_mutex_unlock(&(log->latch));
+		THROW(RC_WRITE_FAILED, "The log could not be written");
+	}
+	char *target = log->buffers[log->activeBuffer] + log->bufferUsed;
+	memcpy(target, &header, sizeof(header));
+	memcpy(target + sizeof(header), data, length);
+	log->bufferUsed += recordBytes;
+	log->nextLsn += recordBytes;
+	log->stats.numRecords ++;
+	log->stats.numBytes += recordBytes;
+	*lsn = log->nextLsn;
+	pthread_mutex_unlock(&(log->latch));
+	return RC_OK;
+}
+
+RC
+flushLog (LM_Log *log, LSN lsn)
+{
+	pthread_mutex_lock(&(log->latch));
+	if (lsn > log->nextLsn){
+		pthread_mutex_unlock(&(log->latch));
+		THROW(RC_LOG_INVALID_LSN, "The LSN is past the end of the log");
+	}
+	if (log->durableLsn < lsn)
+		log->stats.numFlushRequests ++;
+	// Group commit: while a leader syncs, later requests wait, then one of them syncs everything they appended
+	while (!log->failed && log->durableLsn < lsn){
+		if (log->ioInProgress)
+			pthread_cond_wait(&(log->ioDone), &(log->latch));
+		else
+			writeLogBuffer(log, TRUE);
+	}
+	bool failed = log->failed;
+	pthread_mutex_unlock(&(log->latch));
+	if (failed)
+		THROW(RC_WRITE_FAILED, "The log could not be written");
+	return RC_OK;
+}
+
+LSN
+getDurableLSN (LM_Log *log)
+{
+	pthread_mutex_lock(&(log->latch));
+	LSN lsn = log->durableLsn;
+	pthread_mutex_unlock(&(log->latch));
+	return lsn;
+}
+
+RC
+getLogStats (LM_Log *log, LM_LogStats *stats)
+{
+	pthread_mutex_lock(&(log->latch));
+	*stats = log->stats;
+	pthread_mutex_unlock(&(log->latch));
+	return RC_OK;
+}
+
+// Called with the latch held and no write under way: swaps the buffers and writes the full one without the latch,
+// so records keep being appended to the other. Sync also syncs the file, bytes written before by others included.
+RC
+writeLogBuffer (LM_Log *log, bool sync)
+{
+	char *buffer = log->buffers[log->activeBuffer];
+	int used = log->bufferUsed;
+	LSN start = log->bufferStartLsn;
+
+	log->ioInProgress = TRUE;
+	log->activeBuffer ^= 1;
+	log->bufferUsed = 0;
+	log->bufferStartLsn = start + used;
+	pthread_mutex_unlock(&(log->latch));
+	RC result = (used > 0) ? writeAll(log->fd, buffer, used, start) : RC_OK;
+	if (result == RC_OK && sync && fdatasync(log->fd) != 0)
+		result = RC_WRITE_FAILED;
+	pthread_mutex_lock(&(log->latch));
+	if (result == RC_OK){
+		log->writtenLsn = start + used;
+		log->stats.numWrites += (used > 0);
+		if (sync){
+			log->durableLsn = log->writtenLsn;
+			log->stats.numSyncs ++;
+		}
+	} else {
+		log->failed = TRUE;
+	}
+	log->ioInProgress = FALSE;
+	pthread_cond_broadcast(&(log->ioDone));
+	return result;
+}
+
+/************************************************************
+ *                    scan                                  *
+ ************************************************************/
+RC
+openLogScan (const char *fileName, LSN from, LM_LogScan *scan)
+{
+	LM_LogHeader header;
+
+	scan->fd = open(fileName, O_RDONLY);
+	if (scan->fd < 0)
+		THROW(RC_FILE_NOT_FOUND, "Could not open the log");
+	if (pread(scan->fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != LM_LOG_MAGIC){
+		close(scan->fd);
+		THROW(RC_LOG_CORRUPTED, "Not a log file");
+	}
+	scan->position = sizeof(LM_LogHeader);
+	scan->from = from;
+	scan->record = NULL;
+	scan->capacity = 0;
+	return RC_OK;
+}
+
+RC
+nextLogRecord (LM_LogScan *scan, char **data, int *length, LSN *lsn)
+{
+	for (;;){
+		RC result = readRecord(scan->fd, scan->position, &(scan->record), &(scan->capacity), length);
+		if (result != RC_OK)
+			return result;
+		scan->position += sizeof(LM_RecordHeader) + *length;
+		if (scan->position > scan->from){
+			*data = scan->record;
+			*lsn = scan->position;
+			return RC_OK;
+		}
+	}
+}
+
+RC
+closeLogScan (LM_LogScan *scan)
+{
+	close(scan->fd);
+	free(scan->record);
+	scan->record = NULL;
+	return RC_OK;
+}
+
+/************************************************************
+ *                    utility                               *
+ ************************************************************/
+uint32_t
+recordChecksum (uint32_t length, const void *data)
+{
+	return ~crc32cUpdate(crc32cUpdate(~0u, &length, sizeof(length)), data, length);
+}
+
+// The record at position into *record (grown as needed), RC_LOG_END if there is none or it is torn
+RC
+readRecord (int fd, LSN position, char **record, int *capacity, int *length)
+{
+	LM_RecordHeader header;
+
+	if (pread(fd, &header, sizeof(header), position) != sizeof(header) || header.length > LM_MAX_RECORD_BYTES)
+		return RC_LOG_END;
+	if ((int) header.length > *capacity){
+		char *grown = (char *) realloc(*record, header.length);
+		if (grown == NULL)
+			return RC_LOG_END;
+		*record = grown;
+		*capacity = header.length;
+	}
+	if (pread(fd, *record, header.length, position + sizeof(header)) != (ssize_t) header.length
+			|| recordChecksum(header.length, *record) != header.checksum)
+		return RC_LOG_END;
+	*length = header.length;
+	return RC_OK;
+}
+
+RC
+writeAll (int fd, const char *data, size_t length, off_t offset)
+{
+	while (length > 0){
+		ssize_t written = pwrite(fd, data, length, offset);
+		if (written <= 0)
+			THROW(RC_WRITE_FAILED, "Could not write the log");
+		data += written;
+		length -= written;
+		offset += written;
+	}
+	return RC_OK;
+}
@@ -0,0 +1,82 @@
+#ifndef LOG_MGR_H
+#define LOG_MGR_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "dberror.h"
+#include "dt.h"
+
+/* Write-ahead log.
+ * A log file is an LM_LogHeader followed by records, each an LM_RecordHeader and the caller's bytes. The LSN of a
+ * record is the file offset just past it, so "flushed up to lsn" means every byte before lsn is on disk.
+ * appendLogRecord copies the record in the log buffer, flushLog makes it durable. Concurrent flushes are grouped:
+ * one caller (the leader) writes everything buffered and syncs once while the others wait for it, requests that
+ * arrive during the sync are served together by the next leader. The log has two buffers, records are appended to
+ * one while the other is written. */
+
+#define LM_LOG_MAGIC 0x474f4c4c41574d53ULL // "SMWALLOG" in little endian
+#define LM_LOG_VERSION 1
+#define LM_LOG_BUFFER_BYTES (1 << 20) // each of the two buffers, the largest record fits in one
+
+typedef long long LSN; // 0 is no LSN, below the first record
+
+typedef struct LM_LogHeader {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t reserved;
+} LM_LogHeader;
+
+typedef struct LM_RecordHeader {
+	uint32_t length; // bytes of the record after the header
+	uint32_t checksum; // CRC-32C of the length and the bytes, a torn record ends the log
+} LM_RecordHeader;
+
+typedef struct LM_LogStats {
+	long long numRecords;
+	long long numBytes; // appended, headers included
+	long long numFlushRequests; // flushLog calls that had to wait for the disk
+	long long numWrites; // buffer writes
+	long long numSyncs; // fdatasync, numFlushRequests / numSyncs is the group commit batch size
+} LM_LogStats;
+
+typedef struct LM_Log {
+	int fd;
+	char *buffers[2];
+	int activeBuffer; // records are appended to buffers[activeBuffer]
+	int bufferUsed; // bytes in the active buffer
+	LSN bufferStartLsn; // LSN of the first byte of the active buffer
+	LSN nextLsn; // end of the last record appended
+	LSN writtenLsn; // written to the file
+	LSN durableLsn; // synced
+	bool ioInProgress; // a caller is writing a buffer, the others wait for ioDone
+	bool failed; // a write or sync failed, the records of the buffer are lost and every call fails
+	LM_LogStats stats;
+	pthread_mutex_t latch;
+	pthread_cond_t ioDone;
+} LM_Log;
+
+typedef struct LM_LogScan {
+	int fd;
+	LSN position; // start of the next record
+	LSN from;
+	char *record; // bytes of the last record read, valid until the next call
+	int capacity;
+} LM_LogScan;
+
+// Opens (or creates) a log, a torn record at the end of the file is cut off
+RC openLog(const char *fileName, LM_Log *log);
+RC closeLog(LM_Log *log); // Flushes the log
+
+RC appendLogRecord(LM_Log *log, const void *data, int length, LSN *lsn);
+RC flushLog(LM_Log *log, LSN lsn); // Returns once every record up to lsn is on disk (RC_LOG_INVALID_LSN past the end)
+LSN getDurableLSN(LM_Log *log);
+RC getLogStats(LM_Log *log, LM_LogStats *stats);
+
+// Reading the log (recovery): the records with an LSN above from (0 for all), a page stamped with LSN from
+// already contains the ones below
+RC openLogScan(const char *fileName, LSN from, LM_LogScan *scan);
+RC nextLogRecord(LM_LogScan *scan, char **data, int *length, LSN *lsn); // RC_LOG_END after the last valid record
+RC closeLogScan(LM_LogScan *scan);
+
+#endif
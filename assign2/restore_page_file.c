@@ -0,0 +1,45 @@
+#include "storage_mgr_backup.h"
+#include "dberror.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Restore tool of the archives written by backupPageFile (or backupPoolFile).
+ * Rebuilds the page file from a full archive followed by the incremental archives taken after it, in the order they
+ * were taken. The headers of all the archives are checked and listed first, a broken chain or a corrupted archive
+ * stops the restore and leaves no page file behind.
+ *
+ * usage: restore_page_file <page file> <full archive> [incremental archive ...]
+ *        restore_page_file -l <archive> ...   (lists the archives without restoring) */
+
+int
+main (int argc, char **argv)
+{
+	SM_BackupInfo info;
+	int list = (argc > 1 && argv[1][0] == '-' && argv[1][1] == 'l' && argv[1][2] == '\0');
+
+	if (argc < 3){
+		fprintf(stderr, "usage: %s <page file> <full archive> [incremental archive ...]\n"
+				"       %s -l <archive> ...\n", argv[0], argv[0]);
+		return 1;
+	}
+	printf("archive,base_epoch,epoch,pages,file_pages,bytes\n");
+	for (int i = 2; i < argc; i++){
+		if (readBackupInfo(argv[i], &info) != RC_OK){
+			fprintf(stderr, "%s: %s\n", argv[i], RC_message);
+			return 1;
+		}
+		printf("%s,%lld,%lld,%lld,%lld,%lld\n", argv[i], info.baseEpoch, info.epoch, info.numPages, info.totalNumPages,
+				info.archiveBytes);
+	}
+	if (list)
+		return 0;
+
+	if (restorePageFile(argv[1], argv + 2, argc - 2, &info) != RC_OK){
+		fprintf(stderr, "%s: %s\n", argv[1], RC_message);
+		return 1;
+	}
+	printf("%s restored at epoch %lld, %lld pages, %lld bytes copied in the kernel\n", argv[1], info.epoch,
+			info.totalNumPages, info.copiedBytes);
+	return 0;
+}
@@ -0,0 +1,290 @@
+#include "buffer_mgr.h"
+#include "buffer_mgr_trace.h"
+#include "dberror.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Offline replacement policy simulator.
+ * Replays the pins of a trace recorded with startPoolTrace against every ReplacementStrategy for a range of pool sizes
+ * and prints the miss-ratio curves as CSV. Dirty marks and flushes are replayed too so the writes of dirty evictions
+ * are counted. The simulation never pins pages, any frame can be evicted.
+ *
+ * usage: simulate_trace <trace file> [frames ...]   (default: powers of two up to the number of distinct pages) */
+
+
+typedef struct Access {
+	int page; // compact id of (fileId, pageNum)
+	BM_TraceEventType type; // BM_TRACE_PIN_HIT, BM_TRACE_DIRTY or BM_TRACE_FLUSH (hit and miss are both replayed as pins)
+} Access;
+
+typedef struct Simulation {
+	ReplacementStrategy strategy;
+	int numFrames;
+	int numUsed;
+	int *frameOf; // frame of each page id, -1 if not buffered
+	int *pageOf; // page id of each frame
+	bool *dirty;
+	long long clock;
+	long long misses;
+	long long writes;
+	int hand; // FIFO and CLOCK
+	bool *referenced; // CLOCK
+	long long *keyA; // heap keys (LRU, LFU and LRU-K), the victim is the frame with the smallest (keyA, keyB)
+	long long *keyB;
+	int *heap;
+	int *heapPos;
+} Simulation;
+
+static int loadAccesses (const BM_TraceEvent *events, long long numEvents, Access *accesses, long long *numAccesses);
+static void simulate (ReplacementStrategy strategy, int numFrames, const Access *accesses, long long numAccesses,
+		int numDistinct);
+static void simulateAccess (Simulation *sim, int page);
+static int chooseVictim (Simulation *sim);
+static void setKeys (Simulation *sim, int frame, bool loaded);
+static bool heapLess (Simulation *sim, int i, int j);
+static void heapSwap (Simulation *sim, int i, int j);
+static void heapFix (Simulation *sim, int i);
+
+static const char *strategyNames[] = { "FIFO", "LRU", "CLOCK", "LFU", "LRU-K" };
+
+int
+main (int argc, char **argv)
+{
+	BM_TraceHeader header;
+	BM_TraceEvent *events;
+	long long numEvents, numAccesses;
+
+	if (argc < 2){
+		fprintf(stderr, "usage: %s <trace file> [frames ...]\n", argv[0]);
+		return 1;
+	}
+	if (readTrace(argv[1], &header, &events, &numEvents) != RC_OK){
+		fprintf(stderr, "%s: %s\n", argv[1], RC_message);
+		return 1;
+	}
+	Access *accesses = (Access *) malloc(sizeof(Access) * (numEvents + 1));
+	int numDistinct = loadAccesses(events, numEvents, accesses, &numAccesses);
+	free(events);
+
+	printf("strategy,frames,accesses,misses,miss_ratio,writes\n");
+	for (int strategy = RS_FIFO; strategy <= RS_LRU_K; strategy++){
+		if (argc > 2){
+			for (int i = 2; i < argc; i++)
+				simulate((ReplacementStrategy) strategy, atoi(argv[i]), accesses, numAccesses, numDistinct);
+			continue;
+		}
+		for (int frames = 1; ; frames *= 2){
+			int size = (frames < numDistinct) ? frames : numDistinct;
+			simulate((ReplacementStrategy) strategy, size, accesses, numAccesses, numDistinct);
+			if (size == numDistinct)
+				break;
+		}
+	}
+	free(accesses);
+	return 0;
+}
+
+/* Pages get compact ids through an open addressing table of (fileId, pageNum) keys */
+int
+loadAccesses (const BM_TraceEvent *events, long long numEvents, Access *accesses, long long *numAccesses)
+{
+	int bits = 4;
+	while ((1LL << bits) < 2 * numEvents)
+		bits++;
+	long long mask = (1LL << bits) - 1;
+	unsigned long long *keys = (unsigned long long *) malloc(sizeof(unsigned long long) * (mask + 1));
+	int *ids = (int *) malloc(sizeof(int) * (mask + 1));
+	int numDistinct = 0;
+
+	for (long long i = 0; i <= mask; i++)
+		ids[i] = -1;
+	*numAccesses = 0;
+	for (long long i = 0; i < numEvents; i++){
+		if (events[i].type == BM_TRACE_UNPIN)
+			continue;
+		unsigned long long key = ((unsigned long long) events[i].fileId << 48) ^ (unsigned long long) getTraceEventPage(&events[i]);
+		long long slot = (long long) ((key * 11400714819323198485ull) >> (64 - bits));
+		while (ids[slot] >= 0 && keys[slot] != key)
+			slot = (slot + 1) & mask;
+		if (ids[slot] < 0){
+			keys[slot] = key;
+			ids[slot] = numDistinct++;
+		}
+		Access *a = &accesses[(*numAccesses)++];
+		a->page = ids[slot];
+		a->type = (events[i].type == BM_TRACE_PIN_MISS) ? BM_TRACE_PIN_HIT : (BM_TraceEventType) events[i].type;
+	}
+	free(keys);
+	free(ids);
+	return numDistinct;
+}
+
+void
+simulate (ReplacementStrategy strategy, int numFrames, const Access *accesses, long long numAccesses, int numDistinct)
+{
+	Simulation sim;
+	long long pins = 0;
+
+	if (numFrames <= 0)
+		return;
+	memset(&sim, 0, sizeof(sim));
+	sim.strategy = strategy;
+	sim.numFrames = numFrames;
+	sim.frameOf = (int *) malloc(sizeof(int) * numDistinct);
+	sim.pageOf = (int *) malloc(sizeof(int) * numFrames);
+	sim.dirty = (bool *) calloc(numFrames, sizeof(bool));
+	sim.referenced = (bool *) calloc(numFrames, sizeof(bool));
+	sim.keyA = (long long *) malloc(sizeof(long long) * numFrames);
+	sim.keyB = (long long *) malloc(sizeof(long long) * numFrames);
+	sim.heap = (int *) malloc(sizeof(int) * numFrames);
+	sim.heapPos = (int *) malloc(sizeof(int) * numFrames);
+	for (int i = 0; i < numDistinct; i++)
+		sim.frameOf[i] = -1;
+
+	for (long long i = 0; i < numAccesses; i++){
+		int frame = sim.frameOf[accesses[i].page];
+		switch (accesses[i].type){
+		case BM_TRACE_DIRTY:
+			if (frame >= 0)
+				sim.dirty[frame] = TRUE;
+			break;
+		case BM_TRACE_FLUSH:
+			if (frame >= 0 && sim.dirty[frame]){
+				sim.dirty[frame] = FALSE;
+				sim.writes++;
+			}
+			break;
+		default:
+			simulateAccess(&sim, accesses[i].page);
+			pins++;
+		}
+	}
+	printf("%s,%i,%lld,%lld,%.6f,%lld\n", strategyNames[strategy], numFrames, pins, sim.misses,
+			(pins > 0) ? (double) sim.misses / pins : 0.0, sim.writes);
+
+	free(sim.frameOf);
+	free(sim.pageOf);
+	free(sim.dirty);
+	free(sim.referenced);
+	free(sim.keyA);
+	free(sim.keyB);
+	free(sim.heap);
+	free(sim.heapPos);
+}
+
+void
+simulateAccess (Simulation *sim, int page)
+{
+	int frame = sim->frameOf[page];
+
+	sim->clock++;
+	if (frame >= 0){
+		setKeys(sim, frame, FALSE);
+		return;
+	}
+	sim->misses++;
+	if (sim->numUsed < sim->numFrames){
+		frame = sim->numUsed++;
+		sim->heap[frame] = frame;
+		sim->heapPos[frame] = frame;
+	} else {
+		frame = chooseVictim(sim);
+		if (sim->dirty[frame])
+			sim->writes++;
+		sim->frameOf[sim->pageOf[frame]] = -1;
+	}
+	sim->pageOf[frame] = page;
+	sim->frameOf[page] = frame;
+	sim->dirty[frame] = FALSE;
+	setKeys(sim, frame, TRUE);
+}
+
+int
+chooseVictim (Simulation *sim)
+{
+	int victim;
+
+	switch (sim->strategy){
+	case RS_FIFO: // frames are filled in order, so the oldest page is always the next one round-robin
+		victim = sim->hand;
+		sim->hand = (sim->hand + 1) % sim->numFrames;
+		return victim;
+	case RS_CLOCK:
+		while (sim->referenced[sim->hand]){
+			sim->referenced[sim->hand] = FALSE;
+			sim->hand = (sim->hand + 1) % sim->numFrames;
+		}
+		victim = sim->hand;
+		sim->hand = (sim->hand + 1) % sim->numFrames;
+		return victim;
+	default:
+		return sim->heap[0];
+	}
+}
+
+/* LRU orders by last access, LFU by pins since loaded then last access,
+ * LRU-K by the K-th last access (-1 while the page has fewer accesses) then last access */
+void
+setKeys (Simulation *sim, int frame, bool loaded)
+{
+	switch (sim->strategy){
+	case RS_CLOCK:
+		sim->referenced[frame] = TRUE;
+		return;
+	case RS_FIFO:
+		return;
+	case RS_LRU:
+		sim->keyA[frame] = sim->clock;
+		sim->keyB[frame] = 0;
+		break;
+	case RS_LFU:
+		sim->keyA[frame] = loaded ? 1 : sim->keyA[frame] + 1;
+		sim->keyB[frame] = sim->clock;
+		break;
+	default: // RS_LRU_K with K = 2
+		sim->keyA[frame] = loaded ? -1 : sim->keyB[frame];
+		sim->keyB[frame] = sim->clock;
+		break;
+	}
+	heapFix(sim, sim->heapPos[frame]);
+}
+
+bool
+heapLess (Simulation *sim, int i, int j)
+{
+	int a = sim->heap[i], b = sim->heap[j];
+	return sim->keyA[a] < sim->keyA[b] || (sim->keyA[a] == sim->keyA[b] && sim->keyB[a] < sim->keyB[b]);
+}
+
+void
+heapSwap (Simulation *sim, int i, int j)
+{
+	int frame = sim->heap[i];
+	sim->heap[i] = sim->heap[j];
+	sim->heap[j] = frame;
+	sim->heapPos[sim->heap[i]] = i;
+	sim->heapPos[sim->heap[j]] = j;
+}
+
+// Restore the heap after the keys of heap[i] changed, only the first numUsed entries are in the heap
+void
+heapFix (Simulation *sim, int i)
+{
+	while (i > 0 && heapLess(sim, i, (i - 1) / 2)){
+		heapSwap(sim, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	for (;;){
+		int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+		if (left < sim->numUsed && heapLess(sim, left, smallest))
+			smallest = left;
+		if (right < sim->numUsed && heapLess(sim, right, smallest))
+			smallest = right;
+		if (smallest == i)
+			return;
+		heapSwap(sim, i, smallest);
+		i = smallest;
+	}
+}
@@ -1,32 +1,136 @@
+#define _GNU_SOURCE // sync_file_range, fallocate
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "dberror.h"
 #include "storage_mgr.h"
+#include "storage_mgr_checksum.h"
+#include "storage_mgr_compress.h"
+
+#define SM_SIDECAR_GROWTH 1024 // sidecar mappings grow by at least this many pages
+
+/* local functions */
+static RC writeFreeMap (SM_FileHandle *fHandle, int sync);
+static RC reuseFreePage (SM_FileHandle *fHandle, PageNumber pageNum);
+static RC createFile (char *fileName, int flags);
+static RC writeDescriptor (FILE *f, PageNumber totalNumPages, const unsigned char *freeMap, int flags);
+static unsigned int freeMapChecksum (const unsigned char *freeMap, int length);
+static char *sidecarFileName (const char *fileName, const char *suffix);
+static RC openSidecar (SM_FileHandle *fHandle, const char *suffix, int create, PageNumber minEntries, int *fd,
+        void **mapping, PageNumber *capacity, size_t entrySize);
+static RC growSidecar (int fd, void **mapping, PageNumber *capacity, PageNumber pageNum, size_t entrySize);
+static void closeSidecar (int *fd, void **mapping, PageNumber *capacity, size_t entrySize);
+static unsigned int pageChecksum (const char *memPage, int pageSize);
+static RC readCompressedPage (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
+static RC writeCompressedPage (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
+static RC writePageCount (SM_FileHandle *fHandle);
+static RC notePageWrite (SM_FileHandle *fHandle);
+static long long monotonicNanos (void);
+static RC writePage (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
+static RC writeDoubleWriteBatch (SM_FileHandle *fHandle, int numPages, const PageNumber *pageNums, SM_PageHandle *pages);
+static RC repairFromDoubleWrite (SM_FileHandle *fHandle);
+static RC markChanged (SM_FileHandle *fHandle, PageNumber pageNum);
+static inline PageNumber changeMapBytes (PageNumber numPages);
+static int punchPage (SM_FileHandle *fHandle, PageNumber physicalPage);
+static RC setPhysicalPage (SM_FileHandle *fHandle, PageNumber pageNum, PageNumber physicalPage);
+static inline int isZeroPage (const char *memPage, int pageSize);
+
+/* Zeros for new pages, of every page size */
+static const char zeroPage[SM_MAX_PAGE_SIZE];
+
+/* 64 bit offset of a page, pageNum * pageSize overflows an int past 512K pages */
+static inline off_t pageOffset (const SM_FileHandle *fHandle, PageNumber pageNum){
+    return (off_t) ACCESSIBLE_PAGE_OFFSET + (off_t) pageNum * fHandle->pageSize;
+}
+
+/* Physical page of a page (its offset is pageOffset of it), SM_NO_PHYSICAL_PAGE if it has none */
+static inline PageNumber physicalPage (const SM_FileHandle *fHandle, PageNumber pageNum){
+    const SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->indirectionFd < 0 || pageNum >= info->indirectionCapacity || info->indirection[pageNum] == 0){
+        return pageNum;
+    }
+    return (info->indirection[pageNum] < 0) ? SM_NO_PHYSICAL_PAGE : info->indirection[pageNum] - 1;
+}
 
 /* manipulating page files */
 void initStorageManager (void){};
 
 RC createPageFile (char *fileName){
-    int init_page_number = INIT_PAGE_NUMBER;
+    return createFile(fileName, 0);
+}
+
+RC createCompressedPageFile (char *fileName){
+    return createFile(fileName, SM_FLAG_COMPRESSED);
+}
+
+RC createPageFileWithPageSize (char *fileName, int pageSize){
+    int shift = 0;
+    while ((PAGE_SIZE << shift) < pageSize && shift < SM_MAX_PAGE_SHIFT){
+        shift ++;
+    }
+    if ((PAGE_SIZE << shift) != pageSize){
+        THROW(RC_INVALID_PAGE_SIZE, "The page size must be PAGE_SIZE times a power of two up to SM_MAX_PAGE_SIZE");
+    }
+    return createFile(fileName, shift << SM_FLAG_PAGE_SHIFT);
+}
+
+RC createFile (char *fileName, int flags){
+    int pageSize = PAGE_SIZE << SM_PAGE_SHIFT_OF_FLAGS(flags);
     FILE *f = fopen(fileName,"wb");
     if (f == NULL){
         THROW(RC_FILE_NOT_FOUND, "The File could not be created\n");
     };
-    /* We reserve a page sized zone at the start of the file for information like totalNumPages */
-    fwrite(&init_page_number, sizeof(int), 1, f);
-    /* We init the rest of the descriptor page and the first useable page with '/0' */
-    for(int i = 0; i < (INIT_PAGE_NUMBER * PAGE_SIZE) + (DESCRIPTOR_PAGE_NUMBER * PAGE_SIZE - sizeof(int)); i++){
-        char empty = '\0';
-        fwrite(&empty,sizeof(char),1,f);
+    /* Sidecars of a previous file with the same name would not match the new pages */
+    char *sidecar = sidecarFileName(fileName, SM_CHECKSUM_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_DOUBLE_WRITE_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_CHANGE_MAP_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_INDIRECTION_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_PAGE_MAP_SUFFIX);
+    unlink(sidecar);
+    if (flags & SM_FLAG_COMPRESSED){ // every page starts without slot
+        int fd = open(sidecar, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0){
+            free(sidecar);
+            fclose(f);
+            THROW(RC_FILE_NOT_FOUND, "The page map could not be created");
+        }
+        close(fd);
+    }
+    free(sidecar);
+    /* We reserve a page sized zone at the start of the file for information like totalNumPages, an empty free map */
+    RC result = writeDescriptor(f, INIT_PAGE_NUMBER, (const unsigned char *) zeroPage, flags);
+    /* The first useable pages are holes that read as '/0' (a compressed page without slot already reads as zeros) */
+    if (result == RC_OK && !(flags & SM_FLAG_COMPRESSED)
+            && (fflush(f) != 0 || ftruncate(fileno(f), ACCESSIBLE_PAGE_OFFSET + (off_t) INIT_PAGE_NUMBER * pageSize) != 0)){
+        result = RC_WRITE_FAILED;
     }
     fclose(f);
+    if (result != RC_OK){
+        THROW(RC_WRITE_FAILED, "The File could not be initialized");
+    }
     return RC_OK;
 }
 
 RC openPageFile (char *fileName, SM_FileHandle *fHandle){
     SM_FileManagementInfo fMngInfo;
+    unsigned char descriptor[PAGE_SIZE];
+    unsigned int magic, checksum;
     FILE *f;
     if (fHandle == NULL){
         THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
@@ -38,11 +142,158 @@ RC openPageFile (char *fileName, SM_FileHandle *fHandle){
     fHandle->fileName = fileName;
     fHandle->curPagePos = 0;
     fMngInfo.posixFileDescriptor = f;
+    fMngInfo.freeMap = (unsigned char *) calloc(SM_FREE_MAP_BYTES, 1);
+    fMngInfo.numFreePages = 0;
+    fMngInfo.freeMapHint = 0;
+    fMngInfo.checksumFd = -1;
+    fMngInfo.checksums = NULL;
+    fMngInfo.checksumCapacity = 0;
+    fMngInfo.flags = 0;
+    fMngInfo.pageMapFd = -1;
+    fMngInfo.pageMap = NULL;
+    fMngInfo.pageMapCapacity = 0;
+    fMngInfo.slotEnd = 0;
+    fMngInfo.durability.mode = SM_DURABILITY_NONE;
+    fMngInfo.durability.batchPages = 0;
+    fMngInfo.durability.batchMillis = 0;
+    fMngInfo.unsyncedPages = 0;
+    fMngInfo.firstUnsyncedNanos = 0;
+    fMngInfo.pageCountPending = 0;
+    fMngInfo.numSyncs = 0;
+    fMngInfo.doubleWriteFd = -1;
+    fMngInfo.numDoubleWrites = 0;
+    fMngInfo.numRepairedPages = 0;
+    fMngInfo.changeMapFd = -1;
+    fMngInfo.changeMap = NULL;
+    fMngInfo.changeMapCapacity = 0;
+    fMngInfo.punchHoles = 1;
+    fMngInfo.numPunchedPages = 0;
+    fMngInfo.indirectionFd = -1;
+    fMngInfo.indirection = NULL;
+    fMngInfo.indirectionCapacity = 0;
+    fMngInfo.numPhysicalPages = 0;
+    fMngInfo.numRelocatedPages = 0;
     fHandle->mgmtInfo = fMngInfo;
-    /* We read the total number of pages of the file stored in the descriptor page*/
-    fread(&(fHandle->totalNumPages),sizeof(int),1,f);
+    /* We read the descriptor page: total number of pages of the file and the free map after it */
+    memset(descriptor, 0, PAGE_SIZE);
+    fread(descriptor, PAGE_SIZE, 1, f);
+    memcpy(&magic, descriptor, sizeof(int));
+    int version = (magic == SM_DESCRIPTOR_MAGIC) ? SM_DESCRIPTOR_VERSION : 1;
+    int mapOffset = (version == 1) ? SM_V1_FREE_MAP_OFFSET : SM_FREE_MAP_OFFSET;
+    if (version == 1){
+        int totalNumPages;
+        memcpy(&totalNumPages, descriptor, sizeof(int));
+        fHandle->totalNumPages = totalNumPages;
+        memcpy(&checksum, descriptor + SM_V1_FREE_MAP_CHECKSUM_OFFSET, sizeof(int));
+    } else {
+        memcpy(&(fHandle->totalNumPages), descriptor + SM_TOTAL_PAGES_OFFSET, sizeof(PageNumber));
+        memcpy(&checksum, descriptor + SM_FREE_MAP_CHECKSUM_OFFSET, sizeof(int));
+        memcpy(&(fHandle->mgmtInfo.flags), descriptor + SM_FLAGS_OFFSET, sizeof(int));
+    }
+    int pageShift = SM_PAGE_SHIFT_OF_FLAGS(fHandle->mgmtInfo.flags);
+    fHandle->pageSize = PAGE_SIZE << ((pageShift <= SM_MAX_PAGE_SHIFT) ? pageShift : 0);
+    if (pageShift > SM_MAX_PAGE_SHIFT || ((fHandle->mgmtInfo.flags & SM_FLAG_COMPRESSED) && pageShift != 0)){
+        fclose(f);
+        free(fMngInfo.freeMap);
+        THROW(RC_INVALID_PAGE_SIZE,"The page size of the file is not supported");
+    }
+    if (checksum == freeMapChecksum(descriptor + mapOffset, PAGE_SIZE - mapOffset)){
+        /* the version 1 map is longer, the pages it has above SM_FREE_MAP_PAGES are forgotten (leaked) */
+        memcpy(fMngInfo.freeMap, descriptor + mapOffset, SM_FREE_MAP_BYTES);
+        for (PageNumber i = 0; i < fHandle->totalNumPages && i < SM_FREE_MAP_PAGES; i++){
+            fHandle->mgmtInfo.numFreePages += (fMngInfo.freeMap[i / 8] >> (i % 8)) & 1;
+        }
+    }
+    /* else a torn descriptor write: forgetting the free pages only leaks them, a page in use is never handed out */
+    if (version == 1 && writeDescriptor(f, fHandle->totalNumPages, fMngInfo.freeMap, 0) != RC_OK){
+        fclose(f);
+        free(fMngInfo.freeMap);
+        THROW(RC_WRITE_FAILED,"Could not upgrade the descriptor page");
+    }
+    /* A file with a sidecar keeps its checksums up to date whoever opens it */
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    RC result = openSidecar(fHandle, SM_CHECKSUM_SUFFIX, 0, fHandle->totalNumPages, &(info->checksumFd),
+            (void **) &(info->checksums), &(info->checksumCapacity), sizeof(int));
+    /* and its change map, a write that is not marked would be missing from the next incremental backup */
+    if (result == RC_OK){
+        result = openSidecar(fHandle, SM_CHANGE_MAP_SUFFIX, 0, changeMapBytes(fHandle->totalNumPages),
+                &(info->changeMapFd), (void **) &(info->changeMap), &(info->changeMapCapacity), 1);
+    }
+    if (result == RC_OK && (info->flags & SM_FLAG_COMPRESSED)){
+        result = openSidecar(fHandle, SM_PAGE_MAP_SUFFIX, 0, fHandle->totalNumPages, &(info->pageMapFd),
+                (void **) &(info->pageMap), &(info->pageMapCapacity), sizeof(SM_PageSlot));
+        if (result == RC_OK && info->pageMapFd < 0){
+            result = RC_FILE_NOT_FOUND;
+            RC_message = "The page map of the compressed file is missing";
+        }
+        /* Slots are appended after the last one, the file ends with a slot */
+        info->slotEnd = ACCESSIBLE_PAGE_OFFSET;
+        for (PageNumber i = 0; result == RC_OK && i < info->pageMapCapacity; i++){
+            if (info->pageMap[i].offset + info->pageMap[i].capacity > info->slotEnd){
+                info->slotEnd = info->pageMap[i].offset + info->pageMap[i].capacity;
+            }
+            if (info->pageMap[i].offset != 0 && i >= fHandle->totalNumPages){ // see below
+                fHandle->totalNumPages = i + 1;
+                info->pageCountPending = 1;
+            }
+        }
+    } else if (result == RC_OK){
+        result = openSidecar(fHandle, SM_INDIRECTION_SUFFIX, 0, fHandle->totalNumPages, &(info->indirectionFd),
+                (void **) &(info->indirection), &(info->indirectionCapacity), sizeof(PageNumber));
+        /* The page count is written lazily (updateTotalPageNumber), after a crash the file can hold pages it does not
+         * count yet. A page always reaches the file before the count, so the file size is the right count */
+        struct stat st;
+        PageNumber filePages = (fstat(fileno(f), &st) == 0) ? (st.st_size - ACCESSIBLE_PAGE_OFFSET) / fHandle->pageSize : 0;
+        if (result == RC_OK && info->indirectionFd >= 0){
+            /* unless pages are not where their number says: the last page written has its physical page in the map,
+             * the pages counted since the count on disk have none (a zero entry would say they are where they are) */
+            PageNumber counted = fHandle->totalNumPages;
+            for (PageNumber i = counted; i < info->indirectionCapacity; i++){
+                if (info->indirection[i] > 0){
+                    fHandle->totalNumPages = i + 1;
+                    info->pageCountPending = 1;
+                }
+            }
+            for (PageNumber i = counted; i < fHandle->totalNumPages; i++){
+                if (info->indirection[i] == 0){
+                    info->indirection[i] = SM_NO_PHYSICAL_PAGE;
+                }
+            }
+            info->numPhysicalPages = filePages;
+            for (PageNumber i = 0; i < fHandle->totalNumPages; i++){
+                if (physicalPage(fHandle, i) >= info->numPhysicalPages){
+                    info->numPhysicalPages = physicalPage(fHandle, i) + 1;
+                }
+            }
+        } else if (result == RC_OK && filePages > fHandle->totalNumPages){
+            fHandle->totalNumPages = filePages;
+            info->pageCountPending = 1;
+        }
+    }
+    /* A crash during the last batch written through the double-write buffer can have torn some of its pages */
+    if (result == RC_OK){
+        char *name = sidecarFileName(fileName, SM_DOUBLE_WRITE_SUFFIX);
+        info->doubleWriteFd = open(name, O_RDWR);
+        free(name);
+        if (info->doubleWriteFd >= 0){
+            result = repairFromDoubleWrite(fHandle);
+        }
+    }
+    if (result != RC_OK){
+        if (info->doubleWriteFd >= 0){
+            close(info->doubleWriteFd);
+        }
+        closeSidecar(&(info->checksumFd), (void **) &(info->checksums), &(info->checksumCapacity), sizeof(int));
+        closeSidecar(&(info->pageMapFd), (void **) &(info->pageMap), &(info->pageMapCapacity), sizeof(SM_PageSlot));
+        closeSidecar(&(info->changeMapFd), (void **) &(info->changeMap), &(info->changeMapCapacity), 1);
+        closeSidecar(&(info->indirectionFd), (void **) &(info->indirection), &(info->indirectionCapacity),
+                sizeof(PageNumber));
+        fclose(f);
+        free(fMngInfo.freeMap);
+        return result;
+    }
     /* We seek to the first useable page */
-    fseek(f,ACCESSIBLE_PAGE_OFFSET,SEEK_SET);
+    fseeko(f,ACCESSIBLE_PAGE_OFFSET,SEEK_SET);
     return RC_OK;
 }
 
@@ -50,29 +301,63 @@ RC closePageFile (SM_FileHandle *fHandle){
     if (fHandle == NULL){
         THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
     }
+    RC result = writePageCount(fHandle);
     fclose(fHandle->mgmtInfo.posixFileDescriptor);
-    return RC_OK;
+    free(fHandle->mgmtInfo.freeMap);
+    fHandle->mgmtInfo.freeMap = NULL;
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    closeSidecar(&(info->checksumFd), (void **) &(info->checksums), &(info->checksumCapacity), sizeof(int));
+    closeSidecar(&(info->pageMapFd), (void **) &(info->pageMap), &(info->pageMapCapacity), sizeof(SM_PageSlot));
+    closeSidecar(&(info->changeMapFd), (void **) &(info->changeMap), &(info->changeMapCapacity), 1);
+    closeSidecar(&(info->indirectionFd), (void **) &(info->indirection), &(info->indirectionCapacity), sizeof(PageNumber));
+    if (info->doubleWriteFd >= 0){
+        close(info->doubleWriteFd);
+        info->doubleWriteFd = -1;
+    }
+    return result;
 }
 
 RC destroyPageFile (char *fileName){
     if(remove(fileName) != 0){
         THROW(RC_FILE_NOT_FOUND,"Unable to delete due to permissions or file do not exist");
     }
+    char *sidecar = sidecarFileName(fileName, SM_CHECKSUM_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_PAGE_MAP_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_DOUBLE_WRITE_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_CHANGE_MAP_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
+    sidecar = sidecarFileName(fileName, SM_INDIRECTION_SUFFIX);
+    unlink(sidecar);
+    free(sidecar);
     return RC_OK;
 }
 
-RC updateTotalPageNumber (int newTotalPageNumber, SM_FileHandle *fHandle){
+RC updateTotalPageNumber (PageNumber newTotalPageNumber, SM_FileHandle *fHandle){
     if (fHandle == NULL){
         THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
     }
+    /* New pages have no physical page until they are written */
+    for (PageNumber i = fHandle->totalNumPages; fHandle->mgmtInfo.indirectionFd >= 0 && i < newTotalPageNumber; i++){
+        RC result = setPhysicalPage(fHandle, i, SM_NO_PHYSICAL_PAGE);
+        if (result != RC_OK){
+            return result;
+        }
+    }
+    /* Extending a file one page at a time no longer seeks back to the descriptor every time */
     fHandle->totalNumPages = newTotalPageNumber;
-    fseek(fHandle->mgmtInfo.posixFileDescriptor, 0, SEEK_SET);
-    fwrite(&(fHandle->totalNumPages), sizeof(int), 1, fHandle->mgmtInfo.posixFileDescriptor);
+    fHandle->mgmtInfo.pageCountPending = 1;
     return RC_OK;
 }
 
 /* reading blocks from disc */
-RC readBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
+RC readBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
     if (fHandle == NULL){
         THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
     }
@@ -82,13 +367,45 @@ RC readBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
     if (pageNum < 0){
         THROW(RC_READ_NON_EXISTING_PAGE,"The page do not exist (Negative Page)");
     }
-    fseek(fHandle->mgmtInfo.posixFileDescriptor, ACCESSIBLE_PAGE_OFFSET + pageNum * PAGE_SIZE, SEEK_SET);
+    FILE *f = fHandle->mgmtInfo.posixFileDescriptor;
     fHandle->curPagePos = pageNum;
-    fread(memPage, PAGE_SIZE, 1, fHandle->mgmtInfo.posixFileDescriptor);
+    if (pageNum < SM_FREE_MAP_PAGES && (fHandle->mgmtInfo.freeMap[pageNum / 8] & (1 << (pageNum % 8)))){
+        /* A free page holds no data (freePage punched it), its checksum may be the one of the dead page */
+        memset(memPage, 0, fHandle->pageSize);
+        return RC_OK;
+    }
+    if (fHandle->mgmtInfo.flags & SM_FLAG_COMPRESSED){
+        RC result = readCompressedPage(pageNum, fHandle, memPage);
+        if (result != RC_OK){
+            return result;
+        }
+    } else {
+        PageNumber physical = physicalPage(fHandle, pageNum);
+        if (physical == SM_NO_PHYSICAL_PAGE){ // nothing written to it since it has its number
+            memset(memPage, 0, fHandle->pageSize);
+            return RC_OK;
+        }
+        fseeko(f, pageOffset(fHandle, physical), SEEK_SET);
+        size_t numRead = fread(memPage, 1, fHandle->pageSize, f);
+        if (numRead < (size_t) fHandle->pageSize){
+            if (ferror(f)){
+                clearerr(f);
+                THROW(RC_READ_FAILED,"The page could not be read");
+            }
+            /* The file ends inside the page (a crash during an append), the rest reads as zeros */
+            memset(memPage + numRead, 0, fHandle->pageSize - numRead);
+        }
+    }
+    if (pageNum < fHandle->mgmtInfo.checksumCapacity){
+        unsigned int stored = fHandle->mgmtInfo.checksums[pageNum];
+        if (stored != 0 && stored != pageChecksum(memPage, fHandle->pageSize)){
+            THROW(RC_CHECKSUM_MISMATCH,"The page does not match its checksum");
+        }
+    }
     return RC_OK;
 }
 
-int getBlockPos (SM_FileHandle *fHandle){
+PageNumber getBlockPos (SM_FileHandle *fHandle){
     return fHandle->curPagePos;
 }
 
@@ -125,16 +442,103 @@ RC readNextBlock (SM_FileHandle *fHandle, SM_PageHandle memPage){
 }
 
 /* writing blocks to a page file */
-RC writeBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
+RC writeBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
     if (fHandle == NULL){
         THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
     }
     if (pageNum >= fHandle->totalNumPages || pageNum < 0){
         THROW(RC_WRITE_FAILED,"The page do not exist");
     }
-    fseek(fHandle->mgmtInfo.posixFileDescriptor, ACCESSIBLE_PAGE_OFFSET + pageNum * PAGE_SIZE, SEEK_SET);
+    if (fHandle->mgmtInfo.doubleWriteFd >= 0){
+        return writeBlocks(fHandle, 1, &pageNum, &memPage);
+    }
+    RC result = writePage(pageNum, fHandle, memPage);
+    if (result != RC_OK){
+        return result;
+    }
+    return notePageWrite(fHandle);
+}
+
+RC writeBlocks (SM_FileHandle *fHandle, int numPages, const PageNumber *pageNums, SM_PageHandle *pages){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->doubleWriteFd < 0){
+        for (int i = 0; i < numPages; i++){
+            RC result = writeBlock(pageNums[i], fHandle, pages[i]);
+            if (result != RC_OK){
+                return result;
+            }
+        }
+        return RC_OK;
+    }
+    for (int i = 0; i < numPages; i++){
+        if (pageNums[i] >= fHandle->totalNumPages || pageNums[i] < 0){
+            THROW(RC_WRITE_FAILED,"The page do not exist");
+        }
+    }
+    /* Copies first (one sequential write and sync), then in place, then the sync that frees the buffer for the next batch */
+    for (int first = 0; first < numPages; first += SM_DWB_PAGES){
+        int count = (numPages - first < SM_DWB_PAGES) ? numPages - first : SM_DWB_PAGES;
+        RC result = writeDoubleWriteBatch(fHandle, count, pageNums + first, pages + first);
+        for (int i = first; i < first + count && result == RC_OK; i++){
+            result = writePage(pageNums[i], fHandle, pages[i]);
+            info->unsyncedPages ++;
+        }
+        if (result == RC_OK){
+            result = syncPageFile(fHandle);
+        }
+        if (result != RC_OK){
+            return result;
+        }
+    }
+    return RC_OK;
+}
+
+/* Writes a page in place (in its slot for a compressed file) with its checksum */
+RC writePage (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
     fHandle->curPagePos = pageNum;
-    fwrite(memPage, PAGE_SIZE, 1, fHandle->mgmtInfo.posixFileDescriptor);
+    RC reuseResult = reuseFreePage(fHandle, pageNum);
+    if (reuseResult != RC_OK){
+        return reuseResult;
+    }
+    RC changeResult = markChanged(fHandle, pageNum);
+    if (changeResult != RC_OK){
+        return changeResult;
+    }
+    if (info->flags & SM_FLAG_COMPRESSED){
+        RC result = writeCompressedPage(pageNum, fHandle, memPage);
+        if (result != RC_OK){
+            return result;
+        }
+    } else {
+        PageNumber physical = physicalPage(fHandle, pageNum);
+        int zero = isZeroPage(memPage, fHandle->pageSize);
+        if (physical == SM_NO_PHYSICAL_PAGE && !zero){ // its first data, on a new physical page
+            RC result = setPhysicalPage(fHandle, pageNum, info->numPhysicalPages);
+            if (result != RC_OK){
+                return result;
+            }
+            physical = physicalPage(fHandle, pageNum);
+        }
+        if (physical != SM_NO_PHYSICAL_PAGE && (!zero || !punchPage(fHandle, physical))){
+            fseeko(info->posixFileDescriptor, pageOffset(fHandle, physical), SEEK_SET);
+            if (fwrite(memPage, fHandle->pageSize, 1, info->posixFileDescriptor) != 1){
+                clearerr(info->posixFileDescriptor);
+                THROW(RC_WRITE_FAILED,"The page could not be written");
+            }
+        }
+    }
+    if (info->checksumFd >= 0){
+        RC result = growSidecar(info->checksumFd, (void **) &(info->checksums), &(info->checksumCapacity), pageNum,
+                sizeof(int));
+        if (result != RC_OK){
+            return result;
+        }
+        info->checksums[pageNum] = pageChecksum(memPage, fHandle->pageSize);
+    }
     return RC_OK;
 }
 
@@ -149,36 +553,826 @@ RC appendEmptyBlock (SM_FileHandle *fHandle){
     if (fHandle == NULL){
         THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
     }
-    /* First we add a page to the file */
-    fseek(fHandle->mgmtInfo.posixFileDescriptor,0,SEEK_END);
-    int i;
-    for (i = 0; i < PAGE_SIZE; i++){
-        char empty = '\0';
-        if (fwrite(&empty,sizeof(char),1,fHandle->mgmtInfo.posixFileDescriptor) != sizeof(char)){
-            break;
+    /* The new page is a hole, no zeros are written */
+    return extendPageFile(fHandle->totalNumPages + 1, fHandle);
+}
+
+RC ensureCapacity (PageNumber numberOfPages, SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    if (numberOfPages <= fHandle->totalNumPages){
+        return RC_OK;
+    }
+    /* All the missing pages in one extension, as holes */
+    return extendPageFile(numberOfPages, fHandle);
+}
+
+RC extendPageFile (PageNumber numberOfPages, SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    if (numberOfPages <= fHandle->totalNumPages){
+        return RC_OK;
+    }
+    /* The new pages read as zeros, the file system allocates them when they are written (with indirection they get
+     * a physical page then) */
+    fflush(fHandle->mgmtInfo.posixFileDescriptor);
+    if (!(fHandle->mgmtInfo.flags & SM_FLAG_COMPRESSED) && fHandle->mgmtInfo.indirectionFd < 0
+            && ftruncate(fileno(fHandle->mgmtInfo.posixFileDescriptor), pageOffset(fHandle, numberOfPages)) != 0){
+        THROW(RC_WRITE_FAILED, "extendPageFile Failed");
+    }
+    return updateTotalPageNumber(numberOfPages, fHandle);
+}
+
+/* free space */
+RC freePage (PageNumber pageNum, SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    if (pageNum < 0 || pageNum >= fHandle->totalNumPages || pageNum >= SM_FREE_MAP_PAGES){
+        THROW(RC_INVALID_FREE_PAGE,"The page do not exist or is above the free map");
+    }
+    unsigned char *byte = &(fHandle->mgmtInfo.freeMap[pageNum / 8]);
+    if (*byte & (1 << (pageNum % 8))){
+        THROW(RC_INVALID_FREE_PAGE,"The page is already free");
+    }
+    *byte |= 1 << (pageNum % 8);
+    fHandle->mgmtInfo.numFreePages ++;
+    /* Losing this write in a crash only leaks the page, no need to wait for the disk */
+    RC result = writeFreeMap(fHandle, 0);
+    if (result != RC_OK){
+        return result;
+    }
+    /* The data of the page is dead, its space goes back to the file system */
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    result = markChanged(fHandle, pageNum);
+    if (result != RC_OK){
+        return result;
+    }
+    if (info->flags & SM_FLAG_COMPRESSED){
+        if (pageNum < info->pageMapCapacity && info->pageMap[pageNum].offset != 0){
+            memset(&(info->pageMap[pageNum]), 0, sizeof(SM_PageSlot));
+            info->numPunchedPages ++;
+        }
+    } else if (info->indirectionFd >= 0){
+        /* The page leaves its physical page, a later write of the page takes a new one */
+        PageNumber physical = physicalPage(fHandle, pageNum);
+        result = setPhysicalPage(fHandle, pageNum, SM_NO_PHYSICAL_PAGE);
+        if (result == RC_OK && physical != SM_NO_PHYSICAL_PAGE){
+            punchPage(fHandle, physical);
+        }
+        return result;
+    } else if (punchPage(fHandle, pageNum) && pageNum < info->checksumCapacity){
+        info->checksums[pageNum] = pageChecksum(zeroPage, fHandle->pageSize);
+    }
+    return RC_OK;
+}
+
+RC takeFreePage (SM_FileHandle *fHandle, PageNumber *pageNum){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    if (fHandle->mgmtInfo.numFreePages == 0){
+        THROW(RC_NO_FREE_PAGE,"No free page");
+    }
+    /* Next fit from the last page taken, so pages taken one after the other are close to each other */
+    const unsigned char *freeMap = fHandle->mgmtInfo.freeMap;
+    int numBytes = SM_FREE_MAP_BYTES;
+    int start = (int) (fHandle->mgmtInfo.freeMapHint / 8);
+    int found = -1;
+    for (int i = 0; i < numBytes && found < 0; i++){
+        int byte = (start + i) % numBytes;
+        if (freeMap[byte] != 0){
+            found = byte * 8 + __builtin_ctz(freeMap[byte]);
         }
     }
-    if (i < PAGE_SIZE){ // We failed to append an entire block and clean up the partial block
-        ftruncate(fileno(fHandle->mgmtInfo.posixFileDescriptor), ftell(fHandle->mgmtInfo.posixFileDescriptor) - i);
-        THROW(RC_WRITE_FAILED, "Append Failed");
+    if (found < 0){
+        THROW(RC_NO_FREE_PAGE,"No free page");
+    }
+    fHandle->mgmtInfo.freeMap[found / 8] &= ~(1 << (found % 8));
+    fHandle->mgmtInfo.numFreePages --;
+    fHandle->mgmtInfo.freeMapHint = found;
+    /* The map must be on disk before the page is used, else a crash could hand it out a second time */
+    RC result = writeFreeMap(fHandle, 1);
+    if (result != RC_OK){
+        fHandle->mgmtInfo.freeMap[found / 8] |= 1 << (found % 8);
+        fHandle->mgmtInfo.numFreePages ++;
+        return result;
     }
-    updateTotalPageNumber(fHandle->totalNumPages + 1, fHandle);
+    *pageNum = found;
     return RC_OK;
 }
 
-RC ensureCapacity (int numberOfPages, SM_FileHandle *fHandle){
+RC allocatePage (SM_FileHandle *fHandle, PageNumber *pageNum){
+    RC result = takeFreePage(fHandle, pageNum);
+    if (result == RC_NO_FREE_PAGE){
+        result = appendEmptyBlock(fHandle);
+        if (result == RC_OK){
+            *pageNum = fHandle->totalNumPages - 1;
+        }
+        return result;
+    }
+    if (result != RC_OK){
+        return result;
+    }
+    return writeBlock(*pageNum, fHandle, (SM_PageHandle) zeroPage);
+}
+
+int getNumFreePages (SM_FileHandle *fHandle){
+    return fHandle->mgmtInfo.numFreePages;
+}
+
+/* integrity */
+RC enablePageChecksums (SM_FileHandle *fHandle){
     if (fHandle == NULL){
         THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
     }
-    if (numberOfPages <= fHandle->totalNumPages){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->checksumFd >= 0){
+        return RC_OK;
+    }
+    return openSidecar(fHandle, SM_CHECKSUM_SUFFIX, 1, fHandle->totalNumPages, &(info->checksumFd),
+            (void **) &(info->checksums), &(info->checksumCapacity), sizeof(int));
+}
+
+/* change tracking */
+RC enableChangeTracking (SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->changeMapFd >= 0){
+        return RC_OK;
+    }
+    return openSidecar(fHandle, SM_CHANGE_MAP_SUFFIX, 1, changeMapBytes(fHandle->totalNumPages), &(info->changeMapFd),
+            (void **) &(info->changeMap), &(info->changeMapCapacity), 1);
+}
+
+long long getChangeEpoch (SM_FileHandle *fHandle){
+    long long epoch;
+    if (fHandle->mgmtInfo.changeMapFd < 0){
+        return -1;
+    }
+    memcpy(&epoch, fHandle->mgmtInfo.changeMap, sizeof(long long));
+    return epoch;
+}
+
+int isPageChanged (SM_FileHandle *fHandle, PageNumber pageNum){
+    const SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->changeMapFd < 0){
+        return 1;
+    }
+    PageNumber byte = SM_CHANGE_MAP_HEADER + pageNum / 8;
+    return byte < info->changeMapCapacity && (info->changeMap[byte] >> (pageNum % 8)) & 1;
+}
+
+RC startChangeEpoch (SM_FileHandle *fHandle, long long epoch){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->changeMapFd < 0){
+        THROW(RC_NO_CHANGE_TRACKING,"Changes of the file are not tracked");
+    }
+    memset(info->changeMap + SM_CHANGE_MAP_HEADER, 0, info->changeMapCapacity - SM_CHANGE_MAP_HEADER);
+    memcpy(info->changeMap, &epoch, sizeof(long long));
+    if (msync(info->changeMap, info->changeMapCapacity, MS_SYNC) != 0){
+        THROW(RC_SYNC_FAILED,"Could not sync the change map");
+    }
+    return RC_OK;
+}
+
+/* page indirection */
+RC enablePageIndirection (SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->indirectionFd >= 0){
         return RC_OK;
     }
-    for (int i = 0; i < numberOfPages - fHandle->totalNumPages; i++){
-        if (appendEmptyBlock(fHandle) == RC_WRITE_FAILED){
-            updateTotalPageNumber(fHandle->totalNumPages + i, fHandle);
-            THROW(RC_WRITE_FAILED, "ensureCapacity Failed");
+    if (info->flags & SM_FLAG_COMPRESSED){
+        THROW(RC_NO_PAGE_INDIRECTION,"A compressed file places its pages through its page map");
+    }
+    /* The page count is on disk first, openPageFile takes the pages counted after it for new ones */
+    info->unsyncedPages ++;
+    RC result = syncPageFile(fHandle);
+    if (result != RC_OK){
+        return result;
+    }
+    struct stat st;
+    info->numPhysicalPages = fHandle->totalNumPages;
+    if (fstat(fileno(info->posixFileDescriptor), &st) == 0
+            && (st.st_size - ACCESSIBLE_PAGE_OFFSET) / fHandle->pageSize > info->numPhysicalPages){
+        info->numPhysicalPages = (st.st_size - ACCESSIBLE_PAGE_OFFSET) / fHandle->pageSize;
+    }
+    /* A new map is zeros, every page stays where it is, but the free pages that leave theirs */
+    result = openSidecar(fHandle, SM_INDIRECTION_SUFFIX, 1, fHandle->totalNumPages, &(info->indirectionFd),
+            (void **) &(info->indirection), &(info->indirectionCapacity), sizeof(PageNumber));
+    for (PageNumber i = 0; result == RC_OK && i < fHandle->totalNumPages && i < SM_FREE_MAP_PAGES; i++){
+        if ((info->freeMap[i / 8] >> (i % 8)) & 1){
+            info->indirection[i] = SM_NO_PHYSICAL_PAGE;
         }
     }
-    updateTotalPageNumber(numberOfPages, fHandle);
+    return result;
+}
+
+PageNumber getPhysicalPage (SM_FileHandle *fHandle, PageNumber pageNum){
+    return physicalPage(fHandle, pageNum);
+}
+
+RC relocatePages (SM_FileHandle *fHandle, int numPages, const PageNumber *pageNums, const PageNumber *physicalPages,
+        SM_PageHandle *pages){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->indirectionFd < 0){
+        THROW(RC_NO_PAGE_INDIRECTION,"The file has no page indirection");
+    }
+    for (int i = 0; i < numPages; i++){
+        if (pageNums[i] < 0 || pageNums[i] >= fHandle->totalNumPages || physicalPages[i] < 0){
+            THROW(RC_WRITE_FAILED,"The page do not exist");
+        }
+    }
+    /* Physical pages left since the last sync are free on disk too before they are written */
+    int fd = fileno(info->posixFileDescriptor);
+    if (fflush(info->posixFileDescriptor) != 0
+            || msync(info->indirection, info->indirectionCapacity * sizeof(PageNumber), MS_SYNC) != 0){
+        THROW(RC_SYNC_FAILED,"Could not sync the page map");
+    }
+    PageNumber *oldPages = (PageNumber *) malloc(numPages * sizeof(PageNumber));
+    char *buffer = NULL;
+    RC result = RC_OK;
+    for (int i = 0; i < numPages && result == RC_OK; i++){
+        oldPages[i] = physicalPage(fHandle, pageNums[i]);
+        const char *image = (pages != NULL) ? pages[i] : NULL;
+        if (image == NULL){
+            if (buffer == NULL){
+                buffer = (char *) malloc(fHandle->pageSize);
+            }
+            ssize_t numRead = (oldPages[i] == SM_NO_PHYSICAL_PAGE) ? 0
+                    : pread(fd, buffer, fHandle->pageSize, pageOffset(fHandle, oldPages[i]));
+            if (numRead < 0){
+                result = RC_READ_FAILED;
+                break;
+            }
+            memset(buffer + numRead, 0, fHandle->pageSize - numRead); // a hole past the end of the file
+            image = buffer;
+        }
+        if ((!isZeroPage(image, fHandle->pageSize) || !punchPage(fHandle, physicalPages[i]))
+                && pwrite(fd, image, fHandle->pageSize, pageOffset(fHandle, physicalPages[i])) != fHandle->pageSize){
+            result = RC_WRITE_FAILED;
+        }
+    }
+    free(buffer);
+    /* The images are on disk before the map points at them, a crash leaves each page at its old or its new place */
+    if (result == RC_OK && fdatasync(fd) != 0){
+        result = RC_SYNC_FAILED;
+    }
+    for (int i = 0; i < numPages && result == RC_OK; i++){
+        result = setPhysicalPage(fHandle, pageNums[i], physicalPages[i]);
+    }
+    if (result == RC_OK && msync(info->indirection, info->indirectionCapacity * sizeof(PageNumber), MS_SYNC) != 0){
+        result = RC_SYNC_FAILED;
+    }
+    if (result != RC_OK){
+        free(oldPages);
+        THROW(result,"Could not move the pages");
+    }
+    /* The old places are free, their blocks go back to the file system */
+    for (int i = 0; i < numPages; i++){
+        if (oldPages[i] != SM_NO_PHYSICAL_PAGE){
+            punchPage(fHandle, oldPages[i]);
+        }
+    }
+    free(oldPages);
+    info->numRelocatedPages += numPages;
+    return RC_OK;
+}
+
+RC truncatePageFile (SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->indirectionFd < 0){
+        THROW(RC_NO_PAGE_INDIRECTION,"The file has no page indirection");
+    }
+    PageNumber end = 0;
+    for (PageNumber i = 0; i < fHandle->totalNumPages; i++){
+        PageNumber physical = physicalPage(fHandle, i);
+        end = (physical >= end) ? physical + 1 : end;
+    }
+    if (fflush(info->posixFileDescriptor) != 0 || ftruncate(fileno(info->posixFileDescriptor), pageOffset(fHandle, end)) != 0){
+        THROW(RC_WRITE_FAILED,"Could not truncate the page file");
+    }
+    info->numPhysicalPages = end;
+    return RC_OK;
+}
+
+/* durability */
+RC setDurability (SM_FileHandle *fHandle, const SM_Durability *durability){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    if (durability->mode < SM_DURABILITY_NONE || durability->mode > SM_DURABILITY_FLUSH
+            || durability->batchPages < 0 || durability->batchMillis < 0){
+        THROW(RC_INVALID_DURABILITY,"Unknown durability mode or negative batch limit");
+    }
+    fHandle->mgmtInfo.durability = *durability;
+    fHandle->mgmtInfo.firstUnsyncedNanos = monotonicNanos(); // writes already pending start the time limit
+    /* A stricter mode applies to the writes already made */
+    if (durability->mode == SM_DURABILITY_WRITE){
+        return syncPageFile(fHandle);
+    }
+    return RC_OK;
+}
+
+RC syncPageFile (SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->unsyncedPages == 0 && !info->pageCountPending){
+        return RC_OK;
+    }
+    RC result = writePageCount(fHandle);
+    if (result != RC_OK){
+        return result;
+    }
+    /* The change map before the pages, a page on disk must be marked. Then the pages before the other sidecars, so
+     * that a synced checksum, slot or physical page describes a page that is on disk */
+    if (info->changeMap != NULL && msync(info->changeMap, info->changeMapCapacity, MS_SYNC) != 0){
+        THROW(RC_SYNC_FAILED,"Could not sync the change map");
+    }
+    if (fflush(info->posixFileDescriptor) != 0 || fdatasync(fileno(info->posixFileDescriptor)) != 0){
+        THROW(RC_SYNC_FAILED,"Could not sync the page file");
+    }
+    if ((info->checksums != NULL && msync(info->checksums, info->checksumCapacity * sizeof(int), MS_SYNC) != 0)
+            || (info->pageMap != NULL && msync(info->pageMap, info->pageMapCapacity * sizeof(SM_PageSlot), MS_SYNC) != 0)
+            || (info->indirection != NULL
+                && msync(info->indirection, info->indirectionCapacity * sizeof(PageNumber), MS_SYNC) != 0)){
+        THROW(RC_SYNC_FAILED,"Could not sync the sidecar files");
+    }
+    info->unsyncedPages = 0;
+    info->numSyncs ++;
+    return RC_OK;
+}
+
+RC startWriteback (SM_FileHandle *fHandle, PageNumber firstPage, PageNumber lastPage){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    if (fflush(fHandle->mgmtInfo.posixFileDescriptor) != 0){
+        THROW(RC_WRITE_FAILED,"Could not write the page file");
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    /* Only a hint: the pages are queued for writing without waiting for them, syncPageFile still gives durability.
+     * The range keeps it from also starting (and waiting on a full queue for) dirty pages written by others.
+     * Slots of a compressed file (and physical pages with indirection) are not in page order, the whole file is started */
+    off_t offset = 0, length = 0;
+    if (!(fHandle->mgmtInfo.flags & SM_FLAG_COMPRESSED) && fHandle->mgmtInfo.indirectionFd < 0){
+        offset = pageOffset(fHandle, firstPage);
+        length = pageOffset(fHandle, lastPage + 1) - offset;
+    }
+    sync_file_range(fileno(fHandle->mgmtInfo.posixFileDescriptor), offset, length, SYNC_FILE_RANGE_WRITE);
+#endif
+    return RC_OK;
+}
+
+RC enableDoubleWrite (SM_FileHandle *fHandle){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->doubleWriteFd >= 0){
+        return RC_OK;
+    }
+    /* Pages written before have no copy, they reach the disk before the buffer is used */
+    info->unsyncedPages ++;
+    RC result = syncPageFile(fHandle);
+    if (result != RC_OK){
+        return result;
+    }
+    char *name = sidecarFileName(fHandle->fileName, SM_DOUBLE_WRITE_SUFFIX);
+    info->doubleWriteFd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    free(name);
+    if (info->doubleWriteFd < 0){
+        THROW(RC_FILE_NOT_FOUND,"Could not create the double-write buffer");
+    }
+    return RC_OK;
+}
+
+/* compression */
+RC getCompressionInfo (SM_FileHandle *fHandle, SM_CompressionInfo *info){
+    if (fHandle == NULL){
+        THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+    }
+    memset(info, 0, sizeof(SM_CompressionInfo));
+    if (!(fHandle->mgmtInfo.flags & SM_FLAG_COMPRESSED)){
+        return RC_OK;
+    }
+    for (PageNumber i = 0; i < fHandle->mgmtInfo.pageMapCapacity; i++){
+        if (fHandle->mgmtInfo.pageMap[i].offset != 0){
+            info->numStoredPages ++;
+            info->storedBytes += fHandle->mgmtInfo.pageMap[i].length;
+        }
+    }
+    info->allocatedBytes = fHandle->mgmtInfo.slotEnd - ACCESSIBLE_PAGE_OFFSET;
+    return RC_OK;
+}
+
+/* Rewrites the checksum and free map of the descriptor page, sync waits until they are on disk */
+RC writeFreeMap (SM_FileHandle *fHandle, int sync){
+    FILE *f = fHandle->mgmtInfo.posixFileDescriptor;
+    unsigned int checksum = freeMapChecksum(fHandle->mgmtInfo.freeMap, SM_FREE_MAP_BYTES);
+    fseeko(f, SM_FREE_MAP_CHECKSUM_OFFSET, SEEK_SET);
+    if (fwrite(&checksum, sizeof(int), 1, f) != 1 || fseeko(f, SM_FREE_MAP_OFFSET, SEEK_SET) != 0
+            || fwrite(fHandle->mgmtInfo.freeMap, SM_FREE_MAP_BYTES, 1, f) != 1 || fflush(f) != 0){
+        THROW(RC_WRITE_FAILED, "Could not write the free map");
+    }
+    if (sync && fdatasync(fileno(f)) != 0){
+        THROW(RC_WRITE_FAILED, "Could not sync the free map");
+    }
+    return RC_OK;
+}
+
+/* A page written while free is in use again (readBlock returns zeros for a free page), its bit is cleared and the
+ * map synced before the page is written, as takeFreePage does */
+RC reuseFreePage (SM_FileHandle *fHandle, PageNumber pageNum){
+    if (pageNum >= SM_FREE_MAP_PAGES || !(fHandle->mgmtInfo.freeMap[pageNum / 8] & (1 << (pageNum % 8)))){
+        return RC_OK;
+    }
+    unsigned char *byte = &(fHandle->mgmtInfo.freeMap[pageNum / 8]);
+    *byte &= ~(1 << (pageNum % 8));
+    fHandle->mgmtInfo.numFreePages --;
+    RC result = writeFreeMap(fHandle, 1);
+    if (result != RC_OK){
+        *byte |= 1 << (pageNum % 8);
+        fHandle->mgmtInfo.numFreePages ++;
+    }
+    return result;
+}
+
+/* Header page (PAGE_SIZE bytes) and images of a batch (pageSize bytes each) in one write at the start of the
+ * double-write buffer, synced */
+RC writeDoubleWriteBatch (SM_FileHandle *fHandle, int numPages, const PageNumber *pageNums, SM_PageHandle *pages){
+    unsigned char header[PAGE_SIZE];
+    SM_DoubleWriteEntry *entries = (SM_DoubleWriteEntry *) (header + SM_DWB_ENTRIES_OFFSET);
+    struct iovec iov[SM_DWB_PAGES + 1];
+    unsigned int magic = SM_DWB_MAGIC;
+    unsigned int count = numPages;
+    memset(header, 0, PAGE_SIZE);
+    iov[0].iov_base = header;
+    iov[0].iov_len = PAGE_SIZE;
+    for (int i = 0; i < numPages; i++){
+        entries[i].pageNum = pageNums[i];
+        entries[i].checksum = crc32c(pages[i], fHandle->pageSize);
+        iov[i + 1].iov_base = pages[i];
+        iov[i + 1].iov_len = fHandle->pageSize;
+    }
+    unsigned int checksum = crc32c(header + SM_DWB_ENTRIES_OFFSET, numPages * sizeof(SM_DoubleWriteEntry)) ^ count;
+    memcpy(header, &magic, sizeof(int));
+    memcpy(header + 4, &count, sizeof(int));
+    memcpy(header + 8, &checksum, sizeof(int));
+    ssize_t expected = PAGE_SIZE + (ssize_t) numPages * fHandle->pageSize;
+    if (pwritev(fHandle->mgmtInfo.doubleWriteFd, iov, numPages + 1, 0) != expected){
+        THROW(RC_WRITE_FAILED,"Could not write the double-write buffer");
+    }
+    if (fdatasync(fHandle->mgmtInfo.doubleWriteFd) != 0){
+        THROW(RC_SYNC_FAILED,"Could not sync the double-write buffer");
+    }
+    fHandle->mgmtInfo.numDoubleWrites ++;
+    return RC_OK;
+}
+
+/* Rewrites the pages of the last batch whose content differs from their copy: torn by a crash, or not written yet.
+ * Copies that do not match their checksum were torn themselves, their page was not touched yet */
+RC repairFromDoubleWrite (SM_FileHandle *fHandle){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    unsigned char header[PAGE_SIZE];
+    int pageSize = fHandle->pageSize;
+    unsigned int magic, count, checksum;
+    if (pread(info->doubleWriteFd, header, PAGE_SIZE, 0) != PAGE_SIZE){
+        return RC_OK; // empty, nothing was written through it
+    }
+    memcpy(&magic, header, sizeof(int));
+    memcpy(&count, header + 4, sizeof(int));
+    memcpy(&checksum, header + 8, sizeof(int));
+    if (magic != SM_DWB_MAGIC || count > SM_DWB_PAGES
+            || checksum != (crc32c(header + SM_DWB_ENTRIES_OFFSET, count * sizeof(SM_DoubleWriteEntry)) ^ count)){
+        return RC_OK;
+    }
+    const SM_DoubleWriteEntry *entries = (const SM_DoubleWriteEntry *) (header + SM_DWB_ENTRIES_OFFSET);
+    char *image = (char *) malloc(2 * pageSize);
+    char *current = image + pageSize;
+    RC result = RC_OK;
+    for (unsigned int i = 0; i < count && result == RC_OK; i++){
+        if (pread(info->doubleWriteFd, image, pageSize, PAGE_SIZE + (off_t) i * pageSize) != pageSize
+                || crc32c(image, pageSize) != entries[i].checksum || entries[i].pageNum < 0){
+            continue;
+        }
+        PageNumber pageNum = entries[i].pageNum;
+        if (pageNum < SM_FREE_MAP_PAGES && (info->freeMap[pageNum / 8] & (1 << (pageNum % 8)))){
+            continue; // freed after the batch, its image is dead
+        }
+        if (pageNum >= fHandle->totalNumPages){ // the extension was lost with the page
+            result = extendPageFile(pageNum + 1, fHandle);
+            if (result != RC_OK){
+                break;
+            }
+        }
+        if (readBlock(pageNum, fHandle, current) == RC_OK && crc32c(current, pageSize) == entries[i].checksum){
+            continue;
+        }
+        result = writePage(pageNum, fHandle, image);
+        info->unsyncedPages ++;
+        info->numRepairedPages += (result == RC_OK);
+    }
+    free(image);
+    if (result != RC_OK){
+        return result;
+    }
+    fHandle->curPagePos = 0;
+    return syncPageFile(fHandle);
+}
+
+/* Sets the bit of the page in the change map, if the file has one */
+RC markChanged (SM_FileHandle *fHandle, PageNumber pageNum){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (info->changeMapFd < 0){
+        return RC_OK;
+    }
+    RC result = growSidecar(info->changeMapFd, (void **) &(info->changeMap), &(info->changeMapCapacity),
+            SM_CHANGE_MAP_HEADER + pageNum / 8, 1);
+    if (result != RC_OK){
+        return result;
+    }
+    info->changeMap[SM_CHANGE_MAP_HEADER + pageNum / 8] |= 1 << (pageNum % 8);
+    return RC_OK;
+}
+
+/* Points the page at a physical page (or SM_NO_PHYSICAL_PAGE), in the page map of a file with indirection */
+RC setPhysicalPage (SM_FileHandle *fHandle, PageNumber pageNum, PageNumber physicalPage){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    RC result = growSidecar(info->indirectionFd, (void **) &(info->indirection), &(info->indirectionCapacity), pageNum,
+            sizeof(PageNumber));
+    if (result != RC_OK){
+        return result;
+    }
+    info->indirection[pageNum] = (physicalPage == SM_NO_PHYSICAL_PAGE) ? SM_NO_PHYSICAL_PAGE : physicalPage + 1;
+    if (physicalPage >= info->numPhysicalPages){
+        info->numPhysicalPages = physicalPage + 1;
+    }
+    return RC_OK;
+}
+
+/* Size of a change map covering numPages pages */
+PageNumber changeMapBytes (PageNumber numPages){
+    return SM_CHANGE_MAP_HEADER + (numPages + 7) / 8;
+}
+
+/* Deallocates a physical page of an uncompressed file, it then reads as zeros. Returns 0 if the page could not be
+ * punched, the caller writes the zeros itself (a file system without hole punching is not asked again) */
+int punchPage (SM_FileHandle *fHandle, PageNumber physicalPage){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    if (!info->punchHoles){
+        return 0;
+    }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    /* Buffered writes to the page must not land after the hole */
+    if (fflush(info->posixFileDescriptor) == 0 && fallocate(fileno(info->posixFileDescriptor),
+            FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pageOffset(fHandle, physicalPage), fHandle->pageSize) == 0){
+        info->numPunchedPages ++;
+        return 1;
+    }
+    if (errno == EOPNOTSUPP || errno == ENOSYS){
+        info->punchHoles = 0;
+    }
+#else
+    info->punchHoles = 0;
+#endif
+    return 0;
+}
+
+/* memcmp stops at the first byte that differs, a page with data costs a few bytes */
+int isZeroPage (const char *memPage, int pageSize){
+    return memcmp(memPage, zeroPage, pageSize) == 0;
+}
+
+/* Writes the page count to the descriptor page if it changed since the last time */
+RC writePageCount (SM_FileHandle *fHandle){
+    FILE *f = fHandle->mgmtInfo.posixFileDescriptor;
+    if (!fHandle->mgmtInfo.pageCountPending){
+        return RC_OK;
+    }
+    if (fseeko(f, SM_TOTAL_PAGES_OFFSET, SEEK_SET) != 0 || fwrite(&(fHandle->totalNumPages), sizeof(PageNumber), 1, f) != 1){
+        clearerr(f);
+        THROW(RC_WRITE_FAILED, "Could not write the page count");
+    }
+    fHandle->mgmtInfo.pageCountPending = 0;
+    return RC_OK;
+}
+
+/* Counts a page write and syncs the file when the durability mode says so */
+RC notePageWrite (SM_FileHandle *fHandle){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    const SM_Durability *durability = &(info->durability);
+    if (info->unsyncedPages ++ == 0 && durability->mode == SM_DURABILITY_BATCHED && durability->batchMillis > 0){
+        info->firstUnsyncedNanos = monotonicNanos();
+    }
+    switch (durability->mode){
+    case SM_DURABILITY_WRITE:
+        return syncPageFile(fHandle);
+    case SM_DURABILITY_BATCHED:
+        if ((durability->batchPages > 0 && info->unsyncedPages >= durability->batchPages)
+                || (durability->batchMillis > 0
+                    && monotonicNanos() - info->firstUnsyncedNanos >= durability->batchMillis * 1000000LL)){
+            return syncPageFile(fHandle);
+        }
+        return RC_OK;
+    default:
+        return RC_OK;
+    }
+}
+
+long long monotonicNanos (void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Writes a whole version 2 descriptor page at the start of the file */
+RC writeDescriptor (FILE *f, PageNumber totalNumPages, const unsigned char *freeMap, int flags){
+    unsigned char descriptor[PAGE_SIZE];
+    unsigned int magic = SM_DESCRIPTOR_MAGIC;
+    unsigned int version = SM_DESCRIPTOR_VERSION;
+    unsigned int checksum = freeMapChecksum(freeMap, SM_FREE_MAP_BYTES);
+    memset(descriptor, 0, SM_FREE_MAP_OFFSET);
+    memcpy(descriptor, &magic, sizeof(int));
+    memcpy(descriptor + sizeof(int), &version, sizeof(int));
+    memcpy(descriptor + SM_TOTAL_PAGES_OFFSET, &totalNumPages, sizeof(PageNumber));
+    memcpy(descriptor + SM_FREE_MAP_CHECKSUM_OFFSET, &checksum, sizeof(int));
+    memcpy(descriptor + SM_FLAGS_OFFSET, &flags, sizeof(int));
+    memcpy(descriptor + SM_FREE_MAP_OFFSET, freeMap, SM_FREE_MAP_BYTES);
+    fseeko(f, 0, SEEK_SET);
+    if (fwrite(descriptor, PAGE_SIZE, 1, f) != 1 || fflush(f) != 0){
+        THROW(RC_WRITE_FAILED, "Could not write the descriptor page");
+    }
+    return RC_OK;
+}
+
+/* CRC-32C without inversions, an empty map (files created before the free map) has checksum 0 */
+unsigned int freeMapChecksum (const unsigned char *freeMap, int length){
+    return crc32cUpdate(0, freeMap, length);
+}
+
+/* <fileName><suffix>, malloc'd */
+char *sidecarFileName (const char *fileName, const char *suffix){
+    char *name = (char *) malloc(strlen(fileName) + strlen(suffix) + 1);
+    strcpy(name, fileName);
+    strcat(name, suffix);
+    return name;
+}
+
+/* Maps the sidecar <fileName><suffix> (entrySize bytes per entry, at least minEntries), create makes it if missing,
+ * else a file without one keeps *fd at -1 */
+RC openSidecar (SM_FileHandle *fHandle, const char *suffix, int create, PageNumber minEntries, int *fd,
+        void **mapping, PageNumber *capacity, size_t entrySize){
+    char *name = sidecarFileName(fHandle->fileName, suffix);
+    int sidecarFd = open(name, O_RDWR | (create ? O_CREAT : 0), 0644);
+    free(name);
+    if (sidecarFd < 0){
+        if (!create && errno == ENOENT){
+            return RC_OK;
+        }
+        THROW(RC_FILE_NOT_FOUND,"Could not open the sidecar file");
+    }
+    struct stat st;
+    if (fstat(sidecarFd, &st) != 0){
+        close(sidecarFd);
+        THROW(RC_FILE_NOT_FOUND,"Could not open the sidecar file");
+    }
+    *mapping = NULL;
+    *capacity = 0;
+    PageNumber numEntries = st.st_size / entrySize;
+    if (numEntries < minEntries){
+        numEntries = minEntries;
+    }
+    RC result = growSidecar(sidecarFd, mapping, capacity, numEntries - 1, entrySize);
+    if (result != RC_OK){
+        close(sidecarFd);
+        return result;
+    }
+    *fd = sidecarFd;
+    return RC_OK;
+}
+
+/* Makes the mapping cover pageNum, the sidecar grows with ftruncate so the new entries are zeros (no checksum,
+ * no slot) */
+RC growSidecar (int fd, void **mapping, PageNumber *capacity, PageNumber pageNum, size_t entrySize){
+    if (pageNum < *capacity){
+        return RC_OK;
+    }
+    PageNumber newCapacity = (2 * *capacity > pageNum + 1) ? 2 * *capacity : pageNum + 1;
+    newCapacity = (newCapacity + SM_SIDECAR_GROWTH - 1) / SM_SIDECAR_GROWTH * SM_SIDECAR_GROWTH;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < (off_t) (newCapacity * entrySize)
+            && ftruncate(fd, newCapacity * entrySize) != 0)){
+        THROW(RC_WRITE_FAILED,"Could not grow the sidecar file");
+    }
+    void *newMapping = mmap(NULL, newCapacity * entrySize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (newMapping == MAP_FAILED){
+        THROW(RC_WRITE_FAILED,"Could not map the sidecar file");
+    }
+    if (*mapping != NULL){
+        munmap(*mapping, *capacity * entrySize);
+    }
+    *mapping = newMapping;
+    *capacity = newCapacity;
+    return RC_OK;
+}
+
+void closeSidecar (int *fd, void **mapping, PageNumber *capacity, size_t entrySize){
+    if (*fd < 0){
+        return;
+    }
+    if (*mapping != NULL){
+        munmap(*mapping, *capacity * entrySize);
+    }
+    close(*fd);
+    *fd = -1;
+    *mapping = NULL;
+    *capacity = 0;
+}
+
+/* CRC-32C of a page, a page whose checksum is 0 is stored as ~0 as 0 means no checksum */
+unsigned int pageChecksum (const char *memPage, int pageSize){
+    unsigned int crc = crc32c(memPage, pageSize);
+    return (crc == 0) ? ~0u : crc;
+}
+
+
+/* A page without slot is zeros, a slot of PAGE_SIZE bytes holds the page as is */
+RC readCompressedPage (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    char compressed[PAGE_SIZE];
+    if (pageNum >= info->pageMapCapacity || info->pageMap[pageNum].offset == 0){
+        memset(memPage, 0, PAGE_SIZE);
+        return RC_OK;
+    }
+    SM_PageSlot slot = info->pageMap[pageNum];
+    char *target = (slot.length == PAGE_SIZE) ? memPage : compressed;
+    fseeko(info->posixFileDescriptor, slot.offset, SEEK_SET);
+    if (slot.length <= 0 || slot.length > PAGE_SIZE || fread(target, slot.length, 1, info->posixFileDescriptor) != 1){
+        clearerr(info->posixFileDescriptor);
+        THROW(RC_READ_FAILED,"The page could not be read");
+    }
+    if (target == compressed && decompressBlock(compressed, slot.length, memPage, PAGE_SIZE) != PAGE_SIZE){
+        THROW(RC_READ_FAILED,"The compressed page is corrupted");
+    }
+    return RC_OK;
+}
+
+/* Rewrites the page in its slot if it fits, else in a new slot at the end of the file */
+RC writeCompressedPage (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage){
+    SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+    char compressed[PAGE_SIZE];
+    const char *data = compressed;
+    if (isZeroPage(memPage, PAGE_SIZE)){ // no slot reads as zeros, the bytes of the old one are left like a moved slot
+        if (pageNum < info->pageMapCapacity && info->pageMap[pageNum].offset != 0){
+            memset(&(info->pageMap[pageNum]), 0, sizeof(SM_PageSlot));
+            info->numPunchedPages ++;
+        }
+        return RC_OK;
+    }
+    int length = compressBlock(memPage, PAGE_SIZE, compressed, PAGE_SIZE - SM_SLOT_UNIT);
+    if (length == 0){ // saves less than a slot unit
+        data = memPage;
+        length = PAGE_SIZE;
+    }
+    RC result = growSidecar(info->pageMapFd, (void **) &(info->pageMap), &(info->pageMapCapacity), pageNum,
+            sizeof(SM_PageSlot));
+    if (result != RC_OK){
+        return result;
+    }
+    SM_PageSlot slot = info->pageMap[pageNum];
+    if (slot.offset == 0 || slot.capacity < length){
+        slot.offset = info->slotEnd;
+        slot.capacity = (length + SM_SLOT_UNIT - 1) / SM_SLOT_UNIT * SM_SLOT_UNIT;
+    }
+    slot.length = length;
+    fseeko(info->posixFileDescriptor, slot.offset, SEEK_SET);
+    if (fwrite(data, length, 1, info->posixFileDescriptor) != 1){
+        clearerr(info->posixFileDescriptor);
+        THROW(RC_WRITE_FAILED,"The page could not be written");
+    }
+    /* The map points to a new slot only once the page is in it */
+    if (slot.offset == info->slotEnd){
+        info->slotEnd += slot.capacity;
+    }
+    info->pageMap[pageNum] = slot;
     return RC_OK;
 }
\ No newline at end of file
@@ -1,23 +1,162 @@
 #ifndef STORAGE_MGR_H
 #define STORAGE_MGR_H
 
+#include <sys/types.h>
+
 #include "dberror.h"
 
 #define INIT_PAGE_NUMBER 1 
 #define DESCRIPTOR_PAGE_NUMBER 1
 #define ACCESSIBLE_PAGE_OFFSET (DESCRIPTOR_PAGE_NUMBER * PAGE_SIZE)
 
+/* Descriptor page (version 2): magic, version, totalNumPages (64 bits), checksum of the free map, flags, free map
+ * (bit i set when page i is free). Version 1 files start with totalNumPages as a 32 bit int followed by the
+ * checksum and the free map, openPageFile reads them and rewrites the descriptor as version 2. */
+#define SM_DESCRIPTOR_MAGIC 0x46504d53 // "SMPF" in little endian, a version 1 file starts with its page count
+#define SM_DESCRIPTOR_VERSION 2
+#define SM_TOTAL_PAGES_OFFSET 8
+#define SM_FREE_MAP_CHECKSUM_OFFSET 16
+#define SM_FREE_MAP_OFFSET 24
+#define SM_FREE_MAP_BYTES (PAGE_SIZE - SM_FREE_MAP_OFFSET)
+#define SM_FREE_MAP_PAGES (SM_FREE_MAP_BYTES * 8) // pages above can not be freed
+#define SM_V1_FREE_MAP_CHECKSUM_OFFSET 4
+#define SM_V1_FREE_MAP_OFFSET 8
+
+/* Page checksums (enablePageChecksums) live in a sidecar file <fileName>.crc, one CRC-32C per page, so the page
+ * layout is unchanged. A stored 0 means the page was never written with checksums on, it is not verified. */
+#define SM_CHECKSUM_SUFFIX ".crc"
+
+/* Compressed page files (createCompressedPageFile, SM_FLAG_COMPRESSED in the descriptor flags): every page is
+ * compressed (storage_mgr_compress.c) into a variable size slot after the descriptor page, the sidecar
+ * <fileName>.map holds the SM_PageSlot of each page. A page without a slot reads as zeros. A page rewritten larger
+ * than its slot moves to a new slot at the end of the file, the old one stays allocated (getCompressionInfo). */
+#define SM_FLAGS_OFFSET 20
+#define SM_FLAG_COMPRESSED 1
+#define SM_PAGE_MAP_SUFFIX ".map"
+#define SM_SLOT_UNIT 512 // slots are allocated in multiples of it, pages that do not save a unit are stored as is
+
+/* Page size (createPageFileWithPageSize): bits 8 to 15 of the descriptor flags hold log2(pageSize / PAGE_SIZE), so
+ * files created before, with 0 there, have pages of PAGE_SIZE. The descriptor page stays PAGE_SIZE bytes whatever the
+ * page size. Compressed files always have pages of PAGE_SIZE. */
+#define SM_FLAG_PAGE_SHIFT 8
+#define SM_FLAG_PAGE_SHIFT_MASK (0xff << SM_FLAG_PAGE_SHIFT)
+#define SM_PAGE_SHIFT_OF_FLAGS(flags) (((flags) & SM_FLAG_PAGE_SHIFT_MASK) >> SM_FLAG_PAGE_SHIFT)
+#define SM_MAX_PAGE_SHIFT 4
+#define SM_MAX_PAGE_SIZE (PAGE_SIZE << SM_MAX_PAGE_SHIFT) // 64KB
+
+/* Holes: a page written as all zeros and a page given to freePage are deallocated with FALLOC_FL_PUNCH_HOLE (the file
+ * keeps its size) and read back as zeros without touching the device, new pages are added by extending the file
+ * (never written). On a file system without hole punching the zeros are written as before. In a compressed file such
+ * pages lose their slot instead, they are then read without any I/O. */
+
+/* Change tracking (enableChangeTracking): the sidecar <fileName>.chg starts with the epoch of the last backup
+ * (SM_CHANGE_MAP_HEADER bytes, 0 before the first one) followed by a bitmap with the bit of a page set when the page
+ * was written or freed since then. Bits are set before the page is written and the map is synced before the page
+ * file, so a page on disk is always marked (with SM_DURABILITY_NONE a system crash can lose marks, take a full backup
+ * after one). startChangeEpoch clears the bitmap once a backup is safe, see storage_mgr_backup.h. */
+#define SM_CHANGE_MAP_SUFFIX ".chg"
+#define SM_CHANGE_MAP_HEADER ((int) sizeof(long long))
+
+/* Page indirection (enablePageIndirection): the sidecar <fileName>.ind holds, for each page, the physical page of the
+ * file where it is. An entry is the physical page + 1, 0 for a page where it was when indirection was enabled (so a
+ * map lost while being created leaves every page where it is) and SM_NO_PHYSICAL_PAGE for a page without one: a free
+ * page or a new page not written yet, which reads as zeros without I/O. A page gets a physical page at the end of the
+ * file (numPhysicalPages) when data is first written to it, freePage gives it back. Page numbers never change, so the
+ * free map, the checksums, the change map and the buffer pools know nothing of it. relocatePages moves pages to other
+ * physical pages, the images are synced before the map so a crash leaves each page at its old or at its new place,
+ * truncatePageFile cuts the file after the last physical page in use (see buffer_mgr_defrag.h). Compressed files
+ * already place their pages through their page map. */
+#define SM_INDIRECTION_SUFFIX ".ind"
+#define SM_NO_PHYSICAL_PAGE (-1)
+
+/* Double-write buffer (enableDoubleWrite): the sidecar <fileName>.dwb holds the last batch of pages written
+ * (writeBlocks, writeBlock is a batch of one), a header page listing them then their images. A batch is written there
+ * in one sequential write and synced before the pages are written in place, and the page file is synced before the
+ * next batch replaces it, so a page torn by a crash always has an intact copy. openPageFile rewrites the pages of the
+ * batch whose content does not match their copy. Writes through the buffer are durable when they return. */
+#define SM_DOUBLE_WRITE_SUFFIX ".dwb"
+#define SM_DWB_MAGIC 0x42574453 // "SDWB" in little endian
+#define SM_DWB_PAGES 64 // pages per batch
+#define SM_DWB_ENTRIES_OFFSET 16 // header page: magic, number of pages, CRC-32C of the entries, entries
+
+/* Durability (setDurability): when the writes of a handle are synced with fdatasync. A page that was written but
+ * not synced may only be in the OS cache. The batched mode checks its limits on each write, so the last writes of a
+ * burst wait for the next write or syncPageFile. syncPageFile syncs in every mode, the page count and the sidecars
+ * (checksums, page map) included. */
+typedef enum SM_DurabilityMode {
+	SM_DURABILITY_NONE = 0, // never synced by the storage manager (the OS writes pages back when it wants)
+	SM_DURABILITY_WRITE = 1, // every writeBlock returns once the page is on disk
+	SM_DURABILITY_BATCHED = 2, // synced once batchPages pages were written or the oldest unsynced one is batchMillis old
+	SM_DURABILITY_FLUSH = 3 // synced only by syncPageFile (a buffer pool calls it at the end of forceFlushPool)
+} SM_DurabilityMode;
+
+typedef struct SM_Durability {
+	SM_DurabilityMode mode;
+	int batchPages; // SM_DURABILITY_BATCHED, 0 for no page limit
+	int batchMillis; // SM_DURABILITY_BATCHED, 0 for no time limit
+} SM_Durability;
+
+typedef long long PageNumber; // page offsets are computed in off_t, files can be larger than 2^31 pages
+
+typedef struct SM_PageSlot {
+	long long offset; // in the page file, 0 for a page without slot
+	int length; // compressed length, PAGE_SIZE for a page stored uncompressed
+	int capacity; // bytes allocated to the slot
+} SM_PageSlot;
+
+typedef struct SM_DoubleWriteEntry {
+	PageNumber pageNum;
+	unsigned int checksum; // CRC-32C of the image
+	unsigned int reserved;
+} SM_DoubleWriteEntry;
+
+typedef struct SM_CompressionInfo {
+	PageNumber numStoredPages; // pages with a slot
+	long long storedBytes; // sum of their lengths
+	long long allocatedBytes; // bytes of the file used by slots, including the ones of pages that moved
+} SM_CompressionInfo;
+
 /************************************************************
  *                    handle data structures                *
  ************************************************************/
 typedef struct SM_FileManagementInfo {
 	FILE *posixFileDescriptor;
+	unsigned char *freeMap; // SM_FREE_MAP_BYTES, copy of the one in the descriptor page
+	int numFreePages;
+	PageNumber freeMapHint; // last page taken from the free map, the search for the next one starts there
+	int checksumFd; // sidecar checksum file, -1 when the file has no checksums
+	unsigned int *checksums; // shared mapping of the sidecar, checksums[pageNum]
+	PageNumber checksumCapacity; // pages covered by the mapping
+	int flags; // SM_FLAG_* of the descriptor page
+	int pageMapFd; // page map of a compressed file, -1 for other files
+	SM_PageSlot *pageMap; // shared mapping of the page map, pageMap[pageNum]
+	PageNumber pageMapCapacity; // pages covered by the mapping
+	off_t slotEnd; // end of the last slot, new slots are allocated there
+	SM_Durability durability;
+	long long unsyncedPages; // pages written since the last sync
+	long long firstUnsyncedNanos; // CLOCK_MONOTONIC time of the first of them
+	int pageCountPending; // totalNumPages changed since the descriptor page was written
+	long long numSyncs; // fdatasync calls of the handle
+	int doubleWriteFd; // double-write buffer, -1 when the file has none
+	long long numDoubleWrites; // batches written through it
+	int numRepairedPages; // torn pages rewritten from it by openPageFile
+	int changeMapFd; // change tracking sidecar, -1 when changes are not tracked
+	unsigned char *changeMap; // shared mapping of the sidecar, the epoch then the bitmap
+	PageNumber changeMapCapacity; // bytes covered by the mapping
+	int punchHoles; // zero and freed pages become holes, cleared when the file system does not support it
+	long long numPunchedPages; // pages deallocated instead of written (or dropped from their slot when compressed)
+	int indirectionFd; // page indirection sidecar, -1 when pages are where their number says
+	PageNumber *indirection; // shared mapping of the sidecar, indirection[pageNum] (see SM_INDIRECTION_SUFFIX)
+	PageNumber indirectionCapacity; // pages covered by the mapping
+	PageNumber numPhysicalPages; // with indirection, pages of the file past the descriptor, new physical pages go there
+	long long numRelocatedPages; // pages moved by relocatePages
 } SM_FileManagementInfo;
 
 typedef struct SM_FileHandle {
 	char *fileName;
-	int totalNumPages;
-	int curPagePos;
+	PageNumber totalNumPages;
+	int pageSize; // bytes of every page of the file, from its descriptor
+	PageNumber curPagePos;
 	SM_FileManagementInfo mgmtInfo;
 } SM_FileHandle;
 
@@ -29,14 +168,16 @@ typedef char* SM_PageHandle;
 /* manipulating page files */
 extern void initStorageManager (void);
 extern RC createPageFile (char *fileName);
+extern RC createCompressedPageFile (char *fileName); // Same interface, pages are compressed on disk
+extern RC createPageFileWithPageSize (char *fileName, int pageSize); // PAGE_SIZE times a power of two up to SM_MAX_PAGE_SIZE, else RC_INVALID_PAGE_SIZE
 extern RC openPageFile (char *fileName, SM_FileHandle *fHandle);
 extern RC closePageFile (SM_FileHandle *fHandle);
 extern RC destroyPageFile (char *fileName);
-extern RC updateTotalPageNumber (int newTotalPageNumber, SM_FileHandle *fHandle); // Update both in memory and in the file
+extern RC updateTotalPageNumber (PageNumber newTotalPageNumber, SM_FileHandle *fHandle); // In memory, written to the descriptor by the next sync or close
 
 /* reading blocks from disc */
-extern RC readBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
-extern int getBlockPos (SM_FileHandle *fHandle);
+extern RC readBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
+extern PageNumber getBlockPos (SM_FileHandle *fHandle);
 extern RC readFirstBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readPreviousBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
@@ -44,9 +185,42 @@ extern RC readNextBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readLastBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 
 /* writing blocks to a page file */
-extern RC writeBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
+extern RC writeBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC writeCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
+extern RC writeBlocks (SM_FileHandle *fHandle, int numPages, const PageNumber *pageNums, SM_PageHandle *pages); // Batch through the double-write buffer, if any
 extern RC appendEmptyBlock (SM_FileHandle *fHandle);
-extern RC ensureCapacity (int numberOfPages, SM_FileHandle *fHandle);
+extern RC ensureCapacity (PageNumber numberOfPages, SM_FileHandle *fHandle);
+extern RC extendPageFile (PageNumber numberOfPages, SM_FileHandle *fHandle); // Same as ensureCapacity, one ftruncate without writing the pages
+
+/* free space */
+extern RC freePage (PageNumber pageNum, SM_FileHandle *fHandle);
+extern RC takeFreePage (SM_FileHandle *fHandle, PageNumber *pageNum); // Removes a free page from the map, its content is left as is (RC_NO_FREE_PAGE if none)
+extern RC allocatePage (SM_FileHandle *fHandle, PageNumber *pageNum); // A zeroed page, a free one if any else a new one at the end
+extern int getNumFreePages (SM_FileHandle *fHandle);
+
+/* integrity */
+extern RC enablePageChecksums (SM_FileHandle *fHandle); // Creates the sidecar, later writes store a checksum that reads verify (RC_CHECKSUM_MISMATCH)
+extern RC enableDoubleWrite (SM_FileHandle *fHandle); // Creates the double-write buffer, later writes go through it
+
+/* change tracking */
+extern RC enableChangeTracking (SM_FileHandle *fHandle); // Creates the change map, later writes and frees mark their page
+extern long long getChangeEpoch (SM_FileHandle *fHandle); // Epoch of the last backup, 0 before the first one, -1 without change tracking
+extern int isPageChanged (SM_FileHandle *fHandle, PageNumber pageNum); // Written or freed since the last backup (1 without change tracking)
+extern RC startChangeEpoch (SM_FileHandle *fHandle, long long epoch); // Clears the bitmap and records epoch, on disk when it returns
+
+/* page indirection */
+extern RC enablePageIndirection (SM_FileHandle *fHandle); // Creates the map, every page stays where it is (RC_NO_PAGE_INDIRECTION for a compressed file)
+extern PageNumber getPhysicalPage (SM_FileHandle *fHandle, PageNumber pageNum); // SM_NO_PHYSICAL_PAGE for a page without one, pageNum without indirection
+extern RC relocatePages (SM_FileHandle *fHandle, int numPages, const PageNumber *pageNums, const PageNumber *physicalPages,
+        SM_PageHandle *pages); // Moves each page to a physical page no page is on, pages (or one of them) NULL to copy it in the file, else its image as stored
+extern RC truncatePageFile (SM_FileHandle *fHandle); // Cuts the physical pages after the last one in use
+
+/* durability */
+extern RC setDurability (SM_FileHandle *fHandle, const SM_Durability *durability); // SM_DURABILITY_NONE when the file is opened
+extern RC syncPageFile (SM_FileHandle *fHandle); // Every write of the handle on disk, whatever the mode
+extern RC startWriteback (SM_FileHandle *fHandle, PageNumber firstPage, PageNumber lastPage); // Starts writing the written pages of the range to the disk without waiting, a later sync is shorter
+
+/* compression */
+extern RC getCompressionInfo (SM_FileHandle *fHandle, SM_CompressionInfo *info); // All zeros for a file that is not compressed
 
 #endif
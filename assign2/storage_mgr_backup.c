@@ -0,0 +1,514 @@
+#define _GNU_SOURCE // copy_file_range, SEEK_DATA and SEEK_HOLE
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "storage_mgr_backup.h"
+#include "storage_mgr_checksum.h"
+
+#define SM_BACKUP_LIST_CHUNK 4096 // page numbers of the list written or read at a time
+#define SM_BACKUP_COPY_BYTES (1024 * 1024) // buffer of the pread/pwrite fallback
+
+// Walks the pages that go in an archive, in increasing order
+typedef struct SM_BackupCursor {
+	SM_FileHandle *fHandle;
+	int incremental;
+	PageNumber next; // first page not looked at yet
+	PageNumber dataEnd; // full backup of an uncompressed file: end of the data extent that holds the pages below it
+} SM_BackupCursor;
+
+// local functions
+static PageNumber nextBackupPage (SM_BackupCursor *cursor);
+static RC copyPageRun (SM_FileHandle *fHandle, PageNumber firstPage, PageNumber numPages, int archiveFd,
+		off_t archiveOffset, long long *copiedBytes, char **buffer);
+static RC copyRange (int fromFd, off_t from, int toFd, off_t to, size_t length, long long *copiedBytes, char **buffer);
+static RC applyArchive (SM_FileHandle *fHandle, int archiveFd, const SM_BackupHeader *header,
+		const unsigned char *descriptor, long long *copiedBytes);
+static RC restorePageRun (SM_FileHandle *fHandle, int archiveFd, const SM_BackupHeader *header, PageNumber firstPage,
+		PageNumber firstIndex, PageNumber numPages, long long *copiedBytes, char **buffer);
+static RC writeList (int archiveFd, const PageNumber *list, PageNumber firstIndex, int count, unsigned int *crc);
+static int readList (int archiveFd, const SM_BackupHeader *header, PageNumber firstIndex, PageNumber *list);
+static RC readHeader (int archiveFd, SM_BackupHeader *header, unsigned char *descriptor);
+static unsigned int headerChecksum (const SM_BackupHeader *header);
+static void fillInfo (SM_BackupInfo *info, const SM_BackupHeader *header, const unsigned char *descriptor);
+static inline off_t filePageOffset (int pageSize, PageNumber pageNum);
+
+/************************************************************
+ *                    backup                                *
+ ************************************************************/
+RC
+backupPageFile (SM_FileHandle *fHandle, char *archiveName, int incremental, SM_BackupInfo *info)
+{
+	SM_BackupHeader header;
+	unsigned char descriptor[PAGE_SIZE];
+	long long copiedBytes = 0;
+
+	if (fHandle == NULL){
+		THROW(RC_FILE_HANDLE_NOT_INIT,"fHandle is NULL");
+	}
+	long long epoch = getChangeEpoch(fHandle);
+	if (epoch < 0){
+		THROW(RC_NO_CHANGE_TRACKING,"Changes of the file are not tracked");
+	}
+	if (incremental && epoch == 0){
+		THROW(RC_NO_BASE_BACKUP,"No backup to start an incremental one from");
+	}
+	/* The pages are copied from the file, what the handle wrote must be in it */
+	RC result = syncPageFile(fHandle);
+	if (result == RC_OK && fflush(fHandle->mgmtInfo.posixFileDescriptor) != 0){
+		result = RC_WRITE_FAILED;
+	}
+	if (result != RC_OK){
+		return result;
+	}
+	int fd = fileno(fHandle->mgmtInfo.posixFileDescriptor);
+	int archiveFd = open(archiveName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (archiveFd < 0){
+		THROW(RC_FILE_NOT_FOUND,"Could not create the archive");
+	}
+
+	memset(&header, 0, sizeof(SM_BackupHeader));
+	header.magic = SM_BACKUP_MAGIC;
+	header.version = SM_BACKUP_VERSION;
+	header.pageSize = fHandle->pageSize;
+	header.baseEpoch = incremental ? epoch : 0;
+	header.epoch = epoch + 1;
+	/* A first walk counts the pages so the images can start right after the list */
+	SM_BackupCursor cursor = { fHandle, incremental, 0, 0 };
+	while (nextBackupPage(&cursor) >= 0)
+		header.numPages ++;
+	off_t listEnd = SM_BACKUP_LIST_OFFSET + header.numPages * (off_t) sizeof(PageNumber);
+	header.dataOffset = (listEnd + header.pageSize - 1) / header.pageSize * header.pageSize;
+
+	/* The second one writes the list and copies each run of consecutive pages at once */
+	PageNumber *list = (PageNumber *) malloc(SM_BACKUP_LIST_CHUNK * sizeof(PageNumber));
+	char *buffer = NULL;
+	unsigned int crc = ~0U;
+	PageNumber index = 0, runFirst = 0, runIndex = 0, runLength = 0;
+	cursor = (SM_BackupCursor) { fHandle, incremental, 0, 0 };
+	while (result == RC_OK){
+		PageNumber pageNum = nextBackupPage(&cursor);
+		if (runLength > 0 && pageNum != runFirst + runLength){
+			result = copyPageRun(fHandle, runFirst, runLength, archiveFd,
+					header.dataOffset + (off_t) runIndex * header.pageSize, &copiedBytes, &buffer);
+			runLength = 0;
+		}
+		if (pageNum < 0)
+			break;
+		if (runLength == 0){
+			runFirst = pageNum;
+			runIndex = index;
+		}
+		runLength ++;
+		list[index % SM_BACKUP_LIST_CHUNK] = pageNum;
+		index ++;
+		if (index % SM_BACKUP_LIST_CHUNK == 0 && result == RC_OK)
+			result = writeList(archiveFd, list, index - SM_BACKUP_LIST_CHUNK, SM_BACKUP_LIST_CHUNK, &crc);
+	}
+	if (result == RC_OK && index % SM_BACKUP_LIST_CHUNK != 0)
+		result = writeList(archiveFd, list, index - index % SM_BACKUP_LIST_CHUNK, index % SM_BACKUP_LIST_CHUNK, &crc);
+	free(list);
+	free(buffer);
+
+	/* The descriptor page gives the page count, flags and free map to the restored file */
+	if (result == RC_OK && (pread(fd, descriptor, PAGE_SIZE, 0) != PAGE_SIZE
+			|| pwrite(archiveFd, descriptor, PAGE_SIZE, SM_BACKUP_DESCRIPTOR_OFFSET) != PAGE_SIZE)){
+		result = RC_WRITE_FAILED;
+	}
+	header.listChecksum = ~crc;
+	header.headerChecksum = headerChecksum(&header);
+	if (result == RC_OK && (pwrite(archiveFd, &header, sizeof(SM_BackupHeader), 0) != sizeof(SM_BackupHeader)
+			|| ftruncate(archiveFd, header.dataOffset + (off_t) header.numPages * header.pageSize) != 0)){
+		result = RC_WRITE_FAILED;
+	}
+	/* The marks are only cleared once the archive is safe, a failed backup leaves them to the next one */
+	if (result == RC_OK && fdatasync(archiveFd) != 0){
+		result = RC_SYNC_FAILED;
+	}
+	close(archiveFd);
+	if (result == RC_OK){
+		result = startChangeEpoch(fHandle, header.epoch);
+	}
+	if (result != RC_OK){
+		unlink(archiveName);
+		THROW(result,"The backup failed");
+	}
+	if (info != NULL){
+		fillInfo(info, &header, descriptor);
+		info->archiveBytes = header.dataOffset + (long long) header.numPages * header.pageSize;
+		info->copiedBytes = copiedBytes;
+	}
+	return RC_OK;
+}
+
+/************************************************************
+ *                    restore                               *
+ ************************************************************/
+RC
+restorePageFile (char *fileName, char *const *archiveNames, int numArchives, SM_BackupInfo *info)
+{
+	SM_FileHandle fh;
+	SM_BackupHeader header, previous;
+	unsigned char descriptor[PAGE_SIZE];
+	long long copiedBytes = 0;
+	int opened = 0;
+	RC result = RC_OK;
+
+	if (numArchives < 1){
+		THROW(RC_INVALID_BACKUP,"No archive to restore");
+	}
+	for (int i = 0; i < numArchives && result == RC_OK; i++){
+		int archiveFd = open(archiveNames[i], O_RDONLY);
+		if (archiveFd < 0){
+			result = RC_FILE_NOT_FOUND;
+			break;
+		}
+		result = readHeader(archiveFd, &header, descriptor);
+		if (result == RC_OK && ((i == 0 && header.baseEpoch != 0) || (i > 0 && (header.baseEpoch != previous.epoch
+				|| header.pageSize != previous.pageSize)))){
+			result = RC_BACKUP_CHAIN_BROKEN;
+		}
+		if (result == RC_OK && i == 0){
+			int flags;
+			memcpy(&flags, descriptor + SM_FLAGS_OFFSET, sizeof(int));
+			result = (flags & SM_FLAG_COMPRESSED) ? createCompressedPageFile(fileName)
+					: createPageFileWithPageSize(fileName, header.pageSize);
+			if (result == RC_OK && (result = openPageFile(fileName, &fh)) != RC_OK)
+				destroyPageFile(fileName);
+			opened = (result == RC_OK);
+		}
+		if (result == RC_OK)
+			result = applyArchive(&fh, archiveFd, &header, descriptor, &copiedBytes);
+		close(archiveFd);
+		previous = header;
+	}
+	if (opened){
+		/* A file that shrank after an earlier archive loses its tail */
+		PageNumber totalNumPages;
+		memcpy(&totalNumPages, descriptor + SM_TOTAL_PAGES_OFFSET, sizeof(PageNumber));
+		if (result == RC_OK && !(fh.mgmtInfo.flags & SM_FLAG_COMPRESSED) && totalNumPages < fh.totalNumPages
+				&& (fflush(fh.mgmtInfo.posixFileDescriptor) != 0
+					|| ftruncate(fileno(fh.mgmtInfo.posixFileDescriptor), filePageOffset(fh.pageSize, totalNumPages)) != 0)){
+			result = RC_WRITE_FAILED;
+		}
+		RC closeResult = closePageFile(&fh);
+		if (result == RC_OK)
+			result = closeResult;
+	}
+	/* Last the descriptor page of the last archive, with its page count and free map */
+	if (result == RC_OK){
+		int fd = open(fileName, O_WRONLY);
+		if (fd < 0 || pwrite(fd, descriptor, PAGE_SIZE, 0) != PAGE_SIZE || fdatasync(fd) != 0)
+			result = RC_WRITE_FAILED;
+		if (fd >= 0)
+			close(fd);
+	}
+	if (result != RC_OK){
+		if (opened)
+			destroyPageFile(fileName);
+		if (result == RC_BACKUP_CHAIN_BROKEN){
+			THROW(result,"An archive does not start from the epoch of the previous one");
+		}
+		THROW(result,"The restore failed");
+	}
+	if (info != NULL){
+		fillInfo(info, &header, descriptor);
+		info->copiedBytes = copiedBytes;
+	}
+	return RC_OK;
+}
+
+RC
+readBackupInfo (char *archiveName, SM_BackupInfo *info)
+{
+	SM_BackupHeader header;
+	unsigned char descriptor[PAGE_SIZE];
+	struct stat st;
+
+	int archiveFd = open(archiveName, O_RDONLY);
+	if (archiveFd < 0){
+		THROW(RC_FILE_NOT_FOUND,"Could not open the archive");
+	}
+	RC result = readHeader(archiveFd, &header, descriptor);
+	if (result == RC_OK){
+		fillInfo(info, &header, descriptor);
+		info->archiveBytes = (fstat(archiveFd, &st) == 0) ? st.st_size : 0;
+	}
+	close(archiveFd);
+	return result;
+}
+
+/************************************************************
+ *                    local functions                       *
+ ************************************************************/
+/* Next page of the archive, -1 after the last one. An incremental backup takes the marked pages, a full one every
+ * page that is not free and has data: holes found with SEEK_DATA/SEEK_HOLE (one pair of calls per extent) and pages
+ * of a compressed file without slot (of a file with page indirection without physical page) are left out, they read as
+ * zeros anyway */
+PageNumber
+nextBackupPage (SM_BackupCursor *cursor)
+{
+	SM_FileHandle *fHandle = cursor->fHandle;
+	SM_FileManagementInfo *info = &(fHandle->mgmtInfo);
+
+	while (cursor->next < fHandle->totalNumPages){
+		PageNumber pageNum = cursor->next;
+		if (cursor->incremental){
+			PageNumber byte = SM_CHANGE_MAP_HEADER + pageNum / 8;
+			if (byte >= info->changeMapCapacity)
+				break;
+			if (pageNum % 8 == 0 && info->changeMap[byte] == 0){ // 8 pages without a mark
+				cursor->next += 8;
+				continue;
+			}
+			cursor->next ++;
+			if (isPageChanged(fHandle, pageNum))
+				return pageNum;
+			continue;
+		}
+		cursor->next ++;
+		if (pageNum < SM_FREE_MAP_PAGES && (info->freeMap[pageNum / 8] >> (pageNum % 8)) & 1)
+			continue;
+		if (info->flags & SM_FLAG_COMPRESSED){
+			if (pageNum < info->pageMapCapacity && info->pageMap[pageNum].offset != 0)
+				return pageNum;
+			continue;
+		}
+		if (info->indirectionFd >= 0){ // the holes of the file are not the ones of the pages
+			if (getPhysicalPage(fHandle, pageNum) != SM_NO_PHYSICAL_PAGE)
+				return pageNum;
+			continue;
+		}
+		if (pageNum >= cursor->dataEnd){
+			int fd = fileno(info->posixFileDescriptor);
+			off_t data = lseek(fd, filePageOffset(fHandle->pageSize, pageNum), SEEK_DATA);
+			if (data < 0 && errno == ENXIO) // only holes up to the end of the file
+				break;
+			off_t hole = (data < 0) ? -1 : lseek(fd, data, SEEK_HOLE);
+			if (hole < 0){ // no hole detection, every page has data
+				cursor->dataEnd = fHandle->totalNumPages;
+				return pageNum;
+			}
+			PageNumber first = (data - ACCESSIBLE_PAGE_OFFSET) / fHandle->pageSize;
+			cursor->dataEnd = (hole - ACCESSIBLE_PAGE_OFFSET + fHandle->pageSize - 1) / fHandle->pageSize;
+			if (first > pageNum){
+				cursor->next = first;
+				continue;
+			}
+		}
+		return pageNum;
+	}
+	cursor->next = fHandle->totalNumPages;
+	return -1;
+}
+
+/* Copies numPages pages from firstPage on to the archive, the pages of a compressed file or of a file with page
+ * indirection are read one by one */
+RC
+copyPageRun (SM_FileHandle *fHandle, PageNumber firstPage, PageNumber numPages, int archiveFd, off_t archiveOffset,
+		long long *copiedBytes, char **buffer)
+{
+	if (!(fHandle->mgmtInfo.flags & SM_FLAG_COMPRESSED) && fHandle->mgmtInfo.indirectionFd < 0){
+		return copyRange(fileno(fHandle->mgmtInfo.posixFileDescriptor), filePageOffset(fHandle->pageSize, firstPage),
+				archiveFd, archiveOffset, (size_t) numPages * fHandle->pageSize, copiedBytes, buffer);
+	}
+	if (*buffer == NULL)
+		*buffer = (char *) malloc(SM_BACKUP_COPY_BYTES);
+	for (PageNumber i = 0; i < numPages; i++){
+		RC result = readBlock(firstPage + i, fHandle, *buffer);
+		if (result != RC_OK)
+			return result;
+		if (pwrite(archiveFd, *buffer, fHandle->pageSize, archiveOffset + i * fHandle->pageSize) != fHandle->pageSize){
+			THROW(RC_WRITE_FAILED,"Could not write the archive");
+		}
+	}
+	return RC_OK;
+}
+
+/* copy_file_range, or pread and pwrite through *buffer once the file systems refused it. A source that ends early
+ * leaves the rest of the range to read as zeros */
+RC
+copyRange (int fromFd, off_t from, int toFd, off_t to, size_t length, long long *copiedBytes, char **buffer)
+{
+	while (length > 0){
+		if (*buffer == NULL){
+			ssize_t copied = copy_file_range(fromFd, &from, toFd, &to, length, 0);
+			if (copied > 0){
+				length -= copied;
+				*copiedBytes += copied;
+				continue;
+			}
+			if (copied == 0)
+				break;
+			if (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EINVAL){
+				THROW(RC_WRITE_FAILED,"Could not copy the pages");
+			}
+			*buffer = (char *) malloc(SM_BACKUP_COPY_BYTES);
+		}
+		size_t chunk = (length < SM_BACKUP_COPY_BYTES) ? length : SM_BACKUP_COPY_BYTES;
+		ssize_t numRead = pread(fromFd, *buffer, chunk, from);
+		if (numRead < 0){
+			THROW(RC_READ_FAILED,"Could not read the pages");
+		}
+		if (numRead == 0)
+			break;
+		if (pwrite(toFd, *buffer, numRead, to) != numRead){
+			THROW(RC_WRITE_FAILED,"Could not write the pages");
+		}
+		from += numRead;
+		to += numRead;
+		length -= numRead;
+	}
+	return RC_OK;
+}
+
+/* Checks the page list of the archive, then copies its images to their pages */
+RC
+applyArchive (SM_FileHandle *fHandle, int archiveFd, const SM_BackupHeader *header, const unsigned char *descriptor,
+		long long *copiedBytes)
+{
+	PageNumber totalNumPages;
+	memcpy(&totalNumPages, descriptor + SM_TOTAL_PAGES_OFFSET, sizeof(PageNumber));
+	RC result = ensureCapacity(totalNumPages, fHandle);
+	if (result != RC_OK)
+		return result;
+
+	PageNumber *list = (PageNumber *) malloc(SM_BACKUP_LIST_CHUNK * sizeof(PageNumber));
+	char *buffer = NULL;
+	unsigned int crc = ~0U;
+	PageNumber last = -1;
+	/* The whole list is checked before a page is touched: its checksum, increasing pages of the file */
+	for (PageNumber index = 0; index < header->numPages && result == RC_OK; index += SM_BACKUP_LIST_CHUNK){
+		int count = readList(archiveFd, header, index, list);
+		if (count < 0){
+			result = RC_INVALID_BACKUP;
+			break;
+		}
+		crc = crc32cUpdate(crc, list, count * sizeof(PageNumber));
+		for (int i = 0; i < count; i++){
+			if (list[i] <= last || list[i] >= totalNumPages)
+				result = RC_INVALID_BACKUP;
+			last = list[i];
+		}
+	}
+	if (result == RC_OK && ~crc != header->listChecksum)
+		result = RC_INVALID_BACKUP;
+	/* The extension is in the file before pages are copied behind the handle */
+	if (result == RC_OK && fflush(fHandle->mgmtInfo.posixFileDescriptor) != 0)
+		result = RC_WRITE_FAILED;
+
+	PageNumber runFirst = 0, runIndex = 0, runLength = 0;
+	for (PageNumber index = 0; index < header->numPages && result == RC_OK; index += SM_BACKUP_LIST_CHUNK){
+		int count = readList(archiveFd, header, index, list);
+		for (int i = 0; i < count && result == RC_OK; i++){
+			if (runLength > 0 && list[i] != runFirst + runLength){
+				result = restorePageRun(fHandle, archiveFd, header, runFirst, runIndex, runLength, copiedBytes, &buffer);
+				runLength = 0;
+			}
+			if (runLength == 0){
+				runFirst = list[i];
+				runIndex = index + i;
+			}
+			runLength ++;
+		}
+	}
+	if (result == RC_OK && runLength > 0)
+		result = restorePageRun(fHandle, archiveFd, header, runFirst, runIndex, runLength, copiedBytes, &buffer);
+	free(list);
+	free(buffer);
+	if (result == RC_INVALID_BACKUP){
+		THROW(RC_INVALID_BACKUP,"The page list of the archive is corrupted");
+	}
+	return result;
+}
+
+/* Copies numPages images from firstIndex on to the pages from firstPage on, through the handle for a compressed file */
+RC
+restorePageRun (SM_FileHandle *fHandle, int archiveFd, const SM_BackupHeader *header, PageNumber firstPage,
+		PageNumber firstIndex, PageNumber numPages, long long *copiedBytes, char **buffer)
+{
+	off_t from = header->dataOffset + (off_t) firstIndex * header->pageSize;
+	if (!(fHandle->mgmtInfo.flags & SM_FLAG_COMPRESSED)){
+		return copyRange(archiveFd, from, fileno(fHandle->mgmtInfo.posixFileDescriptor),
+				filePageOffset(fHandle->pageSize, firstPage), (size_t) numPages * header->pageSize, copiedBytes, buffer);
+	}
+	if (*buffer == NULL)
+		*buffer = (char *) malloc(SM_BACKUP_COPY_BYTES);
+	for (PageNumber i = 0; i < numPages; i++){
+		if (pread(archiveFd, *buffer, PAGE_SIZE, from + i * PAGE_SIZE) != PAGE_SIZE){
+			THROW(RC_INVALID_BACKUP,"The archive is truncated");
+		}
+		RC result = writeBlock(firstPage + i, fHandle, *buffer);
+		if (result != RC_OK)
+			return result;
+	}
+	return RC_OK;
+}
+
+/* count entries of the page list from firstIndex on */
+RC
+writeList (int archiveFd, const PageNumber *list, PageNumber firstIndex, int count, unsigned int *crc)
+{
+	size_t bytes = count * sizeof(PageNumber);
+	*crc = crc32cUpdate(*crc, list, bytes);
+	if (pwrite(archiveFd, list, bytes, SM_BACKUP_LIST_OFFSET + firstIndex * (off_t) sizeof(PageNumber)) != (ssize_t) bytes){
+		THROW(RC_WRITE_FAILED,"Could not write the archive");
+	}
+	return RC_OK;
+}
+
+/* Reads up to SM_BACKUP_LIST_CHUNK entries from firstIndex on, returns their number or -1 */
+int
+readList (int archiveFd, const SM_BackupHeader *header, PageNumber firstIndex, PageNumber *list)
+{
+	PageNumber left = header->numPages - firstIndex;
+	int count = (left < SM_BACKUP_LIST_CHUNK) ? (int) left : SM_BACKUP_LIST_CHUNK;
+	size_t bytes = count * sizeof(PageNumber);
+	if (pread(archiveFd, list, bytes, SM_BACKUP_LIST_OFFSET + firstIndex * (off_t) sizeof(PageNumber)) != (ssize_t) bytes)
+		return -1;
+	return count;
+}
+
+/* Header and descriptor page of an archive, checked */
+RC
+readHeader (int archiveFd, SM_BackupHeader *header, unsigned char *descriptor)
+{
+	if (pread(archiveFd, header, sizeof(SM_BackupHeader), 0) != sizeof(SM_BackupHeader)
+			|| pread(archiveFd, descriptor, PAGE_SIZE, SM_BACKUP_DESCRIPTOR_OFFSET) != PAGE_SIZE
+			|| header->magic != SM_BACKUP_MAGIC || header->version != SM_BACKUP_VERSION
+			|| header->headerChecksum != headerChecksum(header)){
+		THROW(RC_INVALID_BACKUP,"Not an archive of a page file");
+	}
+	if (header->pageSize < PAGE_SIZE || header->pageSize > SM_MAX_PAGE_SIZE || (header->pageSize & (header->pageSize - 1))
+			|| header->numPages < 0
+			|| header->dataOffset < SM_BACKUP_LIST_OFFSET + header->numPages * (long long) sizeof(PageNumber)){
+		THROW(RC_INVALID_BACKUP,"The archive header is corrupted");
+	}
+	return RC_OK;
+}
+
+unsigned int
+headerChecksum (const SM_BackupHeader *header)
+{
+	return crc32c(header, offsetof(SM_BackupHeader, headerChecksum));
+}
+
+void
+fillInfo (SM_BackupInfo *info, const SM_BackupHeader *header, const unsigned char *descriptor)
+{
+	memset(info, 0, sizeof(SM_BackupInfo));
+	info->baseEpoch = header->baseEpoch;
+	info->epoch = header->epoch;
+	info->numPages = header->numPages;
+	memcpy(&(info->totalNumPages), descriptor + SM_TOTAL_PAGES_OFFSET, sizeof(PageNumber));
+}
+
+off_t
+filePageOffset (int pageSize, PageNumber pageNum)
+{
+	return (off_t) ACCESSIBLE_PAGE_OFFSET + (off_t) pageNum * pageSize;
+}
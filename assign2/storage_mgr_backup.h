@@ -0,0 +1,57 @@
+#ifndef STORAGE_MGR_BACKUP_H
+#define STORAGE_MGR_BACKUP_H
+
+#include "storage_mgr.h"
+
+/* Full and incremental backups of page files with change tracking (enableChangeTracking).
+ * A full backup holds every page with data (holes and free pages are left out), an incremental one the pages marked
+ * in the change map since the last backup. Either way the change map is cleared and the epoch of the file moves to
+ * the one of the archive once the archive is on disk, so a failed backup leaves the marks for the next one.
+ * An archive is a header block, the descriptor page of the file, the list of its page numbers then the page images,
+ * aligned on the page size. Images are copied from the page file with copy_file_range, so the data never goes
+ * through user space (and a file system with reflinks can share the blocks), with a pread/pwrite fallback when the
+ * two files are not on a file system that supports it. Pages of a compressed file are read and stored uncompressed, the
+ * ones of a file with page indirection are read through its page map and stored in page order.
+ *
+ * restorePageFile rebuilds a page file from a full archive followed by the incremental ones taken after it, each
+ * must start from the epoch of the previous one (RC_BACKUP_CHAIN_BROKEN), a failed restore removes the file. The
+ * restored file has no sidecars: enable change tracking again and take a new full backup before the next incremental
+ * one. restore_page_file.c is the command line version. */
+
+#define SM_BACKUP_MAGIC 0x4B424D53 // "SMBK" in little endian
+#define SM_BACKUP_VERSION 1
+#define SM_BACKUP_DESCRIPTOR_OFFSET PAGE_SIZE // the header block is PAGE_SIZE bytes
+#define SM_BACKUP_LIST_OFFSET (2 * PAGE_SIZE)
+
+typedef struct SM_BackupHeader {
+	unsigned int magic;
+	int version;
+	int pageSize;
+	unsigned int listChecksum; // CRC-32C of the page list
+	long long baseEpoch; // epoch the archive applies to, 0 for a full backup
+	long long epoch; // epoch of the file once the archive is applied
+	PageNumber numPages; // pages in the archive
+	long long dataOffset; // first image, the one of the i-th page of the list is at dataOffset + i * pageSize
+	unsigned int headerChecksum; // CRC-32C of the fields above
+} SM_BackupHeader;
+
+typedef struct SM_BackupInfo {
+	long long baseEpoch;
+	long long epoch;
+	PageNumber numPages; // pages in the archive
+	PageNumber totalNumPages; // pages of the file
+	long long archiveBytes;
+	long long copiedBytes; // of the images, copied in the kernel with copy_file_range
+} SM_BackupInfo;
+
+// Writes an archive of the file: every page if incremental is 0, else the pages changed since the last backup
+// (RC_NO_BASE_BACKUP before the first one). The pages written through the handle are synced first.
+RC backupPageFile(SM_FileHandle *fHandle, char *archiveName, int incremental, SM_BackupInfo *info); // info may be NULL
+
+// Creates fileName from a chain of archives, info (may be NULL) describes the last one
+RC restorePageFile(char *fileName, char *const *archiveNames, int numArchives, SM_BackupInfo *info);
+
+// Reads and checks the header of an archive
+RC readBackupInfo(char *archiveName, SM_BackupInfo *info);
+
+#endif
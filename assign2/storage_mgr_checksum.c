@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "storage_mgr_checksum.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // reflected Castagnoli polynomial
+#define CRC32C_STREAM_BYTES 1360 // each of the 3 interleaved streams, 3 * 1360 + 16 = PAGE_SIZE
+
+// local functions
+static unsigned int crc32cScalar (unsigned int crc, const unsigned char *data, size_t length);
+static unsigned int crc32cResolve (unsigned int crc, const unsigned char *data, size_t length);
+static void initTables (void);
+
+// Dispatch pointer, it starts on a resolver that picks the implementation on first use
+static unsigned int (*crc32cImpl) (unsigned int, const unsigned char *, size_t) = crc32cResolve;
+static ChecksumImplementation currentImplementation = CHECKSUM_SCALAR;
+static int resolved = 0;
+
+// sliceTables[k][b]: register after b followed by k zero bytes
+static uint32_t sliceTables[8][256];
+// shiftTables[k][b]: register (b << 8k) after CRC32C_STREAM_BYTES zero bytes, to combine interleaved streams
+static uint32_t shiftTables[4][256];
+
+/************************************************************
+ *                    slice-by-8 fallback                   *
+ ************************************************************/
+unsigned int
+crc32cScalar (unsigned int crc, const unsigned char *data, size_t length)
+{
+	while (length > 0 && ((uintptr_t) data & 7) != 0){
+		crc = sliceTables[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+		length--;
+	}
+	while (length >= 8){
+		uint64_t word;
+		memcpy(&word, data, 8);
+		word ^= crc;
+		crc = sliceTables[7][word & 0xff] ^ sliceTables[6][(word >> 8) & 0xff]
+				^ sliceTables[5][(word >> 16) & 0xff] ^ sliceTables[4][(word >> 24) & 0xff]
+				^ sliceTables[3][(word >> 32) & 0xff] ^ sliceTables[2][(word >> 40) & 0xff]
+				^ sliceTables[1][(word >> 48) & 0xff] ^ sliceTables[0][word >> 56];
+		data += 8;
+		length -= 8;
+	}
+	while (length > 0){
+		crc = sliceTables[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+		length--;
+	}
+	return crc;
+}
+
+#ifdef CHECKSUM_X86
+/************************************************************
+ *                    SSE4.2                                *
+ ************************************************************/
+__attribute__((target("sse4.2")))
+static unsigned int
+crc32cSequentialSSE42 (unsigned int crc, const unsigned char *data, size_t length)
+{
+	uint64_t crc64 = crc;
+	while (length > 0 && ((uintptr_t) data & 7) != 0){
+		crc64 = _mm_crc32_u8((unsigned int) crc64, *data++);
+		length--;
+	}
+	for (; length >= 8; length -= 8, data += 8){
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	while (length > 0){
+		crc64 = _mm_crc32_u8((unsigned int) crc64, *data++);
+		length--;
+	}
+	return (unsigned int) crc64;
+}
+
+// The crc32 instruction has a 3 cycle latency and a 1 cycle throughput: three independent streams keep it busy,
+// their registers are then combined with shiftTables
+__attribute__((target("sse4.2")))
+static unsigned int
+crc32cSSE42 (unsigned int crc, const unsigned char *data, size_t length)
+{
+	while (length >= 3 * CRC32C_STREAM_BYTES){
+		uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+		const unsigned char *stream1 = data + CRC32C_STREAM_BYTES;
+		const unsigned char *stream2 = data + 2 * CRC32C_STREAM_BYTES;
+		for (int i = 0; i < CRC32C_STREAM_BYTES; i += 8){
+			uint64_t word0, word1, word2;
+			memcpy(&word0, data + i, 8);
+			memcpy(&word1, stream1 + i, 8);
+			memcpy(&word2, stream2 + i, 8);
+			crc0 = _mm_crc32_u64(crc0, word0);
+			crc1 = _mm_crc32_u64(crc1, word1);
+			crc2 = _mm_crc32_u64(crc2, word2);
+		}
+		uint32_t shifted = (uint32_t) crc0;
+		shifted = shiftTables[0][shifted & 0xff] ^ shiftTables[1][(shifted >> 8) & 0xff]
+				^ shiftTables[2][(shifted >> 16) & 0xff] ^ shiftTables[3][shifted >> 24];
+		shifted ^= (uint32_t) crc1;
+		shifted = shiftTables[0][shifted & 0xff] ^ shiftTables[1][(shifted >> 8) & 0xff]
+				^ shiftTables[2][(shifted >> 16) & 0xff] ^ shiftTables[3][shifted >> 24];
+		crc = shifted ^ (uint32_t) crc2;
+		data += 3 * CRC32C_STREAM_BYTES;
+		length -= 3 * CRC32C_STREAM_BYTES;
+	}
+	return crc32cSequentialSSE42(crc, data, length);
+}
+#endif
+
+/************************************************************
+ *                    tables                                *
+ ************************************************************/
+void
+initTables (void)
+{
+	static const unsigned char zeros[CRC32C_STREAM_BYTES];
+
+	for (int b = 0; b < 256; b++){
+		uint32_t crc = b;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		sliceTables[0][b] = crc;
+	}
+	for (int b = 0; b < 256; b++){
+		for (int k = 1; k < 8; k++)
+			sliceTables[k][b] = sliceTables[0][sliceTables[k - 1][b] & 0xff] ^ (sliceTables[k - 1][b] >> 8);
+	}
+	// The register update is linear, so shifting by zeros is the xor of the shifts of each byte of the register
+	for (int k = 0; k < 4; k++){
+		for (int b = 0; b < 256; b++)
+			shiftTables[k][b] = crc32cScalar((uint32_t) b << (8 * k), zeros, CRC32C_STREAM_BYTES);
+	}
+}
+
+/************************************************************
+ *                    dispatch                              *
+ ************************************************************/
+static void
+resolveImplementation (void)
+{
+	ChecksumImplementation best = CHECKSUM_SCALAR;
+	initTables();
+#ifdef CHECKSUM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")){
+		best = CHECKSUM_SSE42;
+	}
+#endif
+	resolved = 1;
+	setChecksumImplementation(best);
+}
+
+unsigned int
+crc32cResolve (unsigned int crc, const unsigned char *data, size_t length)
+{
+	resolveImplementation();
+	return crc32cImpl(crc, data, length);
+}
+
+unsigned int
+crc32cUpdate (unsigned int crc, const void *data, size_t length)
+{
+	return crc32cImpl(crc, (const unsigned char *) data, length);
+}
+
+unsigned int
+crc32c (const void *data, size_t length)
+{
+	return ~crc32cImpl(~0u, (const unsigned char *) data, length);
+}
+
+ChecksumImplementation
+getChecksumImplementation (void)
+{
+	if (!resolved){
+		resolveImplementation();
+	}
+	return currentImplementation;
+}
+
+void
+setChecksumImplementation (ChecksumImplementation implementation)
+{
+	if (!resolved){
+		resolveImplementation();
+	}
+	currentImplementation = CHECKSUM_SCALAR;
+	crc32cImpl = crc32cScalar;
+#ifdef CHECKSUM_X86
+	if (implementation >= CHECKSUM_SSE42 && __builtin_cpu_supports("sse4.2")){
+		currentImplementation = CHECKSUM_SSE42;
+		crc32cImpl = crc32cSSE42;
+	}
+#endif
+}
@@ -0,0 +1,27 @@
+#ifndef STORAGE_MGR_CHECKSUM_H
+#define STORAGE_MGR_CHECKSUM_H
+
+#include <stddef.h>
+
+/* CRC-32C (Castagnoli) of pages and of the free map.
+ * The implementation (SSE4.2 crc32 instruction or slice-by-8 tables) is chosen at runtime from the CPU features
+ * the first time a checksum is computed. */
+
+typedef enum ChecksumImplementation {
+	CHECKSUM_SCALAR = 0,
+	CHECKSUM_SSE42 = 1
+} ChecksumImplementation;
+
+// Update of the CRC register, without the initial and final inversions (so zeros leave a 0 register unchanged)
+unsigned int crc32cUpdate(unsigned int crc, const void *data, size_t length);
+
+// Standard CRC-32C of a buffer ("123456789" gives 0xE3069283)
+unsigned int crc32c(const void *data, size_t length);
+
+// Implementation selected for this CPU
+ChecksumImplementation getChecksumImplementation(void);
+
+// Force an implementation (used by tests and benchmarks), the scalar one is used if the CPU lacks SSE4.2
+void setChecksumImplementation(ChecksumImplementation implementation);
+
+#endif
@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "storage_mgr_compress.h"
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the block always ends with literals
+#define LZ4_MATCH_LIMIT 12 // no match starts in the last 12 bytes
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12
+#define LZ4_SKIP_SHIFT 6 // after 2^6 failed probes the search moves 2 bytes at a time, then 3...
+
+// local functions
+static inline uint32_t read32 (const unsigned char *p);
+static inline uint64_t read64 (const unsigned char *p);
+static inline uint32_t hash4 (uint32_t value);
+static unsigned char *writeLength (unsigned char *op, int length);
+
+uint32_t
+read32 (const unsigned char *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+uint64_t
+read64 (const unsigned char *p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+uint32_t
+hash4 (uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// Extra bytes of a length that does not fit in its 4 bits of the token (length - 15 in 255 steps)
+unsigned char *
+writeLength (unsigned char *op, int length)
+{
+	for (length -= 15; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char) length;
+	return op;
+}
+
+/************************************************************
+ *                    compression                           *
+ ************************************************************/
+int
+compressBlock (const char *src, int srcLength, char *dst, int dstCapacity)
+{
+	const unsigned char *base = (const unsigned char *) src;
+	const unsigned char *end = base + srcLength;
+	const unsigned char *ip = base;
+	const unsigned char *anchor = base; // first byte not yet emitted
+	unsigned char *op = (unsigned char *) dst;
+	unsigned char *opEnd = op + dstCapacity;
+	uint16_t table[1 << LZ4_HASH_BITS]; // position of the last 4 bytes seen with each hash (blocks are at most 64KB)
+
+	if (srcLength > LZ4_MATCH_LIMIT){
+		const unsigned char *matchStartLimit = end - LZ4_MATCH_LIMIT;
+		const unsigned char *matchEndLimit = end - LZ4_LAST_LITERALS;
+		int misses = 0;
+		memset(table, 0, sizeof(table));
+		ip++;
+		while (ip <= matchStartLimit){
+			uint32_t h = hash4(read32(ip));
+			const unsigned char *ref = base + table[h];
+			table[h] = (uint16_t) (ip - base);
+			if (ip - ref > LZ4_MAX_OFFSET || read32(ref) != read32(ip)){
+				ip += 1 + (misses++ >> LZ4_SKIP_SHIFT);
+				continue;
+			}
+			misses = 0;
+			while (ip > anchor && ref > base && ip[-1] == ref[-1]){
+				ip--;
+				ref--;
+			}
+			// forward 8 bytes at a time, the first differing byte is the lowest set byte of the xor
+			const unsigned char *matchEnd = ip + LZ4_MIN_MATCH;
+			const unsigned char *refEnd = ref + LZ4_MIN_MATCH;
+			uint64_t diff = 0;
+			while (matchEnd + 8 <= matchEndLimit && (diff = read64(matchEnd) ^ read64(refEnd)) == 0){
+				matchEnd += 8;
+				refEnd += 8;
+			}
+			if (diff != 0){
+				matchEnd += __builtin_ctzll(diff) >> 3;
+			} else {
+				while (matchEnd < matchEndLimit && *matchEnd == *refEnd){
+					matchEnd++;
+					refEnd++;
+				}
+			}
+			int literalLength = (int) (ip - anchor);
+			int matchLength = (int) (matchEnd - ip) - LZ4_MIN_MATCH;
+			// token, literal length, literals, offset, match length
+			if (op + 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1 > opEnd){
+				return 0;
+			}
+			unsigned char *token = op++;
+			*token = (unsigned char) ((literalLength >= 15 ? 15 : literalLength) << 4);
+			if (literalLength >= 15)
+				op = writeLength(op, literalLength);
+			memcpy(op, anchor, literalLength);
+			op += literalLength;
+			uint16_t offset = (uint16_t) (ip - ref);
+			*op++ = (unsigned char) (offset & 0xff);
+			*op++ = (unsigned char) (offset >> 8);
+			*token |= (unsigned char) (matchLength >= 15 ? 15 : matchLength);
+			if (matchLength >= 15)
+				op = writeLength(op, matchLength);
+			ip = matchEnd;
+			anchor = ip;
+			if (ip <= matchStartLimit){
+				table[hash4(read32(ip - 2))] = (uint16_t) (ip - 2 - base);
+			}
+		}
+	}
+	// last literals
+	int literalLength = (int) (end - anchor);
+	if (op + 1 + literalLength / 255 + 1 + literalLength > opEnd){
+		return 0;
+	}
+	unsigned char *token = op++;
+	*token = (unsigned char) ((literalLength >= 15 ? 15 : literalLength) << 4);
+	if (literalLength >= 15)
+		op = writeLength(op, literalLength);
+	memcpy(op, anchor, literalLength);
+	op += literalLength;
+	return (int) (op - (unsigned char *) dst);
+}
+
+/************************************************************
+ *                    decompression                         *
+ ************************************************************/
+int
+decompressBlock (const char *src, int srcLength, char *dst, int dstCapacity)
+{
+	const unsigned char *ip = (const unsigned char *) src;
+	const unsigned char *end = ip + srcLength;
+	unsigned char *base = (unsigned char *) dst;
+	unsigned char *op = base;
+	unsigned char *opEnd = base + dstCapacity;
+
+	while (ip < end){
+		unsigned int token = *ip++;
+		size_t literalLength = token >> 4;
+		if (literalLength == 15){
+			unsigned int extra;
+			do {
+				if (ip >= end)
+					return -1;
+				extra = *ip++;
+				literalLength += extra;
+			} while (extra == 255);
+		}
+		if (literalLength > (size_t) (end - ip) || literalLength > (size_t) (opEnd - op)){
+			return -1;
+		}
+		// short literals are copied as 16 bytes when both buffers have room, one fixed size copy
+		if (literalLength <= 16 && end - ip >= 16 && opEnd - op >= 16)
+			memcpy(op, ip, 16);
+		else
+			memcpy(op, ip, literalLength);
+		op += literalLength;
+		ip += literalLength;
+		if (ip == end){ // the last sequence has no match
+			break;
+		}
+		if (end - ip < 2){
+			return -1;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t) (op - base)){
+			return -1;
+		}
+		size_t matchLength = (token & 15) + LZ4_MIN_MATCH;
+		if ((token & 15) == 15){
+			unsigned int extra;
+			do {
+				if (ip >= end)
+					return -1;
+				extra = *ip++;
+				matchLength += extra;
+			} while (extra == 255);
+		}
+		if (matchLength > (size_t) (opEnd - op)){
+			return -1;
+		}
+		// 8 bytes at a time when the match is at least 8 bytes back (every chunk reads bytes already written),
+		// else an overlapping match repeats its first offset bytes, copied in chunks that double each time
+		const unsigned char *match = op - offset;
+		if (offset >= 8 && (size_t) (opEnd - op) >= matchLength + 8){
+			for (size_t copied = 0; copied < matchLength; copied += 8)
+				memcpy(op + copied, match + copied, 8);
+			op += matchLength;
+			continue;
+		}
+		while (matchLength > 0){
+			size_t chunk = (size_t) (op - match);
+			if (chunk > matchLength)
+				chunk = matchLength;
+			memcpy(op, match, chunk);
+			op += chunk;
+			matchLength -= chunk;
+		}
+	}
+	return (int) (op - base);
+}
@@ -0,0 +1,14 @@
+#ifndef STORAGE_MGR_COMPRESS_H
+#define STORAGE_MGR_COMPRESS_H
+
+/* Page codec of compressed page files, in the LZ4 block format (sequences of literals and matches of at least
+ * 4 bytes up to 64KB back, the last 5 bytes are literals). Greedy single hash probe: fast rather than tight. */
+
+// Compresses src into dst, returns the compressed length or 0 if it needs more than dstCapacity bytes
+// (srcLength at most 64KB)
+int compressBlock(const char *src, int srcLength, char *dst, int dstCapacity);
+
+// Decompresses src into dst, returns the decompressed length or -1 if src is malformed or does not fit in dstCapacity
+int decompressBlock(const char *src, int srcLength, char *dst, int dstCapacity);
+
+#endif
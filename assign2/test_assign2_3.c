@@ -0,0 +1,2201 @@
+#include "storage_mgr.h"
+#include "buffer_mgr_stat.h"
+#include "buffer_mgr.h"
+#include "buffer_mgr_scan.h"
+#include "buffer_mgr_memory.h"
+#include "buffer_mgr_budget.h"
+#include "buffer_mgr_trace.h"
+#include "buffer_mgr_checkpoint.h"
+#include "buffer_mgr_defrag.h"
+#include "storage_mgr_checksum.h"
+#include "storage_mgr_compress.h"
+#include "storage_mgr_backup.h"
+#include "dberror.h"
+#include "test_helper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// var to store the current test's name
+char *testName;
+
+// check whether two the content of a buffer pool is the same as an expected content
+// (given in the format produced by sprintPoolContent)
+#define ASSERT_EQUALS_POOL(expected,bm,message)                    \
+do {                                    \
+char *real;                                \
+char *_exp = (char *) (expected);                                   \
+real = sprintPoolContent(bm);                    \
+if (strcmp((_exp),real) != 0)                    \
+{                                    \
+printf("[%s-%s-L%i-%s] FAILED: expected <%s> but was <%s>: %s\n",TEST_INFO, _exp, real, message); \
+free(real);                            \
+exit(1);                            \
+}                                    \
+printf("[%s-%s-L%i-%s] OK: expected <%s> and was <%s>: %s\n",TEST_INFO, _exp, real, message); \
+free(real);                                \
+} while(0)
+
+// test and helper methods
+static void createDummyPages(BM_BufferPool *bm, int num);
+
+static void testScanImplementations (void);
+static void testLargePoolFIFO (void);
+static void testPoolConfig (void);
+static void testNumaPartitionRanges (void);
+static void testResize (void);
+static void testConcurrentResize (void);
+static void testLazyFrameInit (void);
+static void testMultiFilePool (void);
+static void testBudgetManager (void);
+static void testPoolStats (void);
+static void testPoolSnapshot (void);
+static void testPoolTrace (void);
+static void testNewPage (void);
+static void testFreePages (void);
+static void testLargeFiles (void);
+static void testPageChecksums (void);
+static void testCompressedFiles (void);
+static void testWriteAheadLog (void);
+static void testDurability (void);
+static void testDoubleWrite (void);
+static void testCheckpoint (void);
+static void testPageSizes (void);
+static void testHolePunching (void);
+static void testBackup (void);
+static void testDefrag (void);
+static long long allocatedBytes (const char *fileName);
+static void *commitRecords (void *log);
+static void *pinRandomPages (void *bm);
+
+// main method
+int
+main (void)
+{
+    initStorageManager();
+    testName = "";
+
+    testScanImplementations();
+    testLargePoolFIFO();
+    testPoolConfig();
+    testNumaPartitionRanges();
+    testResize();
+    testConcurrentResize();
+    testLazyFrameInit();
+    testMultiFilePool();
+    testBudgetManager();
+    testPoolStats();
+    testPoolSnapshot();
+    testPoolTrace();
+    testNewPage();
+    testFreePages();
+    testLargeFiles();
+    testPageChecksums();
+    testCompressedFiles();
+    testWriteAheadLog();
+    testDurability();
+    testDoubleWrite();
+    testCheckpoint();
+    testPageSizes();
+    testHolePunching();
+    testBackup();
+    testDefrag();
+    return 0;
+}
+
+
+// 64KB pages in a file (checksums and double-write included) and in a pool, sizes that are refused,
+// a pool does not mix page sizes
+void
+testPageSizes (void)
+{
+    const int bigPage = 16 * PAGE_SIZE;
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PoolConfig config = BM_DEFAULT_POOL_CONFIG;
+    SM_FileHandle fh;
+    SM_PageHandle page = (SM_PageHandle) malloc(bigPage);
+    SM_PageHandle readBack = (SM_PageHandle) malloc(bigPage);
+    int fileId;
+    RC result;
+    testName = "page sizes";
+
+    result = createPageFileWithPageSize("testbuffer.bin", 3000);
+    ASSERT_EQUALS_INT(RC_INVALID_PAGE_SIZE, result, "not a power of two");
+    result = createPageFileWithPageSize("testbuffer.bin", 2 * SM_MAX_PAGE_SIZE);
+    ASSERT_EQUALS_INT(RC_INVALID_PAGE_SIZE, result, "above the largest size");
+
+    // a file of 64KB pages keeps its size across opens
+    CHECK(createPageFileWithPageSize("testbuffer.bin", bigPage));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(bigPage, fh.pageSize, "page size of a new file");
+    CHECK(enablePageChecksums(&fh));
+    CHECK(enableDoubleWrite(&fh));
+    CHECK(ensureCapacity(3, &fh));
+    for (int i = 0; i < bigPage; i++)
+    {
+        page[i] = (char) (i % 251);
+    }
+    PageNumber pageNum = 2;
+    CHECK(writeBlocks(&fh, 1, &pageNum, &page));
+    CHECK(closePageFile(&fh));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(bigPage, fh.pageSize, "page size read from the descriptor");
+    ASSERT_EQUALS_INT(3, fh.totalNumPages, "pages of the file");
+    CHECK(enablePageChecksums(&fh));
+    CHECK(readBlock(2, &fh, readBack));
+    ASSERT_EQUALS_INT(0, memcmp(page, readBack, bigPage), "whole page read back");
+    CHECK(closePageFile(&fh));
+
+    // the pool takes the page size of its file, frames are 64KB apart
+    config.pageSize = PAGE_SIZE;
+    result = initBufferPoolWithConfig(bm, "testbuffer.bin", 4, RS_LRU, NULL, &config);
+    ASSERT_EQUALS_INT(RC_INVALID_PAGE_SIZE, result, "file and pool sizes differ");
+    config.pageSize = 5000;
+    result = initBufferPoolWithConfig(bm, "testbuffer.bin", 4, RS_LRU, NULL, &config);
+    ASSERT_EQUALS_INT(RC_INVALID_PAGE_SIZE, result, "pool size not a power of two");
+    config.pageSize = 0;
+    config.pageChecksums = TRUE;
+    CHECK(initBufferPoolWithConfig(bm, "testbuffer.bin", 8, RS_LRU, NULL, &config));
+    ASSERT_EQUALS_INT(bigPage, bm->mgmtData->allocation.pageSize, "frame size");
+    for (int i = 0; i < 20; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        memset(h->data, 'a' + i, BM_PAGE_DATA_BYTES(bigPage));
+        memset(h->data + BM_PAGE_DATA_BYTES(bigPage), 0, BM_PAGE_LSN_BYTES); // page 2 was written without a stamp
+        CHECK(markDirtyLSN(bm, h, 100 + i));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(pinPage(bm, h, 19));
+    ASSERT_EQUALS_INT(119, (int) getPageLSN(h->data + bigPage - PAGE_SIZE), "LSN at the end of the page");
+    CHECK(unpinPage(bm, h));
+    CHECK(resizeBufferPool(bm, 4));
+    CHECK(pinPage(bm, h, 18));
+    ASSERT_EQUALS_INT('a' + 18, h->data[bigPage - BM_PAGE_LSN_BYTES - 1], "page moved by the shrink");
+    CHECK(unpinPage(bm, h));
+
+    // files of another page size cannot join the pool
+    CHECK(createPageFile("testbuffer2.bin"));
+    result = registerPageFile(bm, "testbuffer2.bin", &fileId);
+    ASSERT_EQUALS_INT(RC_INVALID_PAGE_SIZE, result, "4KB file refused by a 64KB pool");
+    CHECK(shutdownBufferPool(bm));
+
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(20, fh.totalNumPages, "file extended by the pool");
+    CHECK(readBlock(12, &fh, readBack));
+    ASSERT_EQUALS_INT('a' + 12, readBack[bigPage / 2], "page written through the pool");
+    CHECK(closePageFile(&fh));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    CHECK(destroyPageFile("testbuffer2.bin"));
+    free(page);
+    free(readBack);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// pages added as holes, zero pages and freed pages deallocated, the same pages of a compressed file lose their slot
+void
+testHolePunching (void)
+{
+    SM_FileHandle fh;
+    SM_CompressionInfo compression;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    testName = "hole punching";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    long long empty = allocatedBytes("testbuffer.bin");
+    CHECK(ensureCapacity(256, &fh));
+    CHECK(appendEmptyBlock(&fh));
+    ASSERT_EQUALS_INT(257, (int) fh.totalNumPages, "pages added");
+    ASSERT_TRUE(allocatedBytes("testbuffer.bin") <= empty, "new pages are not written");
+    if (!fh.mgmtInfo.punchHoles)
+    {
+        printf("file system without hole punching, rest of the test skipped\n");
+        CHECK(closePageFile(&fh));
+        CHECK(destroyPageFile("testbuffer.bin"));
+        free(page);
+        TEST_DONE();
+        return;
+    }
+
+    CHECK(enablePageChecksums(&fh));
+    memset(page, 'x', PAGE_SIZE);
+    for (int i = 0; i < 16; i++)
+    {
+        CHECK(writeBlock(i, &fh, page));
+    }
+    fflush(fh.mgmtInfo.posixFileDescriptor);
+    fsync(fileno(fh.mgmtInfo.posixFileDescriptor)); // blocks are only counted once allocated
+    long long written = allocatedBytes("testbuffer.bin");
+    ASSERT_EQUALS_INT(empty + 16 * PAGE_SIZE, written, "written pages are allocated");
+    memset(page, 0, PAGE_SIZE);
+    CHECK(writeBlock(3, &fh, page));
+    ASSERT_EQUALS_INT(1, (int) fh.mgmtInfo.numPunchedPages, "zero page punched");
+    CHECK(freePage(4, &fh));
+    ASSERT_EQUALS_INT(2, (int) fh.mgmtInfo.numPunchedPages, "freed page punched");
+    ASSERT_EQUALS_INT(written - 2 * PAGE_SIZE, allocatedBytes("testbuffer.bin"), "two pages deallocated");
+    memset(page, 'y', PAGE_SIZE);
+    CHECK(readBlock(3, &fh, page));
+    ASSERT_TRUE(page[0] == 0 && page[PAGE_SIZE - 1] == 0, "zero page reads as zeros");
+    CHECK(readBlock(5, &fh, page));
+    ASSERT_TRUE(page[0] == 'x', "neighbour page kept");
+    PageNumber pageNum;
+    CHECK(allocatePage(&fh, &pageNum));
+    ASSERT_EQUALS_INT(4, (int) pageNum, "freed page reused");
+    CHECK(readBlock(4, &fh, page));
+    ASSERT_TRUE(page[0] == 0 && page[PAGE_SIZE - 1] == 0, "reused page passes its checksum as zeros");
+    CHECK(freePage(6, &fh));
+    int numFree = (int) fh.mgmtInfo.numFreePages;
+    memset(page, 'y', PAGE_SIZE);
+    CHECK(writeBlock(6, &fh, page));
+    ASSERT_EQUALS_INT(numFree - 1, (int) fh.mgmtInfo.numFreePages, "written free page taken back");
+    memset(page, 0, PAGE_SIZE);
+    CHECK(readBlock(6, &fh, page));
+    ASSERT_TRUE(page[0] == 'y' && page[PAGE_SIZE - 1] == 'y', "page written after its free reads back");
+    CHECK(closePageFile(&fh));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(readBlock(6, &fh, page));
+    ASSERT_TRUE(page[0] == 'y', "free map written with the page");
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile("testbuffer.bin"));
+
+    CHECK(createCompressedPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(ensureCapacity(4, &fh));
+    memset(page, 'x', PAGE_SIZE);
+    CHECK(writeBlock(0, &fh, page));
+    CHECK(writeBlock(1, &fh, page));
+    memset(page, 0, PAGE_SIZE);
+    CHECK(writeBlock(0, &fh, page));
+    CHECK(freePage(1, &fh));
+    CHECK(getCompressionInfo(&fh, &compression));
+    ASSERT_EQUALS_INT(0, (int) compression.numStoredPages, "zero and freed pages have no slot");
+    CHECK(readBlock(0, &fh, page));
+    ASSERT_TRUE(page[0] == 0, "page without slot reads as zeros");
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile("testbuffer.bin"));
+
+    free(page);
+    TEST_DONE();
+}
+
+// a full backup without holes and free pages, incremental ones with the changed pages, a chain restored page by page,
+// broken chains and corrupted archives refused, backups of a pool file
+void
+testBackup (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PoolConfig config = BM_DEFAULT_POOL_CONFIG;
+    SM_FileHandle fh, restored;
+    SM_BackupInfo info;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    SM_PageHandle expected = (SM_PageHandle) malloc(PAGE_SIZE);
+    char *chain[] = { "testbuffer.full", "testbuffer.inc1", "testbuffer.inc2" };
+    char *incrementalOnly[] = { "testbuffer.inc1" };
+    char *gap[] = { "testbuffer.full", "testbuffer.inc2" };
+    RC result;
+    testName = "backup";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    result = backupPageFile(&fh, "testbuffer.full", 0, &info);
+    ASSERT_EQUALS_INT(RC_NO_CHANGE_TRACKING, result, "changes not tracked");
+    CHECK(enableChangeTracking(&fh));
+    ASSERT_EQUALS_INT(0, (int) getChangeEpoch(&fh), "no backup yet");
+    result = backupPageFile(&fh, "testbuffer.inc1", 1, &info);
+    ASSERT_EQUALS_INT(RC_NO_BASE_BACKUP, result, "incremental backup needs a full one");
+
+    // 20 pages written out of 64, one of them freed
+    CHECK(ensureCapacity(64, &fh));
+    for (int i = 0; i < 20; i++)
+    {
+        memset(page, 'a' + i, PAGE_SIZE);
+        CHECK(writeBlock(i, &fh, page));
+    }
+    CHECK(freePage(5, &fh));
+    CHECK(backupPageFile(&fh, "testbuffer.full", 0, &info));
+    if (fh.mgmtInfo.punchHoles)
+    {
+        ASSERT_EQUALS_INT(19, (int) info.numPages, "holes and free pages left out");
+    }
+    ASSERT_EQUALS_INT(0, (int) info.baseEpoch, "full backup");
+    ASSERT_EQUALS_INT(1, (int) info.epoch, "first backup");
+    ASSERT_EQUALS_INT(1, (int) getChangeEpoch(&fh), "epoch of the file moved");
+    ASSERT_EQUALS_INT(0, isPageChanged(&fh, 3), "marks cleared");
+
+    // a rewritten page, a page written in a hole, a freed page and one more page
+    memset(page, 'X', PAGE_SIZE);
+    CHECK(writeBlock(3, &fh, page));
+    memset(page, 'Y', PAGE_SIZE);
+    CHECK(writeBlock(30, &fh, page));
+    CHECK(freePage(10, &fh));
+    CHECK(appendEmptyBlock(&fh));
+    ASSERT_EQUALS_INT(1, isPageChanged(&fh, 30), "written page marked");
+    CHECK(backupPageFile(&fh, "testbuffer.inc1", 1, &info));
+    ASSERT_EQUALS_INT(3, (int) info.numPages, "changed pages only");
+    ASSERT_EQUALS_INT(1, (int) info.baseEpoch, "applies to the full backup");
+    ASSERT_EQUALS_INT(65, (int) info.totalNumPages, "page count of the file");
+    CHECK(backupPageFile(&fh, "testbuffer.inc2", 1, &info));
+    ASSERT_EQUALS_INT(0, (int) info.numPages, "nothing changed");
+    ASSERT_EQUALS_INT(3, (int) info.epoch, "third backup");
+
+    // the chain gives the file back
+    remove("testbuffer.restored");
+    CHECK(restorePageFile("testbuffer.restored", chain, 3, &info));
+    CHECK(openPageFile("testbuffer.restored", &restored));
+    ASSERT_EQUALS_INT(65, (int) restored.totalNumPages, "page count restored");
+    int same = 1;
+    for (int i = 0; i < 65; i++)
+    {
+        CHECK(readBlock(i, &fh, expected));
+        CHECK(readBlock(i, &restored, page));
+        same &= (memcmp(page, expected, PAGE_SIZE) == 0);
+    }
+    ASSERT_TRUE(same, "every page restored");
+    PageNumber pageNum;
+    CHECK(allocatePage(&restored, &pageNum));
+    ASSERT_EQUALS_INT(5, (int) pageNum, "free map restored");
+    CHECK(closePageFile(&restored));
+    CHECK(destroyPageFile("testbuffer.restored"));
+
+    result = restorePageFile("testbuffer.restored", incrementalOnly, 1, NULL);
+    ASSERT_EQUALS_INT(RC_BACKUP_CHAIN_BROKEN, result, "chain without its full backup");
+    result = restorePageFile("testbuffer.restored", gap, 2, NULL);
+    ASSERT_EQUALS_INT(RC_BACKUP_CHAIN_BROKEN, result, "chain with a missing backup");
+    FILE *f = fopen("testbuffer.restored", "rb");
+    ASSERT_TRUE(f == NULL, "failed restore leaves no file");
+    f = fopen("testbuffer.inc1", "r+b");
+    fseeko(f, SM_BACKUP_LIST_OFFSET, SEEK_SET);
+    fputc(0x7f, f);
+    fclose(f);
+    result = restorePageFile("testbuffer.restored", chain, 3, NULL);
+    ASSERT_EQUALS_INT(RC_INVALID_BACKUP, result, "corrupted page list");
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile("testbuffer.bin"));
+
+    // the pool writes its dirty pages before the copy
+    config.changeTracking = TRUE;
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(initBufferPoolWithConfig(bm, "testbuffer.bin", 20, RS_LRU, NULL, &config));
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "Page-%i", i);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(backupPoolFile(bm, BM_DEFAULT_FILE, "testbuffer.full", FALSE, &info));
+    ASSERT_EQUALS_INT(10, (int) info.numPages, "dirty pages in the full backup");
+    for (int i = 2; i < 4; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "Changed-%i", i);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(backupPoolFile(bm, BM_DEFAULT_FILE, "testbuffer.inc1", TRUE, &info));
+    ASSERT_EQUALS_INT(2, (int) info.numPages, "pages changed in the pool");
+    CHECK(shutdownBufferPool(bm));
+    CHECK(restorePageFile("testbuffer.restored", chain, 2, NULL));
+    CHECK(openPageFile("testbuffer.restored", &restored));
+    CHECK(readBlock(3, &restored, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Changed-3"), "changed page restored");
+    CHECK(closePageFile(&restored));
+
+    CHECK(destroyPageFile("testbuffer.restored"));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    f = fopen("testbuffer.bin" SM_CHANGE_MAP_SUFFIX, "rb");
+    ASSERT_TRUE(f == NULL, "change map destroyed with the page file");
+    for (int i = 0; i < 3; i++)
+    {
+        remove(chain[i]);
+    }
+    free(page);
+    free(expected);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+long long
+allocatedBytes (const char *fileName)
+{
+    struct stat st;
+    if (stat(fileName, &st) != 0)
+    {
+        return -1;
+    }
+    return (long long) st.st_blocks * 512;
+}
+
+void
+createDummyPages(BM_BufferPool *bm, int num)
+{
+    int i;
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+
+    CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_FIFO, NULL));
+
+    for (i = 0; i < num; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "%s-%lld", "Page", h->pageNum);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm,h));
+    }
+
+    CHECK(shutdownBufferPool(bm));
+
+    free(h);
+}
+
+// every scan implementation supported by the CPU must agree with the scalar one
+void
+testScanImplementations (void)
+{
+    const ScanImplementation implementations[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+    int values[100];
+    long long longValues[100];
+    int queue[100];
+    int fixCounts[100];
+    testName = "Scan implementations";
+
+    srand(42);
+    for (int impl = 0; impl < 3; impl++)
+    {
+        setScanImplementation(implementations[impl]);
+        for (int length = 0; length <= 100; length++)
+        {
+            for (int i = 0; i < length; i++)
+            {
+                values[i] = rand() % 50;
+                longValues[i] = ((long long) (rand() % 2) << 32) | values[i]; // equal low halves must not match
+                queue[i] = length - 1 - i;
+                fixCounts[i] = rand() % 3;
+            }
+            int key = rand() % 50;
+            long long longKey = ((long long) (rand() % 2) << 32) | key;
+            int expectedIndex = -1;
+            int expectedLongIndex = -1;
+            int expectedPosition = -1;
+            for (int i = length - 1; i >= 0; i--)
+            {
+                if (values[i] == key)
+                    expectedIndex = i;
+                if (longValues[i] == longKey)
+                    expectedLongIndex = i;
+                if (fixCounts[queue[i]] == 0)
+                    expectedPosition = i;
+            }
+            if (scanFindInt(values, length, key) != expectedIndex || scanFindLong(longValues, length, longKey) != expectedLongIndex
+                    || scanFindUnpinned(queue, fixCounts, length) != expectedPosition)
+            {
+                printf("[%s-%s-L%i-%s] FAILED: implementation %i disagrees for length %i\n", TEST_INFO, getScanImplementation(), length);
+                exit(1);
+            }
+        }
+    }
+    setScanImplementation(SCAN_AVX2);
+    ASSERT_TRUE(getScanImplementation() >= SCAN_SCALAR, "an implementation is selected");
+
+    TEST_DONE();
+}
+
+// node ranges are fixed at the allocation: ranges past the last frame of a small or shrunk pool are empty
+void
+testNumaPartitionRanges (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PoolAllocationInfo info = { BM_HUGEPAGES_TRANSPARENT, BM_NUMA_PARTITION, 4, 512, 4096, 0, PAGE_SIZE };
+    BM_PoolConfig config = { BM_HUGEPAGES_NONE, BM_NUMA_PARTITION };
+    char expected[64];
+    int start, end;
+    testName = "NUMA partition with more nodes than frames";
+
+    getNodeFrameRange(&info, 0, 100, &start, &end);
+    ASSERT_TRUE(start == 0 && end == 100, "the first node has every frame of a small pool");
+    getNodeFrameRange(&info, 1, 100, &start, &end);
+    ASSERT_TRUE(start >= end, "a node past the pool has no frame");
+    getNodeFrameRange(&info, 3, 100, &start, &end);
+    ASSERT_TRUE(start >= end, "the last node has no frame either");
+    getNodeFrameRange(&info, 2, 1100, &start, &end);
+    ASSERT_TRUE(start == 1024 && end == 1100, "a range is cut at the last frame");
+    getNodeFrameRange(&info, 3, 2100, &start, &end);
+    ASSERT_TRUE(start == 1536 && end == 2100, "the last node has the frames past the ranges");
+
+    // a pool partitioned over more nodes than its frames fill, whatever node the test runs on
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 150);
+    CHECK(initBufferPoolWithConfig(bm, "testbuffer.bin", 100, RS_LRU, NULL, &config));
+    bm->mgmtData->allocation.numaPolicy = BM_NUMA_PARTITION;
+    bm->mgmtData->allocation.numNumaNodes = 8;
+    bm->mgmtData->allocation.framesPerNode = 512;
+    for (int round = 0; round < 3; round++)
+    {
+        CHECK(resizeBufferPool(bm, (round == 1) ? 10 : 100));
+        for (int i = 0; i < 150; i++)
+        {
+            CHECK(pinPage(bm, h, i));
+            sprintf(expected, "%s-%i", "Page", i);
+            if (strcmp(expected, h->data) != 0)
+            {
+                printf("[%s-%s-L%i-%s] FAILED: expected <%s> but was <%s>\n", TEST_INFO, expected, h->data);
+                exit(1);
+            }
+            CHECK(unpinPage(bm, h));
+        }
+    }
+    ASSERT_TRUE(bm->mgmtData->numInitializedFrames <= 100, "no frame past the pool was set up");
+    CHECK(shutdownBufferPool(bm));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(bm);
+    free(h);
+
+    TEST_DONE();
+}
+
+// pools above BM_SCAN_MAX_FRAMES use the page table, FIFO must behave as with a scan
+void
+testLargePoolFIFO (void)
+{
+    const int numFrames = 64;
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    char expected[64];
+    testName = "Testing FIFO on a pool using the page table";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 200);
+    CHECK(initBufferPool(bm, "testbuffer.bin", numFrames, RS_FIFO, NULL));
+    ASSERT_TRUE(bm->mgmtData->pageTable != NULL, "pool uses a page table");
+
+    for (int i = 0; i < 200; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(expected, "%s-%i", "Page", i);
+        if (strcmp(expected, h->data) != 0)
+        {
+            printf("[%s-%s-L%i-%s] FAILED: expected <%s> but was <%s>\n", TEST_INFO, expected, h->data);
+            exit(1);
+        }
+        CHECK(unpinPage(bm, h));
+    }
+
+    // frames were filled in order and then replaced in FIFO order
+    PageNumber *frameContent = getFrameContents(bm);
+    for (int i = 0; i < numFrames; i++)
+        ASSERT_EQUALS_INT((i < 8) ? 192 + i : 128 + i, frameContent[i], "frame content after FIFO replacement");
+    free(frameContent);
+
+    // pages that were replaced are not found anymore, the others are hits
+    h->pageNum = 5;
+    ASSERT_ERROR(markDirty(bm, h), "replaced page is not in the pool");
+    CHECK(pinPage(bm, h, 150));
+    CHECK(unpinPage(bm, h));
+    ASSERT_EQUALS_INT(200, getNumReadIO(bm), "hit does not read");
+
+    CHECK(shutdownBufferPool(bm));
+    CHECK(destroyPageFile("testbuffer.bin"));
+
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// every huge page and NUMA combination must work, falling back when the system lacks support
+void
+testPoolConfig (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PoolAllocationInfo info;
+    char expected[64];
+    testName = "Pool configuration (huge pages and NUMA)";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 50);
+
+    for (int huge = BM_HUGEPAGES_NONE; huge <= BM_HUGEPAGES_EXPLICIT; huge++)
+    {
+        for (int numa = BM_NUMA_NONE; numa <= BM_NUMA_PARTITION; numa++)
+        {
+            BM_PoolConfig config = { (BM_HugePageMode) huge, (BM_NumaPolicy) numa };
+            CHECK(initBufferPoolWithConfig(bm, "testbuffer.bin", 20, RS_LRU, NULL, &config));
+            CHECK(getPoolAllocationInfo(bm, &info));
+            ASSERT_TRUE(info.hugePages <= (BM_HugePageMode) huge, "effective huge page mode is never stronger than requested");
+            ASSERT_TRUE(info.numaPolicy <= (BM_NumaPolicy) numa, "effective NUMA policy is never stronger than requested");
+            ASSERT_TRUE(info.numNumaNodes >= 1, "at least one NUMA node");
+            ASSERT_TRUE(info.framePoolBytes >= 20 * PAGE_SIZE, "frame pool holds every frame");
+            printPoolAllocation(bm);
+
+            for (int i = 0; i < 50; i++)
+            {
+                CHECK(pinPage(bm, h, i));
+                sprintf(expected, "%s-%i", "Page", i);
+                if (strcmp(expected, h->data) != 0)
+                {
+                    printf("[%s-%s-L%i-%s] FAILED: expected <%s> but was <%s>\n", TEST_INFO, expected, h->data);
+                    exit(1);
+                }
+                CHECK(unpinPage(bm, h));
+            }
+            CHECK(shutdownBufferPool(bm));
+        }
+    }
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// growing keeps every frame, shrinking evicts in LRU order and moves the other pages to the remaining frames
+void
+testResize (void)
+{
+    const int orderRequests[] = {3,4,0,2,1};
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    testName = "Resizing a buffer pool";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 20);
+    CHECK(initBufferPool(bm, "testbuffer.bin", 5, RS_LRU, NULL));
+
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        CHECK(unpinPage(bm, h));
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK(pinPage(bm, h, orderRequests[i]));
+        CHECK(unpinPage(bm, h));
+    }
+
+    // grow, new frames are empty and used before any eviction
+    CHECK(resizeBufferPool(bm, 8));
+    ASSERT_EQUALS_POOL("[0 0],[1 0],[2 0],[3 0],[4 0],[-1 0],[-1 0],[-1 0]", bm, "content kept when growing");
+    for (int i = 5; i < 8; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        if (i == 7)
+            CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    ASSERT_EQUALS_POOL("[0 0],[1 0],[2 0],[3 0],[4 0],[5 0],[6 0],[7x0]", bm, "new frames filled");
+    ASSERT_EQUALS_INT(8, getNumReadIO(bm), "growing does not read");
+
+    // shrink, LRU order is 3,4,0,2,1,5,6,7 so 3,4,0,2 are evicted and 5,6,7 move to their frames
+    CHECK(resizeBufferPool(bm, 4));
+    ASSERT_EQUALS_POOL("[5 0],[1 0],[6 0],[7x0]", bm, "LRU pages evicted and others moved when shrinking");
+    ASSERT_EQUALS_INT(0, getNumWriteIO(bm), "moved dirty page is not written");
+    CHECK(pinPage(bm, h, 7));
+    ASSERT_EQUALS_STRING("Page-7", h->data, "moved page keeps its content");
+    ASSERT_ERROR(resizeBufferPool(bm, 2), "cannot release a frame holding a pinned page");
+    ASSERT_EQUALS_POOL("[5 0],[1 0],[6 0],[7x1]", bm, "failed shrink does not change the pool");
+    CHECK(unpinPage(bm, h));
+
+    // the LRU state survived, page 1 is the least recently used page
+    CHECK(pinPage(bm, h, 8));
+    CHECK(unpinPage(bm, h));
+    ASSERT_EQUALS_POOL("[5 0],[8 0],[6 0],[7x0]", bm, "LRU order kept after shrinking");
+
+    ASSERT_ERROR(resizeBufferPool(bm, 0), "a pool needs at least one frame");
+    ASSERT_ERROR(resizeBufferPool(bm, 5 * BM_RESERVE_FACTOR + 1), "cannot grow beyond the reserved frames");
+
+    CHECK(shutdownBufferPool(bm));
+    CHECK(destroyPageFile("testbuffer.bin"));
+
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// readers keep pinning pages while the pool is resized under them
+static volatile int stopReaders;
+
+void *
+pinRandomPages (void *pool)
+{
+    BM_BufferPool *bm = (BM_BufferPool *) pool;
+    BM_PageHandle h;
+    char expected[64];
+    unsigned int seed = 7;
+    long failures = 0;
+
+    while (!stopReaders)
+    {
+        int pageNum = rand_r(&seed) % 100;
+        if (pinPage(bm, &h, pageNum) != RC_OK)
+            continue; // every frame may be pinned by the other readers
+        sprintf(expected, "%s-%i", "Page", pageNum);
+        if (strcmp(expected, h.data) != 0)
+            failures++;
+        unpinPage(bm, &h);
+    }
+    return (void *) failures;
+}
+
+void
+testConcurrentResize (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    pthread_t readers[3];
+    testName = "Resizing a buffer pool while it is used";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 100);
+    CHECK(initBufferPool(bm, "testbuffer.bin", 10, RS_LRU, NULL));
+
+    stopReaders = 0;
+    for (int i = 0; i < 3; i++)
+        pthread_create(&readers[i], NULL, pinRandomPages, bm);
+    int resizes = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        if (resizeBufferPool(bm, 4 + (i * 7) % 36) == RC_OK)
+            resizes++;
+    }
+    stopReaders = 1;
+    long failures = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        void *result;
+        pthread_join(readers[i], &result);
+        failures += (long) result;
+    }
+    ASSERT_EQUALS_INT(0, (int) failures, "readers always saw the right page content");
+    ASSERT_TRUE(resizes > 0, "pool was resized while in use");
+
+    CHECK(shutdownBufferPool(bm));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(bm);
+    TEST_DONE();
+}
+
+// frames of a large pool are only set up when first used, unused frames still report as empty
+void
+testLazyFrameInit (void)
+{
+    const int numFrames = 1 << 20;
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    testName = "Frames initialized on first use";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 20);
+    CHECK(initBufferPool(bm, "testbuffer.bin", numFrames, RS_LRU, NULL));
+    ASSERT_EQUALS_INT(0, bm->mgmtData->numInitializedFrames, "no frame set up by init");
+
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(pinPage(bm, h, 3));
+    ASSERT_EQUALS_STRING("Page-3", h->data, "hit on a lazily set up frame");
+    CHECK(unpinPage(bm, h));
+    ASSERT_EQUALS_INT(10, bm->mgmtData->numInitializedFrames, "one frame set up per page");
+
+    PageNumber *frameContent = getFrameContents(bm);
+    int *fixCounts = getFixCounts(bm);
+    ASSERT_EQUALS_INT(9, frameContent[9], "used frame holds its page");
+    ASSERT_EQUALS_INT(NO_PAGE, frameContent[numFrames - 1], "unused frame is empty");
+    ASSERT_EQUALS_INT(0, fixCounts[numFrames - 1], "unused frame is not pinned");
+    free(frameContent);
+    free(fixCounts);
+
+    // shrinking below the used frames evicts in LRU order (3 was used last), growing adds unused frames
+    CHECK(resizeBufferPool(bm, 4));
+    ASSERT_EQUALS_POOL("[7 0],[8 0],[9 0],[3 0]", bm, "least recently used pages evicted");
+    CHECK(resizeBufferPool(bm, 6));
+    ASSERT_EQUALS_POOL("[7 0],[8 0],[9 0],[3 0],[-1 0],[-1 0]", bm, "grown frames are empty");
+    ASSERT_EQUALS_INT(4, bm->mgmtData->numInitializedFrames, "grown frames are not set up");
+    for (int i = 10; i < 13; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        CHECK(unpinPage(bm, h));
+    }
+    ASSERT_EQUALS_POOL("[12 0],[8 0],[9 0],[3 0],[10 0],[11 0]", bm, "empty frames used before evicting");
+
+    CHECK(shutdownBufferPool(bm));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// one pool caches pages of several files, the same page number of two files are two different pages
+void
+testMultiFilePool (void)
+{
+    const char *fileNames[] = {"testbuffer_a.bin", "testbuffer_b.bin", "testbuffer_c.bin"};
+    const int numFrameCounts[] = {4, 64};
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    int fileIds[3];
+    char expected[64];
+    testName = "Pool shared by several page files";
+
+    // a pool created without a page file only serves registered files
+    CHECK(initBufferPool(bm, NULL, 4, RS_LRU, NULL));
+    ASSERT_ERROR(pinPage(bm, h, 0), "no default file");
+    for (int f = 0; f < 3; f++)
+    {
+        CHECK(createPageFile((char *) fileNames[f]));
+        CHECK(registerPageFile(bm, (char *) fileNames[f], &fileIds[f]));
+        for (int i = 0; i < 10; i++)
+        {
+            CHECK(pinFilePage(bm, h, fileIds[f], i));
+            sprintf(h->data, "File-%i-Page-%i", f, i);
+            CHECK(markDirty(bm, h));
+            CHECK(unpinPage(bm, h));
+        }
+    }
+    ASSERT_EQUALS_INT(fileIds[0], BM_DEFAULT_FILE, "first registered file takes the default id");
+    CHECK(shutdownBufferPool(bm));
+
+    for (int n = 0; n < 2; n++)
+    {
+        CHECK(initBufferPool(bm, (char *) fileNames[0], numFrameCounts[n], RS_LRU, NULL));
+        CHECK(registerPageFile(bm, (char *) fileNames[1], &fileIds[1]));
+        CHECK(registerPageFile(bm, (char *) fileNames[2], &fileIds[2]));
+        for (int round = 0; round < 2; round++)
+        {
+            for (int i = 0; i < 10; i++)
+            {
+                for (int f = 0; f < 3; f++)
+                {
+                    CHECK(pinFilePage(bm, h, fileIds[f], i));
+                    sprintf(expected, "File-%i-Page-%i", f, i);
+                    ASSERT_EQUALS_STRING(expected, h->data, "page read from its own file");
+                    CHECK(unpinPage(bm, h));
+                }
+            }
+        }
+        CHECK(pinPage(bm, h, 9));
+        ASSERT_EQUALS_STRING("File-0-Page-9", h->data, "pinPage uses the default file");
+        CHECK(unpinPage(bm, h));
+
+        // flushing one file only writes its pages
+        int writes = getNumWriteIO(bm);
+        CHECK(pinFilePage(bm, h, fileIds[1], 9));
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+        CHECK(pinFilePage(bm, h, fileIds[2], 9));
+        CHECK(markDirty(bm, h));
+        CHECK(forceFlushFile(bm, fileIds[1]));
+        ASSERT_EQUALS_INT(writes + 1, getNumWriteIO(bm), "only the page of the flushed file is written");
+
+        // pages of a file with a pinned page cannot be dropped, dropping discards changes
+        ASSERT_ERROR(unregisterPageFile(bm, fileIds[2]), "file has a pinned page");
+        sprintf(h->data, "changed");
+        CHECK(unpinPage(bm, h));
+        CHECK(dropFilePages(bm, fileIds[2]));
+        int *fileIdsOfFrames = getFrameFileIds(bm);
+        for (int i = 0; i < bm->numPages; i++)
+            ASSERT_TRUE(fileIdsOfFrames[i] != fileIds[2], "no frame holds a dropped page");
+        free(fileIdsOfFrames);
+        CHECK(pinFilePage(bm, h, fileIds[2], 9));
+        ASSERT_EQUALS_STRING("File-2-Page-9", h->data, "dropped change is not written");
+        CHECK(unpinPage(bm, h));
+
+        CHECK(unregisterPageFile(bm, fileIds[2]));
+        ASSERT_ERROR(pinFilePage(bm, h, fileIds[2], 0), "unregistered file");
+        ASSERT_ERROR(pinFilePage(bm, h, 7, 0), "unknown file");
+        int reusedId;
+        CHECK(registerPageFile(bm, (char *) fileNames[2], &reusedId));
+        ASSERT_EQUALS_INT(fileIds[2], reusedId, "id of an unregistered file is reused");
+        CHECK(shutdownBufferPool(bm));
+    }
+
+    for (int f = 0; f < 3; f++)
+        CHECK(destroyPageFile((char *) fileNames[f]));
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// frames move from a pool whose working set fits to one that thrashes, the budget is never exceeded
+void
+testBudgetManager (void)
+{
+    BM_BudgetManager mgr;
+    BM_BudgetAllocation allocations[2];
+    BM_BufferPool *hot = MAKE_POOL();
+    BM_BufferPool *idle = MAKE_POOL();
+    BM_BufferPool *extra = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    int moved;
+    testName = "Frame budget shared by pools";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(hot, 20);
+    CHECK(initBufferPool(hot, "testbuffer.bin", 10, RS_LRU, NULL));
+    CHECK(initBufferPool(idle, "testbuffer.bin", 20, RS_LRU, NULL));
+    CHECK(initBufferPool(extra, "testbuffer.bin", 1, RS_LRU, NULL));
+
+    CHECK(initBudgetManager(&mgr, 30, 10));
+    CHECK(registerBudgetPool(&mgr, hot, 2));
+    CHECK(registerBudgetPool(&mgr, idle, 2));
+    ASSERT_ERROR(registerBudgetPool(&mgr, extra, 1), "pool beyond the budget");
+    ASSERT_EQUALS_INT(0, getBudgetFreeFrames(&mgr), "budget fully used");
+    ASSERT_ERROR(resizeBufferPool(hot, 15), "a registered pool is sized by its manager");
+    ASSERT_ERROR(resizeBudgetPool(&mgr, hot, 15), "no free frame in the budget");
+    ASSERT_ERROR(resizeBudgetPool(&mgr, hot, 1), "below the minimum of the pool");
+
+    CHECK(rebalanceBudget(&mgr, &moved));
+    ASSERT_EQUALS_INT(0, moved, "nothing moves without ghost hits");
+
+    // hot loops over 16 pages with 10 frames (every access misses), idle over 2 pages
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            CHECK(pinPage(hot, h, i));
+            CHECK(unpinPage(hot, h));
+            CHECK(pinPage(idle, h, i % 2));
+            CHECK(unpinPage(idle, h));
+        }
+    }
+    ASSERT_TRUE(getNumGhostHits(hot) > 0, "thrashing pool hits its ghost list");
+    ASSERT_EQUALS_INT(0, getNumGhostHits(idle), "idle pool has no ghost hit");
+
+    CHECK(rebalanceBudget(&mgr, &moved));
+    ASSERT_EQUALS_INT(10, moved, "one step moved");
+    ASSERT_EQUALS_INT(2, getBudgetAllocation(&mgr, allocations, 2), "two pools published");
+    ASSERT_EQUALS_INT(20, allocations[0].numPages, "thrashing pool grew");
+    ASSERT_EQUALS_INT(10, allocations[1].numPages, "idle pool shrank");
+    ASSERT_EQUALS_INT(0, getBudgetFreeFrames(&mgr), "budget not exceeded");
+
+    int reads = getNumReadIO(hot);
+    for (int i = 0; i < 16; i++)
+    {
+        CHECK(pinPage(hot, h, i));
+        CHECK(unpinPage(hot, h));
+    }
+    CHECK(pinPage(hot, h, 0));
+    CHECK(unpinPage(hot, h));
+    ASSERT_TRUE(getNumReadIO(hot) - reads <= 16, "working set fits after rebalancing");
+    CHECK(rebalanceBudget(&mgr, &moved));
+    CHECK(rebalanceBudget(&mgr, &moved));
+    ASSERT_EQUALS_INT(0, moved, "stable once the working set fits");
+
+    CHECK(unregisterBudgetPool(&mgr, idle));
+    ASSERT_EQUALS_INT(10, getBudgetFreeFrames(&mgr), "frames of an unregistered pool are free");
+    CHECK(resizeBudgetPool(&mgr, hot, 25));
+    ASSERT_EQUALS_INT(5, getBudgetFreeFrames(&mgr), "pool grown within the budget");
+    CHECK(resizeBufferPool(idle, 12));
+
+    // a pool shut down leaves its manager, which no longer sees it
+    CHECK(registerBudgetPool(&mgr, extra, 1));
+    CHECK(shutdownBufferPool(extra));
+    ASSERT_EQUALS_INT(1, getBudgetAllocation(&mgr, allocations, 2), "shut down pool left the budget");
+    ASSERT_EQUALS_INT(5, getBudgetFreeFrames(&mgr), "frames of a shut down pool are free");
+    CHECK(rebalanceBudget(&mgr, &moved));
+    CHECK(initBufferPool(extra, "testbuffer.bin", 1, RS_LRU, NULL));
+    CHECK(shutdownBudgetManager(&mgr));
+
+    CHECK(shutdownBufferPool(hot));
+    CHECK(shutdownBufferPool(idle));
+    CHECK(shutdownBufferPool(extra));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(hot);
+    free(idle);
+    free(extra);
+    free(h);
+    TEST_DONE();
+}
+
+// counters follow every pin, eviction and write, histograms bucket values within 1/8
+void
+testPoolStats (void)
+{
+    const long long values[] = {0, 7, 8, 15, 16, 1000, 123456789, 1LL << 40};
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_Histogram histogram;
+    BM_Stats stats;
+    testName = "Buffer pool statistics";
+
+    for (int i = 0; i < 8; i++)
+    {
+        long long lower = histogramBucketValue(histogramBucket(values[i]));
+        ASSERT_TRUE(lower <= values[i] && values[i] - lower <= values[i] / 8, "bucket lower bound close to the value");
+    }
+    memset(&histogram, 0, sizeof(histogram));
+    for (int i = 1; i <= 100; i++)
+        histogramRecord(&histogram, i * 100);
+    ASSERT_TRUE(getHistogramPercentile(&histogram, 50) > 4400 && getHistogramPercentile(&histogram, 50) <= 5100, "median");
+    ASSERT_TRUE(getHistogramPercentile(&histogram, 100) > 8800, "maximum bucket");
+    ASSERT_EQUALS_INT(10000, (int) histogram.maxNanos, "maximum value");
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 10);
+    CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_FIFO, NULL));
+
+    CHECK(pinPage(bm, h, 0));
+    CHECK(markDirty(bm, h));
+    CHECK(unpinPage(bm, h));
+    for (int i = 1; i < 3; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(pinPage(bm, h, 0));
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 3)); // evicts the dirty page 0
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 4)); // evicts page 1
+    CHECK(unpinPage(bm, h));
+    h->pageNum = 4;
+    CHECK(forcePage(bm, h));
+    CHECK(forceFlushPool(bm));
+
+    CHECK(getPoolStats(bm, &stats));
+    printPoolStats(bm);
+    ASSERT_EQUALS_INT(6, (int) stats.numPins, "pins");
+    ASSERT_EQUALS_INT(1, (int) stats.numHits, "hits");
+    ASSERT_EQUALS_INT(5, (int) stats.numMisses, "misses");
+    ASSERT_EQUALS_INT(1, (int) stats.numCleanEvictions, "clean evictions");
+    ASSERT_EQUALS_INT(1, (int) stats.numDirtyEvictions, "dirty evictions");
+    ASSERT_EQUALS_INT(1, (int) stats.numFlushes, "flushes");
+    ASSERT_EQUALS_INT(getNumReadIO(bm), (int) stats.numReadIO, "reads");
+    ASSERT_EQUALS_INT(2, getNumWriteIO(bm), "writes");
+    ASSERT_EQUALS_INT(5, (int) stats.readLatency.totalCount, "every read timed");
+    ASSERT_EQUALS_INT(2, (int) stats.writeLatency.totalCount, "every write timed");
+    ASSERT_TRUE(stats.pinLatency.totalCount <= stats.numPins, "pins are sampled");
+
+    CHECK(resetPoolStats(bm));
+    CHECK(getPoolStats(bm, &stats));
+    ASSERT_EQUALS_INT(0, (int) stats.numPins, "reset");
+
+    CHECK(shutdownBufferPool(bm));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// snapshots and summaries fill caller buffers from one consistent pass
+void
+testPoolSnapshot (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PageHandle *pinned = MAKE_PAGE_HANDLE();
+    BM_FrameSnapshot frames[5];
+    BM_PoolSummary summaries[4];
+    int numFrames, numSummaries, otherFile;
+    testName = "Pool snapshots and summaries";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(createPageFile("testbuffer_a.bin"));
+    createDummyPages(bm, 10);
+    CHECK(initBufferPool(bm, "testbuffer.bin", 5, RS_LRU, NULL));
+    CHECK(registerPageFile(bm, "testbuffer_a.bin", &otherFile));
+
+    CHECK(pinPage(bm, h, 0));
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 1));
+    CHECK(markDirty(bm, h));
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 2));
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, pinned, 2));
+    CHECK(pinFilePage(bm, h, otherFile, 10));
+    CHECK(unpinPage(bm, h));
+
+    CHECK(getPoolSnapshot(bm, frames, 0, 5, &numFrames));
+    ASSERT_EQUALS_INT(5, numFrames, "every frame");
+    ASSERT_EQUALS_INT(1, frames[1].pageNum, "page of frame 1");
+    ASSERT_TRUE(frames[1].dirty, "dirty flag");
+    ASSERT_EQUALS_INT(1, frames[2].fixCount, "fix count");
+    ASSERT_EQUALS_INT(2, frames[2].accessCount, "access count");
+    ASSERT_EQUALS_INT(4, (int) frames[0].age, "age of the first page");
+    ASSERT_EQUALS_INT(1, (int) frames[2].age, "age of a page pinned again");
+    ASSERT_EQUALS_INT(otherFile, frames[3].fileId, "file of frame 3");
+    ASSERT_EQUALS_INT(NO_PAGE, frames[4].pageNum, "empty frame");
+    ASSERT_EQUALS_INT(-1, frames[4].fileId, "empty frame has no file");
+
+    CHECK(getPoolSnapshot(bm, frames, 3, 5, &numFrames));
+    ASSERT_EQUALS_INT(2, numFrames, "snapshot of the last frames");
+    ASSERT_EQUALS_INT(10, frames[0].pageNum, "chunk starts at firstFrame");
+
+    CHECK(getFileSummaries(bm, summaries, 4, &numSummaries));
+    ASSERT_EQUALS_INT(2, numSummaries, "one summary per file");
+    ASSERT_EQUALS_INT(3, summaries[BM_DEFAULT_FILE].numFrames, "frames of the default file");
+    ASSERT_EQUALS_INT(1, summaries[BM_DEFAULT_FILE].numDirty, "dirty frames of the default file");
+    ASSERT_EQUALS_INT(1, summaries[BM_DEFAULT_FILE].numPinned, "pinned frames of the default file");
+    ASSERT_EQUALS_INT(4, (int) summaries[BM_DEFAULT_FILE].accessCount, "pins of the default file");
+    ASSERT_EQUALS_INT(1, summaries[otherFile].numFrames, "frames of the other file");
+
+    CHECK(getPageRangeSummaries(bm, BM_DEFAULT_FILE, 2, summaries, 4, &numSummaries));
+    ASSERT_EQUALS_INT(2, numSummaries, "ranges up to the last buffered page");
+    ASSERT_EQUALS_INT(2, summaries[0].numFrames, "pages 0 and 1");
+    ASSERT_EQUALS_INT(2, summaries[1].firstPage, "second range starts at page 2");
+    ASSERT_EQUALS_INT(1, summaries[1].numPinned, "page 2 pinned");
+    ASSERT_ERROR(getPageRangeSummaries(bm, 5, 2, summaries, 4, &numSummaries), "unknown file");
+
+    CHECK(unpinPage(bm, pinned));
+    CHECK(shutdownBufferPool(bm));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    CHECK(destroyPageFile("testbuffer_a.bin"));
+    free(bm);
+    free(h);
+    free(pinned);
+    TEST_DONE();
+}
+
+// the trace holds every pin, unpin, dirty mark and flush in order
+void
+testPoolTrace (void)
+{
+    const BM_TraceEventType expectedTypes[] = {BM_TRACE_PIN_MISS, BM_TRACE_DIRTY, BM_TRACE_UNPIN, BM_TRACE_PIN_MISS,
+            BM_TRACE_UNPIN, BM_TRACE_PIN_HIT, BM_TRACE_UNPIN, BM_TRACE_FLUSH};
+    const int expectedPages[] = {0, 0, 0, 1, 1, 0, 0, 0};
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_TraceHeader header;
+    BM_TraceEvent *events;
+    long long numEvents;
+    testName = "Page access trace";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    createDummyPages(bm, 10);
+    CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_LRU, NULL));
+    CHECK(startPoolTrace(bm, "testtrace.bin"));
+
+    CHECK(pinPage(bm, h, 0));
+    CHECK(markDirty(bm, h));
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 1));
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 0));
+    CHECK(unpinPage(bm, h));
+    CHECK(forceFlushPool(bm));
+    CHECK(stopPoolTrace(bm));
+    CHECK(pinPage(bm, h, 2)); // not traced anymore
+    CHECK(unpinPage(bm, h));
+
+    CHECK(readTrace("testtrace.bin", &header, &events, &numEvents));
+    ASSERT_EQUALS_INT(3, header.numPages, "pool size in the header");
+    ASSERT_EQUALS_INT(RS_LRU, header.strategy, "strategy in the header");
+    ASSERT_EQUALS_INT(8, (int) numEvents, "every event recorded");
+    for (int i = 0; i < 8; i++)
+    {
+        ASSERT_EQUALS_INT(expectedTypes[i], events[i].type, "event type");
+        ASSERT_EQUALS_INT(expectedPages[i], getTraceEventPage(&events[i]), "event page");
+        ASSERT_EQUALS_INT(BM_DEFAULT_FILE, events[i].fileId, "event file");
+    }
+    free(events);
+
+    CHECK(shutdownBufferPool(bm));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    CHECK(destroyPageFile("testtrace.bin"));
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// new pages get a zeroed dirty frame without a read, the file grows when they are written
+void
+testNewPage (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    SM_FileHandle fh;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    BM_Stats stats;
+    testName = "New pages without reads";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_FIFO, NULL));
+    for (int i = 1; i <= 5; i++)
+    {
+        CHECK(newPage(bm, h));
+        ASSERT_EQUALS_INT(i, h->pageNum, "pages are added after the last one");
+        ASSERT_EQUALS_INT(0, h->data[0], "new page is zeroed");
+        sprintf(h->data, "%s-%lld", "New", h->pageNum);
+        CHECK(unpinPage(bm, h));
+    }
+    ASSERT_EQUALS_POOL("[4x0],[5x0],[3x0]", bm, "new pages are dirty");
+    CHECK(pinPage(bm, h, 9)); // past the end of the file, takes the same path
+    CHECK(unpinPage(bm, h));
+
+    CHECK(getPoolStats(bm, &stats));
+    ASSERT_EQUALS_INT(0, (int) stats.numReadIO, "no read for new pages");
+    ASSERT_EQUALS_INT(6, (int) stats.numNewPages, "new pages");
+    ASSERT_EQUALS_INT(3, (int) stats.numDirtyEvictions, "evicted new pages are written");
+    CHECK(shutdownBufferPool(bm));
+
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(10, fh.totalNumPages, "file extended to the last new page");
+    for (int i = 1; i <= 5; i++)
+    {
+        CHECK(readBlock(i, &fh, page));
+        ASSERT_EQUALS_INT(i, atoi(page + 4), "new page written");
+    }
+    CHECK(readBlock(7, &fh, page));
+    ASSERT_EQUALS_INT(0, page[0], "skipped pages read as zeros");
+    CHECK(closePageFile(&fh));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// freed pages are kept in the free map of the descriptor page and reused close to each other
+void
+testFreePages (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    SM_FileHandle fh;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    PageNumber pageNum;
+    testName = "Free pages";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(ensureCapacity(10, &fh));
+    memset(page, 'x', PAGE_SIZE);
+    CHECK(writeBlock(3, &fh, page));
+    CHECK(freePage(8, &fh));
+    CHECK(freePage(3, &fh));
+    CHECK(freePage(4, &fh));
+    ASSERT_ERROR(freePage(3, &fh), "page already free");
+    ASSERT_ERROR(freePage(10, &fh), "page past the end of the file");
+    CHECK(closePageFile(&fh));
+
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(3, getNumFreePages(&fh), "free map kept in the descriptor page");
+    CHECK(allocatePage(&fh, &pageNum));
+    ASSERT_EQUALS_INT(3, pageNum, "lowest free page first");
+    CHECK(readBlock(3, &fh, page));
+    ASSERT_EQUALS_INT(0, page[0], "allocated page is zeroed");
+    CHECK(allocatePage(&fh, &pageNum));
+    ASSERT_EQUALS_INT(4, pageNum, "next free page after the last one");
+    CHECK(allocatePage(&fh, &pageNum));
+    ASSERT_EQUALS_INT(8, pageNum, "last free page");
+    CHECK(allocatePage(&fh, &pageNum));
+    ASSERT_EQUALS_INT(10, pageNum, "file grows when no page is free");
+    CHECK(freePage(6, &fh));
+    CHECK(closePageFile(&fh));
+
+    // a free map that does not match its checksum (torn write) is dropped, its pages leak but none is handed out twice
+    FILE *f = fopen("testbuffer.bin", "rb+");
+    fseek(f, SM_FREE_MAP_OFFSET + 100, SEEK_SET);
+    fputc(0xff, f);
+    fclose(f);
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(0, getNumFreePages(&fh), "corrupted free map ignored");
+    CHECK(freePage(6, &fh));
+    CHECK(closePageFile(&fh));
+
+    // through a buffer pool: deleted pages are dropped from the pool and reused by newPage without a read
+    CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_FIFO, NULL));
+    CHECK(pinPage(bm, h, 5));
+    CHECK(markDirty(bm, h));
+    ASSERT_ERROR(deletePage(bm, 5), "cannot delete a pinned page");
+    CHECK(unpinPage(bm, h));
+    CHECK(deletePage(bm, 5));
+    ASSERT_EQUALS_POOL("[-1 0],[-1 0],[-1 0]", bm, "deleted page dropped without writing it");
+    CHECK(newPage(bm, h));
+    ASSERT_EQUALS_INT(5, h->pageNum, "free page close to the last one reused");
+    CHECK(unpinPage(bm, h));
+    CHECK(newPage(bm, h));
+    ASSERT_EQUALS_INT(6, h->pageNum, "second free page");
+    CHECK(unpinPage(bm, h));
+    CHECK(newPage(bm, h));
+    ASSERT_EQUALS_INT(11, h->pageNum, "no free page left");
+    CHECK(unpinPage(bm, h));
+    ASSERT_EQUALS_INT(1, getNumReadIO(bm), "only the first pin read its page");
+
+    // a newPage that finds no frame gives its free page back
+    CHECK(deletePage(bm, 6));
+    BM_PageHandle pinned[3];
+    for (int i = 0; i < 3; i++)
+    {
+        CHECK(pinPage(bm, &pinned[i], i));
+    }
+    ASSERT_ERROR(newPage(bm, h), "every frame is pinned");
+    ASSERT_EQUALS_INT(1, getNumFreePages(&(bm->mgmtData->files[BM_DEFAULT_FILE].fileHandle)), "free page not leaked");
+    for (int i = 0; i < 3; i++)
+    {
+        CHECK(unpinPage(bm, &pinned[i]));
+    }
+    CHECK(newPage(bm, h));
+    ASSERT_EQUALS_INT(6, h->pageNum, "free page of the failed newPage reused");
+    CHECK(unpinPage(bm, h));
+    CHECK(shutdownBufferPool(bm));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// 64 bit page numbers on a sparse file of more than 2^31 pages (8 TB), and files with a version 1 descriptor
+void
+testLargeFiles (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    SM_FileHandle fh;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    const PageNumber big = (1LL << 31) + 5;
+    const PageNumber alias = 5 + (1LL << 32); // same low 32 bits as page 5
+    unsigned int magic;
+    testName = "64 bit page numbers";
+
+    // version 1 file: 32 bit page count then zeros, 3 pages
+    FILE *f = fopen("testbuffer.bin", "wb");
+    int oldNumPages = 3;
+    memset(page, 0, PAGE_SIZE);
+    memcpy(page, &oldNumPages, sizeof(int));
+    fwrite(page, PAGE_SIZE, 1, f);
+    for (int i = 0; i < 3; i++)
+    {
+        memset(page, 0, PAGE_SIZE);
+        sprintf(page, "Old-%i", i);
+        fwrite(page, PAGE_SIZE, 1, f);
+    }
+    fclose(f);
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(3, fh.totalNumPages, "version 1 page count read");
+    CHECK(readBlock(2, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Old-2"), "version 1 pages read");
+    CHECK(closePageFile(&fh));
+    f = fopen("testbuffer.bin", "rb");
+    fread(&magic, sizeof(int), 1, f);
+    fclose(f);
+    ASSERT_EQUALS_INT(SM_DESCRIPTOR_MAGIC, magic, "descriptor rewritten as version 2");
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(3, fh.totalNumPages, "page count kept by the upgrade");
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile("testbuffer.bin"));
+
+    // sparse file past 2^31 pages
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(extendPageFile(big + 1, &fh));
+    memset(page, 0, PAGE_SIZE);
+    strcpy(page, "Big");
+    CHECK(writeBlock(big, &fh, page));
+    CHECK(readBlock(big - 1, &fh, page));
+    ASSERT_EQUALS_INT(0, page[0], "pages of the hole read as zeros");
+    CHECK(closePageFile(&fh));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_TRUE(fh.totalNumPages == big + 1, "64 bit page count kept in the descriptor");
+    CHECK(readBlock(big, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Big"), "page past 2^31 read back");
+    CHECK(closePageFile(&fh));
+
+    // pool with a page table: pages differing only above bit 32 are different pages
+    CHECK(initBufferPool(bm, "testbuffer.bin", 20, RS_LRU, NULL));
+    CHECK(pinPage(bm, h, big));
+    ASSERT_EQUALS_INT(0, strcmp(h->data, "Big"), "pinned page past 2^31");
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 5));
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, alias));
+    ASSERT_TRUE(h->pageNum == alias, "page above 2^32 pinned");
+    CHECK(unpinPage(bm, h));
+    ASSERT_EQUALS_INT(2, getNumReadIO(bm), "page above 2^32 is new, not page 5");
+    CHECK(dropFilePages(bm, BM_DEFAULT_FILE)); // not written, the file would grow past the file system limit
+    CHECK(pinPage(bm, h, big + 1));
+    strcpy(h->data, "Bigger");
+    CHECK(markDirty(bm, h));
+    CHECK(unpinPage(bm, h));
+    CHECK(shutdownBufferPool(bm));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_TRUE(fh.totalNumPages == big + 2, "file extended past 2^31 pages by the pool");
+    CHECK(readBlock(big + 1, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Bigger"), "new page written past 2^31");
+    CHECK(closePageFile(&fh));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// CRC-32C implementations agree, a corrupted page fails readBlock and the pin, pages written before are not checked
+void
+testPageChecksums (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PoolConfig config = BM_DEFAULT_POOL_CONFIG;
+    SM_FileHandle fh;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    char buffer[3 * PAGE_SIZE];
+    testName = "page checksums";
+
+    ASSERT_TRUE(crc32c("123456789", 9) == 0xE3069283, "CRC-32C check value");
+    for (int i = 0; i < 3 * PAGE_SIZE; i++)
+    {
+        buffer[i] = (char) rand();
+    }
+    ChecksumImplementation best = getChecksumImplementation();
+    for (int length = 0; length < 3 * PAGE_SIZE - 8; length += 127)
+    {
+        setChecksumImplementation(CHECKSUM_SCALAR);
+        unsigned int expected = crc32c(buffer + length % 8, length);
+        setChecksumImplementation(best);
+        ASSERT_TRUE(crc32c(buffer + length % 8, length) == expected, "implementations agree");
+    }
+
+    // page 0 written without checksums, pages 1 and 2 with
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(ensureCapacity(3, &fh));
+    memset(page, 0, PAGE_SIZE);
+    strcpy(page, "Page-0");
+    CHECK(writeBlock(0, &fh, page));
+    CHECK(enablePageChecksums(&fh));
+    for (int i = 1; i < 3; i++)
+    {
+        sprintf(page, "Page-%i", i);
+        CHECK(writeBlock(i, &fh, page));
+    }
+    CHECK(closePageFile(&fh));
+
+    // flip a byte of page 2 behind the storage manager
+    FILE *f = fopen("testbuffer.bin", "rb+");
+    fseek(f, ACCESSIBLE_PAGE_OFFSET + 2 * PAGE_SIZE + 100, SEEK_SET);
+    fputc('X', f);
+    fclose(f);
+
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(readBlock(0, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Page-0"), "page without checksum read");
+    CHECK(readBlock(1, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Page-1"), "page with checksum read");
+    ASSERT_EQUALS_INT(RC_CHECKSUM_MISMATCH, readBlock(2, &fh, page), "corrupted page detected by readBlock");
+    CHECK(closePageFile(&fh));
+
+    // through a pool: the pin fails and the frame is not kept, a handle opened later still maintains the checksums
+    config.pageChecksums = TRUE;
+    CHECK(initBufferPoolWithConfig(bm, "testbuffer.bin", 1, RS_FIFO, NULL, &config));
+    CHECK(pinPage(bm, h, 1));
+    CHECK(unpinPage(bm, h));
+    ASSERT_EQUALS_INT(RC_CHECKSUM_MISMATCH, pinPage(bm, h, 2), "corrupted page detected by the pin");
+    ASSERT_EQUALS_POOL("[-1 0]", bm, "frame emptied after the failed read");
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    memset(page, 0, PAGE_SIZE);
+    strcpy(page, "Page-2");
+    CHECK(writeBlock(2, &fh, page));
+    CHECK(closePageFile(&fh));
+    CHECK(pinPage(bm, h, 2));
+    ASSERT_EQUALS_INT(0, strcmp(h->data, "Page-2"), "rewritten page matches its checksum");
+    CHECK(unpinPage(bm, h));
+    CHECK(shutdownBufferPool(bm));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    f = fopen("testbuffer.bin" SM_CHECKSUM_SUFFIX, "rb");
+    ASSERT_TRUE(f == NULL, "checksum file destroyed with the page file");
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// LZ4 style codec round trips, compressed page files read back what was written through the storage manager and a pool
+void
+testCompressedFiles (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    SM_FileHandle fh;
+    SM_CompressionInfo info;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    char compressed[PAGE_SIZE + PAGE_SIZE / 255 + 16];
+    char decompressed[PAGE_SIZE];
+    testName = "compressed page files";
+
+    // text, zeros and random bytes
+    for (int kind = 0; kind < 3; kind++)
+    {
+        for (int i = 0; i < PAGE_SIZE; i++)
+        {
+            page[i] = (kind == 0) ? "page-record-"[i % 12] + (i / 97) % 3 : (kind == 1) ? 0 : (char) rand();
+        }
+        int length = compressBlock(page, PAGE_SIZE, compressed, sizeof(compressed));
+        ASSERT_TRUE(length > 0, "block compressed");
+        ASSERT_TRUE(kind == 2 || length < PAGE_SIZE / 4, "compressible block shrinks");
+        ASSERT_EQUALS_INT(PAGE_SIZE, decompressBlock(compressed, length, decompressed, PAGE_SIZE), "block decompressed");
+        ASSERT_EQUALS_INT(0, memcmp(page, decompressed, PAGE_SIZE), "round trip");
+        ASSERT_EQUALS_INT(-1, decompressBlock(compressed, length, decompressed, PAGE_SIZE - 1), "output bound checked");
+    }
+    ASSERT_EQUALS_INT(0, compressBlock(page, PAGE_SIZE, compressed, PAGE_SIZE / 2), "random block does not fit");
+
+    // pages written, read back after reopening, rewritten with less compressible content
+    CHECK(createCompressedPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(ensureCapacity(100, &fh));
+    CHECK(readBlock(50, &fh, page));
+    ASSERT_EQUALS_INT(0, page[0], "page without slot reads as zeros");
+    for (int i = 0; i < 100; i++)
+    {
+        memset(page, 0, PAGE_SIZE);
+        for (int j = 0; j < PAGE_SIZE - 16; j += 16)
+        {
+            sprintf(page + j, "%04i-row-%06i", i, j % 7);
+        }
+        CHECK(writeBlock(i, &fh, page));
+    }
+    CHECK(closePageFile(&fh));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(100, fh.totalNumPages, "page count kept");
+    CHECK(readBlock(42, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page + 32, "0042-row-000004"), "page read back");
+    CHECK(getCompressionInfo(&fh, &info));
+    ASSERT_EQUALS_INT(100, info.numStoredPages, "every page has a slot");
+    ASSERT_TRUE(info.allocatedBytes * 2 < 100LL * PAGE_SIZE, "file smaller than half of its pages");
+    long long allocated = info.allocatedBytes;
+    for (int i = 0; i < PAGE_SIZE; i++)
+    {
+        page[i] = (char) rand();
+    }
+    CHECK(writeBlock(7, &fh, page));
+    CHECK(readBlock(7, &fh, decompressed));
+    ASSERT_EQUALS_INT(0, memcmp(page, decompressed, PAGE_SIZE), "incompressible page stored as is");
+    CHECK(getCompressionInfo(&fh, &info));
+    ASSERT_EQUALS_INT(allocated + PAGE_SIZE, info.allocatedBytes, "grown page moved to a new slot");
+    CHECK(closePageFile(&fh));
+
+    // through a pool, appending pages
+    CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_LRU, NULL));
+    for (int i = 100; i < 110; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "Page-%i", i);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(pinPage(bm, h, 42));
+    ASSERT_EQUALS_INT(0, strcmp(h->data + 32, "0042-row-000004"), "pool reads compressed page");
+    CHECK(unpinPage(bm, h));
+    CHECK(shutdownBufferPool(bm));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(110, fh.totalNumPages, "file extended by the pool");
+    CHECK(readBlock(105, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Page-105"), "page appended through the pool");
+    CHECK(closePageFile(&fh));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    FILE *f = fopen("testbuffer.bin" SM_PAGE_MAP_SUFFIX, "rb");
+    ASSERT_TRUE(f == NULL, "page map destroyed with the page file");
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+#define LOG_THREADS 4
+#define LOG_COMMITS 50
+
+// each thread appends records and flushes the log up to each of them
+void *
+commitRecords (void *log)
+{
+    char record[64];
+    LSN lsn;
+
+    for (int i = 0; i < LOG_COMMITS; i++)
+    {
+        sprintf(record, "commit-%i", i);
+        if (appendLogRecord((LM_Log *) log, record, strlen(record) + 1, &lsn) != RC_OK
+                || flushLog((LM_Log *) log, lsn) != RC_OK || getDurableLSN((LM_Log *) log) < lsn)
+        {
+            return (void *) 1;
+        }
+    }
+    return NULL;
+}
+
+// records appended, flushed and read back after reopening, torn tail cut, group commit, write-ahead rule in a pool
+void
+testWriteAheadLog (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    LM_Log log;
+    LM_LogScan scan;
+    LM_LogStats logStats;
+    BM_Stats stats;
+    pthread_t threads[LOG_THREADS];
+    char record[64];
+    char *data;
+    int length;
+    LSN lsn, lsns[10];
+    testName = "write-ahead log";
+
+    remove("testbuffer.log");
+    CHECK(openLog("testbuffer.log", &log));
+    for (int i = 0; i < 10; i++)
+    {
+        sprintf(record, "record-%i", i);
+        CHECK(appendLogRecord(&log, record, strlen(record) + 1, &lsns[i]));
+    }
+    ASSERT_TRUE(getDurableLSN(&log) < lsns[0], "appended records are not durable");
+    CHECK(flushLog(&log, lsns[4]));
+    ASSERT_TRUE(getDurableLSN(&log) >= lsns[4], "log durable up to the flushed record");
+    ASSERT_EQUALS_INT(RC_LOG_INVALID_LSN, flushLog(&log, lsns[9] + 1), "flush past the end of the log");
+    CHECK(closeLog(&log));
+
+    // the scan starts after the given LSN
+    CHECK(openLogScan("testbuffer.log", lsns[6], &scan));
+    for (int i = 7; i < 10; i++)
+    {
+        CHECK(nextLogRecord(&scan, &data, &length, &lsn));
+        sprintf(record, "record-%i", i);
+        ASSERT_EQUALS_INT(0, strcmp(record, data), "record read back");
+        ASSERT_EQUALS_INT(lsns[i], lsn, "LSN of the record");
+    }
+    ASSERT_EQUALS_INT(RC_LOG_END, nextLogRecord(&scan, &data, &length, &lsn), "end of the log");
+    CHECK(closeLogScan(&scan));
+
+    // a record torn by a crash is cut off when the log is opened, appending continues after the last whole one
+    FILE *f = fopen("testbuffer.log", "ab");
+    LM_RecordHeader torn = { 1000, 0 };
+    fwrite(&torn, sizeof(torn), 1, f);
+    fwrite("partial", 1, 7, f);
+    fclose(f);
+    CHECK(openLog("testbuffer.log", &log));
+    CHECK(appendLogRecord(&log, "after", 6, &lsn));
+    ASSERT_EQUALS_INT(lsns[9] + sizeof(LM_RecordHeader) + 6, lsn, "torn record cut off");
+    CHECK(flushLog(&log, lsn));
+    CHECK(openLogScan("testbuffer.log", lsns[9], &scan));
+    CHECK(nextLogRecord(&scan, &data, &length, &lsn));
+    ASSERT_EQUALS_INT(0, strcmp("after", data), "record appended after the cut");
+    CHECK(closeLogScan(&scan));
+
+    // concurrent commits share syncs
+    for (int i = 0; i < LOG_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, commitRecords, &log);
+    }
+    for (int i = 0; i < LOG_THREADS; i++)
+    {
+        void *failed;
+        pthread_join(threads[i], &failed);
+        ASSERT_TRUE(failed == NULL, "commits durable");
+    }
+    CHECK(getLogStats(&log, &logStats));
+    ASSERT_EQUALS_INT(LOG_THREADS * LOG_COMMITS + 1, logStats.numRecords, "every record appended");
+    ASSERT_TRUE(logStats.numSyncs <= logStats.numFlushRequests, "at most one sync per commit");
+
+    // a page is written only once the log holds its changes
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(initBufferPool(bm, "testbuffer.bin", 3, RS_FIFO, NULL));
+    CHECK(setPoolLog(bm, &log));
+    CHECK(pinPage(bm, h, 0));
+    strcpy(h->data, "logged page");
+    CHECK(appendLogRecord(&log, "page 0 changed", 15, &lsn));
+    CHECK(markDirtyLSN(bm, h, lsn));
+    ASSERT_EQUALS_INT(lsn, getPageLSN(h->data), "LSN stamped in the page");
+    ASSERT_TRUE(getDurableLSN(&log) < lsn, "change not durable before the page is written");
+    CHECK(forcePage(bm, h));
+    ASSERT_TRUE(getDurableLSN(&log) >= lsn, "log flushed before the page");
+    CHECK(getPoolStats(bm, &stats));
+    ASSERT_EQUALS_INT(1, stats.numLogFlushes, "one log flush");
+    CHECK(unpinPage(bm, h));
+    CHECK(pinPage(bm, h, 1));
+    CHECK(markDirty(bm, h));
+    CHECK(forcePage(bm, h));
+    CHECK(unpinPage(bm, h));
+    CHECK(getPoolStats(bm, &stats));
+    ASSERT_EQUALS_INT(1, stats.numLogFlushes, "unlogged page does not flush the log");
+    CHECK(pinPage(bm, h, 0));
+    memset(h->data, 'z', PAGE_SIZE);
+    LSN overwritten;
+    CHECK(appendLogRecord(&log, "page 0 overwritten", 19, &overwritten));
+    RC result = markDirtyLSN(bm, h, overwritten);
+    ASSERT_EQUALS_INT(RC_PAGE_LSN_TRAILER_IN_USE, result, "data in the LSN trailer refused");
+    ASSERT_TRUE(h->data[BM_PAGE_DATA_BYTES(PAGE_SIZE)] == 'z', "data not clobbered");
+    CHECK(unpinPage(bm, h)); // left clean, the page on disk keeps its stamp
+
+    // a write that fails (here its log record cannot be flushed) is not counted
+    CHECK(pinPage(bm, h, 2));
+    CHECK(markDirtyLSN(bm, h, lsn + 1000));
+    CHECK(getPoolStats(bm, &stats));
+    BM_Stats failedStats;
+    ASSERT_ERROR(forcePage(bm, h), "log record past the end of the log");
+    CHECK(unpinPage(bm, h));
+    ASSERT_ERROR(forceFlushPool(bm), "still not written");
+    CHECK(getPoolStats(bm, &failedStats));
+    ASSERT_EQUALS_INT(stats.numFlushes, failedStats.numFlushes, "failed flushes not counted");
+    ASSERT_EQUALS_INT(stats.numWriteIO, failedStats.numWriteIO, "failed writes not counted");
+    ASSERT_EQUALS_INT(stats.numLogFlushes, failedStats.numLogFlushes, "failed log flush not counted");
+    CHECK(shutdownBufferPool(bm));
+
+    SM_FileHandle fh;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(readBlock(0, &fh, page));
+    ASSERT_EQUALS_INT(lsn, getPageLSN(page), "page LSN on disk");
+    CHECK(closePageFile(&fh));
+
+    CHECK(closeLog(&log));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    remove("testbuffer.log");
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// syncs of each durability mode, page count written lazily and recovered from the file size
+void
+testDurability (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PoolConfig config = BM_DEFAULT_POOL_CONFIG;
+    SM_FileHandle fh, other;
+    SM_Durability durability = { SM_DURABILITY_WRITE, 0, 0 };
+    SM_Durability invalid = { SM_DURABILITY_BATCHED, -1, 0 };
+    SM_PageHandle page = (SM_PageHandle) calloc(PAGE_SIZE, 1);
+    PageNumber onDisk;
+    testName = "durability modes";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(RC_INVALID_DURABILITY, setDurability(&fh, &invalid), "negative batch limit");
+    CHECK(ensureCapacity(20, &fh));
+    CHECK(writeBlock(0, &fh, page));
+    ASSERT_EQUALS_INT(0, fh.mgmtInfo.numSyncs, "no sync by default");
+    CHECK(setDurability(&fh, &durability));
+    ASSERT_EQUALS_INT(1, fh.mgmtInfo.numSyncs, "pending writes synced when switching to write mode");
+    for (int i = 0; i < 3; i++)
+    {
+        CHECK(writeBlock(i, &fh, page));
+    }
+    ASSERT_EQUALS_INT(4, fh.mgmtInfo.numSyncs, "one sync per write");
+
+    durability.mode = SM_DURABILITY_BATCHED;
+    durability.batchPages = 4;
+    CHECK(setDurability(&fh, &durability));
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(writeBlock(i, &fh, page));
+    }
+    ASSERT_EQUALS_INT(6, fh.mgmtInfo.numSyncs, "one sync per 4 writes");
+    CHECK(syncPageFile(&fh));
+    CHECK(syncPageFile(&fh));
+    ASSERT_EQUALS_INT(7, fh.mgmtInfo.numSyncs, "explicit sync of the last writes, then nothing to sync");
+    durability.batchPages = 0;
+    durability.batchMillis = 20;
+    CHECK(setDurability(&fh, &durability));
+    CHECK(writeBlock(0, &fh, page));
+    usleep(30000);
+    CHECK(writeBlock(1, &fh, page));
+    ASSERT_EQUALS_INT(8, fh.mgmtInfo.numSyncs, "sync once the first write is older than the limit");
+
+    // extensions do not write the page count, a handle opened meanwhile counts the pages from the file size
+    CHECK(ensureCapacity(50, &fh));
+    FILE *f = fopen("testbuffer.bin", "rb");
+    setvbuf(f, NULL, _IONBF, 0);
+    fseeko(f, SM_TOTAL_PAGES_OFFSET, SEEK_SET);
+    ASSERT_TRUE(fread(&onDisk, sizeof(PageNumber), 1, f) == 1 && onDisk == 20, "page count not written yet");
+    CHECK(syncPageFile(&fh));
+    fseeko(f, SM_TOTAL_PAGES_OFFSET, SEEK_SET);
+    ASSERT_TRUE(fread(&onDisk, sizeof(PageNumber), 1, f) == 1 && onDisk == 50, "page count written by the sync");
+    fclose(f);
+    CHECK(ensureCapacity(60, &fh));
+    fflush(fh.mgmtInfo.posixFileDescriptor);
+    CHECK(openPageFile("testbuffer.bin", &other));
+    ASSERT_EQUALS_INT(60, other.totalNumPages, "page count from the file size");
+    CHECK(closePageFile(&other));
+    CHECK(closePageFile(&fh));
+
+    // a pool in flush mode syncs each file once per forceFlushPool
+    config.durability.mode = SM_DURABILITY_FLUSH;
+    CHECK(initBufferPoolWithConfig(bm, "testbuffer.bin", 3, RS_FIFO, NULL, &config));
+    SM_FileManagementInfo *info = &(bm->mgmtData->files[BM_DEFAULT_FILE].fileHandle.mgmtInfo);
+    for (int i = 0; i < 6; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "Page-%i", i);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    ASSERT_EQUALS_INT(0, info->numSyncs, "evictions do not sync");
+    CHECK(forceFlushPool(bm));
+    ASSERT_EQUALS_INT(1, info->numSyncs, "one sync for the flush");
+    durability.mode = SM_DURABILITY_WRITE;
+    CHECK(setFileDurability(bm, BM_DEFAULT_FILE, &durability));
+    CHECK(pinPage(bm, h, 0));
+    CHECK(markDirty(bm, h));
+    CHECK(forcePage(bm, h));
+    CHECK(unpinPage(bm, h));
+    ASSERT_EQUALS_INT(2, info->numSyncs, "forced page synced");
+    CHECK(shutdownBufferPool(bm));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// pages torn after a batch are rewritten from their copy on open, torn copies are ignored, flushes write in batches
+void
+testDoubleWrite (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PoolConfig config = BM_DEFAULT_POOL_CONFIG;
+    SM_FileHandle fh;
+    PageNumber pageNums[10];
+    SM_PageHandle pages[10];
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    char garbage[PAGE_SIZE / 2];
+    testName = "double-write buffer";
+
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(ensureCapacity(10, &fh));
+    CHECK(enableDoubleWrite(&fh));
+    for (int i = 0; i < 10; i++)
+    {
+        pageNums[i] = i;
+        pages[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+        memset(pages[i], 'a' + i, PAGE_SIZE);
+    }
+    CHECK(writeBlocks(&fh, 10, pageNums, pages));
+    ASSERT_EQUALS_INT(1, fh.mgmtInfo.numDoubleWrites, "one batch for 10 pages");
+    CHECK(closePageFile(&fh));
+
+    // a crash in the middle of writing page 3 in place
+    memset(garbage, 'x', sizeof(garbage));
+    FILE *f = fopen("testbuffer.bin", "r+b");
+    fseeko(f, ACCESSIBLE_PAGE_OFFSET + 3 * PAGE_SIZE + PAGE_SIZE / 2, SEEK_SET);
+    fwrite(garbage, sizeof(garbage), 1, f);
+    fclose(f);
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(1, fh.mgmtInfo.numRepairedPages, "torn page repaired");
+    CHECK(readBlock(3, &fh, page));
+    ASSERT_EQUALS_INT(0, memcmp(page, pages[3], PAGE_SIZE), "page restored from its copy");
+    CHECK(closePageFile(&fh));
+
+    // a torn copy is not used
+    f = fopen("testbuffer.bin" SM_DOUBLE_WRITE_SUFFIX, "r+b");
+    fseeko(f, 6 * PAGE_SIZE, SEEK_SET);
+    fwrite(garbage, sizeof(garbage), 1, f);
+    fclose(f);
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(0, fh.mgmtInfo.numRepairedPages, "nothing to repair");
+    CHECK(readBlock(5, &fh, page));
+    ASSERT_EQUALS_INT(0, memcmp(page, pages[5], PAGE_SIZE), "page kept");
+    CHECK(closePageFile(&fh));
+
+    // a pool flushes its dirty pages SM_DWB_PAGES at a time
+    config.doubleWrite = TRUE;
+    CHECK(initBufferPoolWithConfig(bm, "testbuffer.bin", 80, RS_LRU, NULL, &config));
+    SM_FileManagementInfo *info = &(bm->mgmtData->files[BM_DEFAULT_FILE].fileHandle.mgmtInfo);
+    for (int i = 0; i < 80; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "Page-%i", i);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(forceFlushPool(bm));
+    ASSERT_EQUALS_INT(2, info->numDoubleWrites, "80 pages in 2 batches");
+    CHECK(shutdownBufferPool(bm));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(80, fh.totalNumPages, "file extended by the pool");
+    CHECK(readBlock(75, &fh, page));
+    ASSERT_EQUALS_INT(0, strcmp(page, "Page-75"), "page written through the buffer");
+    CHECK(closePageFile(&fh));
+
+    CHECK(destroyPageFile("testbuffer.bin"));
+    f = fopen("testbuffer.bin" SM_DOUBLE_WRITE_SUFFIX, "rb");
+    ASSERT_TRUE(f == NULL, "double-write buffer destroyed with the page file");
+    for (int i = 0; i < 10; i++)
+    {
+        free(pages[i]);
+    }
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// pinned pages retried then written, pages dirtied after the begin left dirty, begin and end records, abandoned pages,
+// a rate-limited checkpoint while other threads pin
+void
+testCheckpoint (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_PageHandle pinned, pinnedClean;
+    BM_CheckpointConfig config = { 0, 4, 0 };
+    BM_CheckpointInfo info;
+    BM_CheckpointRecord *record;
+    BM_Stats stats;
+    LM_Log log;
+    LM_LogScan scan;
+    pthread_t readers[2];
+    char *data;
+    int length;
+    LSN lsn;
+    testName = "checkpoint";
+
+    remove("testbuffer.log");
+    CHECK(openLog("testbuffer.log", &log));
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(initBufferPool(bm, "testbuffer.bin", 100, RS_LRU, NULL));
+    CHECK(setPoolLog(bm, &log));
+    ASSERT_EQUALS_INT(RC_NO_CHECKPOINT, checkpointStep(bm, &info), "no checkpoint begun");
+    for (int i = 0; i < 13; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "Page-%i", i);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(forceFlushPool(bm));
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    CHECK(pinPage(bm, &pinned, 3));
+    CHECK(pinPage(bm, &pinnedClean, 12));
+
+    CHECK(beginCheckpoint(bm, &config));
+    ASSERT_EQUALS_INT(RC_CHECKPOINT_IN_PROGRESS, beginCheckpoint(bm, &config), "one checkpoint at a time");
+    CHECK(getCheckpointInfo(bm, &info));
+    ASSERT_EQUALS_INT(11, info.numPages, "dirty and pinned pages listed");
+    ASSERT_TRUE(info.beginLsn > 0, "begin record appended");
+    CHECK(pinPage(bm, h, 15));
+    CHECK(markDirty(bm, h));
+    CHECK(unpinPage(bm, h));
+
+    CHECK(checkpointStep(bm, &info));
+    ASSERT_EQUALS_INT(4, info.numWritten, "one step writes pagesPerStep pages");
+    ASSERT_EQUALS_INT(1, info.numRetries, "pinned page retried");
+    CHECK(checkpointStep(bm, &info));
+    CHECK(checkpointStep(bm, &info));
+    ASSERT_EQUALS_INT(9, info.numWritten, "every unpinned page written");
+    ASSERT_TRUE(!info.done, "not done while pages are pinned");
+    CHECK(unpinPage(bm, &pinned));
+    CHECK(unpinPage(bm, &pinnedClean));
+    CHECK(checkpointStep(bm, &info));
+    ASSERT_TRUE(info.done, "checkpoint done");
+    ASSERT_EQUALS_INT(10, info.numWritten, "page written once unpinned");
+    ASSERT_EQUALS_INT(1, info.numSkipped, "page still clean skipped");
+    ASSERT_TRUE(bm->mgmtData->frameDirtyFlags[getFrameIndex(bm, BM_DEFAULT_FILE, 15)], "page dirtied after the begin left dirty");
+    CHECK(getPoolStats(bm, &stats));
+    ASSERT_EQUALS_INT(10, stats.numCheckpointWrites, "checkpoint writes counted");
+    ASSERT_EQUALS_INT(13 + 10, stats.numWriteIO, "flushed and checkpointed pages written");
+
+    // the end record points back to the begin record
+    CHECK(openLogScan("testbuffer.log", info.beginLsn, &scan));
+    CHECK(nextLogRecord(&scan, &data, &length, &lsn));
+    record = (BM_CheckpointRecord *) data;
+    ASSERT_EQUALS_INT(BM_CHECKPOINT_RECORD_MAGIC, record->magic, "checkpoint record");
+    ASSERT_EQUALS_INT(BM_CHECKPOINT_END, record->type, "end record");
+    ASSERT_EQUALS_INT(info.beginLsn, record->beginLsn, "end record of this checkpoint");
+    ASSERT_TRUE(lsn <= getDurableLSN(&log), "end record durable");
+    CHECK(closeLogScan(&scan));
+
+    // a page pinned for the whole checkpoint is given up
+    config.maxRetries = 2;
+    CHECK(pinPage(bm, &pinned, 5));
+    CHECK(markDirty(bm, &pinned));
+    RC result = runCheckpoint(bm, &config, &info);
+    ASSERT_EQUALS_INT(RC_BUFFER_WITH_PINNED_PAGES, result, "pinned page abandoned");
+    ASSERT_EQUALS_INT(1, info.numAbandoned, "one page abandoned");
+    ASSERT_EQUALS_INT(2, info.id, "second checkpoint");
+    CHECK(unpinPage(bm, &pinned));
+
+    // 100 pages at 1000 pages per second take about 0.1s, pins go on meanwhile
+    for (int i = 0; i < 100; i++)
+    {
+        CHECK(pinPage(bm, h, i));
+        sprintf(h->data, "Page-%i", i);
+        CHECK(markDirty(bm, h));
+        CHECK(unpinPage(bm, h));
+    }
+    config.pagesPerSecond = 1000;
+    config.pagesPerStep = 10;
+    config.maxRetries = 0;
+    CHECK(getPoolStats(bm, &stats));
+    long long pinsBefore = stats.numPins;
+    stopReaders = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        pthread_create(&readers[i], NULL, pinRandomPages, bm);
+    }
+    CHECK(runCheckpoint(bm, &config, &info));
+    stopReaders = 1;
+    for (int i = 0; i < 2; i++)
+    {
+        void *failures;
+        pthread_join(readers[i], &failures);
+        ASSERT_EQUALS_INT(0, (int) (long) failures, "readers saw their pages");
+    }
+    ASSERT_EQUALS_INT(100, info.numWritten + info.numSkipped, "every page written");
+    ASSERT_TRUE(info.elapsedNanos >= 80000000LL, "write rate respected");
+    CHECK(getPoolStats(bm, &stats));
+    ASSERT_TRUE(stats.numPins > pinsBefore + 100, "pins during the checkpoint");
+    CHECK(shutdownBufferPool(bm));
+
+    CHECK(closeLog(&log));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    remove("testbuffer.log");
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
+
+// pages moved to the places of a scattered order while readers pin them, the file truncated after the last place,
+// a dirty page written at its new place, the map persisted, files without indirection refused
+void
+testDefrag (void)
+{
+    BM_BufferPool *bm = MAKE_POOL();
+    BM_PageHandle *h = MAKE_PAGE_HANDLE();
+    BM_DefragConfig config = { 0, 0 };
+    BM_DefragInfo info;
+    SM_FileHandle fh;
+    SM_PageHandle page = (SM_PageHandle) malloc(PAGE_SIZE);
+    PageNumber order[100];
+    pthread_t readers[2];
+    struct stat st;
+    RC result;
+    testName = "defragmentation";
+
+    // 120 pages, the last 20 freed
+    CHECK(createPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    CHECK(ensureCapacity(120, &fh));
+    for (int i = 0; i < 120; i++)
+    {
+        memset(page, 0, PAGE_SIZE);
+        sprintf(page, "Page-%i", i);
+        CHECK(writeBlock(i, &fh, page));
+    }
+    for (int i = 100; i < 120; i++)
+    {
+        CHECK(freePage(i, &fh));
+    }
+    PageNumber pageNum = 3, physical = 0;
+    result = relocatePages(&fh, 1, &pageNum, &physical, NULL);
+    ASSERT_EQUALS_INT(RC_NO_PAGE_INDIRECTION, result, "no page map yet");
+    ASSERT_EQUALS_INT(3, (int) getPhysicalPage(&fh, 3), "pages are where their number says");
+    CHECK(closePageFile(&fh));
+
+    // every 37th page first, 8 moves per step, pins go on meanwhile
+    CHECK(initBufferPool(bm, "testbuffer.bin", 10, RS_LRU, NULL));
+    result = defragStep(bm, &info);
+    ASSERT_EQUALS_INT(RC_NO_DEFRAG, result, "no defragmentation begun");
+    for (int i = 0; i < 100; i++)
+    {
+        order[i] = (i * 37) % 100;
+    }
+    config.pagesPerSecond = 2000;
+    config.pagesPerStep = 8;
+    CHECK(beginDefrag(bm, BM_DEFAULT_FILE, order, 100, &config));
+    result = beginDefrag(bm, BM_DEFAULT_FILE, order, 100, &config);
+    ASSERT_EQUALS_INT(RC_DEFRAG_IN_PROGRESS, result, "one defragmentation at a time");
+    stopReaders = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        pthread_create(&readers[i], NULL, pinRandomPages, bm);
+    }
+    do
+    {
+        CHECK(defragStep(bm, &info));
+    } while (!info.done);
+    stopReaders = 1;
+    for (int i = 0; i < 2; i++)
+    {
+        void *failures;
+        pthread_join(readers[i], &failures);
+        ASSERT_EQUALS_INT(0, (int) (long) failures, "readers saw their pages");
+    }
+    ASSERT_TRUE(info.done, "defragmentation done");
+    ASSERT_EQUALS_INT(100, (int) info.numPages, "pages with data placed");
+    ASSERT_EQUALS_INT(100, (int) info.numPlaced, "every page at its place");
+    ASSERT_TRUE(info.numMoved >= 90 && info.numDisplaced > 0, "pages moved out of the way and to their places");
+    ASSERT_EQUALS_INT(120, (int) info.physicalPagesBefore, "freed pages still in the file");
+    ASSERT_EQUALS_INT(100, (int) info.physicalPagesAfter, "file ends at the last place");
+    int placed = 1;
+    for (int i = 0; i < 100; i++)
+    {
+        placed &= (getPhysicalPage(&(bm->mgmtData->files[BM_DEFAULT_FILE].fileHandle), order[i]) == i);
+    }
+    ASSERT_TRUE(placed, "i-th page of the order on physical page i");
+
+    // a dirty page goes first, its write lands at its new place
+    CHECK(pinPage(bm, h, 50));
+    sprintf(h->data, "Dirty-50");
+    CHECK(markDirty(bm, h));
+    CHECK(unpinPage(bm, h));
+    pageNum = 50;
+    CHECK(runDefrag(bm, BM_DEFAULT_FILE, &pageNum, 1, &config, &info));
+    ASSERT_TRUE(info.numMoved > 0, "pages moved back in page order");
+    ASSERT_TRUE(info.elapsedNanos >= (info.numMoved + info.numDisplaced - 8) * 500000LL, "move rate respected");
+    CHECK(shutdownBufferPool(bm));
+
+    stat("testbuffer.bin", &st);
+    ASSERT_TRUE(st.st_size == ACCESSIBLE_PAGE_OFFSET + 100LL * PAGE_SIZE, "file truncated");
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    ASSERT_EQUALS_INT(120, (int) fh.totalNumPages, "page count kept");
+    ASSERT_EQUALS_INT(0, (int) getPhysicalPage(&fh, 50), "page map persisted");
+    int intact = 1;
+    for (int i = 0; i < 100; i++)
+    {
+        char expected[64];
+        sprintf(expected, (i == 50) ? "Dirty-%i" : "Page-%i", i);
+        CHECK(readBlock(i, &fh, page));
+        intact &= (strcmp(page, expected) == 0);
+        intact &= (getPhysicalPage(&fh, i) == ((i < 50) ? i + 1 : (i == 50) ? 0 : i));
+    }
+    ASSERT_TRUE(intact, "pages intact at their places");
+    CHECK(readBlock(110, &fh, page));
+    ASSERT_TRUE(page[0] == 0, "free page has no physical page");
+    memset(page, 'n', PAGE_SIZE);
+    CHECK(writeBlock(110, &fh, page));
+    ASSERT_EQUALS_INT(100, (int) getPhysicalPage(&fh, 110), "new data at the end of the file");
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile("testbuffer.bin"));
+    FILE *f = fopen("testbuffer.bin" SM_INDIRECTION_SUFFIX, "rb");
+    ASSERT_TRUE(f == NULL, "page map destroyed with the page file");
+
+    // the slot map of a compressed file places its pages
+    CHECK(createCompressedPageFile("testbuffer.bin"));
+    CHECK(openPageFile("testbuffer.bin", &fh));
+    result = enablePageIndirection(&fh);
+    ASSERT_EQUALS_INT(RC_NO_PAGE_INDIRECTION, result, "no indirection for a compressed file");
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile("testbuffer.bin"));
+
+    free(page);
+    free(bm);
+    free(h);
+    TEST_DONE();
+}
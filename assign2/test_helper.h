@@ -41,10 +41,10 @@ extern char *testName;
 		do {									\
 			if ((expected) != (real))					\
 			{									\
-				printf("[%s-%s-L%i-%s] FAILED: expected <%i> but was <%i>: %s\n",TEST_INFO, expected, real, message); \
+				printf("[%s-%s-L%i-%s] FAILED: expected <%lld> but was <%lld>: %s\n",TEST_INFO, (long long) (expected), (long long) (real), message); \
 				exit(1);							\
 			}									\
-			printf("[%s-%s-L%i-%s] OK: expected <%i> and was <%i>: %s\n",TEST_INFO, expected, real, message); \
+			printf("[%s-%s-L%i-%s] OK: expected <%lld> and was <%lld>: %s\n",TEST_INFO, (long long) (expected), (long long) (real), message); \
 		} while(0)
 
 // check whether two ints are equals